@@ -0,0 +1,45 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#pragma OPENCL EXTENSION cl_khr_global_int32_base_atomics : enable
+
+#include "common.h"
+
+/* count all pixels of a 4 channel image into 4*bins interleaved counters.
+   channels is a bit mask of the channels to count, the fourth one is max(r,g,b).
+   see common/histogram.h for the layout. */
+kernel void
+histogram_4c(read_only image2d_t in, global unsigned int *hist, const int width, const int height,
+             const int bins, const int channels, const float4 mul, const float4 add)
+{
+  const int x = get_global_id(0);
+  const int y = get_global_id(1);
+
+  if(x >= width || y >= height) return;
+
+  float4 pixel = read_imagef(in, sampleri, (int2)(x, y));
+  pixel.w = fmax(pixel.x, fmax(pixel.y, pixel.z));
+
+  const float4 v = clamp(pixel * mul + add, (float4)0.0f, (float4)(bins - 1));
+  const int4 b = convert_int4_rtz(v);
+
+  atomic_inc(hist + 4*b.x);
+  if(channels & 2) atomic_inc(hist + 4*b.y + 1);
+  if(channels & 4) atomic_inc(hist + 4*b.z + 2);
+  if(channels & 8) atomic_inc(hist + 4*b.w + 3);
+}
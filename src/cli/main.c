@@ -36,6 +36,7 @@
 #include "common/imageio_module.h"
 #include "common/exif.h"
 #include "common/history.h"
+#include "control/jobs/control_jobs.h"
 
 #include <sys/time.h>
 #include <unistd.h>
@@ -47,6 +48,7 @@ static void
 usage(const char* progname)
 {
   fprintf(stderr, "usage: %s <input file> [<xmp file>] <output file> [--width <max width>,--height <max height>,--bpp <bpp>,--hq <0|1|true|false>,--verbose] [--core <darktable options>]\n", progname);
+  fprintf(stderr, "       %s --thumbnails [--core <darktable options>]\n", progname);
 }
 
 int main(int argc, char *arg[])
@@ -63,7 +65,7 @@ int main(int argc, char *arg[])
   char *output_filename = NULL;
   int file_counter = 0;
   int width = 0, height = 0, bpp = 0;
-  gboolean verbose = FALSE, high_quality = TRUE;
+  gboolean verbose = FALSE, high_quality = TRUE, thumbnails = FALSE;
 
   int k;
   for(k=1; k<argc; k++)
@@ -112,6 +114,10 @@ int main(int argc, char *arg[])
         }
         g_free(str);
       }
+      else if(!strcmp(arg[k], "--thumbnails"))
+      {
+        thumbnails = TRUE;
+      }
       else if(!strcmp(arg[k], "-v") || !strcmp(arg[k], "--verbose"))
       {
         verbose = TRUE;
@@ -139,11 +145,31 @@ int main(int argc, char *arg[])
   int m_argc = 0;
   char *m_arg[4 + argc - k];
   m_arg[m_argc++] = "darktable-cli";
-  m_arg[m_argc++] = "--library";
-  m_arg[m_argc++] = ":memory:";
+  // the thumbnails are for the real library, exports run on a throwaway one:
+  if(!thumbnails)
+  {
+    m_arg[m_argc++] = "--library";
+    m_arg[m_argc++] = ":memory:";
+  }
   for(; k < argc; k++) m_arg[m_argc++] = arg[k];
   m_arg[m_argc] = NULL;
 
+  if(thumbnails)
+  {
+    if(file_counter)
+    {
+      usage(arg[0]);
+      exit(1);
+    }
+    if(dt_init(m_argc, m_arg, 0)) exit(1);
+    // the collection last used in the lighttable. the mipmap cache goes to disk on cleanup.
+    dt_job_t job;
+    dt_control_generate_thumbnails_job_init(&job);
+    dt_control_generate_thumbnails_job_run(&job);
+    dt_cleanup();
+    return 0;
+  }
+
   if(file_counter < 2 || file_counter > 3)
   {
     usage(arg[0]);
@@ -35,6 +35,13 @@
 // and a hopscotch hashmap, source following the paper and
 // the additional material (GPLv2+ c++ concurrency package source)
 // `Hopscotch Hashing' by Maurice Herlihy, Nir Shavit and Moran Tzafrir
+//
+// cache hits don't take any lock: the chain of the key is walked optimistically
+// (validated by the segment timestamp, which is bumped by every removal), and
+// the entry is pinned by atomically counting up its users. instead of moving
+// the entry to the front of the lru list, hits only set a reference bit, and
+// the garbage collector gives referenced entries a second chance (CLOCK).
+// only insertion, removal and garbage collection take the segment and lru locks.
 
 #define DT_CACHE_NULL_DELTA SHRT_MIN
 #define DT_CACHE_EMPTY_HASH -1
@@ -42,18 +49,23 @@
 #define DT_CACHE_EMPTY_DATA  NULL
 
 
+// bucket->users holds the number of readers in the lower bits,
+// and these flags for a writer and an entry currently being removed:
+#define DT_CACHE_READERS 0xffff
+#define DT_CACHE_WRITER  0x10000
+#define DT_CACHE_DEAD    0x40000000
+
 typedef struct dt_cache_bucket_t
 {
   int16_t  first_delta;
   int16_t  next_delta;
-  int16_t  read;   // number of readers
-  int16_t  write;  // number of writers (0 or 1)
+  int32_t  users;  // readers | writer flag, only ever changed atomically
   int32_t  lru;    // for garbage collection: lru list
   int32_t  mru;
   int32_t  cost;   // cost associated with this entry (such as byte size)
   uint32_t hash;   // hash of the element
   uint32_t key;    // key of the element
-  // due to alignment, we waste 32 bits here
+  uint32_t referenced; // set by cache hits, cleared by the garbage collector
   void*    data;   // actual data
 }
 dt_cache_bucket_t;
@@ -76,7 +88,7 @@ dt_cache_testlock(uint32_t *lock)
 static inline void
 dt_cache_lock(uint32_t *lock)
 {
-  while(__sync_val_compare_and_swap(lock, 0, 1));
+  while(__sync_val_compare_and_swap(lock, 0, 1)) sched_yield();
 }
 
 static inline void
@@ -171,53 +183,117 @@ remove_key(dt_cache_t *cache,
   key_bucket->next_delta = DT_CACHE_NULL_DELTA;
 }
 
-// unexposed helpers to increase the read lock count.
-// the segment needs to be locked by the caller.
+// unexposed helpers to change the user count of a bucket.
+// these are atomic, the read lock ones don't need the segment lock.
+static inline int
+dt_cache_bucket_readers(const dt_cache_bucket_t *bucket)
+{
+  return bucket->users & DT_CACHE_READERS;
+}
+static inline int
+dt_cache_bucket_writers(const dt_cache_bucket_t *bucket)
+{
+  return (bucket->users & DT_CACHE_WRITER) ? 1 : 0;
+}
 static int
 dt_cache_bucket_read_testlock(dt_cache_bucket_t *bucket)
 {
-  if(bucket->write) return 1;
-  assert(bucket->read < 0x7ffe);
-  assert(bucket->write == 0);
-  bucket->read ++;
-  return 0;
+  while(1)
+  {
+    const int32_t users = bucket->users;
+    if(users & (DT_CACHE_WRITER | DT_CACHE_DEAD)) return 1;
+    assert((users & DT_CACHE_READERS) < 0x7ffe);
+    if(__sync_bool_compare_and_swap(&bucket->users, users, users + 1)) return 0;
+  }
 }
 static void
 dt_cache_bucket_read_lock(dt_cache_bucket_t *bucket)
 {
-  assert(bucket->read < 0x7ffe);
-  assert(bucket->write == 0);
-  bucket->read ++;
+  // only used on fresh buckets, under the segment lock.
+  assert(dt_cache_bucket_writers(bucket) == 0);
+  __sync_fetch_and_add(&bucket->users, 1);
 }
 static void
 dt_cache_bucket_read_release(dt_cache_bucket_t *bucket)
 {
-  assert(bucket->read > 0);
-  assert(bucket->write == 0);
-  bucket->read --;
+  assert(dt_cache_bucket_readers(bucket) > 0);
+  assert(dt_cache_bucket_writers(bucket) == 0);
+  __sync_fetch_and_sub(&bucket->users, 1);
 }
 static int
 dt_cache_bucket_write_testlock(dt_cache_bucket_t *bucket)
 {
-  if(bucket->read > 1) return 1;
-  assert(bucket->read == 1);
-  assert(bucket->write < 0x7ffe);
-  bucket->write ++;
+  // only the one reader which wants to write may be left:
+  if(!__sync_bool_compare_and_swap(&bucket->users, 1, 1 | DT_CACHE_WRITER)) return 1;
   return 0;
 }
 static void
 dt_cache_bucket_write_lock(dt_cache_bucket_t *bucket)
 {
-  assert(bucket->read == 1);
-  assert(bucket->write < 0x7ffe);
-  bucket->write ++;
+  // fresh bucket in the allocate callback, before the key is visible.
+  assert(dt_cache_bucket_writers(bucket) == 0);
+  __sync_fetch_and_or(&bucket->users, DT_CACHE_WRITER);
 }
 static void
 dt_cache_bucket_write_release(dt_cache_bucket_t *bucket)
 {
-  assert(bucket->read == 1);
-  assert(bucket->write > 0);
-  bucket->write --;
+  assert(dt_cache_bucket_readers(bucket) == 1);
+  assert(dt_cache_bucket_writers(bucket) == 1);
+  __sync_fetch_and_and(&bucket->users, ~DT_CACHE_WRITER);
+}
+// claim an unused bucket for removal. fails if anyone holds a lock.
+static int
+dt_cache_bucket_remove_testlock(dt_cache_bucket_t *bucket)
+{
+  if(!__sync_bool_compare_and_swap(&bucket->users, 0, DT_CACHE_DEAD)) return 1;
+  return 0;
+}
+static void
+dt_cache_bucket_remove_release(dt_cache_bucket_t *bucket)
+{
+  __sync_fetch_and_and(&bucket->users, ~DT_CACHE_DEAD);
+}
+
+// lock-free lookup of the bucket for the given key, which is read locked on success.
+// returns 0 if found and locked, 1 if the key is not in the cache (or we raced
+// with a concurrent removal, the caller falls back to the locked path then) and 2 if
+// the bucket is currently write locked.
+static int
+dt_cache_bucket_find_read_testlock(
+  dt_cache_t         *cache,
+  const uint32_t      key,
+  dt_cache_bucket_t **bucket)
+{
+  const uint32_t hash = key;
+  const dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
+  dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
+
+  const uint32_t start_timestamp = segment->timestamp;
+  __sync_synchronize();
+  dt_cache_bucket_t *compare_bucket = start_bucket;
+  int16_t next_delta = compare_bucket->first_delta;
+  while(next_delta != DT_CACHE_NULL_DELTA)
+  {
+    compare_bucket += next_delta;
+    if(hash == compare_bucket->hash && key == compare_bucket->key)
+    {
+      if(dt_cache_bucket_read_testlock(compare_bucket)) return 2;
+      // the bucket might have been removed and recycled after we compared the key,
+      // or just been filled by a writer:
+      __sync_synchronize();
+      if(hash != compare_bucket->hash || key != compare_bucket->key || dt_cache_bucket_writers(compare_bucket))
+      {
+        __sync_fetch_and_sub(&compare_bucket->users, 1);
+        return 1;
+      }
+      *bucket = compare_bucket;
+      return 0;
+    }
+    next_delta = compare_bucket->next_delta;
+    // removals from this chain bump the timestamp, and we could be walking a stale chain:
+    if(segment->timestamp != start_timestamp) return 1;
+  }
+  return 1;
 }
 
 static void
@@ -240,6 +316,9 @@ add_key_to_beginning_of_list(
   free_bucket->key  = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->referenced = 0;
+  // lock-free readers may see the bucket as soon as it's linked:
+  __sync_synchronize();
 
   if(keys_bucket->first_delta == 0)
   {
@@ -279,7 +358,9 @@ add_key_to_end_of_list(
   free_bucket->key  = key;
   free_bucket->hash = hash;
   free_bucket->cost = cost;
+  free_bucket->referenced = 0;
   free_bucket->next_delta = DT_CACHE_NULL_DELTA;
+  __sync_synchronize();
 
   if(last_bucket == NULL)
     keys_bucket->first_delta = (int16_t)(free_bucket - keys_bucket);
@@ -391,8 +472,8 @@ dt_cache_init(dt_cache_t *cache, const int32_t capacity, const int32_t num_threa
     cache->table[k].hash        = DT_CACHE_EMPTY_HASH;
     cache->table[k].key         = DT_CACHE_EMPTY_KEY;
     cache->table[k].data        = DT_CACHE_EMPTY_DATA;
-    cache->table[k].read        = 0;
-    cache->table[k].write       = 0;
+    cache->table[k].users       = 0;
+    cache->table[k].referenced  = 0;
     cache->table[k].lru         = -2;
     cache->table[k].mru         = -2;
   }
@@ -625,43 +706,23 @@ dt_cache_read_testget(
   dt_cache_t     *cache,
   const uint32_t  key)
 {
-  // just to support different keys:
-  const uint32_t hash = key;
-  dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-
-  if(dt_cache_testlock(&segment->lock))
+  dt_cache_bucket_t *bucket = NULL;
+  if(dt_cache_bucket_find_read_testlock(cache, key, &bucket))
     return NULL;
-
-  dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
-  dt_cache_bucket_t *compare_bucket = start_bucket;
-  int16_t next_delta = compare_bucket->first_delta;
-  while(next_delta != DT_CACHE_NULL_DELTA)
-  {
-    compare_bucket += next_delta;
-    if(hash == compare_bucket->hash && (key == compare_bucket->key))
-    {
-      void *rc = compare_bucket->data;
-      int err = dt_cache_bucket_read_testlock(compare_bucket);
-      dt_cache_unlock(&segment->lock);
-      if(err) return NULL;
-      // move this to the  most recently used slot, too:
-      lru_insert_locked(cache, compare_bucket);
-      return rc;
-    }
-    next_delta = compare_bucket->next_delta;
-  }
-  dt_cache_unlock(&segment->lock);
-  return NULL;
+  // give it a second chance in the garbage collector:
+  if(!bucket->referenced) bucket->referenced = 1;
+  return bucket->data;
 }
 
 // if found, the data void* is returned. if not, it is set to be
 // the given *data and a new hash table entry is created, which can be
 // found using the given key later on.
 //
-void*
-dt_cache_read_get(
+static void*
+_cache_read_get(
   dt_cache_t     *cache,
-  const uint32_t  key)
+  const uint32_t  key,
+  const int       block)
 {
   assert(key != DT_CACHE_EMPTY_KEY);
 
@@ -678,6 +739,20 @@ dt_cache_read_get(
 retry_cache_full:
   while(1)
   {
+    // hits don't need any lock:
+    dt_cache_bucket_t *bucket = NULL;
+    const int found = dt_cache_bucket_find_read_testlock(cache, key, &bucket);
+    if(found == 0)
+    {
+      if(!bucket->referenced) bucket->referenced = 1;
+      return bucket->data;
+    }
+    if(found == 2)
+    {
+      if(!block) return NULL;
+      goto wait;
+    }
+
     // block and try our luck
     dt_cache_lock(&segment->lock);
 
@@ -693,9 +768,9 @@ retry_cache_full:
         int err = dt_cache_bucket_read_testlock(compare_bucket);
         dt_cache_unlock(&segment->lock);
         // actually all good, just we couldn't get a lock on the bucket.
+        if(err && !block) return NULL;
         if(err) goto wait;
-        // move this to the  most recently used slot, too:
-        lru_insert_locked(cache, compare_bucket);
+        if(!compare_bucket->referenced) compare_bucket->referenced = 1;
         // found and locked:
         return rc;
       }
@@ -806,6 +881,22 @@ wait:
   // goto wait;
 }
 
+void*
+dt_cache_read_get(
+  dt_cache_t     *cache,
+  const uint32_t  key)
+{
+  return _cache_read_get(cache, key, 1);
+}
+
+void*
+dt_cache_read_tryget(
+  dt_cache_t     *cache,
+  const uint32_t  key)
+{
+  return _cache_read_get(cache, key, 0);
+}
+
 int
 dt_cache_remove_bucket(dt_cache_t *cache, const uint32_t num)
 {
@@ -846,7 +937,8 @@ dt_cache_remove(dt_cache_t *cache, const uint32_t key)
 
     if(hash == curr_bucket->hash && key == curr_bucket->key)
     {
-      if(curr_bucket->read || curr_bucket->write)
+      // lock-free readers might grab it any time, so claim it atomically:
+      if(dt_cache_bucket_remove_testlock(curr_bucket))
       {
         // fprintf(stderr, "[cache remove] key still in use %u!\n", key);
         dt_cache_unlock(&segment->lock);
@@ -855,6 +947,7 @@ dt_cache_remove(dt_cache_t *cache, const uint32_t key)
       remove_key(cache, segment, start_bucket, curr_bucket, last_bucket, hash);
       if(cache->optimize_cacheline)
         optimize_cacheline_use(cache, segment, curr_bucket);
+      dt_cache_bucket_remove_release(curr_bucket);
       // put back into unused part of the cache: remove from lru list.
       dt_cache_unlock(&segment->lock);
       lru_remove_locked(cache, curr_bucket);
@@ -876,7 +969,9 @@ dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
 {
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
+  // we hold the lru lock, and inserting threads take it while holding their segment
+  // lock. never wait here, just skip this one:
+  if(dt_cache_testlock(&segment->lock)) return 1;
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
   dt_cache_bucket_t *last_bucket = NULL;
@@ -894,7 +989,8 @@ dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
 
     if(hash == curr_bucket->hash && key == curr_bucket->key)
     {
-      if(curr_bucket->read || curr_bucket->write)
+      // lock-free readers might grab it any time, so claim it atomically:
+      if(dt_cache_bucket_remove_testlock(curr_bucket))
       {
         // fprintf(stderr, "[cache remove] key still in use %u!\n", key);
         dt_cache_unlock(&segment->lock);
@@ -903,6 +999,7 @@ dt_cache_remove_no_lru_lock(dt_cache_t *cache, const uint32_t key)
       remove_key(cache, segment, start_bucket, curr_bucket, last_bucket, hash);
       if(cache->optimize_cacheline)
         optimize_cacheline_use(cache, segment, curr_bucket);
+      dt_cache_bucket_remove_release(curr_bucket);
       // put back into unused part of the cache: remove from lru list.
       dt_cache_unlock(&segment->lock);
       lru_remove(cache, curr_bucket);
@@ -922,7 +1019,9 @@ dt_cache_remove_bucket_no_lru_lock(dt_cache_t *cache, const uint32_t num)
   // dt_cache_remove works on key, not bucket number, so translate that:
   const uint32_t hash = num;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
-  dt_cache_lock(&segment->lock);
+  // we hold the lru lock, and inserting threads take it while holding their segment
+  // lock. never wait here, just skip this one:
+  if(dt_cache_testlock(&segment->lock)) return 1;
 
   dt_cache_bucket_t *const curr_bucket = cache->table + (hash & cache->bucket_mask);
   const uint32_t key = curr_bucket->key;
@@ -986,31 +1085,44 @@ dt_cache_gc(dt_cache_t *cache, const float fill_ratio)
     }
     // fprintf(stderr, "[cache gc] from %u to %u\n", cache->cost, (uint32_t)(0.8*cache->cost_quota));
 
-    // remove it. takes care of lru, cost, user cleanup, and hashtable
-    // this could run into keys being concurrently removed, and will not remove these,
-    // nor alter the lru list in that case (could be interleaved with the other thread
-    // who is currently doing that)
-    //
-    // in the very unlikely case the bucket in question got just removed,
-    // and the lru not cleaned up yet, but another image already occupies that slot...
-    // it will be read locked and we go on. very worst case we clean up the wrong image.
+    dt_cache_bucket_t *bucket = cache->table + curr;
 #ifdef DT_CACHE_BFL
-    const int err = dt_cache_remove_bucket_no_lru_lock(cache, curr);
+    const int32_t next = bucket->mru;
 #else
-    const int err = dt_cache_remove_bucket(cache, curr);
+    dt_cache_lock(&cache->lru_lock);
+    const int32_t next = bucket->mru;
+    dt_cache_unlock(&cache->lru_lock);
 #endif
-    if(err)
+    if(bucket->referenced)
     {
-      // fprintf(stderr, "[cache gc] remove failed %d\n", err);
-      // in case we failed, try next entry
+      // hit since we last came by: second chance, append to the most recently used end.
+      bucket->referenced = 0;
 #ifdef DT_CACHE_BFL
-      curr = cache->table[curr].mru;
+      lru_insert(cache, bucket);
 #else
-      dt_cache_lock(&cache->lru_lock);
-      curr = cache->table[curr].mru;
-      dt_cache_unlock(&cache->lru_lock);
+      lru_insert_locked(cache, bucket);
+#endif
+    }
+    else
+    {
+      // remove it. takes care of lru, cost, user cleanup, and hashtable
+      // this could run into keys being concurrently removed, and will not remove these,
+      // nor alter the lru list in that case (could be interleaved with the other thread
+      // who is currently doing that)
+      //
+      // in the very unlikely case the bucket in question got just removed,
+      // and the lru not cleaned up yet, but another image already occupies that slot...
+      // it will be read locked and we go on. very worst case we clean up the wrong image.
+#ifdef DT_CACHE_BFL
+      const int err = dt_cache_remove_bucket_no_lru_lock(cache, curr);
+#else
+      const int err = dt_cache_remove_bucket(cache, curr);
 #endif
+      (void)err;
+      // fprintf(stderr, "[cache gc] remove failed %d\n", err);
+      // in case we failed (entry in use), just go on with the next one.
     }
+    curr = next;
     i++;
   }
 #ifdef DT_CACHE_BFL
@@ -1036,6 +1148,28 @@ dt_cache_read_release(dt_cache_t *cache, const uint32_t key)
   const uint32_t hash = key;
   dt_cache_segment_t *segment = cache->segments + ((hash >> cache->segment_shift) & cache->segment_mask);
 
+  // our read lock keeps the bucket from being removed, so try to find it without
+  // locking. only concurrent removals of other keys in the chain make us retry.
+  dt_cache_bucket_t *const start = cache->table + (hash & cache->bucket_mask);
+  for(int tries=0; tries<4; tries++)
+  {
+    const uint32_t start_timestamp = segment->timestamp;
+    __sync_synchronize();
+    dt_cache_bucket_t *curr = start;
+    int16_t delta = curr->first_delta;
+    while(delta != DT_CACHE_NULL_DELTA)
+    {
+      curr += delta;
+      if(hash == curr->hash && key == curr->key)
+      {
+        dt_cache_bucket_read_release(curr);
+        return;
+      }
+      delta = curr->next_delta;
+      if(segment->timestamp != start_timestamp) break;
+    }
+  }
+
   dt_cache_lock(&segment->lock);
 
   dt_cache_bucket_t *const start_bucket = cache->table + (hash & cache->bucket_mask);
@@ -1060,8 +1194,8 @@ dt_cache_read_release(dt_cache_t *cache, const uint32_t key)
 
 // augments an already acquired read lock to a write lock. blocks until
 // all readers have released the image.
-void*
-dt_cache_write_get(dt_cache_t *cache, const uint32_t key)
+static void*
+_cache_write_get(dt_cache_t *cache, const uint32_t key, const int block)
 {
   // just to support different keys:
   const uint32_t hash = key;
@@ -1082,6 +1216,7 @@ dt_cache_write_get(dt_cache_t *cache, const uint32_t key)
         void *rc = compare_bucket->data;
         int err = dt_cache_bucket_write_testlock(compare_bucket);
         dt_cache_unlock(&segment->lock);
+        if(err && !block) return NULL;
         if(err) goto wait;
         return rc;
       }
@@ -1100,6 +1235,18 @@ wait:
   return NULL;
 }
 
+void*
+dt_cache_write_get(dt_cache_t *cache, const uint32_t key)
+{
+  return _cache_write_get(cache, key, 1);
+}
+
+void*
+dt_cache_write_tryget(dt_cache_t *cache, const uint32_t key)
+{
+  return _cache_write_get(cache, key, 0);
+}
+
 void
 dt_cache_realloc(dt_cache_t *cache, const uint32_t key, const int32_t cost, void *data)
 {
@@ -1117,11 +1264,11 @@ dt_cache_realloc(dt_cache_t *cache, const uint32_t key, const int32_t cost, void
     compare_bucket += next_delta;
     if(hash == compare_bucket->hash && (key == compare_bucket->key))
     {
-      if(compare_bucket->write != 1 || compare_bucket->read != 1)
+      if(dt_cache_bucket_writers(compare_bucket) != 1 || dt_cache_bucket_readers(compare_bucket) != 1)
         fprintf(stderr, "[cache realloc] key %u not locked!\n", key);
       // need to have the bucket write locked:
-      assert(compare_bucket->write == 1);
-      assert(compare_bucket->read == 1);
+      assert(dt_cache_bucket_writers(compare_bucket) == 1);
+      assert(dt_cache_bucket_readers(compare_bucket) == 1);
       compare_bucket->data = data;
       const int32_t cost_diff = cost - compare_bucket->cost;
       compare_bucket->cost = cost;
@@ -1172,10 +1319,11 @@ void dt_cache_print(dt_cache_t *cache)
   {
     if(cache->table[k].key != DT_CACHE_EMPTY_KEY)
       fprintf(stderr, "[cache] bucket %d holds key %u with locks r %d w %d\n",
-              k, (cache->table[k].key & 0x1fffffff)+1, cache->table[k].read, cache->table[k].write);
+              k, (cache->table[k].key & 0x1fffffff)+1,
+              dt_cache_bucket_readers(cache->table + k), dt_cache_bucket_writers(cache->table + k));
     else
       fprintf(stderr, "[cache] bucket %d is empty with locks r %d w %d\n",
-              k, cache->table[k].read, cache->table[k].write);
+              k, dt_cache_bucket_readers(cache->table + k), dt_cache_bucket_writers(cache->table + k));
   }
   fprintf(stderr, "[cache] lru entries:\n");
   dt_cache_lock(&cache->lru_lock);
@@ -1184,11 +1332,12 @@ void dt_cache_print(dt_cache_t *cache)
   {
     if(cache->table[curr].key != DT_CACHE_EMPTY_KEY)
       fprintf(stderr, "[cache] bucket %d holds key %u with locks r %d w %d\n",
-              curr, (cache->table[curr].key & 0x1fffffff)+1, cache->table[curr].read, cache->table[curr].write);
+              curr, (cache->table[curr].key & 0x1fffffff)+1,
+              dt_cache_bucket_readers(cache->table + curr), dt_cache_bucket_writers(cache->table + curr));
     else
     {
       fprintf(stderr, "[cache] bucket %d is empty with locks r %d w %d\n",
-              curr, cache->table[curr].read, cache->table[curr].write);
+              curr, dt_cache_bucket_readers(cache->table + curr), dt_cache_bucket_writers(cache->table + curr));
       // this list should only ever contain valid buffers.
       assert(0);
     }
@@ -1208,10 +1357,11 @@ void dt_cache_print_locked(dt_cache_t *cache)
   int32_t i = 0;
   while(curr >= 0)
   {
-    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY && (cache->table[curr].read || cache->table[curr].write))
+    if(cache->table[curr].key != DT_CACHE_EMPTY_KEY && cache->table[curr].users)
     {
       fprintf(stderr, "[cache] bucket[%d|%d] holds key %u with locks r %d w %d\n",
-              i, curr, (cache->table[curr].key & 0x1fffffff)+1, cache->table[curr].read, cache->table[curr].write);
+              i, curr, (cache->table[curr].key & 0x1fffffff)+1,
+              dt_cache_bucket_readers(cache->table + curr), dt_cache_bucket_writers(cache->table + curr));
     }
     if(curr == cache->mru) break;
     int32_t next = cache->table[curr].mru;
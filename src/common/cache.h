@@ -83,18 +83,23 @@ void  dt_cache_read_release(dt_cache_t *cache, const uint32_t key);
 // augments an already acquired read lock to a write lock. blocks until
 // all readers have released the image.
 void* dt_cache_write_get    (dt_cache_t *cache, const uint32_t key);
+// same, but returns NULL instead of waiting for the other readers.
+void* dt_cache_write_tryget (dt_cache_t *cache, const uint32_t key);
 void  dt_cache_write_release(dt_cache_t *cache, const uint32_t key);
 
 // gets you a slot in the cache for the given key, read locked.
 // will only contain valid data if it was there before.
 void*   dt_cache_read_get(dt_cache_t *cache, const uint32_t key);
 void*   dt_cache_read_testget(dt_cache_t *cache, const uint32_t key);
+// same as read_get, but returns NULL instead of waiting for a writer.
+void*   dt_cache_read_tryget(dt_cache_t *cache, const uint32_t key);
 int32_t dt_cache_contains(const dt_cache_t *const cache, const uint32_t key);
 // returns 0 on success, 1 if the key was not found.
 int32_t dt_cache_remove(dt_cache_t *cache, const uint32_t key);
 // removes from the end of the lru list, until the fill ratio
 // of the hashtable goes below the given parameter, in terms
-// of the user defined cost measure.
+// of the user defined cost measure. entries which have been read since
+// the last pass get a second chance and move to the other end instead.
 int32_t dt_cache_gc(dt_cache_t *cache, const float fill_ratio);
 
 // returns the number of elements currently stored in the cache.
@@ -380,12 +380,11 @@ uint32_t dt_collection_get_count(const dt_collection_t *collection)
 
 uint32_t dt_collection_get_selected_count (const dt_collection_t *collection)
 {
-  sqlite3_stmt *stmt = NULL;
   uint32_t count=0;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select count (distinct imgid) from selected_images", -1, &stmt, NULL);
+  sqlite3_stmt *stmt = dt_database_get_statement(darktable.db, "select count (distinct imgid) from selected_images");
   if(sqlite3_step(stmt) == SQLITE_ROW)
     count = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   return count;
 }
 
@@ -411,14 +410,15 @@ GList *dt_collection_get_selected (const dt_collection_t *collection)
   query = dt_util_dstrcat(query, "where id in (select imgid from selected_images) %s", sq);
 
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),query, -1, &stmt, NULL);
+  /* one text per sort order, few enough to keep them all */
+  stmt = dt_database_get_statement(darktable.db, query);
 
   while (sqlite3_step (stmt) == SQLITE_ROW)
   {
     long int imgid = sqlite3_column_int(stmt, 0);
     list = g_list_append (list, (gpointer)imgid);
   }
-
+  dt_database_release_statement(darktable.db, stmt);
 
   /* free allocated strings */
   if (sq)
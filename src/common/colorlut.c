@@ -0,0 +1,186 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/colorlut.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// random input used to measure the error against lcms2, and to time both.
+#define DT_COLORLUT_SAMPLES 4096
+
+// from grid coordinate in [0,1] to transform input
+static inline float
+_colorlut_unshape(const dt_colorlut_t *lut, const float x, const int c)
+{
+  const float v = lut->shaper == DT_COLORLUT_SHAPER_SQRT ? x*x : x;
+  return v/lut->scale[c] + lut->offset[c];
+}
+
+static int
+_colorlut_fill(dt_colorlut_t *lut, cmsHTRANSFORM xform)
+{
+  const int size = lut->size;
+  const size_t nodes = (size_t)size*size*size;
+  float *in = (float *)malloc(sizeof(float)*3*nodes);
+  float *out = (float *)malloc(sizeof(float)*3*nodes);
+  free(lut->table);
+  lut->table = (float *)dt_alloc_align(16, sizeof(float)*4*nodes);
+  if(!in || !out || !lut->table)
+  {
+    free(in);
+    free(out);
+    return 1;
+  }
+  size_t k = 0;
+  for(int j2=0; j2<size; j2++)
+    for(int j1=0; j1<size; j1++)
+      for(int j0=0; j0<size; j0++, k++)
+      {
+        in[3*k+0] = _colorlut_unshape(lut, j0/(size - 1.0f), 0);
+        in[3*k+1] = _colorlut_unshape(lut, j1/(size - 1.0f), 1);
+        in[3*k+2] = _colorlut_unshape(lut, j2/(size - 1.0f), 2);
+      }
+  // one call for the whole grid, lcms2 transforms aren't thread safe anyways.
+  cmsDoTransform(xform, in, out, nodes);
+  for(k=0; k<nodes; k++)
+  {
+    lut->table[4*k+0] = out[3*k+0];
+    lut->table[4*k+1] = out[3*k+1];
+    lut->table[4*k+2] = out[3*k+2];
+    lut->table[4*k+3] = 0.0f;
+  }
+  free(in);
+  free(out);
+  return 0;
+}
+
+dt_colorlut_t *
+dt_colorlut_bake(cmsHTRANSFORM xform, const int size, const dt_colorlut_shaper_t shaper,
+                 const float *min, const float *max, const float tolerance)
+{
+  if(!xform) return NULL;
+  dt_colorlut_t *lut = (dt_colorlut_t *)malloc(sizeof(dt_colorlut_t));
+  if(!lut) return NULL;
+  lut->table = NULL;
+  lut->shaper = shaper;
+  lut->size = CLAMPS(size, DT_COLORLUT_MIN_SIZE, DT_COLORLUT_MAX_SIZE);
+  for(int c=0; c<3; c++)
+  {
+    lut->offset[c] = min[c];
+    lut->scale[c] = 1.0f/(max[c] - min[c]);
+  }
+  lut->offset[3] = 0.0f;
+  lut->scale[3] = 0.0f;
+
+  // samples spread evenly in grid space, so they hit all cells alike:
+  float *in  = (float *)dt_alloc_align(16, sizeof(float)*4*DT_COLORLUT_SAMPLES);
+  float *ref = (float *)malloc(sizeof(float)*3*DT_COLORLUT_SAMPLES);
+  float *cms = (float *)malloc(sizeof(float)*3*DT_COLORLUT_SAMPLES);
+  float *res = (float *)dt_alloc_align(16, sizeof(float)*4*DT_COLORLUT_SAMPLES);
+  if(!in || !ref || !cms || !res) goto error;
+  uint32_t seed = 0x1234567;
+  for(int k=0; k<DT_COLORLUT_SAMPLES; k++)
+  {
+    for(int c=0; c<3; c++)
+    {
+      seed = seed*1664525u + 1013904223u;
+      in[4*k+c] = cms[3*k+c] = _colorlut_unshape(lut, (seed >> 8)/(float)(1<<24), c);
+    }
+    in[4*k+3] = 0.0f;
+  }
+  const double start = dt_get_wtime();
+  cmsDoTransform(xform, cms, ref, DT_COLORLUT_SAMPLES);
+  const double cms_time = dt_get_wtime() - start;
+
+  double lut_time = 0.0;
+  while(1)
+  {
+    const double bake = dt_get_wtime();
+    if(_colorlut_fill(lut, xform)) goto error;
+    const double bake_time = dt_get_wtime() - bake;
+
+    const double apply = dt_get_wtime();
+    dt_colorlut_apply(lut, in, res, DT_COLORLUT_SAMPLES);
+    lut_time = dt_get_wtime() - apply;
+
+    lut->max_error = 0.0f;
+    for(int k=0; k<DT_COLORLUT_SAMPLES; k++)
+      for(int c=0; c<3; c++)
+        lut->max_error = fmaxf(lut->max_error, fabsf(res[4*k+c] - ref[3*k+c]));
+
+    dt_print(DT_DEBUG_PERF, "[colorlut] baked %d^3 lut in %.3f secs, max error %f (tolerance %f)\n",
+             lut->size, bake_time, lut->max_error, tolerance);
+    if(lut->max_error <= tolerance || lut->size >= DT_COLORLUT_MAX_SIZE) break;
+    // refine: 2n-1 puts a new node between each pair of old ones.
+    lut->size = MIN(DT_COLORLUT_MAX_SIZE, 2*lut->size - 1);
+  }
+  dt_print(DT_DEBUG_PERF, "[colorlut] %d samples: lcms2 %.3f Mpix/s, lut %.3f Mpix/s\n", DT_COLORLUT_SAMPLES,
+           DT_COLORLUT_SAMPLES*1e-6/MAX(cms_time, 1e-9), DT_COLORLUT_SAMPLES*1e-6/MAX(lut_time, 1e-9));
+
+  free(in);
+  free(ref);
+  free(cms);
+  free(res);
+  return lut;
+
+error:
+  free(in);
+  free(ref);
+  free(cms);
+  free(res);
+  dt_colorlut_free(lut);
+  return NULL;
+}
+
+void
+dt_colorlut_free(dt_colorlut_t *lut)
+{
+  if(!lut) return;
+  free(lut->table);
+  free(lut);
+}
+
+gchar *
+dt_colorlut_key(cmsHPROFILE profile, const int intent, const int size)
+{
+  cmsUInt32Number len = 0;
+  if(!profile || !cmsSaveProfileToMem(profile, NULL, &len) || !len) return NULL;
+  guchar *buf = (guchar *)g_malloc(len);
+  gchar *key = NULL;
+  if(cmsSaveProfileToMem(profile, buf, &len))
+  {
+    gchar *md5 = g_compute_checksum_for_data(G_CHECKSUM_MD5, buf, len);
+    key = g_strdup_printf("%s-%d-%d", md5, intent, size);
+    g_free(md5);
+  }
+  g_free(buf);
+  return key;
+}
+
+void
+dt_colorlut_apply(const dt_colorlut_t *const lut, const float *in, float *out, const int width)
+{
+  for(int i=0; i<width; i++, in+=4, out+=4)
+    _mm_store_ps(out, dt_colorlut_lookup_sse(lut, _mm_load_ps(in)));
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,125 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_COLORLUT_H
+#define DT_COMMON_COLORLUT_H
+
+#include <glib.h>
+#include <inttypes.h>
+#include <lcms2.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+/**
+ * 3d lookup tables baked from lcms2 transforms.
+ *
+ * profiles which aren't a simple matrix/shaper (camera profiles with a clut,
+ * printer profiles, ..) would otherwise need a cmsDoTransform() per pixel. instead
+ * the transform is sampled once on a regular grid, and evaluated with tetrahedral
+ * interpolation. an optional 1d shaper in front of the grid spends more of the
+ * nodes on the shadows of linear input.
+ */
+
+#define DT_COLORLUT_MIN_SIZE 9
+#define DT_COLORLUT_MAX_SIZE 65
+
+typedef enum dt_colorlut_shaper_t
+{
+  DT_COLORLUT_SHAPER_LINEAR = 0, // perceptual input, like Lab
+  DT_COLORLUT_SHAPER_SQRT   = 1  // linear rgb input
+}
+dt_colorlut_shaper_t;
+
+typedef struct dt_colorlut_t
+{
+  // grid points per axis
+  int size;
+  dt_colorlut_shaper_t shaper;
+  // maps the input range to [0,1]: (in - offset) * scale
+  float offset[4] __attribute__((aligned(16)));
+  float scale[4] __attribute__((aligned(16)));
+  // size^3 nodes of 4 floats, first channel varies fastest
+  float *table;
+  // largest deviation from lcms2 found when baking, in output units
+  float max_error;
+}
+dt_colorlut_t;
+
+/** bake a lut from a transform with three float input and three float output channels
+    (TYPE_RGB_FLT, TYPE_Lab_FLT, ..). input outside [min,max] is clamped. starting with size
+    grid points per axis, the lut is refined until the error compared to lcms2 is below
+    tolerance, or DT_COLORLUT_MAX_SIZE is reached. returns NULL on failure. */
+dt_colorlut_t *dt_colorlut_bake(cmsHTRANSFORM xform, const int size, const dt_colorlut_shaper_t shaper,
+                                const float *min, const float *max, const float tolerance);
+
+void dt_colorlut_free(dt_colorlut_t *lut);
+
+/** identifies the lut for a profile (by content), intent and size. modules keep the
+    key next to the lut and only bake again when it changes. free with g_free(). */
+gchar *dt_colorlut_key(cmsHPROFILE profile, const int intent, const int size);
+
+/** convert width pixels of 4 floats, the fourth channel is set to zero. */
+void dt_colorlut_apply(const dt_colorlut_t *const lut, const float *in, float *out, const int width);
+
+/** single pixel version, for modules which do some more work per pixel. */
+static inline __m128
+dt_colorlut_lookup_sse(const dt_colorlut_t *const lut, const __m128 in)
+{
+  const int size = lut->size;
+  __m128 x = _mm_mul_ps(_mm_sub_ps(in, _mm_load_ps(lut->offset)), _mm_load_ps(lut->scale));
+  // clamp, nan ends up as 0:
+  x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+  if(lut->shaper == DT_COLORLUT_SHAPER_SQRT) x = _mm_sqrt_ps(x);
+  x = _mm_mul_ps(x, _mm_set1_ps(size - 1));
+  // cell index, the last one also covers 1.0:
+  const __m128 fi = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(x)), _mm_set1_ps(size - 2));
+  float f[4] __attribute__((aligned(16)));
+  int32_t i[4] __attribute__((aligned(16)));
+  _mm_store_ps(f, _mm_sub_ps(x, fi));
+  _mm_store_si128((__m128i *)i, _mm_cvttps_epi32(fi));
+
+  // strides of the three axes in floats:
+  const int s0 = 4, s1 = 4*size, s2 = 4*size*size;
+  const float *c000 = lut->table + i[0]*s0 + i[1]*s1 + i[2]*s2;
+
+  // pick the tetrahedron by sorting the fractions, walking along the largest first:
+  float fa, fb, fc;
+  int sa, sb;
+  if(f[0] >= f[1])
+  {
+    if(f[1] >= f[2])      { fa = f[0]; fb = f[1]; fc = f[2]; sa = s0; sb = s0+s1; }
+    else if(f[0] >= f[2]) { fa = f[0]; fb = f[2]; fc = f[1]; sa = s0; sb = s0+s2; }
+    else                  { fa = f[2]; fb = f[0]; fc = f[1]; sa = s2; sb = s0+s2; }
+  }
+  else
+  {
+    if(f[0] >= f[2])      { fa = f[1]; fb = f[0]; fc = f[2]; sa = s1; sb = s0+s1; }
+    else if(f[1] >= f[2]) { fa = f[1]; fb = f[2]; fc = f[0]; sa = s1; sb = s1+s2; }
+    else                  { fa = f[2]; fb = f[1]; fc = f[0]; sa = s2; sb = s1+s2; }
+  }
+  const __m128 v0 = _mm_load_ps(c000);
+  const __m128 v1 = _mm_load_ps(c000 + sa);
+  const __m128 v2 = _mm_load_ps(c000 + sb);
+  const __m128 v3 = _mm_load_ps(c000 + s0 + s1 + s2);
+  return _mm_add_ps(_mm_add_ps(_mm_mul_ps(v0, _mm_set1_ps(1.0f - fa)), _mm_mul_ps(v1, _mm_set1_ps(fa - fb))),
+                    _mm_add_ps(_mm_mul_ps(v2, _mm_set1_ps(fb - fc)), _mm_mul_ps(v3, _mm_set1_ps(fc))));
+}
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
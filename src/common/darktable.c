@@ -33,6 +33,7 @@
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio_module.h"
+#include "common/memory.h"
 #include "common/mipmap_cache.h"
 #include "common/opencl.h"
 #include "common/points.h"
@@ -650,6 +651,11 @@ int dt_init(int argc, char *argv[], const int init_gui)
   InitializeMagick(darktable.progname);
 #endif
 
+  // all caches and buffers below account their memory here:
+  darktable.memory = (dt_memory_t *)malloc(sizeof(dt_memory_t));
+  memset(darktable.memory, 0, sizeof(dt_memory_t));
+  dt_memory_init(darktable.memory);
+
   darktable.opencl = (dt_opencl_t *)malloc(sizeof(dt_opencl_t));
   memset(darktable.opencl, 0, sizeof(dt_opencl_t));
   dt_opencl_init(darktable.opencl, argc, argv);
@@ -760,10 +766,13 @@ int dt_init(int argc, char *argv[], const int init_gui)
   {
     fprintf(stderr, "[memory] after successful startup\n");
     dt_print_mem_usage();
+    dt_memory_print(darktable.memory);
   }
 
   dt_image_local_copy_synch();
 
+  if(init_gui) dt_film_watch_all();
+
   /* init lua last, since it's user made stuff it must be in the real environment */
 #ifdef USE_LUA
   dt_lua_init(darktable.lua_state,init_gui);
@@ -776,6 +785,10 @@ void dt_cleanup()
   dt_ctl_switch_mode_to(DT_MODE_NONE);
   const int init_gui = (darktable.gui != NULL);
 
+  // stop the folder watch first, it queues jobs and uses the caches
+  dt_fswatch_destroy(darktable.fswatch);
+  darktable.fswatch = NULL;
+
   if(init_gui)
   {
     dt_dbus_destroy(darktable.dbus);
@@ -812,11 +825,12 @@ void dt_cleanup()
   dt_iop_unload_modules_so();
   dt_opencl_cleanup(darktable.opencl);
   free(darktable.opencl);
+  dt_memory_cleanup(darktable.memory);
+  free(darktable.memory);
 #ifdef HAVE_GPHOTO2
   dt_camctl_destroy(darktable.camctl);
 #endif
   dt_pwstorage_destroy(darktable.pwstorage);
-  dt_fswatch_destroy(darktable.fswatch);
 
 #ifdef HAVE_GRAPHICSMAGICK
   DestroyMagick();
@@ -23,10 +23,25 @@
 #include "control/control.h"
 #include "control/conf.h"
 
+#include <assert.h>
+#include <inttypes.h>
 #include <sqlite3.h>
 #include <glib.h>
 #include <gio/gio.h>
 
+/* idle statements kept per sql text */
+#define DT_DATABASE_MAX_IDLE_STATEMENTS 4
+
+/* all statements compiled from the same sql text */
+typedef struct dt_database_statement_t
+{
+  /* prepared, reset and currently not borrowed by anyone */
+  GSList *idle;
+  int num_idle;
+  /* for the statistics */
+  uint64_t borrowed, prepared;
+} dt_database_statement_t;
+
 typedef struct dt_database_t
 {
   gboolean is_new_database;
@@ -37,8 +52,28 @@ typedef struct dt_database_t
 
   /* ondisk DB */
   sqlite3 *handle;
+
+  /* sql text -> dt_database_statement_t, protected by lock */
+  GHashTable *statements;
+  dt_pthread_mutex_t lock;
+
+  /* the thread which has savepoints open on the connection and how many, protected by lock */
+  pthread_t savepoint_owner;
+  int savepoint_depth;
+  pthread_cond_t savepoint_cond;
+
+  /* per thread: how many statements it ran on the connection */
+  pthread_key_t statements_run;
 } dt_database_t;
 
+/* called by sqlite whenever a statement has run to its end or was reset */
+static void _database_profile(void *data, const char *sql, sqlite3_uint64 ns)
+{
+  const dt_database_t *db = (const dt_database_t *)data;
+  const int run = GPOINTER_TO_INT(pthread_getspecific(db->statements_run));
+  pthread_setspecific(db->statements_run, GINT_TO_POINTER(run + 1));
+}
+
 
 /* migrates database from old place to new */
 static void _database_migrate_to_xdg_structure();
@@ -87,6 +122,10 @@ dt_database_t *dt_database_init(char *alternative)
   memset(db,0,sizeof(dt_database_t));
   db->dbfilename = g_strdup(dbfilename);
   db->is_new_database = FALSE;
+  db->statements = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  dt_pthread_mutex_init(&db->lock, NULL);
+  pthread_cond_init(&db->savepoint_cond, NULL);
+  pthread_key_create(&db->statements_run, NULL);
 
   /* test if databasefile is available */
   if(!g_file_test(dbfilename, G_FILE_TEST_IS_REGULAR))
@@ -103,6 +142,10 @@ dt_database_t *dt_database_init(char *alternative)
     fprintf(stderr, "[init] try `cp %s/darktablerc %s/darktablerc'\n", dbfilename,datadir);
     sqlite3_close(db->handle);
     g_free(dbname);
+    g_hash_table_destroy(db->statements);
+    pthread_cond_destroy(&db->savepoint_cond);
+    pthread_key_delete(db->statements_run);
+    dt_pthread_mutex_destroy(&db->lock);
     g_free(db);
     return NULL;
   }
@@ -126,14 +169,161 @@ dt_database_t *dt_database_init(char *alternative)
   sqlite3_exec(db->handle, "PRAGMA journal_mode = MEMORY", NULL, NULL, NULL);
   sqlite3_exec(db->handle, "PRAGMA page_size = 32768", NULL, NULL, NULL);
 
+  sqlite3_profile(db->handle, _database_profile, db);
+
   g_free(dbname);
   return db;
 }
 
 void dt_database_destroy(const dt_database_t *db)
 {
+  dt_database_t *d = (dt_database_t *)db;
+  if(darktable.unmuted & DT_DEBUG_SQL)
+    dt_database_print_statements(db);
+
+  /* statements have to be finalized before the connection can be closed */
+  GHashTableIter iter;
+  gpointer value;
+  g_hash_table_iter_init(&iter, d->statements);
+  while(g_hash_table_iter_next(&iter, NULL, &value))
+  {
+    dt_database_statement_t *entry = (dt_database_statement_t *)value;
+    g_slist_free_full(entry->idle, (GDestroyNotify)sqlite3_finalize);
+  }
+  g_hash_table_destroy(d->statements);
+  pthread_cond_destroy(&d->savepoint_cond);
+  pthread_key_delete(d->statements_run);
+  dt_pthread_mutex_destroy(&d->lock);
+
   sqlite3_close(db->handle);
-  g_free((dt_database_t *)db);
+  g_free(d->dbfilename);
+  g_free(d);
+}
+
+sqlite3_stmt *dt_database_get_statement(const dt_database_t *db, const char *sql)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  sqlite3_stmt *stmt = NULL;
+  dt_pthread_mutex_lock(&d->lock);
+  dt_database_statement_t *entry = (dt_database_statement_t *)g_hash_table_lookup(d->statements, sql);
+  if(!entry)
+  {
+    entry = (dt_database_statement_t *)g_malloc0(sizeof(dt_database_statement_t));
+    g_hash_table_insert(d->statements, g_strdup(sql), entry);
+  }
+  entry->borrowed++;
+  if(entry->idle)
+  {
+    stmt = (sqlite3_stmt *)entry->idle->data;
+    entry->idle = g_slist_delete_link(entry->idle, entry->idle);
+    entry->num_idle--;
+  }
+  else entry->prepared++;
+  dt_pthread_mutex_unlock(&d->lock);
+
+  /* nothing idle, another thread holds it or it's the first time */
+  if(!stmt)
+    DT_DEBUG_SQLITE3_PREPARE_V2(db->handle, sql, -1, &stmt, NULL);
+  return stmt;
+}
+
+void dt_database_release_statement(const dt_database_t *db, sqlite3_stmt *stmt)
+{
+  if(!stmt) return;
+  dt_database_t *d = (dt_database_t *)db;
+  /* the return value repeats the last step error, if any. that's been dealt with already. */
+  sqlite3_reset(stmt);
+  sqlite3_clear_bindings(stmt);
+  dt_pthread_mutex_lock(&d->lock);
+  dt_database_statement_t *entry = (dt_database_statement_t *)g_hash_table_lookup(d->statements, sqlite3_sql(stmt));
+  if(entry && entry->num_idle < DT_DATABASE_MAX_IDLE_STATEMENTS)
+  {
+    entry->idle = g_slist_prepend(entry->idle, stmt);
+    entry->num_idle++;
+    stmt = NULL;
+  }
+  dt_pthread_mutex_unlock(&d->lock);
+  if(stmt) sqlite3_finalize(stmt);
+}
+
+void dt_database_start_savepoint(const dt_database_t *db, const char *name)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->lock);
+  /* the savepoints of another thread would be released along with ours, or the other way round */
+  while(d->savepoint_depth > 0 && !pthread_equal(d->savepoint_owner, pthread_self()))
+    dt_pthread_cond_wait(&d->savepoint_cond, &d->lock);
+  d->savepoint_owner = pthread_self();
+  d->savepoint_depth++;
+  dt_pthread_mutex_unlock(&d->lock);
+
+  gchar *sql = g_strdup_printf("savepoint %s", name);
+  DT_DEBUG_SQLITE3_EXEC(d->handle, sql, NULL, NULL, NULL);
+  g_free(sql);
+}
+
+void dt_database_release_savepoint(const dt_database_t *db, const char *name)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  gchar *sql = g_strdup_printf("release %s", name);
+  DT_DEBUG_SQLITE3_EXEC(d->handle, sql, NULL, NULL, NULL);
+  g_free(sql);
+
+  dt_pthread_mutex_lock(&d->lock);
+  assert(d->savepoint_depth > 0 && pthread_equal(d->savepoint_owner, pthread_self()));
+  if(--d->savepoint_depth == 0)
+    pthread_cond_broadcast(&d->savepoint_cond);
+  dt_pthread_mutex_unlock(&d->lock);
+}
+
+int dt_database_get_savepoint_depth(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->lock);
+  const int depth = (d->savepoint_depth > 0 && pthread_equal(d->savepoint_owner, pthread_self())) ? d->savepoint_depth : 0;
+  dt_pthread_mutex_unlock(&d->lock);
+  return depth;
+}
+
+int dt_database_get_statements_run(const dt_database_t *db)
+{
+  return GPOINTER_TO_INT(pthread_getspecific(db->statements_run));
+}
+
+static gint _database_statement_compare(gconstpointer a, gconstpointer b, gpointer user_data)
+{
+  GHashTable *statements = (GHashTable *)user_data;
+  const dt_database_statement_t *ea = (const dt_database_statement_t *)g_hash_table_lookup(statements, a);
+  const dt_database_statement_t *eb = (const dt_database_statement_t *)g_hash_table_lookup(statements, b);
+  return (ea->borrowed < eb->borrowed) - (ea->borrowed > eb->borrowed);
+}
+
+void dt_database_print_statements(const dt_database_t *db)
+{
+  dt_database_t *d = (dt_database_t *)db;
+  dt_pthread_mutex_lock(&d->lock);
+  uint64_t borrowed = 0, prepared = 0;
+  GList *keys = g_hash_table_get_keys(d->statements);
+  for(GList *l = keys; l; l = g_list_next(l))
+  {
+    const dt_database_statement_t *entry = (const dt_database_statement_t *)g_hash_table_lookup(d->statements, l->data);
+    borrowed += entry->borrowed;
+    prepared += entry->prepared;
+  }
+  fprintf(stderr, "[sql] statement cache: %u statements, borrowed %" PRIu64 " times, prepared %" PRIu64 " times, hit rate %.1f%%\n",
+          g_hash_table_size(d->statements), borrowed, prepared,
+          borrowed ? 100.0*(borrowed - prepared)/borrowed : 0.0);
+  /* the busiest ones */
+  keys = g_list_sort_with_data(keys, _database_statement_compare, d->statements);
+  int cnt = 0;
+  for(GList *l = keys; l && cnt < 10; l = g_list_next(l), cnt++)
+  {
+    const dt_database_statement_t *entry = (const dt_database_statement_t *)g_hash_table_lookup(d->statements, l->data);
+    fprintf(stderr, "[sql]   %8" PRIu64 " borrowed %6" PRIu64 " prepared  \"%s\"\n",
+            entry->borrowed, entry->prepared, (const char *)l->data);
+  }
+  g_list_free(keys);
+  dt_pthread_mutex_unlock(&d->lock);
 }
 
 sqlite3 *dt_database_get(const dt_database_t *db)
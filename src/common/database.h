@@ -20,6 +20,7 @@
 #define DATABASE_H
 
 #include <glib.h>
+#include <sqlite3.h>
 
 /** allocates and initializes database */
 struct dt_database_t *dt_database_init(char *alternative);
@@ -33,6 +34,26 @@ gboolean dt_database_is_new(const struct dt_database_t *db);
 const gchar *dt_database_get_path(const struct dt_database_t *db);
 /** test if database was already locked by another instance */
 gboolean dt_database_get_already_locked(const struct dt_database_t *db);
+
+/** borrow a prepared statement for sql from the statement cache, instead of compiling
+    it again. the statement belongs to the caller until it is handed back with
+    dt_database_release_statement(), so every thread works on its own handle. */
+sqlite3_stmt *dt_database_get_statement(const struct dt_database_t *db, const char *sql);
+/** reset the statement, clear its bindings and keep it for the next caller. */
+void dt_database_release_statement(const struct dt_database_t *db, sqlite3_stmt *stmt);
+/** open a named savepoint. savepoints nest on the one shared connection, and releasing one
+    also releases all opened after it, no matter by which thread. so only one thread at a time
+    may have savepoints open: the others wait here until it has released its last one. */
+void dt_database_start_savepoint(const struct dt_database_t *db, const char *name);
+/** release the savepoint opened last by dt_database_start_savepoint() with this name. */
+void dt_database_release_savepoint(const struct dt_database_t *db, const char *name);
+/** number of savepoints the calling thread has open. */
+int dt_database_get_savepoint_depth(const struct dt_database_t *db);
+/** number of statements the calling thread has run on the connection so far, savepoints and
+    each run of a reused statement included. the difference tells what an operation cost. */
+int dt_database_get_statements_run(const struct dt_database_t *db);
+/** print how often statements were borrowed and compiled (shown on exit with -d sql). */
+void dt_database_print_statements(const struct dt_database_t *db);
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
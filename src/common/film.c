@@ -20,10 +20,14 @@
 #include "control/control.h"
 #include "control/conf.h"
 #include "control/jobs.h"
+#include "control/jobs/image_jobs.h"
 #include "common/film.h"
 #include "common/dtpthread.h"
 #include "common/collection.h"
 #include "common/image_cache.h"
+#include "common/mipmap_cache.h"
+#include "common/exif.h"
+#include "common/fswatch.h"
 #include "common/debug.h"
 #include "views/view.h"
 
@@ -219,6 +223,7 @@ int dt_film_new(dt_film_t *film, const char *directory)
       film->id = sqlite3_column_int(stmt, 0);
     sqlite3_finalize(stmt);
     dt_pthread_mutex_unlock(&darktable.db_insert);
+    if(film->id > 0) dt_film_watch(film->id);
   }
 
   if(film->id<=0)
@@ -275,6 +280,7 @@ int dt_film_import(const char *dirname)
     if(sqlite3_step(stmt) == SQLITE_ROW)
       film->id = sqlite3_column_int(stmt, 0);
     sqlite3_finalize(stmt);
+    if(film->id > 0) dt_film_watch(film->id);
   }
 
   /* bail out if we got troubles */
@@ -470,6 +476,7 @@ void dt_film_remove_empty()
     sqlite3_stmt *inner_stmt;
     raise_signal = TRUE;
     gint id = sqlite3_column_int(stmt, 0);
+    dt_film_unwatch(id);
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "delete from film_rolls where id=?1", -1, &inner_stmt, NULL);
     DT_DEBUG_SQLITE3_BIND_INT(inner_stmt, 1, id);
@@ -524,14 +531,18 @@ void dt_film_remove(const int id)
   }
 
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update tagxtag set count = count - 1 where "
-                              "(id2 in (select tagid from tagged_images where imgid in "
-                              "(select id from images where film_id = ?1))) or (id1 in "
-                              "(select tagid from tagged_images where imgid in "
-                              "(select id from images where film_id = ?1)))", -1, &stmt, NULL);
+                              "update tagxtag set count = count - (select count(*) from tagged_images a "
+                              "join tagged_images b on b.imgid = a.imgid where a.tagid = tagxtag.id1 and "
+                              "b.tagid = tagxtag.id2 and a.imgid in (select id from images where film_id = ?1)) "
+                              "where id1 in (select tagid from tagged_images where imgid in "
+                              "(select id from images where film_id = ?1)) and id2 in (select tagid from "
+                              "tagged_images where imgid in (select id from images where film_id = ?1))",
+                              -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "delete from tagxtag where count <= 0", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "delete from tagged_images where imgid in "
                               "(select id from images where film_id = ?1)", -1, &stmt, NULL);
@@ -582,6 +593,7 @@ void dt_film_remove(const int id)
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
 
+  dt_film_unwatch(id);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "delete from film_rolls where id = ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
@@ -590,6 +602,171 @@ void dt_film_remove(const int id)
   // dt_control_update_recent_films();
   dt_control_signal_raise(darktable.signals , DT_SIGNAL_FILMROLLS_CHANGED);
 }
+
+void dt_film_watch(const int id)
+{
+  if(!darktable.fswatch || !dt_conf_get_bool("plugins/lighttable/watch_folders")) return;
+  dt_fswatch_add(darktable.fswatch, DT_FSWATCH_FILMROLL_DIRECTORY, GINT_TO_POINTER(id));
+}
+
+void dt_film_unwatch(const int id)
+{
+  if(!darktable.fswatch || !dt_conf_get_bool("plugins/lighttable/watch_folders")) return;
+  dt_fswatch_remove(darktable.fswatch, DT_FSWATCH_FILMROLL_DIRECTORY, GINT_TO_POINTER(id));
+}
+
+void dt_film_watch_all()
+{
+  if(!darktable.fswatch || !dt_conf_get_bool("plugins/lighttable/watch_folders")) return;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id from film_rolls", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    dt_film_watch(sqlite3_column_int(stmt, 0));
+  sqlite3_finalize(stmt);
+}
+
+static int32_t _film_get_id_by_file(const gchar *filename)
+{
+  int32_t id = -1;
+  gchar *dirname = g_path_get_dirname(filename);
+  sqlite3_stmt *stmt = dt_database_get_statement(darktable.db,
+                                                 "select id from film_rolls where folder = ?1");
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, dirname, strlen(dirname), SQLITE_STATIC);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    id = sqlite3_column_int(stmt, 0);
+  dt_database_release_statement(darktable.db, stmt);
+  g_free(dirname);
+  return id;
+}
+
+// the file of known images was rewritten (by a raw converter, say): all versions get their exif
+// and size read again, and everything decoded from the old file is dropped.
+static int _film_refresh_image(const int32_t film_id, const gchar *filename)
+{
+  int found = 0;
+  gchar *basename = g_path_get_basename(filename);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id from images where film_id = ?1 and filename = ?2", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, basename, strlen(basename), SQLITE_STATIC);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+    dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+    // the rating is the user's, not the file's:
+    const int stars = img->flags & 0x7;
+    (void)dt_exif_read(img, filename);
+    img->flags = (img->flags & ~0x7) | stars;
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_mipmap_cache_remove_all(darktable.mipmap_cache, imgid);
+    found = 1;
+  }
+  sqlite3_finalize(stmt);
+  g_free(basename);
+  return found;
+}
+
+// IMG_1234.CR2.xmp belongs to the first version of IMG_1234.CR2, IMG_1234_01.CR2.xmp to the second.
+static int _film_refresh_sidecar(const gchar *xmpname)
+{
+  const int32_t film_id = _film_get_id_by_file(xmpname);
+  if(film_id <= 0) return 0;
+  gchar *original = g_path_get_basename(xmpname);
+  original[strlen(original) - 4] = '\0';
+  gchar *versioned = g_strdup(original);
+  char *c = strrchr(original, '.');
+  if(c && c - original > 3 && c[-3] == '_' && g_ascii_isdigit(c[-2]) && g_ascii_isdigit(c[-1]))
+    memmove(c - 3, c, strlen(c) + 1);
+
+  int found = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id from images where film_id = ?1 and filename in (?2, ?3)",
+                              -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, film_id);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, original, strlen(original), SQLITE_STATIC);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, versioned, strlen(versioned), SQLITE_STATIC);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const int32_t imgid = sqlite3_column_int(stmt, 0);
+    gboolean from_cache = FALSE;
+    char path[DT_MAX_PATH_LEN+8];
+    dt_image_full_path(imgid, path, DT_MAX_PATH_LEN, &from_cache);
+    dt_image_path_append_version(imgid, path, DT_MAX_PATH_LEN);
+    g_strlcat(path, ".xmp", sizeof(path));
+    if(strcmp(path, xmpname)) continue;
+
+    // edited elsewhere (another darktable, a sync tool): take over history and metadata.
+    // relaxed, so the sidecar isn't written straight back.
+    const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
+    dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
+    (void)dt_exif_xmp_read(img, xmpname, 0);
+    dt_image_cache_write_release(darktable.image_cache, img, DT_IMAGE_CACHE_RELAXED);
+    dt_image_cache_read_release(darktable.image_cache, img);
+    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    found = 1;
+    break;
+  }
+  sqlite3_finalize(stmt);
+  g_free(original);
+  g_free(versioned);
+  return found;
+}
+
+void dt_film_import_files(GList *files)
+{
+  int imported = 0, changed = 0;
+  int32_t last_film_id = -1;
+  GList *sidecars = NULL;
+  files = g_list_sort(g_list_copy(files), (GCompareFunc)_film_filename_cmp);
+  for(GList *f = files; f; f = g_list_next(f))
+  {
+    const gchar *filename = (const gchar *)f->data;
+    // images first, so sidecars arriving with them find them imported already
+    if(g_str_has_suffix(filename, ".xmp") || g_str_has_suffix(filename, ".XMP"))
+    {
+      sidecars = g_list_prepend(sidecars, f->data);
+      continue;
+    }
+    if(!dt_supported_image(filename)) continue;
+    const int32_t film_id = _film_get_id_by_file(filename);
+    if(film_id <= 0) continue;
+    if(_film_refresh_image(film_id, filename))
+    {
+      changed++;
+      continue;
+    }
+    const int32_t imgid = dt_image_import(film_id, filename, FALSE);
+    if(imgid <= 0) continue;
+    imported++;
+    last_film_id = film_id;
+    // the thumbnail behind whatever the user asked for already
+    dt_job_t j;
+    dt_image_load_job_init(&j, imgid, DT_MIPMAP_2);
+    dt_control_add_job(darktable.control, &j);
+  }
+  for(GList *f = sidecars; f; f = g_list_next(f))
+    changed += _film_refresh_sidecar((const gchar *)f->data);
+  g_list_free(sidecars);
+  g_list_free(files);
+
+  dt_print(DT_DEBUG_FSWATCH, "[film_import_files] %d new images, %d changed\n", imported, changed);
+  if(imported)
+  {
+    dt_control_log(ngettext("imported %d new image from watched folders",
+                            "imported %d new images from watched folders", imported), imported);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_FILMROLLS_IMPORTED, last_film_id);
+  }
+  if(changed)
+    dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
+  if(imported || changed)
+    dt_control_queue_redraw_center();
+}
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
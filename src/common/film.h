@@ -64,6 +64,16 @@ int dt_film_new(dt_film_t *film,const char *directory);
 /** removes all empty film rolls. */
 void dt_film_remove_empty();
 
+/** watch the folder of this film roll for new files (plugins/lighttable/watch_folders). */
+void dt_film_watch(const int id);
+/** stop watching the folder of this film roll. */
+void dt_film_unwatch(const int id);
+/** watch the folders of all film rolls, once at startup. */
+void dt_film_watch_all();
+/** import new files (full paths) into the film rolls of their folders and refresh
+    images whose file or sidecar changed. used by the folder watch. */
+void dt_film_import_files(GList *files);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
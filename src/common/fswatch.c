@@ -23,37 +23,43 @@
 #include "common/dtpthread.h"
 #include "common/image.h"
 #include "common/fswatch.h"
-#include "develop/develop.h"
+#include "common/debug.h"
+#include "control/control.h"
+#include "control/jobs/film_jobs.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <errno.h>
 #include <glib.h>
+#include <string.h>
 #include <strings.h>
-#if 0//def  HAVE_INOTIFY
+#include <limits.h>
+#include <sys/stat.h>
+#ifdef HAVE_INOTIFY
 #include <sys/inotify.h>
+#include <poll.h>
 #endif
 
+// seconds without new events before the pending files are imported. copying a
+// card or syncing a folder produces a burst of files, which go out as one job.
+#define DT_FSWATCH_QUIET_PERIOD 2.0
+
+typedef struct _written_t
+{
+  time_t mtime;
+  off_t size;
+} _written_t;
 
 typedef struct _watch_t
 {
   int descriptor;   // Handle
   dt_fswatch_type_t type;        // DT_FSWATCH_* type
   void *data;				// Assigned data
-  int events;				// events occurred..
+  gchar *path;      // watched file or folder
 } _watch_t;
 
 
-#if 0// def  HAVE_INOTIFY
-
-typedef struct inotify_event_t
-{
-  uint32_t wd;       /* Watch descriptor */
-  uint32_t mask;     /* Mask of events */
-  uint32_t cookie;   /* Unique cookie associating related events (for rename(2)) */
-  uint32_t len;      /* Size of 'name' field */
-  char     name[];   /* Optional null-terminated name */
-} inotify_event_t;
+#ifdef HAVE_INOTIFY
 
 // Compare func for GList
 static gint _fswatch_items_by_data(const void* a,const void *b)
@@ -68,79 +74,132 @@ static gint _fswatch_items_by_descriptor(const void *a,const void *b)
   return result;
 }
 
+static GList *_fswatch_find(dt_fswatch_t *fswatch, dt_fswatch_type_t type, void *data)
+{
+  for(GList *l = g_list_find_custom(fswatch->items, data, &_fswatch_items_by_data); l;
+      l = g_list_find_custom(g_list_next(l), data, &_fswatch_items_by_data))
+    if(((_watch_t *)l->data)->type == type) return l;
+  return NULL;
+}
+
+// called with the mutex held
+static void _fswatch_event(dt_fswatch_t *fswatch, const struct inotify_event *event)
+{
+  GList *gitem=g_list_find_custom(fswatch->items,&event->wd,&_fswatch_items_by_descriptor);
+  if(!gitem)
+  {
+    // events still queued for a watch which was just removed end up here
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %d\n", event->wd);
+    return;
+  }
+  _watch_t *item = gitem->data;
+  gchar *filename = NULL;
+  switch(item->type)
+  {
+    case DT_FSWATCH_IMAGE:
+      // Something wrote on image externally and closed it
+      if(event->mask & IN_CLOSE_WRITE)
+        filename = g_strdup(item->path);
+      break;
+
+    case DT_FSWATCH_FILMROLL_DIRECTORY:
+      // a file was written and closed, or moved in (tethering and sync tools often write
+      // to a temporary name first). folders are not followed.
+      if(event->len > 0 && (event->mask & (IN_CLOSE_WRITE|IN_MOVED_TO)) && !(event->mask & IN_ISDIR))
+        filename = g_build_filename(item->path, event->name, NULL);
+      break;
+
+    default:
+      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %d\n", item->type, event->wd);
+      break;
+  }
+  if(filename)
+  {
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] %s changed\n", filename);
+    // the same file written several times is only handled once
+    g_hash_table_replace(fswatch->pending, filename, NULL);
+    fswatch->last_event = dt_get_wtime();
+  }
+}
+
+// drops the files darktable wrote itself, if nobody touched them since. called with the mutex held.
+static GList *_fswatch_filter_written(dt_fswatch_t *fswatch, GList *files)
+{
+  GList *l = files;
+  while(l)
+  {
+    GList *next = g_list_next(l);
+    const _written_t *w = g_hash_table_lookup(fswatch->written, l->data);
+    if(w)
+    {
+      struct stat st;
+      const int own = !stat((const char *)l->data, &st) && st.st_mtime == w->mtime && st.st_size == w->size;
+      g_hash_table_remove(fswatch->written, l->data);
+      if(own)
+      {
+        g_free(l->data);
+        files = g_list_delete_link(files, l);
+      }
+    }
+    l = next;
+  }
+  return files;
+}
 
 static void *_fswatch_thread(void *data)
 {
   dt_fswatch_t *fswatch=(dt_fswatch_t *)data;
-  uint32_t res=0;
-  uint32_t event_hdr_size=sizeof(inotify_event_t);
-  inotify_event_t *event_hdr=g_malloc(sizeof(inotify_event_t));
-  memset (event_hdr,0,event_hdr_size);
-  char *name=g_malloc(2048);
-  memset (name,0, 2048);
+  // several events with their names fit in, they are read as a whole or not at all
+  char buf[16*(sizeof(struct inotify_event) + NAME_MAX + 1)]
+  __attribute__((aligned(__alignof__(struct inotify_event))));
+  struct pollfd pfd = { .fd = fswatch->inotify_fd, .events = POLLIN };
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Starting thread of context %lx\n",(unsigned long int)data);
-  while(1)
+  while(!fswatch->quit)
   {
-    // Blocking read loop of event fd into event
-    if(read(fswatch->inotify_fd,event_hdr,event_hdr_size) != event_hdr_size)
+    // wake up now and then to check for quit and for batches which are due
+    const int ready = poll(&pfd, 1, 250);
+    if(ready < 0)
     {
       if(errno == EINTR) continue;
-      perror("[fswatch_thread] read inotify fd");
+      perror("[fswatch_thread] poll inotify fd");
       break;
     }
-
-    // Read name into buffer if any...
-    if( event_hdr->len > 0 )
-    {
-      res=read(fswatch->inotify_fd,name,event_hdr_size);
-      name[res]='\0';
-    }
-
-    dt_pthread_mutex_lock(&fswatch->mutex);
-    GList *gitem=g_list_find_custom(fswatch->items,&event_hdr->wd,&_fswatch_items_by_descriptor);
-    if( gitem )
+    if(ready > 0 && (pfd.revents & POLLIN))
     {
-      _watch_t *item = gitem->data;
-      item->events=item->events|event_hdr->mask;
-
-      switch( item->type )
+      const ssize_t len = read(fswatch->inotify_fd, buf, sizeof(buf));
+      if(len <= 0)
       {
-        case DT_FSWATCH_IMAGE:
-        {
-          if( (event_hdr->mask&IN_CLOSE) && (item->events&IN_MODIFY) ) // Check if file modified and closed...
-          {
-            //  Something wrote on image externally and closed it, lets tag item as dirty...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
-          else if( (event_hdr->mask&IN_ATTRIB) && (item->events&IN_DELETE_SELF) && (item->events&IN_IGNORED))
-          {
-            // This pattern showed up when another file is replacing the original...
-            dt_image_t *img=(dt_image_t *)item->data;
-            img->force_reimport = 1;
-            if(darktable.develop->image==img)
-              dt_dev_raw_reload(darktable.develop);
-            item->events=0;
-          }
-        }
+        if(len < 0 && (errno == EINTR || errno == EAGAIN)) continue;
+        perror("[fswatch_thread] read inotify fd");
         break;
-
-        default:
-          dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Unhandled object type %d for event descriptor %ld\n", item->type, event_hdr->wd );
-          break;
       }
+      dt_pthread_mutex_lock(&fswatch->mutex);
+      for(const char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((const struct inotify_event *)p)->len)
+        _fswatch_event(fswatch, (const struct inotify_event *)p);
+      dt_pthread_mutex_unlock(&fswatch->mutex);
     }
-    else
-      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] Failed to found watch item for descriptor %ld\n", event_hdr->wd );
 
+    GList *files = NULL;
+    dt_pthread_mutex_lock(&fswatch->mutex);
+    if(g_hash_table_size(fswatch->pending) > 0 && dt_get_wtime() - fswatch->last_event > DT_FSWATCH_QUIET_PERIOD)
+    {
+      // take over the paths, the table doesn't free them anymore
+      files = g_hash_table_get_keys(fswatch->pending);
+      g_hash_table_steal_all(fswatch->pending);
+      files = _fswatch_filter_written(fswatch, files);
+    }
     dt_pthread_mutex_unlock(&fswatch->mutex);
+
+    if(files)
+    {
+      dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] handing over %d files\n", g_list_length(files));
+      dt_job_t j;
+      dt_film_import_files_init(&j, files);
+      if(dt_control_add_job(darktable.control, &j))
+        g_list_free_full(files, g_free);
+    }
   }
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_thread] terminating.\n");
-  g_free(event_hdr);
-  g_free(name);
   return NULL;
 }
 
@@ -152,12 +211,16 @@ const dt_fswatch_t* dt_fswatch_new()
 {
   dt_fswatch_t *fswatch=g_malloc(sizeof(dt_fswatch_t));
   memset (fswatch, 0, sizeof(dt_fswatch_t));
-  if((fswatch->inotify_fd=inotify_init())==-1)
+  const int fd = inotify_init();
+  if(fd == -1)
   {
     g_free(fswatch);
     return NULL;
   }
+  fswatch->inotify_fd=fd;
   fswatch->items=NULL;
+  fswatch->pending=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+  fswatch->written=g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
   dt_pthread_mutex_init(&fswatch->mutex, NULL);
   pthread_create(&fswatch->thread, NULL, &_fswatch_thread, fswatch);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_new] Creating new context %lx\n",(unsigned long int)fswatch);
@@ -167,12 +230,20 @@ const dt_fswatch_t* dt_fswatch_new()
 
 void dt_fswatch_destroy(const dt_fswatch_t *fswatch)
 {
+  if(!fswatch) return;
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_destroy] Destroying context %lx\n",(unsigned long int)fswatch);
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  // files still pending are picked up by the next full import of their film roll
+  ctx->quit = 1;
+  pthread_join(ctx->thread, NULL);
+  close(ctx->inotify_fd);
   dt_pthread_mutex_destroy(&ctx->mutex);
+  g_hash_table_destroy(ctx->pending);
+  g_hash_table_destroy(ctx->written);
   GList *item=g_list_first(fswatch->items);
   while(item)
   {
+    g_free( ((_watch_t *)item->data)->path );
     g_free( item->data );
     item=g_list_next(item);
   }
@@ -182,6 +253,7 @@ void dt_fswatch_destroy(const dt_fswatch_t *fswatch)
 
 void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *data)
 {
+  if(!fswatch) return;
   char filename[DT_MAX_PATH_LEN];
   uint32_t mask=0;
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
@@ -190,43 +262,74 @@ void dt_fswatch_add(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *d
   switch(type)
   {
     case DT_FSWATCH_IMAGE:
-      mask=IN_ALL_EVENTS;
-      dt_image_full_path(((dt_image_t *)data)->id, filename, DT_MAX_PATH_LEN);
+    {
+      gboolean from_cache = FALSE;
+      mask=IN_CLOSE_WRITE;
+      dt_image_full_path(((dt_image_t *)data)->id, filename, DT_MAX_PATH_LEN, &from_cache);
       break;
+    }
     case DT_FSWATCH_CURVE_DIRECTORY:
       break;
+    case DT_FSWATCH_FILMROLL_DIRECTORY:
+    {
+      sqlite3_stmt *stmt;
+      mask=IN_CLOSE_WRITE|IN_MOVED_TO|IN_ONLYDIR;
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "select folder from film_rolls where id = ?1", -1, &stmt, NULL);
+      DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, GPOINTER_TO_INT(data));
+      if(sqlite3_step(stmt) == SQLITE_ROW)
+        g_strlcpy(filename, (const char *)sqlite3_column_text(stmt, 0), DT_MAX_PATH_LEN);
+      sqlite3_finalize(stmt);
+      break;
+    }
     default:
       dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Unhandled object type %d\n",type);
       break;
   }
 
-  if(filename[0] != '\0')
+  if(filename[0] == '\0')
   {
-    dt_pthread_mutex_lock(&ctx->mutex);
-    _watch_t *item = g_malloc(sizeof(_watch_t));
-    item->type=type;
-    item->data=data;
-    ctx->items=g_list_append(fswatch->items, item);
-    item->descriptor=inotify_add_watch(fswatch->inotify_fd,filename,mask);
-    dt_pthread_mutex_unlock(&ctx->mutex);
-    dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Watch on object %lx added on file %s\n",(unsigned long int)data,filename);
-  }
-  else
     dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] No watch added, failed to get related filename of object type %d\n",type);
+    return;
+  }
 
+  dt_pthread_mutex_lock(&ctx->mutex);
+  if(_fswatch_find(ctx, type, data))
+  {
+    dt_pthread_mutex_unlock(&ctx->mutex);
+    return;
+  }
+  const int descriptor=inotify_add_watch(fswatch->inotify_fd,filename,mask);
+  if(descriptor == -1)
+  {
+    // folder on a disk which isn't mounted, or out of watches (fs.inotify.max_user_watches)
+    dt_pthread_mutex_unlock(&ctx->mutex);
+    dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Failed to watch %s: %s\n",filename,strerror(errno));
+    return;
+  }
+  _watch_t *item = g_malloc(sizeof(_watch_t));
+  item->type=type;
+  item->data=data;
+  item->path=g_strdup(filename);
+  item->descriptor=descriptor;
+  ctx->items=g_list_append(fswatch->items, item);
+  dt_pthread_mutex_unlock(&ctx->mutex);
+  dt_print(DT_DEBUG_FSWATCH,"[fswatch_add] Watch on object %lx added on file %s\n",(unsigned long int)data,filename);
 }
 
 void dt_fswatch_remove(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void *data)
 {
+  if(!fswatch) return;
   dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
   dt_pthread_mutex_lock(&ctx->mutex);
   dt_print(DT_DEBUG_FSWATCH,"[fswatch_remove] removing watch on object %lx\n",(unsigned long int)data);
-  GList *gitem=g_list_find_custom(fswatch->items,data,&_fswatch_items_by_data);
+  GList *gitem=_fswatch_find(ctx,type,data);
   if( gitem )
   {
     _watch_t *item=gitem->data;
     ctx->items=g_list_remove(ctx->items,item);
     inotify_rm_watch(fswatch->inotify_fd,item->descriptor);
+    g_free(item->path);
     g_free(item);
   }
   else
@@ -235,6 +338,21 @@ void dt_fswatch_remove(const dt_fswatch_t * fswatch,dt_fswatch_type_t type, void
   dt_pthread_mutex_unlock(&ctx->mutex);
 }
 
+void dt_fswatch_written(const dt_fswatch_t *fswatch, const char *filename)
+{
+  struct stat st;
+  if(!fswatch || stat(filename, &st)) return;
+  dt_fswatch_t *ctx=(dt_fswatch_t *)fswatch;
+  _written_t *w = g_malloc(sizeof(_written_t));
+  w->mtime = st.st_mtime;
+  w->size = st.st_size;
+  dt_pthread_mutex_lock(&ctx->mutex);
+  // only worth remembering if the folder is watched at all
+  if(ctx->items) g_hash_table_replace(ctx->written, g_strdup(filename), w);
+  else g_free(w);
+  dt_pthread_mutex_unlock(&ctx->mutex);
+}
+
 #else	// HAVE_INOTIFY
 const dt_fswatch_t* dt_fswatch_new()
 {
@@ -244,6 +362,7 @@ const dt_fswatch_t* dt_fswatch_new()
 void dt_fswatch_destroy(const dt_fswatch_t *fswatch) {}
 void dt_fswatch_add(const dt_fswatch_t *fswatch, dt_fswatch_type_t type, void *data) {}
 void dt_fswatch_remove(const dt_fswatch_t * fswatch, dt_fswatch_type_t type, void *data) {}
+void dt_fswatch_written(const dt_fswatch_t *fswatch, const char *filename) {}
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -29,6 +29,14 @@ typedef struct dt_fswatch_t
   dt_pthread_mutex_t mutex;
   pthread_t thread;
   GList *items;
+  /** files written in watched folders, waiting to be handed over as one batch. owns the paths. */
+  GHashTable *pending;
+  /** files darktable wrote itself (sidecars), with their modification time and size, so their events are dropped. */
+  GHashTable *written;
+  /** time of the last event, batches only go out after things calmed down. */
+  double last_event;
+  /** tells the thread to terminate. */
+  int quit;
 }
 dt_fswatch_t;
 
@@ -39,6 +47,8 @@ typedef enum dt_fswatch_type_t
   DT_FSWATCH_IMAGE = 0,
   /** watch is on directory for curves files << Just an test  */
   DT_FSWATCH_CURVE_DIRECTORY,
+  /** watch is on the folder of a film roll, data is GINT_TO_POINTER(film id) */
+  DT_FSWATCH_FILMROLL_DIRECTORY,
 }
 dt_fswatch_type_t;
 
@@ -50,6 +60,8 @@ void dt_fswatch_destroy(const dt_fswatch_t *fswatch);
 void dt_fswatch_add(const dt_fswatch_t *fswatch, dt_fswatch_type_t type, void *data);
 /** removes an watch of type and assigned data. */
 void dt_fswatch_remove(const dt_fswatch_t * fswatch, dt_fswatch_type_t type, void *data);
+/** tells the watch that darktable just wrote this file itself, and doesn't need to hear about it. */
+void dt_fswatch_written(const dt_fswatch_t *fswatch, const char *filename);
 
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -0,0 +1,284 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// bins to count per colorspace, bit k for channel k
+static inline int
+_histogram_channels(const dt_iop_colorspace_type_t cst)
+{
+  switch(cst)
+  {
+    case iop_cs_RAW: return 1;
+    case iop_cs_rgb: return 15;
+    case iop_cs_Lab:
+    default:         return 7;
+  }
+}
+
+// scale and offset mapping channel values to bins
+static inline void
+_histogram_scale(const dt_iop_colorspace_type_t cst, const uint32_t bins, float *mul, float *add)
+{
+  for(int c=0; c<4; c++)
+  {
+    mul[c] = bins;
+    add[c] = 0.0f;
+  }
+  if(cst == iop_cs_Lab)
+  {
+    mul[0] = bins/100.0f;
+    mul[1] = mul[2] = bins/256.0f;
+    add[1] = add[2] = 128.0f*bins/256.0f;
+  }
+}
+
+static inline void
+_histogram_bin_row(const float *in, const int width, const int subsample, const int channels,
+                   const __m128 mul, const __m128 add, const __m128 top, uint32_t *hist)
+{
+  const __m128 zero = _mm_setzero_ps();
+  for(int i=0; i<width; i+=subsample, in+=4*subsample)
+  {
+    __m128 p = _mm_loadu_ps(in);
+    if(channels & 8)
+    {
+      // put max(r,g,b) into the fourth lane
+      const float m = fmaxf(in[0], fmaxf(in[1], in[2]));
+      p = _mm_setr_ps(in[0], in[1], in[2], m);
+    }
+    // scale to bins, clamp (nan ends up in bin 0) and truncate:
+    const __m128 v = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(p, mul), add), zero), top);
+    int32_t b[4] __attribute__((aligned(16)));
+    _mm_store_si128((__m128i *)b, _mm_cvttps_epi32(v));
+    hist[4*b[0]] ++;
+    if(channels & 2) hist[4*b[1]+1] ++;
+    if(channels & 4) hist[4*b[2]+2] ++;
+    if(channels & 8) hist[4*b[3]+3] ++;
+  }
+}
+
+void
+dt_histogram_collect(const float *const pixel, const int width, const int height,
+                     const dt_iop_colorspace_type_t cst, const uint32_t bins, const int subsample,
+                     uint32_t *histogram)
+{
+  const int nthreads = dt_get_num_threads();
+  const int step = subsample > 0 ? subsample : 1;
+  const int channels = _histogram_channels(cst);
+  float m[4], a[4];
+  _histogram_scale(cst, bins, m, a);
+  const __m128 mul = _mm_loadu_ps(m);
+  const __m128 add = _mm_loadu_ps(a);
+  const __m128 top = _mm_set1_ps(bins - 1);
+
+  // one partial histogram per thread, merged below. no locks or atomics needed.
+  uint32_t *partial = calloc((size_t)nthreads*4*bins, sizeof(uint32_t));
+  if(!partial)
+  {
+    memset(histogram, 0, sizeof(uint32_t)*4*bins);
+    return;
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(partial)
+#endif
+  for(int j=0; j<height; j+=step)
+  {
+    uint32_t *hist = partial + (size_t)4*bins*dt_get_thread_num();
+    _histogram_bin_row(pixel + (size_t)4*width*j, width, step, channels, mul, add, top, hist);
+  }
+
+  memcpy(histogram, partial, sizeof(uint32_t)*4*bins);
+  for(int t=1; t<nthreads; t++)
+  {
+    const uint32_t *hist = partial + (size_t)4*bins*t;
+    for(uint32_t k=0; k<4*bins; k++) histogram[k] += hist[k];
+  }
+  free(partial);
+}
+
+void
+dt_histogram_collect_8(const uint8_t *const pixel, const int width, const int height,
+                       const uint32_t bins, const int subsample, uint32_t *histogram)
+{
+  const int nthreads = dt_get_num_threads();
+  const int step = subsample > 0 ? subsample : 1;
+  // 8-bit values map to bins through a table, no float math per pixel.
+  uint32_t lut[256];
+  for(int k=0; k<256; k++) lut[k] = MIN(bins - 1, (uint32_t)(k/255.0f * bins));
+
+  uint32_t *partial = calloc((size_t)nthreads*4*bins, sizeof(uint32_t));
+  if(!partial)
+  {
+    memset(histogram, 0, sizeof(uint32_t)*4*bins);
+    return;
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) shared(partial, lut)
+#endif
+  for(int j=0; j<height; j+=step)
+  {
+    uint32_t *hist = partial + (size_t)4*bins*dt_get_thread_num();
+    const uint8_t *in = pixel + (size_t)4*width*j;
+    for(int i=0; i<width; i+=step, in+=4*step)
+    {
+      const uint8_t v = MAX(in[0], MAX(in[1], in[2]));
+      hist[4*lut[in[0]]] ++;
+      hist[4*lut[in[1]]+1] ++;
+      hist[4*lut[in[2]]+2] ++;
+      hist[4*lut[v]+3] ++;
+    }
+  }
+
+  memcpy(histogram, partial, sizeof(uint32_t)*4*bins);
+  for(int t=1; t<nthreads; t++)
+  {
+    const uint32_t *hist = partial + (size_t)4*bins*t;
+    for(uint32_t k=0; k<4*bins; k++) histogram[k] += hist[k];
+  }
+  free(partial);
+}
+
+void
+dt_histogram_max(const uint32_t *const histogram, const uint32_t bins,
+                 const dt_iop_colorspace_type_t cst, uint32_t *histogram_max)
+{
+  histogram_max[0] = histogram_max[1] = histogram_max[2] = histogram_max[3] = 0;
+  switch(cst)
+  {
+    case iop_cs_RAW:
+      for(uint32_t k=0; k<4*bins; k+=4) histogram_max[0] = MAX(histogram_max[0], histogram[k]);
+      break;
+
+    case iop_cs_rgb:
+      // don't count <= 0 pixels
+      for(uint32_t k=4; k<4*bins; k+=4)
+        for(int c=0; c<4; c++) histogram_max[c] = MAX(histogram_max[c], histogram[k+c]);
+      break;
+
+    case iop_cs_Lab:
+    default:
+      // don't count <= 0 pixels in L
+      for(uint32_t k=4; k<4*bins; k+=4) histogram_max[0] = MAX(histogram_max[0], histogram[k]);
+      // don't count <= -128 and >= +128 pixels in a and b
+      for(uint32_t k=4; k<4*(bins-1); k+=4)
+      {
+        histogram_max[1] = MAX(histogram_max[1], histogram[k+1]);
+        histogram_max[2] = MAX(histogram_max[2], histogram[k+2]);
+      }
+      break;
+  }
+}
+
+int
+dt_histogram_write(const char *filename, const uint32_t *const histogram, const uint32_t bins,
+                   const dt_iop_colorspace_type_t cst)
+{
+  FILE *f = fopen(filename, "wb");
+  if(!f) return 1;
+  switch(cst)
+  {
+    case iop_cs_RAW: fprintf(f, "# bin raw\n"); break;
+    case iop_cs_rgb: fprintf(f, "# bin red green blue max\n"); break;
+    case iop_cs_Lab:
+    default:         fprintf(f, "# bin L a b\n"); break;
+  }
+  const int channels = _histogram_channels(cst);
+  for(uint32_t k=0; k<bins; k++)
+  {
+    fprintf(f, "%u", k);
+    for(int c=0; c<4; c++) if(channels & (1<<c)) fprintf(f, " %u", histogram[4*k+c]);
+    fprintf(f, "\n");
+  }
+  fclose(f);
+  return 0;
+}
+
+#ifdef HAVE_OPENCL
+dt_histogram_cl_global_t *
+dt_histogram_init_cl_global()
+{
+  dt_histogram_cl_global_t *g = (dt_histogram_cl_global_t *)malloc(sizeof(dt_histogram_cl_global_t));
+
+  const int program = 12;   // histogram.cl, from programs.conf
+  g->kernel_histogram_4c = dt_opencl_create_kernel(program, "histogram_4c");
+  return g;
+}
+
+void
+dt_histogram_free_cl_global(dt_histogram_cl_global_t *g)
+{
+  if(!g) return;
+  dt_opencl_free_kernel(g->kernel_histogram_4c);
+  free(g);
+}
+
+cl_int
+dt_histogram_collect_cl(const int devid, cl_mem img, const int width, const int height,
+                        const dt_iop_colorspace_type_t cst, const uint32_t bins, uint32_t *histogram)
+{
+  // counting relies on global atomics, some drivers get those wrong.
+  if(darktable.opencl->avoid_atomics || !darktable.opencl->histogram) return CL_INVALID_KERNEL;
+  const int kernel = darktable.opencl->histogram->kernel_histogram_4c;
+  if(kernel < 0) return CL_INVALID_KERNEL;
+
+  cl_int err = -999;
+  const size_t size = sizeof(uint32_t)*4*bins;
+  cl_mem dev_hist = dt_opencl_alloc_device_buffer(devid, size);
+  if(dev_hist == NULL) goto error;
+
+  memset(histogram, 0, size);
+  err = dt_opencl_write_buffer_to_device(devid, histogram, dev_hist, 0, size, CL_TRUE);
+  if(err != CL_SUCCESS) goto error;
+
+  float m[4], a[4];
+  _histogram_scale(cst, bins, m, a);
+  const int channels = _histogram_channels(cst);
+  const int nbins = bins;
+  size_t sizes[] = { ROUNDUPWD(width), ROUNDUPHT(height), 1 };
+  dt_opencl_set_kernel_arg(devid, kernel, 0, sizeof(cl_mem), (void *)&img);
+  dt_opencl_set_kernel_arg(devid, kernel, 1, sizeof(cl_mem), (void *)&dev_hist);
+  dt_opencl_set_kernel_arg(devid, kernel, 2, sizeof(int), (void *)&width);
+  dt_opencl_set_kernel_arg(devid, kernel, 3, sizeof(int), (void *)&height);
+  dt_opencl_set_kernel_arg(devid, kernel, 4, sizeof(int), (void *)&nbins);
+  dt_opencl_set_kernel_arg(devid, kernel, 5, sizeof(int), (void *)&channels);
+  dt_opencl_set_kernel_arg(devid, kernel, 6, 4*sizeof(float), (void *)m);
+  dt_opencl_set_kernel_arg(devid, kernel, 7, 4*sizeof(float), (void *)a);
+  err = dt_opencl_enqueue_kernel_2d(devid, kernel, sizes);
+  if(err != CL_SUCCESS) goto error;
+
+  err = dt_opencl_read_buffer_from_device(devid, histogram, dev_hist, 0, size, CL_TRUE);
+
+error:
+  if(dev_hist) dt_opencl_release_mem_object(dev_hist);
+  if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl_histogram] couldn't collect histogram: %d\n", err);
+  return err;
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,75 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_HISTOGRAM_H
+#define DT_COMMON_HISTOGRAM_H
+
+#include "common/opencl.h"
+#include "develop/imageop.h"
+
+#include <inttypes.h>
+
+/**
+ * histograms have 4 channels per bin, stored interleaved (4*bin + channel),
+ * same as module->histogram. which channels get filled depends on the colorspace:
+ *  raw: channel 0 only,
+ *  rgb: r, g, b and max(r, g, b),
+ *  Lab: L in [0,100], a and b in [-128,128].
+ * collection runs on all threads, each filling its own partial histogram,
+ * which are summed up at the end.
+ */
+
+/** collect a histogram of a 4 channel float buffer. histogram has to hold 4*bins counters
+    and is overwritten. subsample == 1 counts every pixel, n counts every n-th pixel
+    in both directions. */
+void dt_histogram_collect(const float *const pixel, const int width, const int height,
+                          const dt_iop_colorspace_type_t cst, const uint32_t bins, const int subsample,
+                          uint32_t *histogram);
+
+/** same for 8-bit rgb(a) buffers, as written by the 8-bit export path. */
+void dt_histogram_collect_8(const uint8_t *const pixel, const int width, const int height,
+                            const uint32_t bins, const int subsample, uint32_t *histogram);
+
+/** per channel maxima, ignoring the clipped bins like the gui always did
+    (everything <= 0, and for a/b also everything >= +128). */
+void dt_histogram_max(const uint32_t *const histogram, const uint32_t bins,
+                      const dt_iop_colorspace_type_t cst, uint32_t *histogram_max);
+
+/** write the histogram as plain text, one line per bin. returns non-zero on error. */
+int dt_histogram_write(const char *filename, const uint32_t *const histogram, const uint32_t bins,
+                       const dt_iop_colorspace_type_t cst);
+
+#ifdef HAVE_OPENCL
+typedef struct dt_histogram_cl_global_t
+{
+  int kernel_histogram_4c;
+}
+dt_histogram_cl_global_t;
+
+dt_histogram_cl_global_t *dt_histogram_init_cl_global(void);
+
+void dt_histogram_free_cl_global(dt_histogram_cl_global_t *g);
+
+/** collect the histogram on the device, only the bins are copied back to the host. */
+cl_int dt_histogram_collect_cl(const int devid, cl_mem img, const int width, const int height,
+                               const dt_iop_colorspace_type_t cst, const uint32_t bins, uint32_t *histogram);
+#endif
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -134,6 +134,48 @@ dt_history_load_and_apply_on_selection (gchar *filename)
   return res;
 }
 
+// append " and <column> in (val1, val2)" to restrict a query to the selected history items.
+static void
+_dt_history_append_ops(char *req, const char *column, GList *ops)
+{
+  if (!ops) return;
+  GList *l = ops;
+  int first = 1;
+  strcat (req, " and ");
+  strcat (req, column);
+  strcat (req, " in (");
+
+  while (l)
+  {
+    long unsigned int value = (long unsigned int)l->data;
+    char v[30];
+
+    if (!first) strcat (req, ",");
+    snprintf (v, 30, "%lu", value);
+    strcat (req, v);
+    first=0;
+    l = g_list_next(l);
+  }
+  strcat (req, ")");
+}
+
+// everything which has to follow a change of the history in the db.
+static void
+_dt_history_pasted(int32_t dest_imgid)
+{
+  /* if current image in develop reload history */
+  if (dt_dev_is_current_image(darktable.develop, dest_imgid))
+  {
+    dt_dev_reload_history_items (darktable.develop);
+    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
+  }
+
+  /* update xmp file */
+  dt_image_synch_xmp(dest_imgid);
+
+  dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+}
+
 int
 dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean merge, GList *ops)
 {
@@ -169,25 +211,7 @@ dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean
   strcpy (req, "insert into history (imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority) select ?1, num+?2, module, operation, op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority from history where imgid = ?3");
 
   //  Add ops selection if any format: ... and num in (val1, val2)
-  if (ops)
-  {
-    GList *l = ops;
-    int first = 1;
-    strcat (req, " and num in (");
-
-    while (l)
-    {
-      long unsigned int value = (long unsigned int)l->data;
-      char v[30];
-
-      if (!first) strcat (req, ",");
-      snprintf (v, 30, "%lu", value);
-      strcat (req, v);
-      first=0;
-      l = g_list_next(l);
-    }
-    strcat (req, ")");
-  }
+  _dt_history_append_ops(req, "num", ops);
 
   /* add the history items to stack offest */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
@@ -225,17 +249,7 @@ dt_history_copy_and_paste_on_image (int32_t imgid, int32_t dest_imgid, gboolean
   sqlite3_step (stmt);
   sqlite3_finalize (stmt);
 
-  /* if current image in develop reload history */
-  if (dt_dev_is_current_image(darktable.develop, dest_imgid))
-  {
-    dt_dev_reload_history_items (darktable.develop);
-    dt_dev_modulegroups_set(darktable.develop, dt_dev_modulegroups_get(darktable.develop));
-  }
-
-  /* update xmp file */
-  dt_image_synch_xmp(dest_imgid);
-
-  dt_mipmap_cache_remove(darktable.mipmap_cache, dest_imgid);
+  _dt_history_pasted(dest_imgid);
 
   return 0;
 }
@@ -305,27 +319,57 @@ dt_history_copy_and_paste_on_selection (int32_t imgid, gboolean merge, GList *op
 {
   if (imgid < 0) return 1;
 
-  int res=0;
+  GList *dest = NULL;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid != ?1", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images where imgid != ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  if (sqlite3_step(stmt) == SQLITE_ROW)
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+    dest = g_list_prepend(dest, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  if (!dest) return 1;
+
+  /* all images in one transaction */
+  dt_database_start_savepoint(darktable.db, "paste_history");
+
+  if (merge)
   {
-    do
-    {
-      /* get imgid of selected image */
-      int32_t dest_imgid = sqlite3_column_int (stmt, 0);
+    /* the offset into the history stack differs per image */
+    for (GList *l = dest; l; l = g_list_next(l))
+      dt_history_copy_and_paste_on_image(imgid, GPOINTER_TO_INT(l->data), merge, ops);
+  }
+  else
+  {
+    /* replace the history stacks of the whole selection at once */
+    char req[2048];
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid in (select imgid from selected_images where imgid != ?1)", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
 
-      /* paste history stack onto image id */
-      dt_history_copy_and_paste_on_image(imgid,dest_imgid,merge,ops);
+    strcpy (req, "insert into history (imgid, num, module, operation, op_params, enabled, blendop_params, blendop_version, multi_name, multi_priority) select s.imgid, h.num, h.module, h.operation, h.op_params, h.enabled, h.blendop_params, h.blendop_version, h.multi_name, h.multi_priority from history h, selected_images s where h.imgid = ?1 and s.imgid != ?1");
+    _dt_history_append_ops(req, "h.num", ops);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), req, -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
 
-    }
-    while (sqlite3_step (stmt) == SQLITE_ROW);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from mask where imgid in (select imgid from selected_images where imgid != ?1)", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
+
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert into mask (imgid, formid, form, name, version, points, points_count, source) select s.imgid, m.formid, m.form, m.name, m.version, m.points, m.points_count, m.source from mask m, selected_images s where m.imgid = ?1 and s.imgid != ?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step (stmt);
+    sqlite3_finalize (stmt);
+
+    for (GList *l = dest; l; l = g_list_next(l))
+      _dt_history_pasted(GPOINTER_TO_INT(l->data));
   }
-  else res = 1;
 
-  sqlite3_finalize(stmt);
-  return res;
+  dt_database_release_savepoint(darktable.db, "paste_history");
+  g_list_free(dest);
+  return 0;
 }
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -20,6 +20,7 @@
 #include "common/darktable.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/fswatch.h"
 #include "common/image.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
@@ -155,15 +156,15 @@ gboolean dt_image_safe_remove(const int32_t imgid)
 void dt_image_full_path(const int imgid, char *pathname, int len, gboolean *from_cache)
 {
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select folder || '/' || filename from images, film_rolls where "
-                              "images.film_id = film_rolls.id and images.id = ?1", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "select folder || '/' || filename from images, film_rolls where "
+                                   "images.film_id = film_rolls.id and images.id = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
     g_strlcpy(pathname, (char *)sqlite3_column_text(stmt, 0), len);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
   if (*from_cache && !g_file_test(pathname, G_FILE_TEST_EXISTS))
   {
@@ -178,9 +179,9 @@ static void _image_local_copy_full_path(const int imgid, char *pathname, int len
 {
   sqlite3_stmt *stmt;
   *pathname='\0';
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT folder || '/' || filename FROM images, film_rolls "
-                              "WHERE images.film_id = film_rolls.id AND images.id = ?1", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT folder || '/' || filename FROM images, film_rolls "
+                                   "WHERE images.film_id = film_rolls.id AND images.id = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -199,7 +200,7 @@ static void _image_local_copy_full_path(const int imgid, char *pathname, int len
 
     g_free(md5_filename);
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 }
 
 void dt_image_path_append_version(int imgid, char *pathname, const int len)
@@ -207,15 +208,14 @@ void dt_image_path_append_version(int imgid, char *pathname, const int len)
   // get duplicate suffix
   int version = 0;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select count(id) from images where filename in "
-                              "(select filename from images where id = ?1) and film_id in "
-                              "(select film_id from images where id = ?1) and id < ?1",
-                              -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "select count(id) from images where filename in "
+                                   "(select filename from images where id = ?1) and film_id in "
+                                   "(select film_id from images where id = ?1) and id < ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   if(sqlite3_step(stmt) == SQLITE_ROW)
     version = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   if(version != 0)
   {
     // add version information:
@@ -284,7 +284,7 @@ void dt_image_set_flip(const int32_t imgid, const int32_t orientation)
   sqlite3_finalize(stmt);
   dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
   // write that through to xmp:
-  dt_image_write_sidecar_file(imgid);
+  dt_image_cache_write_sidecar(darktable.image_cache, imgid);
 }
 
 void dt_image_flip(const int32_t imgid, const int32_t cw)
@@ -374,14 +374,7 @@ int32_t dt_image_duplicate(const int32_t imgid)
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "update tagxtag set count = count + 1 where "
-                                "(id1 in (select tagid from tagged_images where imgid = ?1)) or "
-                                "(id2 in (select tagid from tagged_images where imgid = ?1))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    dt_tag_update_pairs(newid, 1);
     if(darktable.gui && darktable.gui->grouping)
     {
       const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, newid);
@@ -417,14 +410,7 @@ void dt_image_remove(const int32_t imgid)
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   sqlite3_step(stmt);
   sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update tagxtag set count = count - 1 where "
-                              "(id2 in (select tagid from tagged_images where imgid = ?1)) or "
-                              "(id1 in (select tagid from tagged_images where imgid = ?1))",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_tag_update_pairs(imgid, -1);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "delete from tagged_images where imgid = ?1", -1, &stmt, NULL);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
@@ -458,8 +444,8 @@ int dt_image_altered(const uint32_t imgid)
 {
   int altered = 0;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "select operation from history where imgid = ?1", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "select operation from history where imgid = ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -475,7 +461,7 @@ int dt_image_altered(const uint32_t imgid)
     altered = 1;
     break;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   if(altered) return 1;
 
   return altered;
@@ -963,14 +949,7 @@ int32_t dt_image_copy(const int32_t imgid, const int32_t filmid)
         DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
         sqlite3_step(stmt);
         sqlite3_finalize(stmt);
-        DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                    "update tagxtag set count = count + 1 where "
-                                    "(id1 in (select tagid from tagged_images where imgid = ?1)) or "
-                                    "(id2 in (select tagid from tagged_images where imgid = ?1))",
-                                    -1, &stmt, NULL);
-        DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, newid);
-        sqlite3_step(stmt);
-        sqlite3_finalize(stmt);
+        dt_tag_update_pairs(newid, 1);
 
         // write xmp file
         dt_image_write_sidecar_file(newid);
@@ -1097,6 +1076,7 @@ void dt_image_write_sidecar_file(int imgid)
     char *c = filename + strlen(filename);
     sprintf(c, ".xmp");
     dt_exif_xmp_write(imgid, filename);
+    dt_fswatch_written(darktable.fswatch, filename);
   }
 }
 
@@ -1104,18 +1084,16 @@ void dt_image_synch_xmp(const int selected)
 {
   if(selected > 0)
   {
-    dt_image_write_sidecar_file(selected);
+    dt_image_cache_write_sidecar(darktable.image_cache, selected);
   }
   else if(dt_conf_get_bool("write_sidecar_files"))
   {
+    // the background writer fetches the image structs of a whole batch at once.
     sqlite3_stmt *stmt;
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "select imgid from selected_images", -1, &stmt, NULL);
     while(sqlite3_step(stmt) == SQLITE_ROW)
-    {
-      const int imgid = sqlite3_column_int(stmt, 0);
-      dt_image_write_sidecar_file(imgid);
-    }
+      dt_image_cache_write_sidecar(darktable.image_cache, sqlite3_column_int(stmt, 0));
     sqlite3_finalize(stmt);
   }
 }
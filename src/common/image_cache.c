@@ -21,11 +21,84 @@
 #include "common/exif.h"
 #include "common/image.h"
 #include "common/image_cache.h"
+#include "common/memory.h"
 #include "control/conf.h"
 #include "develop/develop.h"
 
 #include <sqlite3.h>
 
+#define DT_IMAGE_CACHE_COLUMNS "id, group_id, film_id, width, height, filename, maker, model, lens, exposure, aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, raw_parameters, longitude, latitude, color_matrix, colorspace"
+
+// longest id list bound into one prefetch query
+#define DT_IMAGE_CACHE_PREFETCH_BATCH 512
+
+static void *_image_cache_xmp_worker(void *data);
+
+// fill the image struct from a row of a DT_IMAGE_CACHE_COLUMNS select.
+static void
+_image_cache_fill(dt_image_t *img, sqlite3_stmt *stmt)
+{
+  char *str;
+  img->id      = sqlite3_column_int(stmt, 0);
+  img->group_id = sqlite3_column_int(stmt, 1);
+  img->film_id = sqlite3_column_int(stmt, 2);
+  img->width   = sqlite3_column_int(stmt, 3);
+  img->height  = sqlite3_column_int(stmt, 4);
+  img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0] =
+      img->exif_datetime_taken[0] = '\0';
+  str = (char *)sqlite3_column_text(stmt, 5);
+  if(str) g_strlcpy(img->filename,   str, 512);
+  str = (char *)sqlite3_column_text(stmt, 6);
+  if(str) g_strlcpy(img->exif_maker, str, 32);
+  str = (char *)sqlite3_column_text(stmt, 7);
+  if(str) g_strlcpy(img->exif_model, str, 32);
+  str = (char *)sqlite3_column_text(stmt, 8);
+  if(str) g_strlcpy(img->exif_lens,  str, 52);
+  img->exif_exposure = sqlite3_column_double(stmt, 9);
+  img->exif_aperture = sqlite3_column_double(stmt, 10);
+  img->exif_iso = sqlite3_column_double(stmt, 11);
+  img->exif_focal_length = sqlite3_column_double(stmt, 12);
+  str = (char *)sqlite3_column_text(stmt, 13);
+  if(str) g_strlcpy(img->exif_datetime_taken, str, 20);
+  img->flags = sqlite3_column_int(stmt, 14);
+  img->exif_crop = sqlite3_column_double(stmt, 15);
+  img->orientation = sqlite3_column_int(stmt, 16);
+  img->exif_focus_distance = sqlite3_column_double(stmt,17);
+  if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
+  uint32_t tmp = sqlite3_column_int(stmt, 18);
+  memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
+  if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
+    img->longitude = sqlite3_column_double(stmt, 19);
+  else
+    img->longitude = NAN;
+  if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
+    img->latitude = sqlite3_column_double(stmt, 20);
+  else
+    img->latitude = NAN;
+  const void *color_matrix = sqlite3_column_blob(stmt, 21);
+  if(color_matrix)
+    memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
+  else
+    img->d65_color_matrix[0] = NAN;
+  g_free(img->profile);
+  img->profile = NULL;
+  img->profile_size = 0;
+  img->colorspace = sqlite3_column_int(stmt, 22);
+
+  // buffer size?
+  if(img->flags & DT_IMAGE_LDR)
+    img->bpp = 4*sizeof(float);
+  else if(img->flags & DT_IMAGE_HDR)
+  {
+    if(img->flags & DT_IMAGE_RAW)
+      img->bpp = sizeof(float);
+    else
+      img->bpp = 4*sizeof(float);
+  }
+  else // raw
+    img->bpp = sizeof(uint16_t);
+}
+
 int32_t
 dt_image_cache_allocate(void *data, const uint32_t key, int32_t *cost, void **buf)
 {
@@ -35,78 +108,30 @@ dt_image_cache_allocate(void *data, const uint32_t key, int32_t *cost, void **bu
   *cost = sizeof(dt_image_t);
 
   dt_image_t *img = c->images + slot;
-  // load stuff from db and store in cache:
-  char *str;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id, group_id, film_id, width, height, filename, maker, model, lens, exposure, aperture, iso, focal_length, datetime_taken, flags, crop, orientation, focus_distance, raw_parameters, longitude, latitude, color_matrix, colorspace from images where id = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, key);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  dt_pthread_mutex_lock(&c->lock);
+  // maybe a bulk prefetch already brought this one in:
+  dt_image_t *staged = (dt_image_t *)g_hash_table_lookup(c->staged, GUINT_TO_POINTER(key));
+  if(staged)
   {
-    img->id      = sqlite3_column_int(stmt, 0);
-    img->group_id = sqlite3_column_int(stmt, 1);
-    img->film_id = sqlite3_column_int(stmt, 2);
-    img->width   = sqlite3_column_int(stmt, 3);
-    img->height  = sqlite3_column_int(stmt, 4);
-    img->filename[0] = img->exif_maker[0] = img->exif_model[0] = img->exif_lens[0] =
-        img->exif_datetime_taken[0] = '\0';
-    str = (char *)sqlite3_column_text(stmt, 5);
-    if(str) g_strlcpy(img->filename,   str, 512);
-    str = (char *)sqlite3_column_text(stmt, 6);
-    if(str) g_strlcpy(img->exif_maker, str, 32);
-    str = (char *)sqlite3_column_text(stmt, 7);
-    if(str) g_strlcpy(img->exif_model, str, 32);
-    str = (char *)sqlite3_column_text(stmt, 8);
-    if(str) g_strlcpy(img->exif_lens,  str, 52);
-    img->exif_exposure = sqlite3_column_double(stmt, 9);
-    img->exif_aperture = sqlite3_column_double(stmt, 10);
-    img->exif_iso = sqlite3_column_double(stmt, 11);
-    img->exif_focal_length = sqlite3_column_double(stmt, 12);
-    str = (char *)sqlite3_column_text(stmt, 13);
-    if(str) g_strlcpy(img->exif_datetime_taken, str, 20);
-    img->flags = sqlite3_column_int(stmt, 14);
-    img->exif_crop = sqlite3_column_double(stmt, 15);
-    img->orientation = sqlite3_column_int(stmt, 16);
-    img->exif_focus_distance = sqlite3_column_double(stmt,17);
-    if(img->exif_focus_distance >= 0 && img->orientation >= 0) img->exif_inited = 1;
-    uint32_t tmp = sqlite3_column_int(stmt, 18);
-    memcpy(&img->legacy_flip, &tmp, sizeof(dt_image_raw_parameters_t));
-    if(sqlite3_column_type(stmt, 19) == SQLITE_FLOAT)
-      img->longitude = sqlite3_column_double(stmt, 19);
-    else
-      img->longitude = NAN;
-    if(sqlite3_column_type(stmt, 20) == SQLITE_FLOAT)
-      img->latitude = sqlite3_column_double(stmt, 20);
-    else
-      img->latitude = NAN;
-    const void *color_matrix = sqlite3_column_blob(stmt, 21);
-    if(color_matrix)
-      memcpy(img->d65_color_matrix, color_matrix, sizeof(img->d65_color_matrix));
-    else
-      img->d65_color_matrix[0] = NAN;
     g_free(img->profile);
-    img->profile = NULL;
-    img->profile_size = 0;
-    img->colorspace = sqlite3_column_int(stmt, 22);
-
-    // buffer size?
-    if(img->flags & DT_IMAGE_LDR)
-      img->bpp = 4*sizeof(float);
-    else if(img->flags & DT_IMAGE_HDR)
-    {
-      if(img->flags & DT_IMAGE_RAW)
-        img->bpp = sizeof(float);
-      else
-        img->bpp = 4*sizeof(float);
-    }
-    else // raw
-      img->bpp = sizeof(uint16_t);
+    memcpy(img, staged, sizeof(dt_image_t));
+    g_hash_table_remove(c->staged, GUINT_TO_POINTER(key));
   }
   else
   {
-    img->id = -1;
-    fprintf(stderr, "[image_cache_allocate] failed to open image %d from database: %s\n", key, sqlite3_errmsg(dt_database_get(darktable.db)));
+    // load stuff from db and store in cache:
+    DT_DEBUG_SQLITE3_RESET(c->stmt);
+    DT_DEBUG_SQLITE3_BIND_INT(c->stmt, 1, key);
+    if(sqlite3_step(c->stmt) == SQLITE_ROW)
+      _image_cache_fill(img, c->stmt);
+    else
+    {
+      img->id = -1;
+      fprintf(stderr, "[image_cache_allocate] failed to open image %d from database: %s\n", key, sqlite3_errmsg(dt_database_get(darktable.db)));
+    }
+    DT_DEBUG_SQLITE3_RESET(c->stmt);
   }
-  sqlite3_finalize(stmt);
+  dt_pthread_mutex_unlock(&c->lock);
 
   *buf = c->images + slot;
   return 0; // no write lock required, we inited it all right here.
@@ -148,7 +173,35 @@ dt_image_cache_init(dt_image_cache_t *cache)
   num = dt_cache_capacity(&cache->cache);
   cache->images = dt_alloc_align(64, sizeof(dt_image_t)*num);
   memset(cache->images, 0, sizeof(dt_image_t)*num);
+  // allocated once and never shrinks, so it's only reported:
+  cache->memory = dt_memory_register(darktable.memory, "image structs", DT_MEMORY_RANK_IMAGE_STRUCTS, 1, NULL, NULL);
+  dt_memory_alloc(cache->memory, sizeof(dt_image_t)*num);
   dt_print(DT_DEBUG_CACHE, "[image_cache] has %d entries\n", num);
+
+  // cache misses all go through this one statement, instead of compiling the query every time.
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select " DT_IMAGE_CACHE_COLUMNS " from images where id = ?1", -1, &cache->stmt, NULL);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "update images set width = ?1, height = ?2, maker = ?3, model = ?4, "
+                              "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
+                              "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
+                              "crop = ?14, orientation = ?15, raw_parameters = ?16, group_id = ?17, longitude = ?18, "
+                              "latitude = ?19, color_matrix = ?20, colorspace = ?21 where id = ?22", -1, &cache->update_stmt, NULL);
+  cache->batch = 0;
+  cache->stats.writes = cache->stats.sidecars_requested = cache->stats.sidecars_queued = 0;
+  dt_pthread_mutex_init(&cache->lock, NULL);
+  cache->staged = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+
+  dt_pthread_mutex_init(&cache->xmp_lock, NULL);
+  pthread_cond_init(&cache->xmp_work, NULL);
+  pthread_cond_init(&cache->xmp_done, NULL);
+  cache->xmp_pending = g_hash_table_new(g_direct_hash, g_direct_equal);
+  cache->xmp_queue = g_queue_new();
+  cache->xmp_busy = 0;
+  cache->xmp_hold = 0;
+  cache->xmp_flush = 0;
+  cache->xmp_quit = 0;
+  pthread_create(&cache->xmp_thread, NULL, &_image_cache_xmp_worker, cache);
   // initialize first image as empty data:
   dt_image_init(cache->images);
   for(uint32_t k=1; k<num; k++)
@@ -161,8 +214,25 @@ dt_image_cache_init(dt_image_cache_t *cache)
 void
 dt_image_cache_cleanup(dt_image_cache_t *cache)
 {
+  // the worker writes everything still queued before it quits.
+  dt_pthread_mutex_lock(&cache->xmp_lock);
+  cache->xmp_quit = 1;
+  pthread_cond_broadcast(&cache->xmp_work);
+  dt_pthread_mutex_unlock(&cache->xmp_lock);
+  pthread_join(cache->xmp_thread, NULL);
+  g_queue_free(cache->xmp_queue);
+  g_hash_table_destroy(cache->xmp_pending);
+  pthread_cond_destroy(&cache->xmp_work);
+  pthread_cond_destroy(&cache->xmp_done);
+  dt_pthread_mutex_destroy(&cache->xmp_lock);
+
   dt_cache_cleanup(&cache->cache);
   free(cache->images);
+  dt_memory_unregister(darktable.memory, cache->memory);
+  sqlite3_finalize(cache->stmt);
+  sqlite3_finalize(cache->update_stmt);
+  g_hash_table_destroy(cache->staged);
+  dt_pthread_mutex_destroy(&cache->lock);
 }
 
 void dt_image_cache_print(dt_image_cache_t *cache)
@@ -172,13 +242,46 @@ void dt_image_cache_print(dt_image_cache_t *cache)
          (float)cache->cache.cost/(float)cache->cache.cost_quota);
 }
 
+// the thread with an open write batch owns the savepoints on the connection, and the
+// image loaders attach tags while they hold an image lock. so it must not wait for an
+// image lock with the batch open: commit what it has, wait, and open the batch again.
+// returns the number of savepoints to reopen, 0 if there was nothing to suspend.
+static int
+_image_cache_batch_suspend(
+  dt_image_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  const int batch = (cache->batch > 0 && pthread_equal(cache->batch_thread, pthread_self())) ? cache->batch : 0;
+  dt_pthread_mutex_unlock(&cache->lock);
+  // savepoints opened inside the batch are not ours to release, those have to wait with us.
+  if(batch == 0 || dt_database_get_savepoint_depth(darktable.db) != batch) return 0;
+  for(int k=0; k<batch; k++)
+    dt_database_release_savepoint(darktable.db, "image_cache");
+  return batch;
+}
+
+static void
+_image_cache_batch_resume(
+  const int batch)
+{
+  for(int k=0; k<batch; k++)
+    dt_database_start_savepoint(darktable.db, "image_cache");
+}
+
 const dt_image_t*
 dt_image_cache_read_get(
   dt_image_cache_t *cache,
   const uint32_t imgid)
 {
   if(imgid <= 0) return NULL;
-  return (const dt_image_t *)dt_cache_read_get(&cache->cache, imgid);
+  if(dt_database_get_savepoint_depth(darktable.db) == 0)
+    return (const dt_image_t *)dt_cache_read_get(&cache->cache, imgid);
+  const dt_image_t *img = (const dt_image_t *)dt_cache_read_tryget(&cache->cache, imgid);
+  if(img) return img;
+  const int batch = _image_cache_batch_suspend(cache);
+  img = (const dt_image_t *)dt_cache_read_get(&cache->cache, imgid);
+  _image_cache_batch_resume(batch);
+  return img;
 }
 
 const dt_image_t*
@@ -211,7 +314,14 @@ dt_image_cache_write_get(
 {
   if(!img) return NULL;
   // just force the dt_image_t struct to make sure it has been locked for reading before.
-  return (dt_image_t *)dt_cache_write_get(&cache->cache, img->id);
+  if(dt_database_get_savepoint_depth(darktable.db) == 0)
+    return (dt_image_t *)dt_cache_write_get(&cache->cache, img->id);
+  dt_image_t *wimg = (dt_image_t *)dt_cache_write_tryget(&cache->cache, img->id);
+  if(wimg) return wimg;
+  const int batch = _image_cache_batch_suspend(cache);
+  wimg = (dt_image_t *)dt_cache_write_get(&cache->cache, img->id);
+  _image_cache_batch_resume(batch);
+  return wimg;
 }
 
 
@@ -225,13 +335,9 @@ dt_image_cache_write_release(
   dt_image_cache_write_mode_t mode)
 {
   if(img->id <= 0) return;
-  sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "update images set width = ?1, height = ?2, maker = ?3, model = ?4, "
-                              "lens = ?5, exposure = ?6, aperture = ?7, iso = ?8, focal_length = ?9, "
-                              "focus_distance = ?10, film_id = ?11, datetime_taken = ?12, flags = ?13, "
-                              "crop = ?14, orientation = ?15, raw_parameters = ?16, group_id = ?17, longitude = ?18, "
-                              "latitude = ?19, color_matrix = ?20, colorspace = ?21 where id = ?22", -1, &stmt, NULL);
+  dt_pthread_mutex_lock(&cache->lock);
+  sqlite3_stmt *stmt = cache->update_stmt;
+  DT_DEBUG_SQLITE3_RESET(stmt);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, img->width);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, img->height);
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 3, img->exif_maker, strlen(img->exif_maker), SQLITE_STATIC);
@@ -256,14 +362,18 @@ dt_image_cache_write_release(
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 22, img->id);
   int rc = sqlite3_step(stmt);
   if (rc != SQLITE_DONE) fprintf(stderr, "[image_cache_write_release] sqlite3 error %d\n", rc);
-  sqlite3_finalize(stmt);
+  // the text and blob bindings point into img:
+  DT_DEBUG_SQLITE3_RESET(stmt);
+  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(stmt);
+  cache->stats.writes++;
+  dt_pthread_mutex_unlock(&cache->lock);
 
   // TODO: make this work in relaxed mode, too.
   if(mode == DT_IMAGE_CACHE_SAFE)
   {
     // rest about sidecars:
-    // also synch dttags file:
-    dt_image_write_sidecar_file(img->id);
+    // also synch dttags file, but leave that to the background writer:
+    dt_image_cache_write_sidecar(cache, img->id);
   }
   dt_cache_write_release(&cache->cache, img->id);
 }
@@ -275,10 +385,230 @@ dt_image_cache_remove(
   dt_image_cache_t *cache,
   const uint32_t imgid)
 {
+  // there's no point in writing a sidecar for an image which is going away.
+  dt_pthread_mutex_lock(&cache->xmp_lock);
+  g_hash_table_remove(cache->xmp_pending, GUINT_TO_POINTER(imgid));
+  dt_pthread_mutex_unlock(&cache->xmp_lock);
   dt_cache_remove(&cache->cache, imgid);
 }
 
+void
+dt_image_cache_write_batch_begin(
+  dt_image_cache_t *cache)
+{
+  // may wait for another thread's savepoints, which might need the lock in write_release:
+  dt_database_start_savepoint(darktable.db, "image_cache");
+  dt_pthread_mutex_lock(&cache->lock);
+  if(cache->batch++ == 0)
+  {
+    // only one thread can have a batch open, the others wait for its savepoint above.
+    cache->batch_thread = pthread_self();
+    dt_pthread_mutex_lock(&cache->xmp_lock);
+    cache->xmp_hold = 1;
+    dt_pthread_mutex_unlock(&cache->xmp_lock);
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+void
+dt_image_cache_write_batch_end(
+  dt_image_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  dt_database_release_savepoint(darktable.db, "image_cache");
+  if(--cache->batch == 0)
+  {
+    // committed, let the sidecars go:
+    dt_pthread_mutex_lock(&cache->xmp_lock);
+    cache->xmp_hold = 0;
+    pthread_cond_signal(&cache->xmp_work);
+    dt_pthread_mutex_unlock(&cache->xmp_lock);
+  }
+  dt_pthread_mutex_unlock(&cache->lock);
+}
+
+void
+dt_image_cache_write_sidecar(
+  dt_image_cache_t *cache,
+  const uint32_t imgid)
+{
+  if(imgid <= 0 || !dt_conf_get_bool("write_sidecar_files")) return;
+  dt_pthread_mutex_lock(&cache->xmp_lock);
+  cache->stats.sidecars_requested++;
+  if(!g_hash_table_lookup(cache->xmp_pending, GUINT_TO_POINTER(imgid)))
+  {
+    g_hash_table_insert(cache->xmp_pending, GUINT_TO_POINTER(imgid), GINT_TO_POINTER(1));
+    g_queue_push_tail(cache->xmp_queue, GUINT_TO_POINTER(imgid));
+    cache->stats.sidecars_queued++;
+    pthread_cond_signal(&cache->xmp_work);
+  }
+  dt_pthread_mutex_unlock(&cache->xmp_lock);
+}
+
+void
+dt_image_cache_flush(
+  dt_image_cache_t *cache)
+{
+  dt_pthread_mutex_lock(&cache->xmp_lock);
+  // don't wait for the end of a batch, which might be opened by this very thread.
+  cache->xmp_flush++;
+  pthread_cond_signal(&cache->xmp_work);
+  while(g_hash_table_size(cache->xmp_pending) || cache->xmp_busy)
+    dt_pthread_cond_wait(&cache->xmp_done, &cache->xmp_lock);
+  cache->xmp_flush--;
+  dt_pthread_mutex_unlock(&cache->xmp_lock);
+}
+
+void
+dt_image_cache_get_stats(
+  dt_image_cache_t *cache,
+  dt_image_cache_stats_t *stats)
+{
+  dt_pthread_mutex_lock(&cache->lock);
+  stats->writes = cache->stats.writes;
+  dt_pthread_mutex_unlock(&cache->lock);
+  dt_pthread_mutex_lock(&cache->xmp_lock);
+  stats->sidecars_requested = cache->stats.sidecars_requested;
+  stats->sidecars_queued = cache->stats.sidecars_queued;
+  dt_pthread_mutex_unlock(&cache->xmp_lock);
+}
+
+static void *
+_image_cache_xmp_worker(void *data)
+{
+  dt_image_cache_t *cache = (dt_image_cache_t *)data;
+  dt_pthread_mutex_lock(&cache->xmp_lock);
+  while(1)
+  {
+    while((g_queue_is_empty(cache->xmp_queue) || (cache->xmp_hold && !cache->xmp_flush)) && !cache->xmp_quit)
+      dt_pthread_cond_wait(&cache->xmp_work, &cache->xmp_lock);
+    if(g_queue_is_empty(cache->xmp_queue)) break; // quit, and nothing left to do
 
+    // take everything queued so far. images removed in the meantime aren't pending any more.
+    const int max = g_queue_get_length(cache->xmp_queue);
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t)*2*max);
+    int num = 0;
+    while(!g_queue_is_empty(cache->xmp_queue))
+    {
+      const uint32_t imgid = GPOINTER_TO_UINT(g_queue_pop_head(cache->xmp_queue));
+      if(g_hash_table_remove(cache->xmp_pending, GUINT_TO_POINTER(imgid)) && ids)
+        ids[num++] = imgid;
+    }
+    cache->xmp_busy = 1;
+    dt_pthread_mutex_unlock(&cache->xmp_lock);
+
+    if(ids)
+    {
+      // one query for all the image structs, instead of one per sidecar:
+      uint32_t *loaded = ids + max;
+      const int num_loaded = dt_image_cache_prefetch(cache, ids, num, loaded);
+      for(int k=0; k<num; k++)
+        dt_image_write_sidecar_file(ids[k]);
+      dt_image_cache_prefetch_drop(cache, loaded, num_loaded);
+      dt_print(DT_DEBUG_CACHE, "[image_cache] wrote %d xmp sidecars\n", num);
+      free(ids);
+    }
+
+    dt_pthread_mutex_lock(&cache->xmp_lock);
+    cache->xmp_busy = 0;
+    pthread_cond_broadcast(&cache->xmp_done);
+  }
+  pthread_cond_broadcast(&cache->xmp_done);
+  dt_pthread_mutex_unlock(&cache->xmp_lock);
+  return NULL;
+}
+
+// number of image structs which still fit into the cache before the
+// garbage collector would start to evict entries.
+static int
+_image_cache_room(dt_image_cache_t *cache)
+{
+  const float room = 0.8f*cache->cache.cost_quota - (float)cache->cache.cost;
+  return MAX(0, (int)(room/sizeof(dt_image_t)));
+}
+
+// stage all rows of the statement which are not in the cache yet, and move them
+// into the cache. returns the number of new entries, the ids go to loaded.
+static int
+_image_cache_prefetch_stmt(dt_image_cache_t *cache, sqlite3_stmt *stmt, const int max, uint32_t *loaded)
+{
+  uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t)*MAX(1, max));
+  if(!ids) return 0;
+  int cnt = 0;
+  while(cnt < max && sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    const uint32_t id = sqlite3_column_int(stmt, 0);
+    if(dt_cache_contains(&cache->cache, id)) continue;
+    dt_image_t *img = (dt_image_t *)g_malloc(sizeof(dt_image_t));
+    dt_image_init(img);
+    _image_cache_fill(img, stmt);
+    dt_pthread_mutex_lock(&cache->lock);
+    g_hash_table_insert(cache->staged, GUINT_TO_POINTER(id), img);
+    dt_pthread_mutex_unlock(&cache->lock);
+    ids[cnt++] = id;
+  }
+
+  // the allocate callback picks the staged structs up, no sql involved any more.
+  int num = 0;
+  for(int k=0; k<cnt; k++)
+  {
+    if(dt_cache_contains(&cache->cache, ids[k])) continue;
+    const dt_image_t *img = (const dt_image_t *)dt_cache_read_get(&cache->cache, ids[k]);
+    if(!img) continue;
+    dt_cache_read_release(&cache->cache, ids[k]);
+    if(loaded) loaded[num] = ids[k];
+    num++;
+  }
+
+  // another thread might have loaded some of them in the meantime, drop the leftovers:
+  dt_pthread_mutex_lock(&cache->lock);
+  for(int k=0; k<cnt; k++)
+    g_hash_table_remove(cache->staged, GUINT_TO_POINTER(ids[k]));
+  dt_pthread_mutex_unlock(&cache->lock);
+  free(ids);
+  return num;
+}
+
+int
+dt_image_cache_prefetch(
+  dt_image_cache_t *cache,
+  const uint32_t *imgids,
+  const int num,
+  uint32_t *loaded)
+{
+  int room = _image_cache_room(cache);
+  int cnt = 0;
+  for(int k=0; k<num && room > 0; k+=DT_IMAGE_CACHE_PREFETCH_BATCH)
+  {
+    const int batch = MIN(num - k, DT_IMAGE_CACHE_PREFETCH_BATCH);
+    GString *query = g_string_sized_new(64 + 12*batch);
+    g_string_append(query, "select " DT_IMAGE_CACHE_COLUMNS " from images where id in (");
+    for(int i=0; i<batch; i++)
+      g_string_append_printf(query, i ? ",%u" : "%u", imgids[k+i]);
+    g_string_append(query, ")");
+
+    sqlite3_stmt *stmt;
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query->str, -1, &stmt, NULL);
+    const int new_entries = _image_cache_prefetch_stmt(cache, stmt, room, loaded ? loaded + cnt : NULL);
+    sqlite3_finalize(stmt);
+    g_string_free(query, TRUE);
+    cnt += new_entries;
+    room -= new_entries;
+  }
+  dt_print(DT_DEBUG_CACHE, "[image_cache] prefetched %d of %d image structs\n", cnt, num);
+  return cnt;
+}
+
+void
+dt_image_cache_prefetch_drop(
+  dt_image_cache_t *cache,
+  const uint32_t *imgids,
+  const int num)
+{
+  // entries still locked by someone are kept, dt_cache_remove() skips them.
+  for(int k=0; k<num; k++)
+    dt_cache_remove(&cache->cache, imgids[k]);
+}
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -19,13 +19,59 @@
 #define DT_IMAGE_CACHE_H
 
 #include "common/cache.h"
+#include "common/dtpthread.h"
 #include "common/image.h"
 
+#include <glib.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+// running totals, to tell what batching saved.
+typedef struct dt_image_cache_stats_t
+{
+  // write_release calls, each one is an sql update.
+  int64_t writes;
+  // sidecar writes asked for, and how many of them actually got queued.
+  int64_t sidecars_requested;
+  int64_t sidecars_queued;
+}
+dt_image_cache_stats_t;
+
 typedef struct dt_image_cache_t
 {
   // one fat block of dt_image_t, to assign `dynamic' void* in cache to.
   dt_image_t *images;
   dt_cache_t cache;
+  // reused for every single cache miss, protected by lock.
+  sqlite3_stmt *stmt;
+  dt_pthread_mutex_t lock;
+  // image structs loaded by a bulk prefetch, waiting for the allocate callback.
+  GHashTable *staged;
+  // the fat block, as seen by the memory governor.
+  struct dt_memory_client_t *memory;
+  // write_release runs this for every write lock, protected by lock.
+  sqlite3_stmt *update_stmt;
+  // nesting depth of dt_image_cache_write_batch_begin() and the thread which
+  // opened the batch, protected by lock.
+  int batch;
+  pthread_t batch_thread;
+  // writes counted under lock, sidecars under xmp_lock.
+  dt_image_cache_stats_t stats;
+
+  // write-behind queue for xmp sidecars. every image is queued at most once,
+  // no matter how often it changes before the worker gets to it.
+  dt_pthread_mutex_t xmp_lock;
+  pthread_cond_t xmp_work, xmp_done;
+  GHashTable *xmp_pending;
+  GQueue *xmp_queue;
+  // the worker is writing a batch right now
+  int xmp_busy;
+  // set while a write batch is open: the sidecars wait until it is committed.
+  int xmp_hold;
+  // threads waiting in dt_image_cache_flush(), they override the hold.
+  int xmp_flush;
+  int xmp_quit;
+  pthread_t xmp_thread;
 }
 dt_image_cache_t;
 
@@ -33,7 +79,8 @@ dt_image_cache_t;
 // released after writing.
 typedef enum dt_image_cache_write_mode_t
 {
-  // always write to database and xmp
+  // always write to database and xmp. the database is written right away,
+  // the xmp sidecar shortly after by a background thread.
   DT_IMAGE_CACHE_SAFE = 0,
   // only write to db and do xmp only during shutdown
   DT_IMAGE_CACHE_RELAXED = 1
@@ -79,19 +126,74 @@ dt_image_cache_write_get(
 
 // drops the write privileges on an image struct.
 // this triggers a write-through to sql, and if the setting
-// is present, also to xmp sidecar files (safe setting).
+// is present, queues the xmp sidecar file for writing (safe setting).
 void
 dt_image_cache_write_release(
   dt_image_cache_t *cache,
   dt_image_t *img,
   dt_image_cache_write_mode_t mode);
 
+// put the sql updates of all write_release calls up to the matching
+// batch_end into one transaction, instead of committing each single one.
+// meant for loops over many images. may be nested, also in other savepoints.
+// the batch owns the savepoints on the connection: other threads opening a batch
+// or a savepoint wait until the outermost batch_end. it is committed early when
+// the owning thread has to wait for the lock on an image.
+// the xmp sidecars are held back until the outermost batch_end, so they
+// are written from the committed state, and each image only once.
+void
+dt_image_cache_write_batch_begin(
+  dt_image_cache_t *cache);
+
+void
+dt_image_cache_write_batch_end(
+  dt_image_cache_t *cache);
+
+// queue the xmp sidecar of this image for the background writer.
+// several requests for the same image before it gets written result in one write.
+void
+dt_image_cache_write_sidecar(
+  dt_image_cache_t *cache,
+  const uint32_t imgid);
+
+// blocks until all queued xmp sidecars are on disk.
+void
+dt_image_cache_flush(
+  dt_image_cache_t *cache);
+
+// copy of the running totals.
+void
+dt_image_cache_get_stats(
+  dt_image_cache_t *cache,
+  dt_image_cache_stats_t *stats);
+
 // remove the image from the cache
 void
 dt_image_cache_remove(
   dt_image_cache_t *cache,
   const uint32_t imgid);
 
+// loads the image structs of all these ids which are not cached yet,
+// using one query per few hundred ids instead of one per image.
+// this never evicts other entries: it stops when the cache is about to
+// run the garbage collector. the ids of the newly inserted entries are
+// written to loaded (if not NULL, needs room for num ids), returns how many.
+int
+dt_image_cache_prefetch(
+  dt_image_cache_t *cache,
+  const uint32_t *imgids,
+  const int num,
+  uint32_t *loaded);
+
+// removes entries again which a prefetch loaded only for a one-off sweep
+// over many images, so the sweep doesn't push out the working set.
+// entries which are currently locked stay in the cache.
+void
+dt_image_cache_prefetch_drop(
+  dt_image_cache_t *cache,
+  const uint32_t *imgids,
+  const int num);
+
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -23,6 +23,7 @@
 #include "common/colorlabels.h"
 #include "common/debug.h"
 #include "common/exif.h"
+#include "common/histogram.h"
 #include "common/image_cache.h"
 #include "common/imageio.h"
 #include "common/imageio_module.h"
@@ -515,18 +516,155 @@ int dt_imageio_export(
                                         0, 0, high_quality, 0, NULL);
 }
 
-// internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override
-int dt_imageio_export_with_flags(
-  const uint32_t              imgid,
-  const char                 *filename,
-  dt_imageio_module_format_t *format,
-  dt_imageio_module_data_t   *format_params,
-  const int32_t               ignore_exif,
-  const int32_t               display_byteorder,
-  const gboolean              high_quality,
-  const int32_t               thumbnail_export,
-  const char                 *filter)
+// fraction of the processed size which fits into the maximum size of the format parameters
+static double
+_imageio_export_scale(const dt_imageio_module_data_t *format_params, const int width, const int height)
+{
+  const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)width,  1.0) : 1.0;
+  const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)height, 1.0) : 1.0;
+  return fminf(scalex, scaley);
+}
+
+// converts the processed pixels to what the format wants, in place, and writes the file.
+// the pixels are float rgb if is_float is set, or 8-bit bgr as the pipe puts it with gamma.
+static int
+_imageio_export_write(
+  const uint32_t                imgid,
+  const dt_imageio_rendition_t *rendition,
+  uint8_t                      *outbuf,
+  int                           processed_width,
+  int                           processed_height,
+  const int                     is_float,
+  const int32_t                 ignore_exif,
+  const int32_t                 display_byteorder,
+  const int32_t                 thumbnail_export,
+  const int                     sRGB)
+{
+  const char *filename = rendition->filename;
+  dt_imageio_module_format_t *format = rendition->format;
+  dt_imageio_module_data_t *format_params = rendition->format_params;
+  const int bpp = format->bpp(format_params);
+  int res = 0;
+
+  // full image histogram of the output, to be stored next to the exported file.
+  // float output gets converted in place below, so collect it before that.
+  const uint32_t histogram_bins = CLAMP(dt_conf_get_int("plugins/lighttable/export/histogram_bins"), 2, 65536);
+  uint32_t *histogram = NULL;
+  if(!thumbnail_export && dt_conf_get_bool("plugins/lighttable/export/histogram"))
+    histogram = (uint32_t *)malloc(sizeof(uint32_t)*4*histogram_bins);
+  if(histogram && bpp != 8)
+    dt_histogram_collect((const float *)outbuf, processed_width, processed_height, iop_cs_rgb, histogram_bins, 1, histogram);
+
+  // downconversion to low-precision formats:
+  if(bpp == 8 && !display_byteorder)
+  {
+    // ldr output: char
+    if(is_float)
+    {
+      const float *const inbuf = (float *)outbuf;
+      for(int k=0; k<processed_width*processed_height; k++)
+      {
+        // convert in place, this is unfortunately very serial..
+        const uint8_t r = CLAMP(inbuf[4*k+0]*0xff, 0, 0xff);
+        const uint8_t g = CLAMP(inbuf[4*k+1]*0xff, 0, 0xff);
+        const uint8_t b = CLAMP(inbuf[4*k+2]*0xff, 0, 0xff);
+        outbuf[4*k+0] = r;
+        outbuf[4*k+1] = g;
+        outbuf[4*k+2] = b;
+      }
+    }
+    else
+    {
+      uint8_t *const buf8 = outbuf;
+#ifdef _OPENMP
+      #pragma omp parallel for default(none) shared(processed_width, processed_height) schedule(static)
+#endif
+      // just flip byte order
+      for(int k=0; k<processed_width*processed_height; k++)
+      {
+        uint8_t tmp = buf8[4*k+0];
+        buf8[4*k+0] = buf8[4*k+2];
+        buf8[4*k+2] = tmp;
+      }
+    }
+  }
+  else if(bpp == 16)
+  {
+    // uint16_t per color channel
+    float    *buff  = (float *)   outbuf;
+    uint16_t *buf16 = (uint16_t *)outbuf;
+    for(int y=0; y<processed_height; y++) for(int x=0; x<processed_width ; x++)
+      {
+        // convert in place
+        const int k = x + processed_width*y;
+        for(int i=0; i<3; i++) buf16[4*k+i] = CLAMP(buff[4*k+i]*0x10000, 0, 0xffff);
+      }
+  }
+  // else output float, no further harm done to the pixels :)
+
+  if(histogram && bpp == 8)
+    dt_histogram_collect_8(outbuf, processed_width, processed_height, histogram_bins, 1, histogram);
+
+  format_params->width  = processed_width;
+  format_params->height = processed_height;
+
+  if(!ignore_exif)
+  {
+    int length;
+    uint8_t exif_profile[65535]; // C++ alloc'ed buffer is uncool, so we waste some bits here.
+    char pathname[1024];
+    gboolean from_cache = TRUE;
+    dt_image_full_path(imgid, pathname, 1024, &from_cache);
+    // last param is dng mode, it's false here
+    length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
+
+    res = format->write_image (format_params, filename, outbuf, exif_profile, length, imgid);
+  }
+  else
+  {
+    res = format->write_image (format_params, filename, outbuf, NULL, 0, imgid);
+  }
+
+  if(histogram)
+  {
+    if(!res)
+    {
+      // image.jpg -> image.histogram.txt
+      gchar *basename = g_strdup(filename);
+      char *c = basename + strlen(basename);
+      while(c > basename && *c != '.' && *c != '/') c--;
+      if(*c == '.') *c = '\0';
+      gchar *histname = g_strdup_printf("%s.histogram.txt", basename);
+      if(dt_histogram_write(histname, histogram, histogram_bins, iop_cs_rgb))
+        fprintf(stderr, "[export] could not write histogram `%s'\n", histname);
+      g_free(histname);
+      g_free(basename);
+    }
+    free(histogram);
+  }
+
+  if(!thumbnail_export)
+  {
+    dt_control_signal_raise(darktable.signals,DT_SIGNAL_IMAGE_EXPORT_TMPFILE,imgid,filename);
+  }
+  return res;
+}
+
+// internal function: to avoid exif blob reading + 8-bit byteorder flag + high-quality override.
+// the first rendition decides about the output levels of the pipe and the style.
+static int
+_imageio_export(
+  const uint32_t                imgid,
+  const dt_imageio_rendition_t *renditions,
+  const int                     num,
+  const int32_t                 ignore_exif,
+  const int32_t                 display_byteorder,
+  const gboolean                high_quality,
+  const int32_t                 thumbnail_export,
+  const char                   *filter)
 {
+  dt_imageio_module_format_t *format = renditions[0].format;
+  dt_imageio_module_data_t *format_params = renditions[0].format_params;
   dt_develop_t dev;
   dt_dev_init(&dev, 0);
   dt_mipmap_buffer_t buf;
@@ -650,132 +788,150 @@ int dt_imageio_export_with_flags(
   }
   g_free(overprofile);
 
-  // get only once at the beginning, in case the user changes it on the way:
-  const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe.processed_width ) &&
-      (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height)) ? FALSE :
-      high_quality;
-  const int width  = high_quality_processing ? 0 : format_params->max_width;
-  const int height = high_quality_processing ? 0 : format_params->max_height;
-  const double scalex = width  > 0 ? fminf(width /(double)pipe.processed_width,  1.0) : 1.0;
-  const double scaley = height > 0 ? fminf(height/(double)pipe.processed_height, 1.0) : 1.0;
-  const double scale = fminf(scalex, scaley);
-  int processed_width  = scale*pipe.processed_width  + .5f;
-  int processed_height = scale*pipe.processed_height + .5f;
-  const int bpp = format->bpp(format_params);
-
-  // downsampling done last, if high quality processing was requested:
-  uint8_t *outbuf = pipe.backbuf;
-  uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
-  dt_get_times(&start);
-  if(high_quality_processing)
+  if(num == 1)
   {
-    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe.processed_width,  1.0) : 1.0;
-    const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe.processed_height, 1.0) : 1.0;
+    // get only once at the beginning, in case the user changes it on the way:
+    const gboolean high_quality_processing = ((format_params->max_width  == 0 || format_params->max_width  >= pipe.processed_width ) &&
+        (format_params->max_height == 0 || format_params->max_height >= pipe.processed_height)) ? FALSE :
+        high_quality;
+    const int width  = high_quality_processing ? 0 : format_params->max_width;
+    const int height = high_quality_processing ? 0 : format_params->max_height;
+    const double scalex = width  > 0 ? fminf(width /(double)pipe.processed_width,  1.0) : 1.0;
+    const double scaley = height > 0 ? fminf(height/(double)pipe.processed_height, 1.0) : 1.0;
     const double scale = fminf(scalex, scaley);
-    processed_width  = scale*pipe.processed_width  + .5f;
-    processed_height = scale*pipe.processed_height + .5f;
-    moutbuf = (uint8_t *)dt_alloc_align(64, sizeof(float)*processed_width*processed_height*4);
-    outbuf = moutbuf;
-    // now downscale into the new buffer:
-    dt_iop_roi_t roi_in, roi_out;
-    roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
-    roi_in.scale = 1.0;
-    roi_out.scale = scale;
-    roi_in.width = pipe.processed_width;
-    roi_in.height = pipe.processed_height;
-    roi_out.width = processed_width;
-    roi_out.height = processed_height;
-    dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width, pipe.processed_width);
+    int processed_width  = scale*pipe.processed_width  + .5f;
+    int processed_height = scale*pipe.processed_height + .5f;
+    const int bpp = format->bpp(format_params);
+
+    // downsampling done last, if high quality processing was requested:
+    uint8_t *outbuf = pipe.backbuf;
+    uint8_t *moutbuf = NULL; // keep track of alloc'ed memory
+    dt_get_times(&start);
+    if(high_quality_processing)
+    {
+      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      const double scalex = format_params->max_width  > 0 ? fminf(format_params->max_width /(double)pipe.processed_width,  1.0) : 1.0;
+      const double scaley = format_params->max_height > 0 ? fminf(format_params->max_height/(double)pipe.processed_height, 1.0) : 1.0;
+      const double scale = fminf(scalex, scaley);
+      processed_width  = scale*pipe.processed_width  + .5f;
+      processed_height = scale*pipe.processed_height + .5f;
+      moutbuf = (uint8_t *)dt_alloc_align(64, sizeof(float)*processed_width*processed_height*4);
+      outbuf = moutbuf;
+      // now downscale into the new buffer:
+      dt_iop_roi_t roi_in, roi_out;
+      roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
+      roi_in.scale = 1.0;
+      roi_out.scale = scale;
+      roi_in.width = pipe.processed_width;
+      roi_in.height = pipe.processed_height;
+      roi_out.width = processed_width;
+      roi_out.height = processed_height;
+      dt_iop_clip_and_zoom((float *)outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, processed_width, pipe.processed_width);
+    }
+    else
+    {
+      // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
+      if(bpp == 8)
+        dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      else
+        dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+      outbuf = pipe.backbuf;
+    }
+    dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing" : "[dev_process_export] pixel pipeline processing", NULL);
+
+    res = _imageio_export_write(imgid, renditions, outbuf, processed_width, processed_height,
+                                high_quality_processing || bpp != 8,
+                                ignore_exif, display_byteorder, thumbnail_export, sRGB);
+    free(moutbuf);
   }
   else
   {
-    // do the processing (8-bit with special treatment, to make sure we can use openmp further down):
-    if(bpp == 8)
-      dt_dev_pixelpipe_process(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    else
-      dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
-    outbuf = pipe.backbuf;
-  }
-  dt_show_times(&start, thumbnail_export ? "[dev_process_thumbnail] pixel pipeline processing" : "[dev_process_export] pixel pipeline processing", NULL);
+    // several renditions: run the pipe only once, in float and large enough for the biggest one
+    // (full size for high quality), and downscale the others from that.
+    res = 0;
+    double scale = 0.0;
+    for(int k=0; k<num; k++)
+      scale = fmax(scale, _imageio_export_scale(renditions[k].format_params, pipe.processed_width, pipe.processed_height));
+    if(high_quality) scale = 1.0;
+    const int processed_width  = scale*pipe.processed_width  + .5f;
+    const int processed_height = scale*pipe.processed_height + .5f;
+    dt_get_times(&start);
+    dt_dev_pixelpipe_process_no_gamma(&pipe, &dev, 0, 0, processed_width, processed_height, scale);
+    dt_show_times(&start, "[dev_process_export] pixel pipeline processing", NULL);
 
-  // downconversion to low-precision formats:
-  if(bpp == 8 && !display_byteorder)
-  {
-    // ldr output: char
-    if(high_quality_processing)
+    for(int k=0; k<num; k++)
     {
-      const float *const inbuf = (float *)outbuf;
-      for(int k=0; k<processed_width*processed_height; k++)
+      const double scale = _imageio_export_scale(renditions[k].format_params, processed_width, processed_height);
+      const int width  = scale*processed_width  + .5f;
+      const int height = scale*processed_height + .5f;
+      // conversion to the output format happens in place, so every rendition gets its own copy:
+      float *outbuf = (float *)dt_alloc_align(64, sizeof(float)*width*height*4);
+      if(!outbuf)
       {
-        // convert in place, this is unfortunately very serial..
-        const uint8_t r = CLAMP(inbuf[4*k+0]*0xff, 0, 0xff);
-        const uint8_t g = CLAMP(inbuf[4*k+1]*0xff, 0, 0xff);
-        const uint8_t b = CLAMP(inbuf[4*k+2]*0xff, 0, 0xff);
-        outbuf[4*k+0] = r;
-        outbuf[4*k+1] = g;
-        outbuf[4*k+2] = b;
+        res = 1;
+        break;
       }
-    }
-    else
-    {
-      uint8_t *const buf8 = pipe.backbuf;
-#ifdef _OPENMP
-      #pragma omp parallel for default(none) shared(processed_width, processed_height) schedule(static)
-#endif
-      // just flip byte order
-      for(int k=0; k<processed_width*processed_height; k++)
+      if(width == processed_width && height == processed_height)
       {
-        uint8_t tmp = buf8[4*k+0];
-        buf8[4*k+0] = buf8[4*k+2];
-        buf8[4*k+2] = tmp;
+        memcpy(outbuf, pipe.backbuf, sizeof(float)*width*height*4);
       }
-    }
-  }
-  else if(bpp == 16)
-  {
-    // uint16_t per color channel
-    float    *buff  = (float *)   outbuf;
-    uint16_t *buf16 = (uint16_t *)outbuf;
-    for(int y=0; y<processed_height; y++) for(int x=0; x<processed_width ; x++)
+      else
       {
-        // convert in place
-        const int k = x + processed_width*y;
-        for(int i=0; i<3; i++) buf16[4*k+i] = CLAMP(buff[4*k+i]*0x10000, 0, 0xffff);
+        dt_iop_roi_t roi_in, roi_out;
+        roi_in.x = roi_in.y = roi_out.x = roi_out.y = 0;
+        roi_in.scale = 1.0;
+        roi_out.scale = scale;
+        roi_in.width = processed_width;
+        roi_in.height = processed_height;
+        roi_out.width = width;
+        roi_out.height = height;
+        dt_iop_clip_and_zoom(outbuf, (float *)pipe.backbuf, &roi_out, &roi_in, width, processed_width);
       }
-  }
-  // else output float, no further harm done to the pixels :)
-
-  format_params->width  = processed_width;
-  format_params->height = processed_height;
-
-  if(!ignore_exif)
-  {
-    int length;
-    uint8_t exif_profile[65535]; // C++ alloc'ed buffer is uncool, so we waste some bits here.
-    char pathname[1024];
-    gboolean from_cache = TRUE;
-    dt_image_full_path(imgid, pathname, 1024, &from_cache);
-    // last param is dng mode, it's false here
-    length = dt_exif_read_blob(exif_profile, pathname, imgid, sRGB, processed_width, processed_height, 0);
-
-    res = format->write_image (format_params, filename, outbuf, exif_profile, length, imgid);
-  }
-  else
-  {
-    res = format->write_image (format_params, filename, outbuf, NULL, 0, imgid);
+      if(_imageio_export_write(imgid, renditions + k, (uint8_t *)outbuf, width, height, 1,
+                               ignore_exif, display_byteorder, thumbnail_export, sRGB))
+        res = 1;
+      free(outbuf);
+    }
   }
 
   dt_dev_pixelpipe_cleanup(&pipe);
   dt_dev_cleanup(&dev);
   dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-  free(moutbuf);
+  return res;
+}
 
-  if(!thumbnail_export)
+int dt_imageio_export_with_flags(
+  const uint32_t              imgid,
+  const char                 *filename,
+  dt_imageio_module_format_t *format,
+  dt_imageio_module_data_t   *format_params,
+  const int32_t               ignore_exif,
+  const int32_t               display_byteorder,
+  const gboolean              high_quality,
+  const int32_t               thumbnail_export,
+  const char                 *filter)
+{
+  const dt_imageio_rendition_t rendition = { filename, format, format_params };
+  return _imageio_export(imgid, &rendition, 1, ignore_exif, display_byteorder, high_quality,
+                         thumbnail_export, filter);
+}
+
+int dt_imageio_export_renditions(
+  const uint32_t                imgid,
+  const dt_imageio_rendition_t *renditions,
+  const int                     num,
+  const gboolean                high_quality)
+{
+  if(num <= 0) return 1;
+  if(strcmp(renditions[0].format->mime(renditions[0].format_params),"x-copy")==0)
   {
-    dt_control_signal_raise(darktable.signals,DT_SIGNAL_IMAGE_EXPORT_TMPFILE,imgid,filename);
+    /* nothing to render, just copy the file for each of them */
+    int res = 0;
+    for(int k=0; k<num; k++)
+      res |= renditions[k].format->write_image(renditions[k].format_params, renditions[k].filename, NULL, NULL, 0, imgid);
+    return res;
   }
-  return res;
+  return _imageio_export(imgid, renditions, num, 0, 0, high_quality, 0, NULL);
 }
 
 
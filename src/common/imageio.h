@@ -72,6 +72,25 @@ dt_imageio_export_with_flags(
   const int32_t                      thumbnail_export,
   const char                        *filter);
 
+/** one output file of an export: the size is given by max_width and max_height of the format parameters. */
+typedef struct dt_imageio_rendition_t
+{
+  const char *filename;
+  struct dt_imageio_module_format_t *format;
+  struct dt_imageio_module_data_t *format_params;
+}
+dt_imageio_rendition_t;
+
+/** export several renditions of the same image, running the pixelpipe only once. the pipe works at the
+    size of the largest rendition (or full size for high quality), the others are downscaled from its output.
+    output levels and style of the first rendition are used for all of them. */
+int
+dt_imageio_export_renditions(
+  const uint32_t                imgid,
+  const dt_imageio_rendition_t *renditions,
+  const int                     num,
+  const gboolean                high_quality);
+
 int dt_imageio_write_pos(int i, int j, int wd, int ht, float fwd, float fht, int orientation);
 
 // general, efficient buffer flipping function using memcopies
@@ -0,0 +1,173 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "common/darktable.h"
+#include "common/memory.h"
+#include "control/conf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void
+dt_memory_init(dt_memory_t *memory)
+{
+  memory->used = 0;
+  memory->clients = NULL;
+  dt_pthread_mutex_init(&memory->lock, NULL);
+
+  // budget in MB, 0 means half of the physical memory, -1 means no limit.
+  const int budget = dt_conf_get_int("memory_budget");
+  if(budget > 0)
+    memory->budget = (int64_t)budget << 20;
+  else if(budget == 0)
+    memory->budget = (int64_t)dt_get_total_memory() << 9; // kb/2 in bytes
+  else
+    memory->budget = 0;
+  dt_print(DT_DEBUG_MEMORY, "[memory] budget for caches and buffers: %.0f MB\n",
+           memory->budget/(1024.0*1024.0));
+}
+
+void
+dt_memory_cleanup(dt_memory_t *memory)
+{
+  g_list_free_full(memory->clients, free);
+  memory->clients = NULL;
+  dt_pthread_mutex_destroy(&memory->lock);
+}
+
+static gint
+_memory_client_compare(gconstpointer a, gconstpointer b)
+{
+  return ((const dt_memory_client_t *)a)->rank - ((const dt_memory_client_t *)b)->rank;
+}
+
+dt_memory_client_t *
+dt_memory_register(dt_memory_t *memory, const char *name, const dt_memory_rank_t rank,
+                   const int host, void (*reclaim)(void *data, const size_t bytes), void *data)
+{
+  dt_memory_client_t *client = (dt_memory_client_t *)malloc(sizeof(dt_memory_client_t));
+  if(!client) return NULL;
+  client->memory = memory;
+  g_strlcpy(client->name, name, sizeof(client->name));
+  client->rank = rank;
+  client->host = host;
+  client->used = client->peak = 0;
+  client->reclaim = reclaim;
+  client->data = data;
+  dt_pthread_mutex_lock(&memory->lock);
+  memory->clients = g_list_insert_sorted(memory->clients, client, _memory_client_compare);
+  dt_pthread_mutex_unlock(&memory->lock);
+  return client;
+}
+
+void
+dt_memory_unregister(dt_memory_t *memory, dt_memory_client_t *client)
+{
+  if(!client) return;
+  dt_pthread_mutex_lock(&memory->lock);
+  memory->clients = g_list_remove(memory->clients, client);
+  dt_pthread_mutex_unlock(&memory->lock);
+  if(client->host) __sync_fetch_and_sub(&memory->used, client->used);
+  free(client);
+}
+
+// ask the other clients to give back memory, cheapest to recompute first.
+// the requesting client is left alone: it is in the middle of an allocation
+// and might hold its own locks.
+static void
+_memory_reclaim(dt_memory_t *memory, const dt_memory_client_t *requester)
+{
+  // only one thread at a time, the others just carry on.
+  if(dt_pthread_mutex_trylock(&memory->lock)) return;
+  const int64_t start = memory->used;
+  // free a bit more than needed, so we don't come back for every allocation.
+  const int64_t target = memory->budget - memory->budget/16;
+  for(GList *l = memory->clients; l && memory->used > target; l = g_list_next(l))
+  {
+    dt_memory_client_t *client = (dt_memory_client_t *)l->data;
+    if(client == requester || !client->host || !client->reclaim || client->used <= 0) continue;
+    const int64_t excess = memory->used - target;
+    client->reclaim(client->data, MIN(excess, client->used));
+  }
+  dt_print(DT_DEBUG_MEMORY, "[memory] over budget, reclaimed %.2f MB for %s (%.2f/%.2f MB in use)\n",
+           (start - memory->used)/(1024.0*1024.0), requester->name,
+           memory->used/(1024.0*1024.0), memory->budget/(1024.0*1024.0));
+  dt_pthread_mutex_unlock(&memory->lock);
+}
+
+void
+dt_memory_alloc(dt_memory_client_t *client, const size_t bytes)
+{
+  if(!client || !bytes) return;
+  const int64_t used = __sync_add_and_fetch(&client->used, bytes);
+  if(used > client->peak) client->peak = used;
+  if(!client->host) return;
+  dt_memory_t *memory = client->memory;
+  const int64_t total = __sync_add_and_fetch(&memory->used, bytes);
+  if(memory->budget > 0 && total > memory->budget)
+    _memory_reclaim(memory, client);
+}
+
+void
+dt_memory_free(dt_memory_client_t *client, const size_t bytes)
+{
+  if(!client || !bytes) return;
+  __sync_fetch_and_sub(&client->used, bytes);
+  if(client->host) __sync_fetch_and_sub(&client->memory->used, bytes);
+}
+
+int64_t
+dt_memory_available(dt_memory_t *memory)
+{
+  if(memory->budget <= 0) return INT64_MAX;
+  return memory->budget - memory->used;
+}
+
+void
+dt_memory_print(dt_memory_t *memory)
+{
+  dt_pthread_mutex_lock(&memory->lock);
+  fprintf(stderr, "[memory] %.2f MB of %.2f MB host memory budget in use\n",
+          memory->used/(1024.0*1024.0), memory->budget/(1024.0*1024.0));
+  // clients sharing a name (one per pixelpipe, say) are summed up:
+  GList *printed = NULL;
+  for(GList *l = memory->clients; l; l = g_list_next(l))
+  {
+    const dt_memory_client_t *client = (const dt_memory_client_t *)l->data;
+    if(g_list_find_custom(printed, client->name, (GCompareFunc)strcmp)) continue;
+    printed = g_list_append(printed, (gpointer)client->name);
+    int64_t used = 0, peak = 0;
+    int cnt = 0;
+    for(GList *m = l; m; m = g_list_next(m))
+    {
+      const dt_memory_client_t *other = (const dt_memory_client_t *)m->data;
+      if(strcmp(other->name, client->name)) continue;
+      used += other->used;
+      peak += other->peak;
+      cnt++;
+    }
+    fprintf(stderr, "[memory]   %-20s %3d  %9.2f MB (peak %9.2f MB)%s\n", client->name, cnt,
+            used/(1024.0*1024.0), peak/(1024.0*1024.0), client->host ? "" : " on the device");
+  }
+  g_list_free(printed);
+  dt_pthread_mutex_unlock(&memory->lock);
+}
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
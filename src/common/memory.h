@@ -0,0 +1,103 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DT_COMMON_MEMORY_H
+#define DT_COMMON_MEMORY_H
+
+#include "common/dtpthread.h"
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stddef.h>
+
+/**
+ * process wide memory governor.
+ *
+ * the caches (image structs, mipmaps, pixelpipe caches) and the opencl buffers
+ * register as clients and account every byte they allocate and free. as soon as
+ * the host memory of all clients together exceeds the budget (conf key memory_budget),
+ * the governor asks the clients to give memory back, cheapest to recompute first.
+ * with -d memory, dt_memory_print() reports the live usage per client.
+ */
+
+/** reclaim order: clients with a lower rank are asked first. */
+typedef enum dt_memory_rank_t
+{
+  DT_MEMORY_RANK_IMAGE_STRUCTS = 0, // one sql row
+  DT_MEMORY_RANK_MIPMAP_F      = 1, // downscaled input, from the full buffer or a quick load
+  DT_MEMORY_RANK_PIXELPIPE     = 2, // intermediate results of a pipe, recomputed on the next run
+  DT_MEMORY_RANK_MIPMAP_FULL   = 3, // decoding a raw file
+  DT_MEMORY_RANK_THUMBNAILS    = 4, // a complete pipe run per thumbnail
+  DT_MEMORY_RANK_DEVICE        = 5  // opencl device memory, never reclaimed
+}
+dt_memory_rank_t;
+
+struct dt_memory_t;
+typedef struct dt_memory_client_t
+{
+  struct dt_memory_t *memory;
+  char name[32];
+  dt_memory_rank_t rank;
+  // device memory (opencl) is reported, but doesn't count towards the host budget.
+  int host;
+  // bytes currently held and the most ever held, only changed atomically.
+  int64_t used;
+  int64_t peak;
+  // try to free about this many bytes, by calling dt_memory_free() as memory is released.
+  // may also only schedule the release for later (pixelpipes do it before the next run).
+  // NULL for static blocks which can't shrink.
+  void (*reclaim)(void *data, const size_t bytes);
+  void *data;
+}
+dt_memory_client_t;
+
+typedef struct dt_memory_t
+{
+  // host memory budget in bytes, 0 means unlimited.
+  int64_t budget;
+  // host memory held by all clients together.
+  int64_t used;
+  // clients sorted by rank.
+  GList *clients;
+  // protects the list, and makes sure only one thread reclaims at a time.
+  dt_pthread_mutex_t lock;
+}
+dt_memory_t;
+
+void dt_memory_init(dt_memory_t *memory);
+void dt_memory_cleanup(dt_memory_t *memory);
+
+/** register a new client. several clients may share a name, they are reported together. */
+dt_memory_client_t *dt_memory_register(dt_memory_t *memory, const char *name, const dt_memory_rank_t rank,
+                                       const int host, void (*reclaim)(void *data, const size_t bytes), void *data);
+void dt_memory_unregister(dt_memory_t *memory, dt_memory_client_t *client);
+
+/** account for bytes the client just allocated. reclaims from the other clients if that exceeds the budget. */
+void dt_memory_alloc(dt_memory_client_t *client, const size_t bytes);
+/** account for bytes the client just freed. */
+void dt_memory_free(dt_memory_client_t *client, const size_t bytes);
+
+/** bytes left in the budget, can be negative. a very large number without a budget. */
+int64_t dt_memory_available(dt_memory_t *memory);
+
+/** print live and peak usage per client (DT_DEBUG_MEMORY). */
+void dt_memory_print(dt_memory_t *memory);
+
+#endif
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -22,6 +22,7 @@
 #include "common/imageio.h"
 #include "common/imageio_module.h"
 #include "common/imageio_jpeg.h"
+#include "common/memory.h"
 #include "common/mipmap_cache.h"
 #include "control/conf.h"
 #include "control/jobs.h"
@@ -522,8 +523,12 @@ dt_mipmap_cache_alloc(dt_image_t *img, dt_mipmap_size_t size, dt_mipmap_cache_al
   // so only check size and re-alloc if necessary:
   if(!(*dsc) || ((*dsc)->size < buffer_size) || ((void *)*dsc == (void *)dt_mipmap_cache_static_dead_image))
   {
+    dt_memory_client_t *memory = darktable.mipmap_cache->mip[DT_MIPMAP_FULL].memory;
     if((void *)*dsc != (void *)dt_mipmap_cache_static_dead_image)
+    {
+      if(*dsc) dt_memory_free(memory, (*dsc)->size);
       free(*dsc);
+    }
     *dsc = dt_alloc_align(64, buffer_size);
     // fprintf(stderr, "[mipmap cache] alloc for key %u %lX\n", get_key(img->id, size), (uint64_t)*buf);
     if(!(*dsc))
@@ -535,6 +540,7 @@ dt_mipmap_cache_alloc(dt_image_t *img, dt_mipmap_size_t size, dt_mipmap_cache_al
     }
     // set buffer size only if we're making it larger.
     (*dsc)->size = buffer_size;
+    dt_memory_alloc(memory, buffer_size);
   }
   (*dsc)->width = wd;
   (*dsc)->height = ht;
@@ -584,6 +590,7 @@ dt_mipmap_cache_allocate_dynamic(void *data, const uint32_t key, int32_t *cost,
       dsc->height = 0;
       dsc->size = sizeof(*dsc)+sizeof(float)*4*64;
     }
+    dt_memory_alloc(cache->memory, dsc->size);
   }
   assert(dsc->size >= sizeof(*dsc));
   dsc->flags = DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
@@ -599,12 +606,23 @@ void
 dt_mipmap_cache_deallocate_dynamic(void *data, const uint32_t key, void *payload)
 {
   dt_mipmap_cache_one_t *cache = (dt_mipmap_cache_one_t *)data;
-  if(cache->size == DT_MIPMAP_F)
-  {
-    free(payload);
-  }
-  // else:
-  // don't clean up anything, as we are re-allocating.
+  // a full buffer might be the fallback if allocation failed:
+  if(!payload || payload == (void *)dt_mipmap_cache_static_dead_image) return;
+  const struct dt_mipmap_buffer_dsc *dsc = (const struct dt_mipmap_buffer_dsc *)payload;
+  dt_memory_free(cache->memory, dsc->size);
+  free(payload);
+}
+
+// called by the memory governor: evict unused buffers of the _F or _FULL level
+// until about `bytes' are released. the cost of these caches is one per buffer.
+static void
+dt_mipmap_cache_reclaim(void *data, const size_t bytes)
+{
+  dt_mipmap_cache_one_t *cache = (dt_mipmap_cache_one_t *)data;
+  const int64_t used = cache->memory->used;
+  if(used <= 0 || cache->cache.cost <= 0) return;
+  const float keep = MAX(0.0f, 1.0f - bytes/(float)used);
+  dt_cache_gc(&cache->cache, keep * cache->cache.cost / (float)cache->cache.cost_quota);
 }
 
 static uint32_t
@@ -673,6 +691,8 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
     dt_cache_static_allocation(&cache->scratchmem.cache, (uint8_t *)cache->scratchmem.buf, wd*ht*sizeof(uint32_t));
     dt_cache_set_allocate_callback(&cache->scratchmem.cache,
                                    scratchmem_allocate, &cache->scratchmem);
+    cache->scratchmem.memory = dt_memory_register(darktable.memory, "thumbnails", DT_MEMORY_RANK_THUMBNAILS, 1, NULL, NULL);
+    dt_memory_alloc(cache->scratchmem.memory, cnt * wd*ht*sizeof(uint32_t));
     dt_print(DT_DEBUG_CACHE,
              "[mipmap_cache_init] cache has % 5d entries for temporary compression buffers (% 4.02f MB).\n",
              cnt, cnt* wd*ht*sizeof(uint32_t)/(1024.0*1024.0));
@@ -717,6 +737,9 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
                                    dt_mipmap_cache_allocate, &cache->mip[k]);
     // dt_cache_set_cleanup_callback(&cache->mip[k].cache,
     // &dt_mipmap_cache_deallocate, &cache->mip[k]);
+    // allocated once, so the governor only gets to see it:
+    cache->mip[k].memory = dt_memory_register(darktable.memory, "thumbnails", DT_MEMORY_RANK_THUMBNAILS, 1, NULL, NULL);
+    dt_memory_alloc(cache->mip[k].memory, thumbnails * cache->mip[k].buffer_size);
 
     dt_print(DT_DEBUG_CACHE,
              "[mipmap_cache_init] cache has % 5d entries for mip %d (% 4.02f MB).\n",
@@ -733,8 +756,12 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
   dt_cache_init(&cache->mip[DT_MIPMAP_FULL].cache, max_mem_bufs, parallel, 64, max_mem_bufs);
   dt_cache_set_allocate_callback(&cache->mip[DT_MIPMAP_FULL].cache,
                                  dt_mipmap_cache_allocate_dynamic, &cache->mip[DT_MIPMAP_FULL]);
-  // dt_cache_set_cleanup_callback(&cache->mip[DT_MIPMAP_FULL].cache,
-  // &dt_mipmap_cache_deallocate_dynamic, &cache->mip[DT_MIPMAP_FULL]);
+  // evicted full buffers are freed, otherwise every slot of the hashtable might
+  // end up holding on to a full raw worth of memory.
+  dt_cache_set_cleanup_callback(&cache->mip[DT_MIPMAP_FULL].cache,
+                                dt_mipmap_cache_deallocate_dynamic, &cache->mip[DT_MIPMAP_FULL]);
+  cache->mip[DT_MIPMAP_FULL].memory = dt_memory_register(darktable.memory, "mipmap full", DT_MEMORY_RANK_MIPMAP_FULL, 1,
+                                                         dt_mipmap_cache_reclaim, &cache->mip[DT_MIPMAP_FULL]);
   cache->mip[DT_MIPMAP_FULL].buffer_size = 0;
   cache->mip[DT_MIPMAP_FULL].size = DT_MIPMAP_FULL;
   cache->mip[DT_MIPMAP_FULL].buf = NULL;
@@ -745,6 +772,8 @@ void dt_mipmap_cache_init(dt_mipmap_cache_t *cache)
                                  dt_mipmap_cache_allocate_dynamic, &cache->mip[DT_MIPMAP_F]);
   dt_cache_set_cleanup_callback(&cache->mip[DT_MIPMAP_F].cache,
                                 dt_mipmap_cache_deallocate_dynamic, &cache->mip[DT_MIPMAP_F]);
+  cache->mip[DT_MIPMAP_F].memory = dt_memory_register(darktable.memory, "mipmap f", DT_MEMORY_RANK_MIPMAP_F, 1,
+                                                      dt_mipmap_cache_reclaim, &cache->mip[DT_MIPMAP_F]);
   cache->mip[DT_MIPMAP_F].buffer_size = 4*sizeof(uint32_t) +
                                         4*sizeof(float) * cache->mip[DT_MIPMAP_F].max_width * cache->mip[DT_MIPMAP_F].max_height;
   cache->mip[DT_MIPMAP_F].size = DT_MIPMAP_F;
@@ -762,6 +791,8 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
     // now mem is actually freed, not during cache cleanup
     free(cache->mip[k].buf);
   }
+  for(int k=0; k<DT_MIPMAP_NONE; k++)
+    dt_memory_unregister(darktable.memory, cache->mip[k].memory);
   dt_cache_cleanup(&cache->mip[DT_MIPMAP_FULL].cache);
   dt_cache_cleanup(&cache->mip[DT_MIPMAP_F].cache);
 
@@ -770,6 +801,7 @@ void dt_mipmap_cache_cleanup(dt_mipmap_cache_t *cache)
   {
     dt_cache_cleanup(&cache->scratchmem.cache);
     free(cache->scratchmem.buf);
+    dt_memory_unregister(darktable.memory, cache->scratchmem.memory);
   }
 }
 
@@ -822,6 +854,33 @@ void dt_mipmap_cache_print(dt_mipmap_cache_t *cache)
   //dt_cache_print(&cache->mip[DT_MIPMAP_3].cache);
 }
 
+// uncompressed buffer to generate a compressed thumbnail in. the worker threads each have a
+// slot in the scratchmem cache, other threads (gui, export, thumbnail service) would all end
+// up with the same key, so they get a buffer of their own.
+static uint8_t *
+_scratchmem_get(dt_mipmap_cache_t *cache)
+{
+  if(!cache->compression_type) return NULL;
+  const int key = dt_control_get_threadid();
+  if(key >= darktable.control->num_threads) return dt_mipmap_cache_alloc_scratchmem(cache);
+  dt_cache_read_get(&cache->scratchmem.cache, key);
+  return (uint8_t *)dt_cache_write_get(&cache->scratchmem.cache, key);
+}
+
+static void
+_scratchmem_release(dt_mipmap_cache_t *cache, uint8_t *scratchmem)
+{
+  if(!cache->compression_type) return;
+  const int key = dt_control_get_threadid();
+  if(key >= darktable.control->num_threads)
+  {
+    free(scratchmem);
+    return;
+  }
+  dt_cache_write_release(&cache->scratchmem.cache, key);
+  dt_cache_read_release(&cache->scratchmem.cache, key);
+}
+
 void
 dt_mipmap_cache_read_get(
   dt_mipmap_cache_t *cache,
@@ -946,10 +1005,7 @@ dt_mipmap_cache_read_get(
           if(cache->compression_type)
           {
             // get per-thread temporary storage without malloc from a separate cache:
-            const int key = dt_control_get_threadid();
-            // const void *cbuf =
-            dt_cache_read_get(&cache->scratchmem.cache, key);
-            uint8_t *scratchmem = (uint8_t *)dt_cache_write_get(&cache->scratchmem.cache, key);
+            uint8_t *scratchmem = _scratchmem_get(cache);
             _init_8(scratchmem, &dsc->width, &dsc->height, imgid, mip);
             buf->width  = dsc->width;
             buf->height = dsc->height;
@@ -957,8 +1013,7 @@ dt_mipmap_cache_read_get(
             buf->size   = mip;
             buf->buf = (uint8_t *)(dsc+1);
             dt_mipmap_cache_compress(buf, scratchmem);
-            dt_cache_write_release(&cache->scratchmem.cache, key);
-            dt_cache_read_release(&cache->scratchmem.cache, key);
+            _scratchmem_release(cache, scratchmem);
           }
           else
           {
@@ -968,6 +1023,9 @@ dt_mipmap_cache_read_get(
         dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
         // drop the write lock
         dt_cache_write_release(&cache->mip[mip].cache, key);
+        // the smaller sizes come for free now, instead of loading the image again for each one:
+        if(mip > DT_MIPMAP_0 && mip < DT_MIPMAP_F)
+          dt_mipmap_cache_fill_smaller(cache, imgid, mip);
         /* raise signal that mipmaps has been flushed to cache */
         dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
       }
@@ -1104,6 +1162,205 @@ dt_mipmap_cache_remove(
   }
 }
 
+void
+dt_mipmap_cache_remove_all(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid)
+{
+  dt_mipmap_cache_remove(cache, imgid);
+  // and the buffers decoded from the file:
+  for(int k=DT_MIPMAP_F; k<=DT_MIPMAP_FULL; k++)
+    dt_cache_remove(&cache->mip[k].cache, get_key(imgid, k));
+}
+
+// fit an 8-bit image which is in the byte order of the thumbnails already into wd x ht.
+// not flip_and_zoom_8: that one swaps red and blue, for decoded jpegs.
+static void
+_downscale_8(
+  const uint8_t *in,
+  const int32_t  width,
+  const int32_t  height,
+  uint8_t       *out,
+  const int32_t  wd,
+  const int32_t  ht,
+  uint32_t      *out_width,
+  uint32_t      *out_height)
+{
+  const float scale = fmaxf(width/(float)wd, height/(float)ht);
+  const int32_t ow = *out_width  = MIN(wd, width/scale);
+  const int32_t oh = *out_height = MIN(ht, height/scale);
+  dt_iop_clip_and_zoom_8(in, 0, 0, width, height, width, height, out, 0, 0, ow, oh, ow, oh);
+}
+
+// 2x2 box filter, to go from one thumbnail size to the next smaller one.
+static void
+_downsample_half_8(
+  const uint8_t *in,
+  const int32_t  iw,
+  const int32_t  ih,
+  uint8_t       *out,
+  int32_t       *ow,
+  int32_t       *oh)
+{
+  const int32_t wd = *ow = iw/2, ht = *oh = ih/2;
+  for(int j=0; j<ht; j++)
+  {
+    const uint8_t *i0 = in + 4*iw*2*j, *i1 = i0 + 4*iw;
+    uint8_t *o = out + 4*wd*j;
+    for(int i=0; i<wd; i++, i0+=8, i1+=8, o+=4)
+      for(int c=0; c<4; c++)
+        o[c] = (i0[c] + i0[4+c] + i1[c] + i1[4+c] + 2) >> 2;
+  }
+}
+
+// write one thumbnail from an 8-bit image which is at most twice as large.
+static int
+_write_level(
+  dt_mipmap_cache_t     *cache,
+  const uint32_t         imgid,
+  const dt_mipmap_size_t k,
+  const uint8_t         *in,
+  const int32_t          width,
+  const int32_t          height,
+  const int              replace)
+{
+  const uint32_t key = get_key(imgid, k);
+  if(!replace && dt_cache_contains(&cache->mip[k].cache, key)) return 0;
+  struct dt_mipmap_buffer_dsc* dsc = (struct dt_mipmap_buffer_dsc*)dt_cache_read_get(&cache->mip[k].cache, key);
+  if(!dsc) return 0;
+  // a fresh entry is write locked already, as requested by the alloc callback.
+  if(!(dsc->flags & DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE))
+  {
+    if(!replace)
+    {
+      // someone else was faster.
+      dt_cache_read_release(&cache->mip[k].cache, key);
+      return 0;
+    }
+    dt_cache_write_get(&cache->mip[k].cache, key);
+  }
+  const int32_t wd = cache->mip[k].max_width, ht = cache->mip[k].max_height;
+  uint8_t *scratchmem = _scratchmem_get(cache);
+  uint8_t *out = scratchmem ? scratchmem : (uint8_t *)(dsc+1);
+  if(width <= wd && height <= ht)
+  {
+    memcpy(out, in, sizeof(uint32_t)*width*height);
+    dsc->width = width;
+    dsc->height = height;
+  }
+  else
+  {
+    _downscale_8(in, width, height, out, wd, ht, &dsc->width, &dsc->height);
+  }
+  if(scratchmem)
+  {
+    dt_mipmap_buffer_t buf;
+    buf.width  = dsc->width;
+    buf.height = dsc->height;
+    buf.imgid  = imgid;
+    buf.size   = k;
+    buf.buf    = (uint8_t *)(dsc+1);
+    dt_mipmap_cache_compress(&buf, scratchmem);
+  }
+  _scratchmem_release(cache, scratchmem);
+  dsc->flags &= ~DT_MIPMAP_BUFFER_DSC_FLAG_GENERATE;
+  dt_cache_write_release(&cache->mip[k].cache, key);
+  dt_cache_read_release(&cache->mip[k].cache, key);
+  return 1;
+}
+
+// downscale an 8-bit image into the thumbnails smaller than max, by successive reductions to
+// half the size, so every pixel of the input is only filtered once or twice. with replace,
+// thumbnails which are there already are overwritten, and sizes larger than the input are
+// removed. returns the number of thumbnails written.
+static int
+_write_levels(
+  dt_mipmap_cache_t     *cache,
+  const uint32_t         imgid,
+  const uint8_t         *in,
+  const int32_t          width,
+  const int32_t          height,
+  const dt_mipmap_size_t max,
+  const int              replace)
+{
+  int written = 0;
+  uint8_t *tmp[2] = { NULL, NULL };
+  if(in && width > 1 && height > 1)
+  {
+    tmp[0] = (uint8_t *)dt_alloc_align(64, sizeof(uint32_t)*(width/2)*(height/2));
+    tmp[1] = (uint8_t *)dt_alloc_align(64, sizeof(uint32_t)*(width/2)*(height/2));
+  }
+  const uint8_t *cur = in;
+  int32_t wd = width, ht = height;
+  int t = 0;
+  for(int k=max-1; k>=DT_MIPMAP_0; k--)
+  {
+    const int32_t mw = cache->mip[k].max_width, mh = cache->mip[k].max_height;
+    while(tmp[0] && tmp[1] && wd > 1 && ht > 1 && (wd >= 2*mw || ht >= 2*mh))
+    {
+      _downsample_half_8(cur, wd, ht, tmp[t], &wd, &ht);
+      cur = tmp[t];
+      t = !t;
+    }
+    // we don't upsample, these sizes will be regenerated when they're needed:
+    if(!in || wd <= 0 || ht <= 0 || (wd < mw && ht < mh))
+    {
+      if(replace) dt_cache_remove(&cache->mip[k].cache, get_key(imgid, k));
+      continue;
+    }
+    written += _write_level(cache, imgid, k, cur, wd, ht, replace);
+  }
+  free(tmp[0]);
+  free(tmp[1]);
+  return written;
+}
+
+void
+dt_mipmap_cache_write_from_buffer(
+  dt_mipmap_cache_t *cache,
+  const uint32_t     imgid,
+  const uint8_t     *in,
+  const int32_t      width,
+  const int32_t      height)
+{
+  _write_levels(cache, imgid, in, width, height, DT_MIPMAP_F, 1);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
+}
+
+void
+dt_mipmap_cache_fill_smaller(
+  dt_mipmap_cache_t     *cache,
+  const uint32_t         imgid,
+  const dt_mipmap_size_t mip)
+{
+  if(mip <= DT_MIPMAP_0 || mip >= DT_MIPMAP_F) return;
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(cache, &buf, imgid, mip, DT_MIPMAP_TESTLOCK);
+  if(!buf.buf) return;
+  // nothing to scale down from failed loads:
+  if(buf.width <= 8 || buf.height <= 8)
+  {
+    dt_mipmap_cache_read_release(cache, &buf);
+    return;
+  }
+  // take an uncompressed copy, the scratch memory is needed again for the smaller sizes.
+  const int32_t width = buf.width, height = buf.height;
+  uint8_t *in = (uint8_t *)dt_alloc_align(64, sizeof(uint32_t)*width*height);
+  if(in)
+  {
+    uint8_t *scratchmem = _scratchmem_get(cache);
+    memcpy(in, dt_mipmap_cache_decompress(&buf, scratchmem), sizeof(uint32_t)*width*height);
+    _scratchmem_release(cache, scratchmem);
+  }
+  dt_mipmap_cache_read_release(cache, &buf);
+  if(!in) return;
+  const int written = _write_levels(cache, imgid, in, width, height, mip, 0);
+  dt_print(DT_DEBUG_CACHE, "[mipmap_cache] derived %d smaller thumbnails of image %u from mip %d\n",
+           written, imgid, mip);
+  free(in);
+  if(written) dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
+}
+
 static void
 _init_f(
   float          *out,
@@ -1355,7 +1612,6 @@ libraw_fail:
   }
 
   // TODO: various speed optimizations:
-  // TODO: also init all smaller mips!
   // TODO: use mipf, but:
   // TODO: if output is cropped, don't use mipf!
 }
@@ -92,6 +92,9 @@ typedef struct dt_mipmap_cache_one_t
   // one cache per mipmap scale!
   dt_cache_t cache;
 
+  // bytes held by this level, as accounted with the memory governor.
+  struct dt_memory_client_t *memory;
+
   // a few stats on usage in this run.
   // long int to give 32-bits on old archs, so __sync* calls will work.
   long int stats_requests;    // number of total requests
@@ -164,6 +167,32 @@ dt_mipmap_cache_remove(
   dt_mipmap_cache_t *cache,
   const uint32_t imgid);
 
+// the image file itself changed: remove the thumbnails and the full and f buffers.
+void
+dt_mipmap_cache_remove_all(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid);
+
+// replace the thumbnails by downscaled copies of an already processed 8-bit image
+// (the darkroom preview, say), instead of running the thumbnail pipe again.
+// sizes larger than the input are removed, so they will be regenerated:
+void
+dt_mipmap_cache_write_from_buffer(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const uint8_t *in,
+  const int32_t width,
+  const int32_t height);
+
+// generate the missing thumbnails smaller than mip by scaling down the one
+// in the cache already, instead of loading the image again for each size.
+// this is done automatically whenever mip0..mip3 is loaded on a cache miss.
+void
+dt_mipmap_cache_fill_smaller(
+  dt_mipmap_cache_t *cache,
+  const uint32_t imgid,
+  const dt_mipmap_size_t mip);
+
 // return the closest mipmap size
 // for the given window you wish to draw.
 // a dt_mipmap_size_t has always a fixed resolution associated with it,
@@ -23,7 +23,9 @@
 #include "common/opencl.h"
 #include "common/bilateralcl.h"
 #include "common/gaussian.h"
+#include "common/histogram.h"
 #include "common/dlopencl.h"
+#include "common/memory.h"
 #include "common/nvidia_gpus.h"
 #include "develop/pixelpipe.h"
 #include "control/conf.h"
@@ -50,6 +52,8 @@ void dt_opencl_init(dt_opencl_t *cl, const int argc, char *argv[])
   cl->enabled = 0;
   cl->stopped = 0;
   cl->error_count = 0;
+  // device memory doesn't count towards the host budget, it's only reported:
+  cl->memory = dt_memory_register(darktable.memory, "opencl", DT_MEMORY_RANK_DEVICE, 0, NULL, NULL);
 
   // work-around to fix a bug in some AMD OpenCL compilers, which would fail parsing certain numerical constants if locale is different from "C".
   // we save the current locale, set locale to "C", and restore the previous setting after OpenCL is initialized
@@ -431,6 +435,7 @@ finally:
     dt_capabilities_add("opencl");
     cl->bilateral = dt_bilateral_init_cl_global();
     cl->gaussian = dt_gaussian_init_cl_global();
+    cl->histogram = dt_histogram_init_cl_global();
   }
   if(locale) setlocale(LC_ALL, locale);
   return;
@@ -438,10 +443,12 @@ finally:
 
 void dt_opencl_cleanup(dt_opencl_t *cl)
 {
+  dt_memory_unregister(darktable.memory, cl->memory);
   if(cl->inited)
   {
     dt_bilateral_free_cl_global(cl->bilateral);
     dt_gaussian_free_cl_global(cl->gaussian);
+    dt_histogram_free_cl_global(cl->histogram);
     for(int i=0; i<cl->num_devs; i++)
     {
       dt_pthread_mutex_destroy(&cl->dev[i].lock);
@@ -1312,6 +1319,36 @@ int dt_opencl_write_buffer_to_device(const int devid, void *host, void *device,
 }
 
 
+// keep track of device memory: per device in used_global_mem, and with the memory governor.
+static void dt_opencl_account_mem_object(const int devid, cl_mem mem)
+{
+  size_t size = 0;
+  if(!mem || (darktable.opencl->dlocl->symbols->dt_clGetMemObjectInfo)(mem, CL_MEM_SIZE, sizeof(size), &size, NULL) != CL_SUCCESS)
+    return;
+  __sync_fetch_and_add(&darktable.opencl->dev[devid].used_global_mem, size);
+  dt_memory_alloc(darktable.opencl->memory, size);
+}
+
+static void dt_opencl_unaccount_mem_object(cl_mem mem)
+{
+  size_t size = 0;
+  cl_uint refs = 0;
+  cl_context context = NULL;
+  dt_dlopencl_symbols_t *sym = darktable.opencl->dlocl->symbols;
+  // only the last reference actually frees the memory:
+  if((sym->dt_clGetMemObjectInfo)(mem, CL_MEM_REFERENCE_COUNT, sizeof(refs), &refs, NULL) != CL_SUCCESS || refs != 1
+     || (sym->dt_clGetMemObjectInfo)(mem, CL_MEM_SIZE, sizeof(size), &size, NULL) != CL_SUCCESS
+     || (sym->dt_clGetMemObjectInfo)(mem, CL_MEM_CONTEXT, sizeof(context), &context, NULL) != CL_SUCCESS)
+    return;
+  for(int devid=0; devid<darktable.opencl->num_devs; devid++)
+  {
+    if(darktable.opencl->dev[devid].context != context) continue;
+    __sync_fetch_and_sub(&darktable.opencl->dev[devid].used_global_mem, size);
+    dt_memory_free(darktable.opencl->memory, size);
+    break;
+  }
+}
+
 void* dt_opencl_copy_host_to_device_constant(const int devid, const int size, void *host)
 {
   if(!darktable.opencl->inited || devid < 0) return NULL;
@@ -1321,6 +1358,7 @@ void* dt_opencl_copy_host_to_device_constant(const int devid, const int size, vo
                size,
                host, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl copy_host_to_device_constant] could not alloc buffer on device %d: %d\n", devid, err);
+  else dt_opencl_account_mem_object(devid, dev);
   return dev;
 }
 
@@ -1359,6 +1397,7 @@ void* dt_opencl_copy_host_to_device_rowpitch(const int devid, void *host, const
                width, height, rowpitch,
                host, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl copy_host_to_device] could not alloc/copy img buffer on device %d: %d\n", devid, err);
+  else dt_opencl_account_mem_object(devid, dev);
   return dev;
 }
 
@@ -1366,6 +1405,7 @@ void* dt_opencl_copy_host_to_device_rowpitch(const int devid, void *host, const
 void dt_opencl_release_mem_object(void *mem)
 {
   if (!darktable.opencl->inited) return;
+  dt_opencl_unaccount_mem_object(mem);
   (darktable.opencl->dlocl->symbols->dt_clReleaseMemObject)(mem);
 }
 
@@ -1419,6 +1459,7 @@ void* dt_opencl_alloc_device(const int devid, const int width, const int height,
                width, height, 0,
                NULL, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device] could not alloc img buffer on device %d: %d\n", devid, err);
+  else dt_opencl_account_mem_object(devid, dev);
   return dev;
 }
 
@@ -1452,6 +1493,7 @@ void* dt_opencl_alloc_device_use_host_pointer(const int devid, const int width,
                width, height, rowpitch,
                host, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_use_host_pointer] could not alloc img buffer on device %d: %d\n", devid, err);
+  else dt_opencl_account_mem_object(devid, dev);
   return dev;
 }
 
@@ -1466,6 +1508,7 @@ void* dt_opencl_alloc_device_buffer(const int devid, const int size)
                size,
                NULL, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %d\n", devid, err);
+  else dt_opencl_account_mem_object(devid, buf);
   return buf;
 }
 
@@ -1479,6 +1522,7 @@ void* dt_opencl_alloc_device_buffer_with_flags(const int devid, const int size,
                size,
                NULL, &err);
   if(err != CL_SUCCESS) dt_print(DT_DEBUG_OPENCL, "[opencl alloc_device_buffer] could not alloc buffer on device %d: %d\n", devid, err);
+  else dt_opencl_account_mem_object(devid, buf);
   return buf;
 }
 
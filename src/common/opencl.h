@@ -126,6 +126,12 @@ typedef struct dt_opencl_t
 
   // global kernels for gaussian filtering, to be reused by a few plugins.
   struct dt_gaussian_cl_global_t *gaussian;
+
+  // global kernels for histogram collection in the pixelpipe.
+  struct dt_histogram_cl_global_t *histogram;
+
+  // device memory of all buffers, reported to the memory governor.
+  struct dt_memory_client_t *memory;
 }
 dt_opencl_t;
 
@@ -59,11 +59,14 @@ void dt_ratings_apply_to_selection (int rating)
     /* for each selected image update rating */
     sqlite3_stmt *stmt;
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images", -1, &stmt, NULL);
+    // one transaction for all the updates, not one per image:
+    dt_image_cache_write_batch_begin(darktable.image_cache);
     while(sqlite3_step(stmt) == SQLITE_ROW)
     {
       dt_ratings_apply_to_image(sqlite3_column_int(stmt, 0), rating);
     }
     sqlite3_finalize(stmt);
+    dt_image_cache_write_batch_end(darktable.image_cache);
 
     /* redraw view */
     /* dt_control_queue_redraw_center() */
@@ -17,11 +17,118 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#ifndef DT_UNIT_TEST
 #include "common/darktable.h"
-#include "common/tags.h"
-#include "common/debug.h"
 #include "control/conf.h"
 #include "control/control.h"
+#endif
+#include "common/tags.h"
+#include "common/debug.h"
+
+#include <string.h>
+
+/*
+ * tagxtag is sparse: it only holds pairs of tags which are attached to the same
+ * image, once per pair with id1 < id2, and count is the number of such images.
+ * pairs show up when a tag is attached next to another one, and are dropped again
+ * as soon as no image has both of them.
+ */
+
+// images of the selection, or the single image ?2, which don't have tag ?1 yet:
+#define DT_TAG_IMAGES_NEW_SINGLE \
+  "SELECT ?2 WHERE NOT EXISTS (SELECT 1 FROM tagged_images WHERE imgid = ?2 AND tagid = ?1)"
+#define DT_TAG_IMAGES_NEW_SELECTED \
+  "SELECT imgid FROM selected_images WHERE imgid NOT IN (SELECT imgid FROM tagged_images WHERE tagid = ?1)"
+#define DT_TAG_IMAGES_NEW_LIST \
+  "SELECT imgid FROM memory.tag_images WHERE imgid NOT IN (SELECT imgid FROM tagged_images WHERE tagid = ?1)"
+// .. and the ones which do have it:
+#define DT_TAG_IMAGES_OLD_SINGLE \
+  "SELECT imgid FROM tagged_images WHERE imgid = ?2 AND tagid = ?1"
+#define DT_TAG_IMAGES_OLD_SELECTED \
+  "SELECT imgid FROM tagged_images WHERE tagid = ?1 AND imgid IN (SELECT imgid FROM selected_images)"
+#define DT_TAG_IMAGES_OLD_LIST \
+  "SELECT imgid FROM tagged_images WHERE tagid = ?1 AND imgid IN (SELECT imgid FROM memory.tag_images)"
+
+// pairs of tag ?1 with the other tags of these images:
+#define DT_TAG_PAIRS_INSERT(images) \
+  "INSERT OR IGNORE INTO tagxtag (id1, id2, count) SELECT DISTINCT MIN(?1, tagid), MAX(?1, tagid), 0 " \
+  "FROM tagged_images WHERE tagid != ?1 AND imgid IN (" images ")"
+#define DT_TAG_PAIRS_UPDATE(op, images) \
+  "UPDATE tagxtag SET count = count " op " (SELECT count(*) FROM tagged_images " \
+  "WHERE tagid = tagxtag.id1 + tagxtag.id2 - ?1 AND imgid IN (" images ")) " \
+  "WHERE (id1 = ?1 OR id2 = ?1) AND tagxtag.id1 + tagxtag.id2 - ?1 IN " \
+  "(SELECT tagid FROM tagged_images WHERE imgid IN (" images "))"
+#define DT_TAG_PAIRS_CLEANUP \
+  "DELETE FROM tagxtag WHERE (id1 = ?1 OR id2 = ?1) AND count <= 0"
+
+// the suggestions look up tag names by the trigrams of the keyword in memory.tag_trigrams,
+// which is built on demand and then kept up to date as tags are created and removed.
+static gint _tag_trigrams_valid = 0;
+
+static void
+_tag_execute(const char *sql, const guint tagid, const gint imgid)
+{
+  sqlite3_stmt *stmt = dt_database_get_statement(darktable.db, sql);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
+  if(imgid > 0) DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
+  sqlite3_step(stmt);
+  dt_database_release_statement(darktable.db, stmt);
+}
+
+// fill memory.tag_images, the image set of the _LIST queries:
+static void
+_tag_set_images(const gint *imgs, const int num)
+{
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tag_images", NULL, NULL, NULL);
+  sqlite3_stmt *stmt = dt_database_get_statement(darktable.db,
+                                                 "INSERT OR IGNORE INTO memory.tag_images (imgid) VALUES (?1)");
+  for(int k=0; k<num; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgs[k]);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  dt_database_release_statement(darktable.db, stmt);
+}
+
+// three bytes, lowercase like LIKE compares them:
+static inline int
+_tag_trigram(const char *s)
+{
+  return (g_ascii_tolower(s[0]) & 0xff) << 16 | (g_ascii_tolower(s[1]) & 0xff) << 8 | (g_ascii_tolower(s[2]) & 0xff);
+}
+
+static void
+_tag_trigrams_insert(const guint tagid, const char *name)
+{
+  if(!name) return;
+  const int len = strlen(name);
+  sqlite3_stmt *stmt = dt_database_get_statement(darktable.db,
+                                                 "INSERT OR IGNORE INTO memory.tag_trigrams (trigram, id) VALUES (?1, ?2)");
+  for(int k=0; k+2<len; k++)
+  {
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, _tag_trigram(name + k));
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
+    sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+  }
+  dt_database_release_statement(darktable.db, stmt);
+}
+
+static void
+_tag_trigrams_build()
+{
+  dt_database_start_savepoint(darktable.db, "tag_trigrams");
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), "DELETE FROM memory.tag_trigrams", NULL, NULL, NULL);
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT id, name FROM tags", -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    _tag_trigrams_insert(sqlite3_column_int(stmt, 0), (const char *)sqlite3_column_text(stmt, 1));
+  sqlite3_finalize(stmt);
+  dt_database_release_savepoint(darktable.db, "tag_trigrams");
+  g_atomic_int_set(&_tag_trigrams_valid, 1);
+}
 
 gboolean dt_tag_new(const char *name,guint *tagid)
 {
@@ -32,8 +139,8 @@ gboolean dt_tag_new(const char *name,guint *tagid)
   if (!name || name[0] == '\0')
     return FALSE; // no tagid name.
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM tags WHERE name = ?1", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT id FROM tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
   if(rt == SQLITE_ROW)
@@ -41,35 +148,26 @@ gboolean dt_tag_new(const char *name,guint *tagid)
     // tagid already exists.
     if( tagid != NULL)
       *tagid=sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
     return  TRUE;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO tags (id, name) VALUES (null, ?1)", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "INSERT INTO tags (id, name) VALUES (null, ?1)");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM tags WHERE name = ?1", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT id FROM tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   if (sqlite3_step(stmt) == SQLITE_ROW)
     id = sqlite3_column_int(stmt, 0);
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "INSERT INTO tagxtag SELECT id, ?1, 0 FROM tags", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "UPDATE tagxtag SET count = 1000000 WHERE id1 = ?1 AND id2 = ?1",
-                              -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, id);
-  sqlite3_step(stmt);
-  sqlite3_finalize(stmt);
+  if(g_atomic_int_get(&_tag_trigrams_valid))
+    _tag_trigrams_insert(id, name);
 
   if( tagid != NULL)
     *tagid=id;
@@ -112,6 +210,11 @@ guint dt_tag_remove(const guint tagid, gboolean final)
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
     sqlite3_step(stmt);
     sqlite3_finalize(stmt);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "DELETE FROM memory.tag_trigrams WHERE id=?1", -1, &stmt, NULL);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
     DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                                 "DELETE FROM tagged_images WHERE tagid=?1", -1, &stmt, NULL);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
@@ -131,13 +234,13 @@ gchar *dt_tag_get_name(const guint tagid)
   int rt;
   char *name=NULL;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT name FROM tags WHERE id= ?1", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT name FROM tags WHERE id= ?1");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1,tagid);
   rt = sqlite3_step(stmt);
   if( rt== SQLITE_ROW )
     name=g_strdup((const char *)sqlite3_column_text(stmt, 0));
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
   return name;
 }
@@ -164,6 +267,8 @@ void dt_tag_reorganize(const gchar *source, const gchar *dest)
              source, dest, tag, source);
 
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query, NULL, NULL, NULL);
+  // names changed all over the place, look them up again next time:
+  g_atomic_int_set(&_tag_trigrams_valid, 0);
 
   /* raise signal of tags change to refresh keywords module */
   //dt_control_signal_raise(darktable.signals, DT_SIGNAL_TAG_CHANGED);
@@ -173,8 +278,8 @@ gboolean dt_tag_exists(const char *name,guint *tagid)
 {
   int rt;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                              "SELECT id FROM tags WHERE name = ?1", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db,
+                                   "SELECT id FROM tags WHERE name = ?1");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, name, strlen(name), SQLITE_TRANSIENT);
   rt = sqlite3_step(stmt);
 
@@ -182,60 +287,46 @@ gboolean dt_tag_exists(const char *name,guint *tagid)
   {
     if( tagid != NULL)
       *tagid = sqlite3_column_int64(stmt, 0);
-    sqlite3_finalize(stmt);
+    dt_database_release_statement(darktable.db, stmt);
     return  TRUE;
   }
 
   *tagid = -1;
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   return FALSE;
 }
 
-//FIXME: shall we increment count in tagxtag if the image was already tagged?
 void dt_tag_attach(guint tagid,gint imgid)
 {
-  sqlite3_stmt *stmt;
+  // one go for the whole selection. the pairs are counted before the tag is attached,
+  // so images which already have it don't count twice.
+  dt_database_start_savepoint(darktable.db, "tag_attach");
   if(imgid > 0)
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO tagged_images (imgid, tagid) VALUES (?1, ?2)",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count + 1 WHERE "
-                                "(id1 = ?1 AND id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2)) "
-                                "OR "
-                                "(id2 = ?1 AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_execute(DT_TAG_PAIRS_INSERT(DT_TAG_IMAGES_NEW_SINGLE), tagid, imgid);
+    _tag_execute(DT_TAG_PAIRS_UPDATE("+", DT_TAG_IMAGES_NEW_SINGLE), tagid, imgid);
+    _tag_execute("INSERT OR IGNORE INTO tagged_images (imgid, tagid) VALUES (?2, ?1)", tagid, imgid);
   }
   else
   {
-    // insert into tagged_images if not there already.
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "INSERT OR REPLACE INTO tagged_images SELECT imgid, ?1 "
-                                "FROM selected_images", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count + 1 WHERE (id1 = ?1 AND id2 IN "
-                                "(SELECT tagid FROM selected_images JOIN tagged_images)) OR "
-                                "(id2 = ?1 AND id1 IN (SELECT tagid FROM selected_images "
-                                "JOIN tagged_images))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_execute(DT_TAG_PAIRS_INSERT(DT_TAG_IMAGES_NEW_SELECTED), tagid, imgid);
+    _tag_execute(DT_TAG_PAIRS_UPDATE("+", DT_TAG_IMAGES_NEW_SELECTED), tagid, imgid);
+    _tag_execute("INSERT OR IGNORE INTO tagged_images (imgid, tagid) SELECT imgid, ?1 "
+                 "FROM selected_images", tagid, imgid);
   }
+  dt_database_release_savepoint(darktable.db, "tag_attach");
+}
+
+void dt_tag_attach_images(guint tagid, const gint *imgs, const int num)
+{
+  if(num <= 0) return;
+  dt_database_start_savepoint(darktable.db, "tag_attach");
+  _tag_set_images(imgs, num);
+  _tag_execute(DT_TAG_PAIRS_INSERT(DT_TAG_IMAGES_NEW_LIST), tagid, 0);
+  _tag_execute(DT_TAG_PAIRS_UPDATE("+", DT_TAG_IMAGES_NEW_LIST), tagid, 0);
+  _tag_execute("INSERT OR IGNORE INTO tagged_images (imgid, tagid) SELECT imgid, ?1 "
+               "FROM memory.tag_images", tagid, 0);
+  dt_database_release_savepoint(darktable.db, "tag_attach");
 }
 
 void dt_tag_attach_list(GList *tags,gint imgid)
@@ -277,59 +368,96 @@ void dt_tag_attach_string_list(const gchar *tags, gint imgid)
 
 void dt_tag_detach(guint tagid,gint imgid)
 {
-  sqlite3_stmt *stmt;
+  dt_database_start_savepoint(darktable.db, "tag_detach");
   if(imgid > 0)
   {
     // remove from specified image by id
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "UPDATE tagxtag SET count = count - 1 WHERE (id1 = ?1 AND id2 IN "
-                                "(SELECT tagid FROM tagged_images WHERE imgid = ?2)) OR (id2 = ?1 "
-                                "AND id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?2))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "DELETE FROM tagged_images WHERE tagid = ?1 AND imgid = ?2",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, imgid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_execute(DT_TAG_PAIRS_UPDATE("-", DT_TAG_IMAGES_OLD_SINGLE), tagid, imgid);
+    _tag_execute(DT_TAG_PAIRS_CLEANUP, tagid, 0);
+    _tag_execute("DELETE FROM tagged_images WHERE tagid = ?1 AND imgid = ?2", tagid, imgid);
   }
   else
   {
     // remove from all selected images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "update tagxtag set count = count - 1 where (id1 = ?1 and id2 in "
-                                "(select tagid from selected_images join tagged_images)) or (id2 = ?1 "
-                                "and id1 in (select tagid from selected_images join tagged_images))",
-                                -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
-
-    // remove from tagged_images
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "delete from tagged_images where tagid = ?1 and imgid in "
-                                "(select imgid from selected_images)", -1, &stmt, NULL);
-    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, tagid);
-    sqlite3_step(stmt);
-    sqlite3_finalize(stmt);
+    _tag_execute(DT_TAG_PAIRS_UPDATE("-", DT_TAG_IMAGES_OLD_SELECTED), tagid, imgid);
+    _tag_execute(DT_TAG_PAIRS_CLEANUP, tagid, 0);
+    _tag_execute("DELETE FROM tagged_images WHERE tagid = ?1 AND imgid IN "
+                 "(SELECT imgid FROM selected_images)", tagid, imgid);
   }
+  dt_database_release_savepoint(darktable.db, "tag_detach");
+}
+
+void dt_tag_detach_images(guint tagid, const gint *imgs, const int num)
+{
+  if(num <= 0) return;
+  dt_database_start_savepoint(darktable.db, "tag_detach");
+  _tag_set_images(imgs, num);
+  _tag_execute(DT_TAG_PAIRS_UPDATE("-", DT_TAG_IMAGES_OLD_LIST), tagid, 0);
+  _tag_execute(DT_TAG_PAIRS_CLEANUP, tagid, 0);
+  _tag_execute("DELETE FROM tagged_images WHERE tagid = ?1 AND imgid IN "
+               "(SELECT imgid FROM memory.tag_images)", tagid, 0);
+  dt_database_release_savepoint(darktable.db, "tag_detach");
 }
 
 void dt_tag_detach_by_string(const char *name, gint imgid)
 {
-  char query[2048]= {0};
-  g_snprintf(query, sizeof(query),
-             "DELETE FROM tagged_images WHERE tagid IN (SELECT id FROM "
-             "tags WHERE name LIKE '%s') AND imgid = %d;", name, imgid);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query,
-                        NULL, NULL, NULL);
+  // collect them first, so the pairs can be updated one tag at a time:
+  GList *tags = NULL;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "SELECT tagid FROM tagged_images WHERE imgid = ?1 AND tagid IN "
+                              "(SELECT id FROM tags WHERE name LIKE ?2)", -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 2, name, -1, SQLITE_TRANSIENT);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+    tags = g_list_prepend(tags, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+  sqlite3_finalize(stmt);
+  for(GList *t = tags; t; t = g_list_next(t))
+    dt_tag_detach(GPOINTER_TO_INT(t->data), imgid);
+  g_list_free(tags);
+}
+
+void dt_tag_detach_all(gint imgid)
+{
+  dt_database_start_savepoint(darktable.db, "tag_detach");
+  dt_tag_update_pairs(imgid, -1);
+  sqlite3_stmt *stmt = dt_database_get_statement(darktable.db, "DELETE FROM tagged_images WHERE imgid = ?1");
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  sqlite3_step(stmt);
+  dt_database_release_statement(darktable.db, stmt);
+  dt_database_release_savepoint(darktable.db, "tag_detach");
+}
+
+void dt_tag_update_pairs(gint imgid, gint delta)
+{
+  sqlite3_stmt *stmt;
+  if(delta > 0)
+  {
+    stmt = dt_database_get_statement(darktable.db,
+                                     "INSERT OR IGNORE INTO tagxtag (id1, id2, count) SELECT a.tagid, b.tagid, 0 "
+                                     "FROM tagged_images a JOIN tagged_images b ON b.imgid = a.imgid AND b.tagid > a.tagid "
+                                     "WHERE a.imgid = ?1");
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step(stmt);
+    dt_database_release_statement(darktable.db, stmt);
+  }
+  stmt = dt_database_get_statement(darktable.db,
+                                   "UPDATE tagxtag SET count = count + ?2 WHERE "
+                                   "id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?1) AND "
+                                   "id2 IN (SELECT tagid FROM tagged_images WHERE imgid = ?1)");
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, delta);
+  sqlite3_step(stmt);
+  dt_database_release_statement(darktable.db, stmt);
+  if(delta < 0)
+  {
+    stmt = dt_database_get_statement(darktable.db,
+                                     "DELETE FROM tagxtag WHERE count <= 0 AND "
+                                     "id1 IN (SELECT tagid FROM tagged_images WHERE imgid = ?1)");
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    sqlite3_step(stmt);
+    dt_database_release_statement(darktable.db, stmt);
+  }
 }
 
 
@@ -338,20 +466,18 @@ uint32_t dt_tag_get_attached(gint imgid,GList **result)
   sqlite3_stmt *stmt;
   if(imgid > 0)
   {
-    char query[1024];
-    snprintf(query, sizeof(query),
-             "SELECT DISTINCT T.id, T.name FROM tagged_images "
-             "JOIN tags T on T.id = tagged_images.tagid "
-             "WHERE tagged_images.imgid = %d", imgid);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1,
-                                &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "SELECT DISTINCT T.id, T.name FROM tagged_images "
+                                     "JOIN tags T on T.id = tagged_images.tagid "
+                                     "WHERE tagged_images.imgid = ?1");
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
   }
   else
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
-                                "SELECT DISTINCT T.id, T.name FROM selected_images JOIN "
-                                "tagged_images ON selected_images.imgid = tagged_images.imgid "
-                                "JOIN tags T ON T.id = tagged_images.tagid", -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db,
+                                     "SELECT DISTINCT T.id, T.name FROM selected_images JOIN "
+                                     "tagged_images ON selected_images.imgid = tagged_images.imgid "
+                                     "JOIN tags T ON T.id = tagged_images.tagid");
   }
 
   // Create result
@@ -364,7 +490,7 @@ uint32_t dt_tag_get_attached(gint imgid,GList **result)
     *result=g_list_append(*result,t);
     count++;
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
   return count;
 }
 
@@ -455,19 +581,23 @@ gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
  * * Tags which appear as tagxtag.id1, where (keyword's name = tagxtag.id2)
  *   are listed second, ordered as before.
  *
- * We do not suggest tags which have not yet been matched up in tagxtag,
- * because it is up to the user to add new tags to the list and thereby
- * make the association.
+ * * The tags whose name matches the keyword themselves come first of all,
+ *   also the new ones which have no pairs in tagxtag yet.
  *
  * Expressing these as separate queries avoids making the sqlite3 engine
  * do a large number of operations and thus makes the user experience
  * snappy.
  *
+ * Keywords of three or more characters don't scan the whole tags table:
+ * only names which contain all trigrams of the keyword are candidates,
+ * and those are looked up in memory.tag_trigrams.
+ *
  * SELECT T.id FROM tags T WHERE T.name LIKE '?1';  --> into temp table
  * SELECT TXT.id2 FROM tagxtag TXT WHERE TXT.id1 IN (temp table)
  *   AND TXT.count > 0 ORDER BY TXT.count DESC;
  * SELECT TXT.id1 FROM tagxtag TXT WHERE TXT.id2 IN (temp table)
  *   AND TXT.count > 0 ORDER BY TXT.count DESC;
+ * SELECT id, 1000000 FROM (temp table);
  *
  * SELECT DISTINCT(T.name) FROM tags T JOIN memoryquery MQ on MQ.id = T.id;
  *
@@ -475,7 +605,6 @@ gchar *dt_tag_get_hierarchical(gint imgid, const gchar *separator)
 uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
 {
   sqlite3_stmt *stmt;
-  char query[1024];
   /*
    * Earlier versions of this function used a large collation of selects
    * and joins, resulting in multi-*second* timings for sqlite3_exec().
@@ -491,12 +620,41 @@ uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
     return 0;
 
   /* SELECT T.id FROM tags T WHERE T.name LIKE '%%%s%%';  --> into temp table */
-  memset(query, 0, sizeof(query));
-  snprintf(query, sizeof(query),
-           "INSERT INTO memory.tagq (id) SELECT id FROM tags T WHERE "
-           "T.name LIKE '%%%s%%' ", keyword);
-  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db), query,
-                        NULL, NULL, NULL);
+  const int len = strlen(keyword);
+  if(len >= 3 && !strpbrk(keyword, "%_"))
+  {
+    if(!g_atomic_int_get(&_tag_trigrams_valid)) _tag_trigrams_build();
+    // the distinct trigrams of the keyword, which are all plain integers:
+    GString *trigrams = g_string_new(NULL);
+    int cnt = 0;
+    for(int k=0; k+2<len; k++)
+    {
+      const int t = _tag_trigram(keyword + k);
+      int seen = 0;
+      for(int j=0; j<k && !seen; j++) seen = (_tag_trigram(keyword + j) == t);
+      if(seen) continue;
+      g_string_append_printf(trigrams, "%s%d", cnt ? "," : "", t);
+      cnt++;
+    }
+    gchar *query = g_strdup_printf("INSERT INTO memory.tagq (id) SELECT id FROM tags T WHERE "
+                                   "T.id IN (SELECT id FROM memory.tag_trigrams WHERE trigram IN (%s) "
+                                   "GROUP BY id HAVING count(*) = %d) AND T.name LIKE ?1",
+                                   trigrams->str, cnt);
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    g_free(query);
+    g_string_free(trigrams, TRUE);
+  }
+  else
+  {
+    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                "INSERT INTO memory.tagq (id) SELECT id FROM tags T WHERE "
+                                "T.name LIKE ?1", -1, &stmt, NULL);
+  }
+  gchar *pattern = g_strdup_printf("%%%s%%", keyword);
+  DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, pattern, -1, SQLITE_TRANSIENT);
+  sqlite3_step(stmt);
+  sqlite3_finalize(stmt);
+  g_free(pattern);
 
   /*
    * SELECT TXT.id2 FROM tagxtag TXT WHERE TXT.id1 IN (temp table)
@@ -522,6 +680,15 @@ uint32_t dt_tag_get_suggestions(const gchar *keyword, GList **result)
                         "ORDER BY TXT.count DESC",
                         NULL, NULL, NULL);
 
+  /*
+   * the matching tags themselves. tagxtag has no pairs of a tag with itself,
+   * and none at all for tags which are on no image yet.
+   */
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "INSERT OR REPLACE INTO memory.taglist (id, count) "
+                        "SELECT id, 1000000 FROM memory.tagq",
+                        NULL, NULL, NULL);
+
   /* Now put all the bits together */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
                               "SELECT T.name, T.id, MT.count FROM tags T JOIN memory.taglist MT ON "
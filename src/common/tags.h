@@ -46,6 +46,13 @@ gboolean dt_tag_exists(const char *name,guint *tagid);
 /** attach a list of tags on selected images. \param[in] tagid id of tag to attach. \param[in] imgid the image id to attach tag to, if < 0 selected images are used. */
 void dt_tag_attach(guint tagid,gint imgid);
 
+/** statements dt_tag_attach() and dt_tag_detach() run for one image, savepoint and release included.
+    the list variants run num+6, whatever the number of images. */
+#define DT_TAG_SINGLE_STATEMENTS 5
+
+/** attach a tag to a list of images, in one go instead of one image at a time. \param[in] tagid id of tag to attach. \param[in] imgs the image ids. \param[in] num number of images. */
+void dt_tag_attach_images(guint tagid, const gint *imgs, const int num);
+
 /** attach a list of tags on selected images. \param[in] tags a list of ids of tags. \param[in] imgid the image id to attach tag to, if < 0 selected images are used. \note If tag not exists it's created.*/
 void dt_tag_attach_list(GList *tags,gint imgid);
 
@@ -55,9 +62,18 @@ void dt_tag_attach_string_list(const gchar *tags, gint imgid);
 /** detach tag from images. \param[in] tagid if of tag to deattach. \param[in] imgid the image id to attach tag from, if < 0 selected images are used. */
 void dt_tag_detach(guint tagid,gint imgid);
 
+/** detach tag from a list of images. \param[in] tagid id of tag to detach. \param[in] imgs the image ids. \param[in] num number of images. */
+void dt_tag_detach_images(guint tagid, const gint *imgs, const int num);
+
 /** detach tags from images that matches name, it is valid to use % to match tag */
 void dt_tag_detach_by_string(const char *name, gint imgid);
 
+/** detach all tags from an image, as before they are read from its xmp sidecar again. */
+void dt_tag_detach_all(gint imgid);
+
+/** update the counts of all pairs of tags attached to an image, after they have been attached (delta 1) or before they will be removed (delta -1). */
+void dt_tag_update_pairs(gint imgid, gint delta);
+
 /** retrieves a list of tags of specified imgid \param[out] result a list of dt_tag_t. */
 uint32_t dt_tag_get_attached(gint imgid,GList **result);
 
@@ -184,6 +184,16 @@ static void dt_control_sanitize_database()
                         "(tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT REPLACE, "
                         "count INTEGER)",
                         NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "CREATE TABLE memory.tag_trigrams (trigram INTEGER, id INTEGER, "
+                        "PRIMARY KEY (trigram, id))",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "CREATE INDEX memory.tag_trigrams_id_index ON tag_trigrams (id)",
+                        NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "CREATE TABLE memory.tag_images (imgid INTEGER PRIMARY KEY)",
+                        NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "CREATE TABLE memory.history (imgid integer, num integer, module integer, "
                         "operation varchar(256) UNIQUE ON CONFLICT REPLACE, op_params blob, enabled integer, "
@@ -435,6 +445,10 @@ void dt_control_create_database_schema()
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "create table tagged_images (imgid integer, tagid integer, "
                         "primary key(imgid, tagid))", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "create index tagxtag_id2_index on tagxtag (id2)", NULL, NULL, NULL);
+  DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
+                        "create index tagged_images_tagid_index on tagged_images (tagid)", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
                         "create table styles (name varchar,description varchar)", NULL, NULL, NULL);
   DT_DEBUG_SQLITE3_EXEC(dt_database_get(darktable.db),
@@ -740,6 +754,30 @@ void dt_control_init(dt_control_t *s)
       // and the colorspace as specified in some image types
       sqlite3_exec(dt_database_get(darktable.db), "alter table images add column colorspace integer", NULL, NULL, NULL);
 
+      // tagxtag used to hold every pair of tags there is. now it only has the pairs which share
+      // an image, once with id1 < id2. the old table always has the diagonal, recount from tagged_images:
+      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                                  "select 1 from tagxtag where id1 = id2 limit 1", -1, &stmt, NULL);
+      const int dense_tagxtag = (sqlite3_step(stmt) == SQLITE_ROW);
+      sqlite3_finalize(stmt);
+      if(dense_tagxtag)
+      {
+        sqlite3_exec(dt_database_get(darktable.db), "begin transaction", NULL, NULL, NULL);
+        sqlite3_exec(dt_database_get(darktable.db), "drop table tagxtag", NULL, NULL, NULL);
+        sqlite3_exec(dt_database_get(darktable.db),
+                     "create table tagxtag (id1 integer, id2 integer, count integer, "
+                     "primary key(id1, id2))", NULL, NULL, NULL);
+        sqlite3_exec(dt_database_get(darktable.db),
+                     "insert into tagxtag (id1, id2, count) select a.tagid, b.tagid, count(*) "
+                     "from tagged_images a join tagged_images b on b.imgid = a.imgid and b.tagid > a.tagid "
+                     "group by a.tagid, b.tagid", NULL, NULL, NULL);
+        sqlite3_exec(dt_database_get(darktable.db), "commit", NULL, NULL, NULL);
+      }
+      sqlite3_exec(dt_database_get(darktable.db),
+                   "create index if not exists tagxtag_id2_index on tagxtag (id2)", NULL, NULL, NULL);
+      sqlite3_exec(dt_database_get(darktable.db),
+                   "create index if not exists tagged_images_tagid_index on tagged_images (tagid)", NULL, NULL, NULL);
+
       dt_pthread_mutex_unlock(&(darktable.control->global_mutex));
     }
     dt_control_sanitize_database();
@@ -1142,6 +1180,22 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job)
   return 0;
 }
 
+int32_t dt_control_jobs_pending(dt_control_t *s)
+{
+  if(!dt_control_running()) return 0;
+  int32_t pending = 0;
+  const time_t now = time(NULL);
+  dt_pthread_mutex_lock(&s->queue_mutex);
+  for(GList *jobitem = s->queue; jobitem; jobitem = g_list_next(jobitem))
+  {
+    // background jobs waiting for their time don't count:
+    const dt_job_t *j = (const dt_job_t *)jobitem->data;
+    if(j->ts_execute <= now) pending++;
+  }
+  dt_pthread_mutex_unlock(&s->queue_mutex);
+  return pending;
+}
+
 int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job)
 {
   int32_t found_j = -1;
@@ -301,6 +301,8 @@ int32_t dt_control_add_job(dt_control_t *s, dt_job_t *job);
 /** adds a job to queue tagged as background job and with a delay */
 int32_t dt_control_add_background_job(dt_control_t *s, dt_job_t *job, time_t delay);
 int32_t dt_control_revive_job(dt_control_t *s, dt_job_t *job);
+/** number of queued jobs which are ready to run. */
+int32_t dt_control_jobs_pending(dt_control_t *s);
 int32_t dt_control_run_job_res(dt_control_t *s, int32_t res);
 int32_t dt_control_add_job_res(dt_control_t *s, dt_job_t *job, int32_t res);
 
@@ -25,6 +25,7 @@
 #include "common/imageio_dng.h"
 #include "common/exif.h"
 #include "common/film.h"
+#include "common/fswatch.h"
 #include "common/history.h"
 #include "common/imageio_module.h"
 #include "common/debug.h"
@@ -39,6 +40,9 @@
 #include <glib.h>
 #include <glib/gstdio.h>
 
+// image structs loaded with one query by jobs walking long image lists
+#define DT_CONTROL_PREFETCH_CHUNK 256
+
 #if GLIB_CHECK_VERSION (2, 26, 0)
 typedef struct dt_control_time_offset_t
 {
@@ -72,18 +76,29 @@ int32_t dt_control_write_sidecar_files_job_run(dt_job_t *job)
   long int imgid = -1;
   dt_control_image_enumerator_t *t1 = (dt_control_image_enumerator_t *)job->param;
   GList *t = t1->index;
+  // load the image structs a chunk at a time and throw them out again afterwards
+  uint32_t ids[DT_CONTROL_PREFETCH_CHUNK], loaded[DT_CONTROL_PREFETCH_CHUNK];
   while(t)
   {
-    gboolean from_cache = FALSE;
-    imgid = (long int)t->data;
-    const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, (int32_t)imgid);
-    char dtfilename[DT_MAX_PATH_LEN+4];
-    dt_image_full_path(img->id, dtfilename, DT_MAX_PATH_LEN, &from_cache);
-    char *c = dtfilename + strlen(dtfilename);
-    sprintf(c, ".xmp");
-    dt_exif_xmp_write(imgid, dtfilename);
-    dt_image_cache_read_release(darktable.image_cache, img);
-    t = g_list_delete_link(t, t);
+    int num = 0;
+    for(GList *l = t; l && num < DT_CONTROL_PREFETCH_CHUNK; l = g_list_next(l))
+      ids[num++] = (long int)l->data;
+    const int num_loaded = dt_image_cache_prefetch(darktable.image_cache, ids, num, loaded);
+    for(int k=0; k<num; k++)
+    {
+      gboolean from_cache = FALSE;
+      imgid = (long int)t->data;
+      const dt_image_t *img = dt_image_cache_read_get(darktable.image_cache, (int32_t)imgid);
+      char dtfilename[DT_MAX_PATH_LEN+4];
+      dt_image_full_path(img->id, dtfilename, DT_MAX_PATH_LEN, &from_cache);
+      char *c = dtfilename + strlen(dtfilename);
+      sprintf(c, ".xmp");
+      dt_exif_xmp_write(imgid, dtfilename);
+      dt_fswatch_written(darktable.fswatch, dtfilename);
+      dt_image_cache_read_release(darktable.image_cache, img);
+      t = g_list_delete_link(t, t);
+    }
+    dt_image_cache_prefetch_drop(darktable.image_cache, loaded, num_loaded);
   }
   return 0;
 }
@@ -296,6 +311,7 @@ int32_t dt_control_flip_images_job_run(dt_job_t *job)
   char message[512]= {0};
   snprintf(message, 512, ngettext ("flipping %d image", "flipping %d images", total), total );
   const guint *jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
+  dt_image_cache_write_batch_begin(darktable.image_cache);
   while(t)
   {
     imgid = (long int)t->data;
@@ -304,6 +320,7 @@ int32_t dt_control_flip_images_job_run(dt_job_t *job)
     fraction=1.0/total;
     dt_control_backgroundjobs_progress(darktable.control, jid, fraction);
   }
+  dt_image_cache_write_batch_end(darktable.image_cache);
   dt_control_backgroundjobs_destroy(darktable.control, jid);
   dt_control_queue_redraw_center();
   return 0;
@@ -488,6 +505,7 @@ int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
   GTimeZone *tz_utc = g_time_zone_new_utc();
 
   /* go thru each selected image and lookup location in gpx */
+  dt_image_cache_write_batch_begin(darktable.image_cache);
   do
   {
     GTimeVal timestamp;
@@ -544,6 +562,7 @@ int32_t dt_control_gpx_apply_job_run(dt_job_t *job)
 
   }
   while((t = g_list_next(t)) != NULL);
+  dt_image_cache_write_batch_end(darktable.image_cache);
 
   dt_control_log(_("applied matched GPX location onto %d image(s)"), cntr);
 
@@ -584,6 +603,25 @@ void dt_control_image_enumerator_job_film_init(dt_control_image_enumerator_t *t,
   sqlite3_finalize(stmt);
 }
 
+/* enumerator of the images in the current collection, in its order */
+void dt_control_image_enumerator_job_collection_init(dt_control_image_enumerator_t *t)
+{
+  const gchar *query = dt_collection_get_query(darktable.collection);
+  t->index = NULL;
+  if(!query) return;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, 0);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, -1);
+  while (sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    long int imgid = sqlite3_column_int(stmt, 0);
+    t->index = g_list_prepend(t->index, (gpointer)imgid);
+  }
+  sqlite3_finalize(stmt);
+  t->index = g_list_reverse(t->index);
+}
+
 /* enumerator of selected images */
 void dt_control_image_enumerator_job_selected_init(dt_control_image_enumerator_t *t)
 {
@@ -977,6 +1015,100 @@ int32_t dt_control_local_copy_images_job_run(dt_job_t *job)
   return 0;
 }
 
+/* the export runs as two stages connected by a bounded queue: decoder threads read and
+   decode the raws of the next images into the mipmap cache, while the export threads develop,
+   encode and write. the storage modules do the last three in one go, so they share a stage. */
+typedef struct dt_control_export_queue_t
+{
+  dt_pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  dt_job_t *job;
+  // images not decoded yet
+  GList *todo;
+  // decoded, waiting for an export thread, as dt_control_export_ready_t. each holds a read lock
+  // on its full buffer, so it can't be evicted before it is used. together with the ones being
+  // decoded at most capacity of them.
+  GQueue *ready;
+  int decoding;
+  int capacity;
+  // decoder threads still running
+  int decoders;
+  // images handed to the export threads so far
+  int taken;
+  // seconds spent working and waiting, per stage, summed over the threads
+  double busy[2], wait[2];
+}
+dt_control_export_queue_t;
+
+typedef struct dt_control_export_ready_t
+{
+  int32_t imgid;
+  // locked full buffer, or size DT_MIPMAP_NONE if the image wasn't decoded ahead
+  dt_mipmap_buffer_t buf;
+}
+dt_control_export_ready_t;
+
+static dt_control_export_ready_t *_control_export_decode_image(const int32_t imgid)
+{
+  dt_control_export_ready_t *r = (dt_control_export_ready_t *)malloc(sizeof(dt_control_export_ready_t));
+  r->imgid = imgid;
+  r->buf.size = DT_MIPMAP_NONE;
+  r->buf.buf = NULL;
+  // unavailable images are left to the export threads, which tell the user
+  const dt_image_t *image = dt_image_cache_read_get(darktable.image_cache, imgid);
+  if(!image) return r;
+  char imgfilename[DT_MAX_PATH_LEN];
+  gboolean from_cache = TRUE;
+  dt_image_full_path(image->id, imgfilename, DT_MAX_PATH_LEN, &from_cache);
+  dt_image_cache_read_release(darktable.image_cache, image);
+  if(!g_file_test(imgfilename, G_FILE_TEST_IS_REGULAR)) return r;
+
+  // keep the lock, the export thread releases it when it's done with the image:
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &r->buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  return r;
+}
+
+static void _control_export_ready_free(dt_control_export_ready_t *r)
+{
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &r->buf);
+  free(r);
+}
+
+static void *_control_export_decoder(void *data)
+{
+  dt_control_export_queue_t *q = (dt_control_export_queue_t *)data;
+  double busy = 0.0, wait = 0.0;
+  dt_pthread_mutex_lock(&q->mutex);
+  while(1)
+  {
+    double start = dt_get_wtime();
+    while(q->todo && g_queue_get_length(q->ready) + q->decoding >= q->capacity &&
+          dt_control_job_get_state(q->job) != DT_JOB_STATE_CANCELLED)
+      dt_pthread_cond_wait(&q->cond, &q->mutex);
+    wait += dt_get_wtime() - start;
+    if(!q->todo || dt_control_job_get_state(q->job) == DT_JOB_STATE_CANCELLED) break;
+    const long int imgid = (long int)q->todo->data;
+    q->todo = g_list_delete_link(q->todo, q->todo);
+    q->decoding++;
+    dt_pthread_mutex_unlock(&q->mutex);
+
+    start = dt_get_wtime();
+    dt_control_export_ready_t *r = _control_export_decode_image(imgid);
+    busy += dt_get_wtime() - start;
+
+    dt_pthread_mutex_lock(&q->mutex);
+    q->decoding--;
+    g_queue_push_tail(q->ready, r);
+    pthread_cond_broadcast(&q->cond);
+  }
+  q->decoders--;
+  q->busy[0] += busy;
+  q->wait[0] += wait;
+  pthread_cond_broadcast(&q->cond);
+  dt_pthread_mutex_unlock(&q->mutex);
+  return NULL;
+}
+
 static int32_t dt_control_export_job_run(dt_job_t *job)
 {
   long int imgid = -1;
@@ -989,6 +1121,9 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   dt_imageio_module_storage_t *mstorage = dt_imageio_get_storage_by_index(settings->storage_index);
   g_assert(mstorage);
 
+  // exporters may copy or read the xmp sidecars, don't leave them half written:
+  dt_image_cache_flush(darktable.image_cache);
+
   // Get max dimensions...
   uint32_t w,h,fw,fh,sw,sh;
   fw=fh=sw=sh=0;
@@ -1018,7 +1153,19 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   dt_control_backgroundjobs_set_cancellable(darktable.control, jid, job);
   const dt_control_t *control = darktable.control;
 
+  // bring in the image structs of the whole list with a few queries. the ones
+  // which weren't cached before are dropped again when we're done.
+  uint32_t *prefetch_ids = (uint32_t *)malloc(sizeof(uint32_t)*2*MAX(1, total));
+  int prefetched = 0;
+  if(prefetch_ids)
+  {
+    int k = 0;
+    for(GList *l = t; l; l = g_list_next(l)) prefetch_ids[k++] = (long int)l->data;
+    prefetched = dt_image_cache_prefetch(darktable.image_cache, prefetch_ids, total, prefetch_ids + total);
+  }
+
   double fraction=0;
+  const double export_start = dt_get_wtime();
 #ifdef _OPENMP
   // limit this to num threads = num full buffers - 1 (keep one for darkroom mode)
   // use min of user request and mipmap cache entries
@@ -1026,10 +1173,52 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
   // GCC won't accept that this variable is used in a macro, considers
   // it set but not used, which makes for instance Fedora break.
   const __attribute__((__unused__)) int num_threads = MAX(1, MIN(full_entries, 8));
+#else
+  const int num_threads = 1;
+#endif
+
+  // decode ahead: one image waiting for each export thread is enough to hide the disk,
+  // more would only take full buffers away from the cache. the decoded images are locked
+  // in the full cache, so they have to fit next to the ones the export threads work on,
+  // and one for the darkroom. if they don't, the export threads decode themselves.
+  const int full_slots = darktable.mipmap_cache->mip[DT_MIPMAP_FULL].cache.cost_quota;
+  dt_control_export_queue_t queue;
+  dt_pthread_mutex_init(&queue.mutex, NULL);
+  pthread_cond_init(&queue.cond, NULL);
+  queue.job = job;
+  queue.todo = t;
+  queue.ready = g_queue_new();
+  queue.decoding = 0;
+  queue.capacity = MIN(num_threads, full_slots - num_threads - 1);
+  queue.taken = 0;
+  queue.busy[0] = queue.busy[1] = queue.wait[0] = queue.wait[1] = 0.0;
+  const int num_decoders = queue.capacity > 0 ? CLAMP(dt_conf_get_int("parallel_export_decode"), 1, 4) : 0;
+  pthread_t decoders[4];
+  queue.decoders = 0;
+  for(int k=0; k<num_decoders; k++)
+    if(!pthread_create(decoders + queue.decoders, NULL, _control_export_decoder, &queue))
+      queue.decoders++;
+  const int started_decoders = queue.decoders;
+  // without decoders the export threads do all the work
+  if(!started_decoders)
+  {
+    for(GList *l = queue.todo; l; l = g_list_next(l))
+    {
+      dt_control_export_ready_t *r = (dt_control_export_ready_t *)malloc(sizeof(dt_control_export_ready_t));
+      r->imgid = (long int)l->data;
+      r->buf.size = DT_MIPMAP_NONE;
+      r->buf.buf = NULL;
+      g_queue_push_tail(queue.ready, r);
+    }
+    g_list_free(queue.todo);
+    queue.todo = NULL;
+  }
+
+#ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
-  #pragma omp parallel default(none) private(imgid) shared(control, fraction, w, h, stderr, mformat, mstorage, t, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
+  #pragma omp parallel default(none) private(imgid) shared(control, fraction, w, h, stderr, mformat, mstorage, queue, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
 #else
-  #pragma omp parallel private(imgid) shared(control, fraction, w, h, mformat, mstorage, t, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
+  #pragma omp parallel private(imgid) shared(control, fraction, w, h, mformat, mstorage, queue, sdata, job, jid, darktable, settings) num_threads(num_threads) if(num_threads > 1)
 #endif
   {
 #endif
@@ -1046,22 +1235,24 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
           etagid = 0;
     dt_tag_new("darktable|changed",&tagid);
     dt_tag_new("darktable|exported",&etagid);
+    double busy = 0.0, wait = 0.0;
 
-    while(t && dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
+    while(dt_control_job_get_state(job) != DT_JOB_STATE_CANCELLED)
     {
-#ifdef _OPENMP
-      #pragma omp critical
-#endif
-      {
-        if(!t)
-          imgid = 0;
-        else
-        {
-          imgid = (long int)t->data;
-          t = g_list_delete_link(t, t);
-          num = total - g_list_length(t);
-        }
-      }
+      double start = dt_get_wtime();
+      dt_pthread_mutex_lock(&queue.mutex);
+      while(g_queue_is_empty(queue.ready) && queue.decoders > 0)
+        dt_pthread_cond_wait(&queue.cond, &queue.mutex);
+      dt_control_export_ready_t *ready = (dt_control_export_ready_t *)g_queue_pop_head(queue.ready);
+      imgid = ready ? ready->imgid : 0;
+      if(imgid) num = ++queue.taken;
+      // room for the next decoded image
+      pthread_cond_broadcast(&queue.cond);
+      dt_pthread_mutex_unlock(&queue.mutex);
+      wait += dt_get_wtime() - start;
+      if(!imgid) break;
+
+      start = dt_get_wtime();
       // remove 'changed' tag from image
       dt_tag_detach(tagid, imgid);
       // make sure the 'exported' tag is set on the image
@@ -1086,6 +1277,9 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
           mstorage->store(mstorage,sdata, imgid, mformat, fdata, num, total, settings->high_quality);
         }
       }
+      // the pipe had its own lock on the full buffer, drop the one of the decoder:
+      _control_export_ready_free(ready);
+      busy += dt_get_wtime() - start;
 #ifdef _OPENMP
       #pragma omp critical
 #endif
@@ -1094,6 +1288,12 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
         dt_control_backgroundjobs_progress(control, jid, fraction);
       }
     }
+    dt_pthread_mutex_lock(&queue.mutex);
+    queue.busy[1] += busy;
+    queue.wait[1] += wait;
+    // wake up decoders waiting for room, in case we were cancelled
+    pthread_cond_broadcast(&queue.cond);
+    dt_pthread_mutex_unlock(&queue.mutex);
 #ifdef _OPENMP
     #pragma omp barrier
     #pragma omp master
@@ -1108,6 +1308,30 @@ static int32_t dt_control_export_job_run(dt_job_t *job)
 #ifdef _OPENMP
   }
 #endif
+  dt_pthread_mutex_lock(&queue.mutex);
+  pthread_cond_broadcast(&queue.cond);
+  dt_pthread_mutex_unlock(&queue.mutex);
+  for(int k=0; k<started_decoders; k++)
+    pthread_join(decoders[k], NULL);
+
+  // time working vs waiting per stage, to find the right number of threads for each
+  dt_print(DT_DEBUG_PERF, "[export] %d images in %.3f secs: %d decoder threads %.0f%% busy, "
+           "%d export threads %.0f%% busy\n", queue.taken, dt_get_wtime() - export_start,
+           started_decoders, 100.0*queue.busy[0]/MAX(queue.busy[0] + queue.wait[0], 1e-9),
+           num_threads, 100.0*queue.busy[1]/MAX(queue.busy[1] + queue.wait[1], 1e-9));
+  g_list_free(queue.todo);
+  // left over when cancelled:
+  while(!g_queue_is_empty(queue.ready))
+    _control_export_ready_free((dt_control_export_ready_t *)g_queue_pop_head(queue.ready));
+  g_queue_free(queue.ready);
+  pthread_cond_destroy(&queue.cond);
+  dt_pthread_mutex_destroy(&queue.mutex);
+
+  if(prefetch_ids)
+  {
+    dt_image_cache_prefetch_drop(darktable.image_cache, prefetch_ids + total, prefetched);
+    free(prefetch_ids);
+  }
   g_free(t1->data);
   return 0;
 }
@@ -1132,6 +1356,142 @@ void dt_control_export(GList *imgid_list,int max_width, int max_height, int form
   dt_control_add_job(darktable.control, &job);
 }
 
+/* the thumbnail service fills the mipmap cache for a whole collection ahead of time. it runs on
+   threads of its own, but only while no other jobs are waiting, so browsing always comes first. */
+typedef struct dt_control_thumbnails_t
+{
+  dt_pthread_mutex_t mutex;
+  dt_job_t *job;
+  const guint *jid;
+  uint32_t *ids;
+  int total;
+  // next image to take, images done, and how many of them needed new thumbnails
+  int next, done, generated;
+}
+dt_control_thumbnails_t;
+
+// how long to step back when the job queue is busy
+#define DT_CONTROL_THUMBNAILS_BACKOFF 100000
+
+static void *_control_thumbnails_worker(void *data)
+{
+  dt_control_thumbnails_t *t = (dt_control_thumbnails_t *)data;
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  while(dt_control_job_get_state(t->job) != DT_JOB_STATE_CANCELLED)
+  {
+    if(dt_control_jobs_pending(darktable.control))
+    {
+      g_usleep(DT_CONTROL_THUMBNAILS_BACKOFF);
+      continue;
+    }
+    dt_pthread_mutex_lock(&t->mutex);
+    const int k = t->next++;
+    dt_pthread_mutex_unlock(&t->mutex);
+    if(k >= t->total) break;
+
+    const uint32_t imgid = t->ids[k];
+    int generated = 0;
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_read_get(cache, &buf, imgid, DT_MIPMAP_2, DT_MIPMAP_TESTLOCK);
+    if(buf.buf)
+    {
+      dt_mipmap_cache_read_release(cache, &buf);
+    }
+    else
+    {
+      // one load for the largest size, the smaller ones are scaled down from that.
+      // a cache hit on mip3 doesn't do that by itself, so ask again:
+      dt_mipmap_cache_read_get(cache, &buf, imgid, DT_MIPMAP_3, DT_MIPMAP_BLOCKING);
+      dt_mipmap_cache_read_release(cache, &buf);
+      dt_mipmap_cache_fill_smaller(cache, imgid, DT_MIPMAP_3);
+      generated = 1;
+    }
+
+    dt_pthread_mutex_lock(&t->mutex);
+    t->done++;
+    t->generated += generated;
+    dt_control_backgroundjobs_progress(darktable.control, t->jid, t->done/(double)t->total);
+    dt_pthread_mutex_unlock(&t->mutex);
+  }
+  return NULL;
+}
+
+int32_t dt_control_generate_thumbnails_job_run(dt_job_t *job)
+{
+  dt_control_image_enumerator_t *t1 = (dt_control_image_enumerator_t *)job->param;
+  dt_mipmap_cache_t *cache = darktable.mipmap_cache;
+  // more than the cache holds would only push out the first ones again:
+  const int total = MIN((int)g_list_length(t1->index), (int)dt_cache_capacity(&cache->mip[DT_MIPMAP_2].cache));
+  if(total <= 0)
+  {
+    g_list_free(t1->index);
+    return 0;
+  }
+
+  dt_control_thumbnails_t t;
+  dt_pthread_mutex_init(&t.mutex, NULL);
+  t.job = job;
+  t.total = total;
+  t.next = t.done = t.generated = 0;
+  t.ids = (uint32_t *)malloc(sizeof(uint32_t)*total);
+  int k = 0;
+  for(GList *l = t1->index; l && k < total; l = g_list_next(l)) t.ids[k++] = (long int)l->data;
+  g_list_free(t1->index);
+
+  char message[512] = {0};
+  snprintf(message, 512, ngettext("generating %d thumbnail", "generating %d thumbnails", total), total);
+  t.jid = dt_control_backgroundjobs_create(darktable.control, 0, message);
+  dt_control_backgroundjobs_set_cancellable(darktable.control, t.jid, job);
+
+  // the cores the worker threads leave, but no more than the full buffers allow next to
+  // the darkroom and an export, for the images which need the pixelpipe.
+  const int full = dt_cache_capacity(&cache->mip[DT_MIPMAP_FULL].cache);
+  const int num_threads = CLAMP(dt_ctl_get_num_procs() - darktable.control->num_threads, 1, MAX(1, full/2));
+  pthread_t *threads = (pthread_t *)malloc(sizeof(pthread_t)*num_threads);
+  int started = 0;
+  const double start = dt_get_wtime();
+  for(k=0; k<num_threads; k++)
+    if(!pthread_create(threads + started, NULL, _control_thumbnails_worker, &t))
+      started++;
+  // no threads, do it ourselves:
+  if(!started) _control_thumbnails_worker(&t);
+  for(k=0; k<started; k++)
+    pthread_join(threads[k], NULL);
+  const double elapsed = dt_get_wtime() - start;
+
+  dt_control_backgroundjobs_destroy(darktable.control, t.jid);
+  dt_print(DT_DEBUG_PERF, "[thumbnails] %d of %d images needed thumbnails, %.3f secs on %d threads (%.1f images/s)\n",
+           t.generated, t.done, elapsed, MAX(started, 1), t.generated/MAX(elapsed, 1e-9));
+  if(darktable.gui)
+    dt_control_log(ngettext("generated %d thumbnail in %.1f secs", "generated %d thumbnails in %.1f secs", t.generated),
+                   t.generated, elapsed);
+  else
+    printf(ngettext("generated %d thumbnail in %.1f secs\n", "generated %d thumbnails in %.1f secs\n", t.generated),
+           t.generated, elapsed);
+  dt_control_signal_raise(darktable.signals, DT_SIGNAL_DEVELOP_MIPMAP_UPDATED);
+
+  free(threads);
+  free(t.ids);
+  dt_pthread_mutex_destroy(&t.mutex);
+  return 0;
+}
+
+void dt_control_generate_thumbnails_job_init(dt_job_t *job)
+{
+  dt_control_job_init(job, "generate thumbnails");
+  job->execute = &dt_control_generate_thumbnails_job_run;
+  dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)job->param;
+  dt_control_image_enumerator_job_collection_init(t);
+}
+
+void dt_control_generate_thumbnails()
+{
+  dt_job_t j;
+  dt_control_generate_thumbnails_job_init(&j);
+  dt_control_image_enumerator_t *t = (dt_control_image_enumerator_t *)j.param;
+  if(dt_control_add_job(darktable.control, &j)) g_list_free(t->index);
+}
+
 #if GLIB_CHECK_VERSION (2, 26, 0)
 int32_t dt_control_time_offset_job_run(dt_job_t *job)
 {
@@ -48,6 +48,10 @@ int32_t dt_control_flip_images_job_run(dt_job_t *job);
 
 void dt_control_image_enumerator_job_film_init(dt_control_image_enumerator_t *t, int32_t filmid);
 void dt_control_image_enumerator_job_selected_init(dt_control_image_enumerator_t *t);
+void dt_control_image_enumerator_job_collection_init(dt_control_image_enumerator_t *t);
+
+void dt_control_generate_thumbnails_job_init(dt_job_t *job);
+int32_t dt_control_generate_thumbnails_job_run(dt_job_t *job);
 
 int32_t dt_control_remove_images_job_run(dt_job_t *job);
 void dt_control_remove_images_job_init(dt_job_t *job);
@@ -86,6 +90,7 @@ void dt_control_set_local_copy_images();
 void dt_control_reset_local_copy_images();
 void dt_control_export(GList *imgid_list,int max_width, int max_height, int format_index, int storage_index, gboolean high_quality,char *style);
 void dt_control_merge_hdr();
+void dt_control_generate_thumbnails();
 
 void dt_control_gpx_apply(const gchar *filename, int32_t filmid, const gchar *tz);
 void dt_control_time_offset(const long int offset, long int imgid);
@@ -45,6 +45,23 @@ int32_t dt_film_import1_run(dt_job_t *job)
   }
   return 0;
 }
+
+void dt_film_import_files_init(dt_job_t *job, GList *files)
+{
+  dt_control_job_init(job, "import files from watched folders");
+  job->execute = &dt_film_import_files_run;
+  dt_film_import_files_t *t = (dt_film_import_files_t *)job->param;
+  t->files = files;
+}
+
+int32_t dt_film_import_files_run(dt_job_t *job)
+{
+  dt_film_import_files_t *t = (dt_film_import_files_t *)job->param;
+  dt_film_import_files(t->files);
+  g_list_free_full(t->files, g_free);
+  t->files = NULL;
+  return 0;
+}
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -48,6 +48,31 @@ int32_t dt_image_load_job_run(dt_job_t *job)
   return 0;
 }
 
+void dt_image_prefetch_job_init(dt_job_t *job, int32_t id, dt_mipmap_size_t mip,
+                                const int32_t *current, int32_t generation)
+{
+  dt_control_job_init(job, "prefetch image %d mip %d", id, mip);
+  job->execute = &dt_image_prefetch_job_run;
+  dt_image_prefetch_t *t = (dt_image_prefetch_t *)job->param;
+  t->imgid = id;
+  t->mip = mip;
+  t->current = current;
+  t->generation = generation;
+}
+
+int32_t dt_image_prefetch_job_run(dt_job_t *job)
+{
+  dt_image_prefetch_t *t = (dt_image_prefetch_t *)job->param;
+  // the user has moved on in the meantime:
+  if(*t->current != t->generation) return 0;
+
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, t->imgid, t->mip, DT_MIPMAP_BLOCKING);
+  if(buf.buf)
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+  return 0;
+}
+
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
 // kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -33,6 +33,21 @@ dt_image_load_t;
 int32_t dt_image_load_job_run(dt_job_t *job);
 void dt_image_load_job_init(dt_job_t *job, int32_t imgid, dt_mipmap_size_t mip);
 
+typedef struct dt_image_prefetch_t
+{
+  int32_t imgid;
+  dt_mipmap_size_t mip;
+  // the job is cancelled if *current doesn't match generation any more when it starts.
+  int32_t generation;
+  const int32_t *current;
+}
+dt_image_prefetch_t;
+
+/** speculative load, which can be cancelled as long as it hasn't started. */
+int32_t dt_image_prefetch_job_run(dt_job_t *job);
+void dt_image_prefetch_job_init(dt_job_t *job, int32_t imgid, dt_mipmap_size_t mip,
+                                const int32_t *current, int32_t generation);
+
 
 #endif
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
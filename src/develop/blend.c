@@ -23,7 +23,11 @@
 #include "common/gaussian.h"
 #include "blend.h"
 
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
 #define CLAMP_RANGE(x,y,z)      (CLAMP(x,y,z))
+#define MMCLAMPPS(a, mn, mx)    (_mm_min_ps((mx), _mm_max_ps((a), (mn))))
 
 typedef void (_blend_row_func)(dt_iop_colorspace_type_t cst,const float *a, float *b, const float *mask, int stride, int flag);
 
@@ -312,6 +316,14 @@ static inline void _blend_Lab_rescale(const float *i, float *o)
 static void _blend_make_mask(dt_iop_colorspace_type_t cst, const unsigned int blendif, const float *blendif_parameters, const unsigned int mask_mode, const unsigned int mask_combine,
                              const float gopacity, const float *a, const float *b, float *mask, int stride)
 {
+  if(!(mask_mode & DEVELOP_MASK_CONDITIONAL))
+  {
+    // no parametric mask, the drawn one is combined with a neutral factor and stays as it is:
+    const int inv = mask_combine & DEVELOP_COMBINE_INV;
+    for(int i=0, j=0; j<stride; i++, j+=4)
+      mask[i] = (inv ? 1.0f - mask[i] : mask[i])*gopacity;
+    return;
+  }
   for(int i=0, j=0; j<stride; i++, j+=4)
   {
     float form = mask[i];
@@ -1743,6 +1755,170 @@ static void _blend_Lab_color(dt_iop_colorspace_type_t cst,const float *a, float
 
 
 
+/* sse versions of the blend modes which work on each channel separately. they are specialized
+   per color space, and do the same as the generic functions above for that color space. */
+
+/* bitwise select: m ? x : y */
+static inline __m128 _blend_select_sse(const __m128 m, const __m128 x, const __m128 y)
+{
+  return _mm_or_ps(_mm_and_ps(m, x), _mm_andnot_ps(m, y));
+}
+
+/* rgb: all channels in 0..1. mode is a constant in all callers, so each of them gets its own loop. */
+static inline void _blend_rgb_sse(const int mode, const float *a, float *b, const float *mask, int stride)
+{
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 two = _mm_set1_ps(2.0f);
+
+  for(int i=0, j=0; j<stride; i++, j+=4)
+  {
+    const float local_opacity = mask[i];
+    // the contrast modes fade in with the square of the opacity:
+    const float o = (mode == DEVELOP_BLEND_OVERLAY || mode == DEVELOP_BLEND_SOFTLIGHT || mode == DEVELOP_BLEND_HARDLIGHT)
+                    ? local_opacity*local_opacity : local_opacity;
+    const __m128 op = _mm_set1_ps(o);
+    const __m128 ta = _mm_load_ps(a+j);
+    const __m128 tb = _mm_load_ps(b+j);
+    __m128 la = ta, f, res;
+
+    switch(mode)
+    {
+      case DEVELOP_BLEND_LIGHTEN:
+        f = _mm_max_ps(ta, tb);
+        break;
+      case DEVELOP_BLEND_DARKEN:
+        f = _mm_min_ps(ta, tb);
+        break;
+      case DEVELOP_BLEND_MULTIPLY:
+        f = _mm_mul_ps(ta, tb);
+        break;
+      case DEVELOP_BLEND_AVERAGE:
+        f = _mm_mul_ps(half, _mm_add_ps(ta, tb));
+        break;
+      case DEVELOP_BLEND_ADD:
+        f = _mm_add_ps(ta, tb);
+        break;
+      case DEVELOP_BLEND_SUBSTRACT:
+        f = _mm_sub_ps(_mm_add_ps(ta, tb), one);
+        break;
+      case DEVELOP_BLEND_SCREEN:
+      case DEVELOP_BLEND_OVERLAY:
+      case DEVELOP_BLEND_SOFTLIGHT:
+      case DEVELOP_BLEND_HARDLIGHT:
+      {
+        la = MMCLAMPPS(ta, zero, one);
+        const __m128 lb = MMCLAMPPS(tb, zero, one);
+        if(mode == DEVELOP_BLEND_SCREEN)
+          f = _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, la), _mm_sub_ps(one, lb)));
+        else if(mode == DEVELOP_BLEND_SOFTLIGHT)
+          f = _blend_select_sse(_mm_cmpgt_ps(lb, half),
+                                _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, la), _mm_sub_ps(one, _mm_sub_ps(lb, half)))),
+                                _mm_mul_ps(la, _mm_add_ps(lb, half)));
+        else
+        {
+          // overlay decides on the lower layer, hardlight on the upper one:
+          const __m128 m = _mm_cmpgt_ps(mode == DEVELOP_BLEND_OVERLAY ? la : lb, half);
+          f = _blend_select_sse(m,
+                                _mm_sub_ps(one, _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(two, _mm_sub_ps(la, half))), _mm_sub_ps(one, lb))),
+                                _mm_mul_ps(_mm_mul_ps(two, la), lb));
+        }
+        break;
+      }
+      default:
+        f = tb;
+        break;
+    }
+
+    res = _mm_add_ps(_mm_mul_ps(la, _mm_sub_ps(one, op)), _mm_mul_ps(f, op));
+    if(mode != DEVELOP_BLEND_UNBOUNDED) res = MMCLAMPPS(res, zero, one);
+    _mm_store_ps(b+j, res);
+    b[j+3] = local_opacity;
+  }
+}
+
+#define DT_BLEND_RGB_SSE(name, mode) \
+static void name(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, int stride, int flag) \
+{ \
+  _blend_rgb_sse(mode, a, b, mask, stride); \
+}
+
+DT_BLEND_RGB_SSE(_blend_normal_bounded_rgb_sse, DEVELOP_BLEND_BOUNDED)
+DT_BLEND_RGB_SSE(_blend_normal_unbounded_rgb_sse, DEVELOP_BLEND_UNBOUNDED)
+DT_BLEND_RGB_SSE(_blend_lighten_rgb_sse, DEVELOP_BLEND_LIGHTEN)
+DT_BLEND_RGB_SSE(_blend_darken_rgb_sse, DEVELOP_BLEND_DARKEN)
+DT_BLEND_RGB_SSE(_blend_multiply_rgb_sse, DEVELOP_BLEND_MULTIPLY)
+DT_BLEND_RGB_SSE(_blend_average_rgb_sse, DEVELOP_BLEND_AVERAGE)
+DT_BLEND_RGB_SSE(_blend_add_rgb_sse, DEVELOP_BLEND_ADD)
+DT_BLEND_RGB_SSE(_blend_substract_rgb_sse, DEVELOP_BLEND_SUBSTRACT)
+DT_BLEND_RGB_SSE(_blend_screen_rgb_sse, DEVELOP_BLEND_SCREEN)
+DT_BLEND_RGB_SSE(_blend_overlay_rgb_sse, DEVELOP_BLEND_OVERLAY)
+DT_BLEND_RGB_SSE(_blend_softlight_rgb_sse, DEVELOP_BLEND_SOFTLIGHT)
+DT_BLEND_RGB_SSE(_blend_hardlight_rgb_sse, DEVELOP_BLEND_HARDLIGHT)
+
+#undef DT_BLEND_RGB_SSE
+
+/* Lab: normal blend without scaling to 0..1 and back, that's linear anyways. with flag, a and b
+   are taken from the input. */
+static inline void _blend_normal_Lab_sse(const int bounded, const float *a, float *b, const float *mask, int stride, int flag)
+{
+  const __m128 min = _mm_set_ps(0.0f, -128.0f, -128.0f, 0.0f);
+  const __m128 max = _mm_set_ps(1.0f, 128.0f, 128.0f, 100.0f);
+  // lanes which are blended, the others keep the input:
+  const __m128 lanes = _mm_castsi128_ps(flag ? _mm_set_epi32(-1, 0, 0, -1) : _mm_set1_epi32(-1));
+  const __m128 one = _mm_set1_ps(1.0f);
+
+  for(int i=0, j=0; j<stride; i++, j+=4)
+  {
+    const float local_opacity = mask[i];
+    const __m128 op = _mm_set1_ps(local_opacity);
+    const __m128 ta = _mm_load_ps(a+j);
+    const __m128 tb = _mm_load_ps(b+j);
+    __m128 res = _mm_add_ps(_mm_mul_ps(ta, _mm_sub_ps(one, op)), _mm_mul_ps(tb, op));
+    if(bounded) res = MMCLAMPPS(res, min, max);
+    _mm_store_ps(b+j, _blend_select_sse(lanes, res, ta));
+    b[j+3] = local_opacity;
+  }
+}
+
+static void _blend_normal_bounded_Lab_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, int stride, int flag)
+{
+  _blend_normal_Lab_sse(1, a, b, mask, stride, flag);
+}
+
+static void _blend_normal_unbounded_Lab_sse(dt_iop_colorspace_type_t cst, const float *a, float *b, const float *mask, int stride, int flag)
+{
+  _blend_normal_Lab_sse(0, a, b, mask, stride, flag);
+}
+
+/* returns the sse version of a blend function for the color space, or the generic one if there is none. */
+static _blend_row_func *_blend_row_func_sse(dt_iop_colorspace_type_t cst, _blend_row_func *blend)
+{
+  if(cst == iop_cs_rgb)
+  {
+    if(blend == _blend_normal_bounded)   return _blend_normal_bounded_rgb_sse;
+    if(blend == _blend_normal_unbounded) return _blend_normal_unbounded_rgb_sse;
+    if(blend == _blend_lighten)          return _blend_lighten_rgb_sse;
+    if(blend == _blend_darken)           return _blend_darken_rgb_sse;
+    if(blend == _blend_multiply)         return _blend_multiply_rgb_sse;
+    if(blend == _blend_average)          return _blend_average_rgb_sse;
+    if(blend == _blend_add)              return _blend_add_rgb_sse;
+    if(blend == _blend_substract)        return _blend_substract_rgb_sse;
+    if(blend == _blend_screen)           return _blend_screen_rgb_sse;
+    if(blend == _blend_overlay)          return _blend_overlay_rgb_sse;
+    if(blend == _blend_softlight)        return _blend_softlight_rgb_sse;
+    if(blend == _blend_hardlight)        return _blend_hardlight_rgb_sse;
+  }
+  else if(cst == iop_cs_Lab)
+  {
+    if(blend == _blend_normal_bounded)   return _blend_normal_bounded_Lab_sse;
+    if(blend == _blend_normal_unbounded) return _blend_normal_unbounded_Lab_sse;
+  }
+  return blend;
+}
+
+
 void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, void *i, void *o, const struct dt_iop_roi_t *roi_in, const struct dt_iop_roi_t *roi_out)
 {
   int ch = piece->colors;
@@ -1913,25 +2089,33 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
     /* only true if mask_display was set by an _earlier_ module */
     const int mask_display = piece->pipe->mask_display;
 
+    /* check if mask should be suppressed (i.e. just set to global opacity value) */
+    const int suppress = self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH);
+
+    /* use the sse version of the blend mode for this color space, if there is one */
+    blend = _blend_row_func_sse(cst, blend);
+
+    /* a blurred mask needs all rows before blending starts. without blur, each row of the
+       mask is made right before it is used, while the pixels are still in the cache. */
+    if(maskblur && !suppress)
+    {
 #ifdef _OPENMP
 #if !defined(__SUNOS__) && !defined(__NetBSD__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
+      #pragma omp parallel for default(none) shared(i,roi_out,o,mask,d,stderr,ch)
 #else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
+      #pragma omp parallel for shared(i,roi_out,o,mask,d,ch)
 #endif
 #endif
-    for (int y=0; y<roi_out->height; y++)
-    {
-      int index = ch * y * roi_out->width;
-      int stride = ch * roi_out->width;
-      float *in = (float *)i + index;
-      float *out = (float *)o + index;
-      float *m = (float *)mask + y * roi_out->width;
-      _blend_make_mask(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
-    }
+      for (int y=0; y<roi_out->height; y++)
+      {
+        int index = ch * y * roi_out->width;
+        int stride = ch * roi_out->width;
+        float *in = (float *)i + index;
+        float *out = (float *)o + index;
+        float *m = (float *)mask + y * roi_out->width;
+        _blend_make_mask(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
+      }
 
-    if(maskblur)
-    {
       if(gaussian)
       {
         const float sigma = radius * roi_in->scale / piece ->iscale;
@@ -1952,29 +2136,11 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       }
     }
 
-
-    /* check if mask should be suppressed (i.e. just set to global opacity value) */
-    if(self->suppress_mask && self->dev->gui_attached && (self == self->dev->gui_module) && (piece->pipe == self->dev->pipe) && (mask_mode & DEVELOP_MASK_BOTH))
-    {
 #ifdef _OPENMP
-#if !defined(__SUNOS__)
-      #pragma omp parallel for default(none) shared(roi_out,mask,stderr)
-#else
-      #pragma omp parallel for shared(roi_out,mask)
-#endif
-#endif
-      for (int k=0; k<roi_out->height*roi_out->width; k++)
-      {
-        mask[k] = opacity;
-      }
-    }
-
-
-#ifdef _OPENMP
-#if !defined(__SUNOS__)
-    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,stderr,ch)
+#if !defined(__SUNOS__) && !defined(__NetBSD__)
+    #pragma omp parallel for default(none) shared(i,roi_out,o,mask,blend,d,stderr,ch)
 #else
-    #pragma omp parallel for shared(i,roi_out,o,mask,blend,ch)
+    #pragma omp parallel for shared(i,roi_out,o,mask,blend,d,ch)
 #endif
 #endif
     for (int y=0; y<roi_out->height; y++)
@@ -1984,6 +2150,11 @@ void dt_develop_blend_process (struct dt_iop_module_t *self, struct dt_dev_pixel
       float *in = (float *)i + index;
       float *out = (float *)o + index;
       float *m = (float *)mask + y * roi_out->width;
+      if(suppress)
+        for(int k=0; k<roi_out->width; k++) m[k] = opacity;
+      else if(!maskblur)
+        _blend_make_mask(cst, d->blendif, d->blendif_parameters, d->mask_mode, d->mask_combine, opacity, in, out, m, stride);
+
       blend(cst, in, out, m, stride, blendflag);
 
       if(mask_display && cst != iop_cs_RAW)
@@ -189,23 +189,29 @@ void dt_dev_process_preview_job(dt_develop_t *dev)
   dt_mipmap_buffer_t buf;
   if(dev->image_loading)
   {
-    // raw is already loading, no use starting another file access, we wait.
-    return;
+    // raw is already loading, no use starting another file access for the mip f.
+    // but if the mip f is still in the cache from the lighttable, we can show
+    // something right away. that needs the image dimensions from an earlier load, too.
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_F, DT_MIPMAP_TESTLOCK);
+    if(!buf.buf) return;
+    if(!buf.width || !buf.height || dev->image_storage.width <= 0 || dev->image_storage.height <= 0)
+    {
+      dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      return;
+    }
+  }
+  else
+  {
+    // lock if there, issue a background load, if not (best-effort for mip f).
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_F, 0);
+    if(!buf.buf)
+      return; // not loaded yet. load will issue a gtk redraw on completion, which in turn will trigger us again later.
   }
 
   dt_pthread_mutex_lock(&dev->preview_pipe_mutex);
   dt_control_log_busy_enter();
   dev->preview_pipe->input_timestamp = dev->timestamp;
   dev->preview_dirty = 1;
-
-  // lock if there, issue a background load, if not (best-effort for mip f).
-  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_F, 0);
-  if(!buf.buf)
-  {
-    dt_control_log_busy_leave();
-    dt_pthread_mutex_unlock(&dev->preview_pipe_mutex);
-    return; // not loaded yet. load will issue a gtk redraw on completion, which in turn will trigger us again later.
-  }
   // init pixel pipeline for preview.
   dt_dev_pixelpipe_set_input(dev->preview_pipe, dev, (float *)buf.buf, buf.width, buf.height, dev->image_storage.width/(float)buf.width);
 
@@ -271,7 +277,23 @@ void dt_dev_process_image_job(dt_develop_t *dev)
   dt_mipmap_buffer_t buf;
   dt_times_t start;
   dt_get_times(&start);
-  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_FULL, DT_MIPMAP_BLOCKING);
+  // don't keep this worker waiting for the raw to be decoded, that would hold up the
+  // next pipe runs, too. the preview shows the image meanwhile, and the darkroom
+  // comes back here as soon as the load job signals the full buffer is there.
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_FULL, DT_MIPMAP_TESTLOCK);
+  if(!buf.buf)
+  {
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, dev->image_storage.id, DT_MIPMAP_FULL, DT_MIPMAP_PREFETCH);
+    dt_control_log_busy_leave();
+    dt_pthread_mutex_unlock(&dev->pipe_mutex);
+    return;
+  }
+  if(!buf.width || !buf.height)
+  {
+    // loading failed before, don't pass the empty buffer on.
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    buf.buf = NULL;
+  }
   dt_show_times(&start, "[dev]", "to load the image.");
 
   // copy over image now that width and height are sure to be correct:
@@ -424,6 +446,13 @@ void dt_dev_load_image(dt_develop_t *dev, const uint32_t imgid)
   dev->first_load = 1;
   dev->image_dirty = dev->preview_dirty = 1;
 
+  // start decoding the raw right away, while modules and history are set up.
+  if(dev->gui_attached)
+  {
+    dt_mipmap_buffer_t buf;
+    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, DT_MIPMAP_FULL, DT_MIPMAP_PREFETCH);
+  }
+
   dt_masks_read_forms(dev);
   dev->form_visible = NULL;
 
@@ -453,20 +482,20 @@ int dt_dev_write_history_item(const dt_image_t *image, dt_dev_history_item_t *h,
 {
   if(!image) return 1;
   sqlite3_stmt *stmt;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select num from history where imgid = ?1 and num = ?2", -1, &stmt, NULL);
+  stmt = dt_database_get_statement(darktable.db, "select num from history where imgid = ?1 and num = ?2");
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, image->id);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
   if(sqlite3_step(stmt) != SQLITE_ROW)
   {
-    sqlite3_finalize(stmt);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert into history (imgid, num) values (?1, ?2)", -1, &stmt, NULL);
+    dt_database_release_statement(darktable.db, stmt);
+    stmt = dt_database_get_statement(darktable.db, "insert into history (imgid, num) values (?1, ?2)");
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, image->id);
     DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
     sqlite3_step (stmt);
   }
   // printf("[dev write history item] writing %d - %s params %f %f\n", h->module->instance, h->module->op, *(float *)h->params, *(((float *)h->params)+1));
-  sqlite3_finalize (stmt);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "update history set operation = ?1, op_params = ?2, module = ?3, enabled = ?4, blendop_params = ?7, blendop_version = ?8, multi_priority = ?9, multi_name = ?10 where imgid = ?5 and num = ?6", -1, &stmt, NULL);
+  dt_database_release_statement(darktable.db, stmt);
+  stmt = dt_database_get_statement(darktable.db, "update history set operation = ?1, op_params = ?2, module = ?3, enabled = ?4, blendop_params = ?7, blendop_version = ?8, multi_priority = ?9, multi_name = ?10 where imgid = ?5 and num = ?6");
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 1, h->module->op, strlen(h->module->op), SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_BLOB(stmt, 2, h->params, h->module->params_size, SQLITE_TRANSIENT);
   DT_DEBUG_SQLITE3_BIND_INT(stmt, 3, h->module->version());
@@ -479,7 +508,7 @@ int dt_dev_write_history_item(const dt_image_t *image, dt_dev_history_item_t *h,
   DT_DEBUG_SQLITE3_BIND_TEXT(stmt, 10, h->multi_name, strlen(h->multi_name), SQLITE_TRANSIENT);
 
   sqlite3_step (stmt);
-  sqlite3_finalize (stmt);
+  dt_database_release_statement(darktable.db, stmt);
   return 0;
 }
 
@@ -705,32 +734,90 @@ void dt_dev_pop_history_items(dt_develop_t *dev, int32_t cnt)
   dt_control_queue_redraw_center();
 }
 
+// does the history row in stmt (see dt_dev_write_history) hold the same as item h?
+static int
+_dev_history_item_equal(sqlite3_stmt *stmt, const dt_dev_history_item_t *h)
+{
+  const char *op = (const char *)sqlite3_column_text(stmt, 1);
+  const char *multi_name = (const char *)sqlite3_column_text(stmt, 8);
+  return op && !strcmp(op, h->module->op)
+         && sqlite3_column_bytes(stmt, 2) == h->module->params_size
+         && !memcmp(sqlite3_column_blob(stmt, 2), h->params, h->module->params_size)
+         && sqlite3_column_int(stmt, 3) == h->module->version()
+         && sqlite3_column_int(stmt, 4) == h->enabled
+         && sqlite3_column_bytes(stmt, 5) == sizeof(dt_develop_blend_params_t)
+         && !memcmp(sqlite3_column_blob(stmt, 5), h->blend_params, sizeof(dt_develop_blend_params_t))
+         && sqlite3_column_int(stmt, 6) == dt_develop_blend_version()
+         && sqlite3_column_int(stmt, 7) == h->multi_priority
+         && multi_name && !strcmp(multi_name, h->multi_name);
+}
+
 void dt_dev_write_history(dt_develop_t *dev)
 {
+  const int imgid = dev->image_storage.id;
   sqlite3_stmt *stmt;
 
-  gboolean changed = FALSE;
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from history where imgid = ?1", -1, &stmt, NULL);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, dev->image_storage.id);
-  sqlite3_step(stmt);
-  sqlite3_finalize (stmt);
+  // only write what changed since the last time: usually the top item, or
+  // a few items cut off after going back in history. all in one transaction.
+  const int num = MIN(dev->history_end, g_list_length(dev->history));
+  dt_dev_history_item_t **items = (dt_dev_history_item_t **)malloc(sizeof(dt_dev_history_item_t *)*MAX(num, 1));
+  char *same = (char *)calloc(MAX(num, 1), sizeof(char));
   GList *history = dev->history;
-  for(int i=0; i<dev->history_end && history; i++)
+  for(int i=0; i<num; i++, history = g_list_next(history))
+    items[i] = (dt_dev_history_item_t *)history->data;
+
+  dt_database_start_savepoint(darktable.db, "write_history");
+
+  int stale = 0;
+  stmt = dt_database_get_statement(darktable.db,
+                                   "select num, operation, op_params, module, enabled, blendop_params, blendop_version, "
+                                   "multi_priority, multi_name from history where imgid = ?1");
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
   {
-    dt_dev_history_item_t *hist = (dt_dev_history_item_t *)(history->data);
-    (void)dt_dev_write_history_item(&dev->image_storage, hist, i);
-    history = g_list_next(history);
-    changed = TRUE;
+    const int n = sqlite3_column_int(stmt, 0);
+    if(n >= 0 && n < num) same[n] = _dev_history_item_equal(stmt, items[n]);
+    else stale = 1;
+  }
+  dt_database_release_statement(darktable.db, stmt);
+
+  if(stale)
+  {
+    stmt = dt_database_get_statement(darktable.db,
+                                     "delete from history where imgid = ?1 and (num < 0 or num >= ?2)");
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, num);
+    sqlite3_step(stmt);
+    dt_database_release_statement(darktable.db, stmt);
+  }
+  int written = 0;
+  for(int i=0; i<num; i++)
+  {
+    if(same[i]) continue;
+    (void)dt_dev_write_history_item(&dev->image_storage, items[i], i);
+    written++;
   }
+  free(items);
+  free(same);
 
-  /* attach / detach changed tag reflecting actual change */
+  /* attach / detach changed tag reflecting actual change. only on a transition,
+     attaching again would count the tag pairs twice. */
   guint tagid = 0;
   dt_tag_new("darktable|changed",&tagid);
-  if(changed)
-    dt_tag_attach(tagid, dev->image_storage.id);
-  else
-    dt_tag_detach(tagid, dev->image_storage.id);
-
+  stmt = dt_database_get_statement(darktable.db,
+                                   "select 1 from tagged_images where imgid = ?1 and tagid = ?2");
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgid);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, tagid);
+  const int attached = (sqlite3_step(stmt) == SQLITE_ROW);
+  dt_database_release_statement(darktable.db, stmt);
+  if(num > 0 && !attached)
+    dt_tag_attach(tagid, imgid);
+  else if(num == 0 && attached)
+    dt_tag_detach(tagid, imgid);
+
+  dt_database_release_savepoint(darktable.db, "write_history");
+  dt_print(DT_DEBUG_SQL, "[dev_write_history] image %d: %d of %d items written%s\n",
+           imgid, written, num, stale ? ", stale items removed" : "");
 }
 
 static void
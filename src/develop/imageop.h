@@ -392,7 +392,7 @@ dt_iop_colorspace_type_t;
 /** find which colorspace the module works within */
 dt_iop_colorspace_type_t dt_iop_module_colorspace(const dt_iop_module_t *module);
 
-/** flip according to orientation bits, also zoom to given size. */
+/** flip according to orientation bits, also zoom to given size. red and blue change places. */
 void dt_iop_flip_and_zoom_8( const uint8_t *in, int32_t iw, int32_t ih, uint8_t *out, int32_t ow, int32_t oh, const int32_t orientation, uint32_t *width, uint32_t *height);
 
 /** for homebrew pixel pipe: zoom pixel array. */
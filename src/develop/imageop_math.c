@@ -0,0 +1,583 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// the pixel kernels behind the thumbnails and the preview pipe. these only need
+// the buffers, so tests/zoom.c can build them on their own.
+#ifndef DT_UNIT_TEST
+#include "develop/imageop.h"
+#endif
+
+#include <assert.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// average of four rgba pixels, truncated. with swap, the first and third channels change places.
+static inline void
+_zoom_average_8(const uint8_t *p0, const uint8_t *p1, const uint8_t *p2, const uint8_t *p3,
+                uint8_t *out, const int swap)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i v = _mm_unpacklo_epi64(
+                      _mm_unpacklo_epi32(_mm_cvtsi32_si128(*(const int32_t *)p0), _mm_cvtsi32_si128(*(const int32_t *)p1)),
+                      _mm_unpacklo_epi32(_mm_cvtsi32_si128(*(const int32_t *)p2), _mm_cvtsi32_si128(*(const int32_t *)p3)));
+  __m128i sum = _mm_add_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpackhi_epi8(v, zero));
+  sum = _mm_srli_epi16(_mm_add_epi16(sum, _mm_srli_si128(sum, 8)), 2);
+  if(swap) sum = _mm_shufflelo_epi16(sum, _MM_SHUFFLE(3, 0, 1, 2));
+  *(int32_t *)out = _mm_cvtsi128_si32(_mm_packus_epi16(sum, sum));
+}
+
+void
+dt_iop_flip_and_zoom_8(
+  const uint8_t *in,
+  int32_t iw,
+  int32_t ih,
+  uint8_t *out,
+  int32_t ow,
+  int32_t oh,
+  const int32_t orientation,
+  uint32_t *width,
+  uint32_t *height)
+{
+  // init strides:
+  const uint32_t iwd = (orientation & 4) ? ih : iw;
+  const uint32_t iht = (orientation & 4) ? iw : ih;
+  const float scale = fmaxf(iwd/(float)ow, iht/(float)oh);
+  const uint32_t wd = *width  = MIN(ow, iwd/scale);
+  const uint32_t ht = *height = MIN(oh, iht/scale);
+  const int bpp = 4; // bytes per pixel
+  int32_t ii = 0, jj = 0;
+  int32_t si = 1, sj = iw;
+  if(orientation & 2)
+  {
+    jj = ih - jj - 1;
+    sj = -sj;
+  }
+  if(orientation & 1)
+  {
+    ii = iw - ii - 1;
+    si = -si;
+  }
+  if(orientation & 4)
+  {
+    int t = sj;
+    sj = si;
+    si = t;
+  }
+  const int32_t half_pixel = .5f*scale;
+  const int32_t offm = half_pixel*bpp*MIN(MIN(0, si), MIN(sj, si+sj));
+  const int32_t offM = half_pixel*bpp*MAX(MAX(0, si), MAX(sj, si+sj));
+  // the column offsets are the same for all rows:
+  int32_t *off = (int32_t *)malloc(sizeof(int32_t)*wd);
+  if(!off) return;
+  float stepi = 0.0f;
+  for(uint32_t i=0; i<wd; i++)
+  {
+    off[i] = ((int32_t)stepi)*si*bpp;
+    stepi += scale;
+  }
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si, iw, ih, off)
+#endif
+  for(uint32_t j=0; j<ht; j++)
+  {
+    uint8_t *out2 = out + bpp*wd*j;
+    const uint8_t *in2 = in + bpp*(iw*jj + ii + sj*(int32_t)(scale*j));
+    for(uint32_t i=0; i<wd; i++)
+    {
+      const uint8_t *in3 = in2 + off[i];
+      // this should always be within the bounds of in[], due to the way
+      // wd/ht are constructed by always just rounding down. half_pixel should never
+      // add up to one pixel difference.
+      // we have this check with the hope the branch predictor will get rid of it:
+      if(in3 + offm >= in &&
+          in3 + offM < in + bpp*iw*ih)
+      {
+        _zoom_average_8(in3, in3 + bpp*half_pixel*si, in3 + bpp*half_pixel*sj, in3 + bpp*half_pixel*(si+sj),
+                        out2, 1);
+      }
+      out2  += bpp;
+    }
+  }
+  free(off);
+}
+
+void dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw, int32_t ih, int32_t ibw, int32_t ibh,
+                            uint8_t *o, int32_t ox, int32_t oy, int32_t ow, int32_t oh, int32_t obw, int32_t obh)
+{
+  const float scalex = iw/(float)ow;
+  const float scaley = ih/(float)oh;
+  int32_t ix2 = MAX(ix, 0);
+  int32_t iy2 = MAX(iy, 0);
+  int32_t ox2 = MAX(ox, 0);
+  int32_t oy2 = MAX(oy, 0);
+  int32_t oh2 = MIN(MIN(oh, (ibh - iy2)/scaley), obh - oy2);
+  int32_t ow2 = MIN(MIN(ow, (ibw - ix2)/scalex), obw - ox2);
+  assert((int)(ix2 + ow2*scalex) <= ibw);
+  assert((int)(iy2 + oh2*scaley) <= ibh);
+  assert(ox2 + ow2 <= obw);
+  assert(oy2 + oh2 <= obh);
+  assert(ix2 >= 0 && iy2 >= 0 && ox2 >= 0 && oy2 >= 0);
+  if(ow2 <= 0 || oh2 <= 0) return;
+  // byte offsets of the two samples per column and row, summed up in the same order as always:
+  int32_t *col = (int32_t *)malloc(sizeof(int32_t)*2*ow2);
+  int32_t *row = (int32_t *)malloc(sizeof(int32_t)*2*oh2);
+  if(!col || !row)
+  {
+    free(col);
+    free(row);
+    return;
+  }
+  float x = ix2, y = iy2;
+  for(int t=0; t<ow2; t++)
+  {
+    col[2*t]   = 4*(int32_t) x;
+    col[2*t+1] = 4*(int32_t)(x + .5f*scalex);
+    x += scalex;
+  }
+  for(int s=0; s<oh2; s++)
+  {
+    row[2*s]   = 4*ibw*(int32_t) y;
+    row[2*s+1] = 4*ibw*(int32_t)(y + .5f*scaley);
+    y += scaley;
+  }
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(i, o, col, row, ox2, oy2, ow2, oh2, obw)
+#endif
+  for(int s=0; s<oh2; s++)
+  {
+    const uint8_t *i0 = i + row[2*s], *i1 = i + row[2*s+1];
+    uint8_t *out = o + 4*(ox2 + obw*(oy2+s));
+    for(int t=0; t<ow2; t++, out+=4)
+      _zoom_average_8(i0 + col[2*t], i0 + col[2*t+1], i1 + col[2*t], i1 + col[2*t+1], out, 0);
+  }
+  free(col);
+  free(row);
+}
+
+static int
+FC(const int row, const int col, const unsigned int filters)
+{
+  return filters >> ((((row) << 1 & 14) + ((col) & 1)) << 1) & 3;
+}
+
+/**
+ * downscales and clips a mosaiced buffer (in) to the given region of interest (r_*)
+ * and writes it to out in float4 format.
+ * filters is the dcraw supplied int encoding of the bayer pattern, flipped with the buffer.
+ * resamping is done via bilateral filtering and respecting the input mosaic pattern.
+ */
+void
+dt_iop_clip_and_zoom_demosaic_half_size(
+  float *out,
+  const uint16_t *const in,
+  const dt_iop_roi_t *const roi_out,
+  const dt_iop_roi_t *const roi_in,
+  const int32_t out_stride,
+  const int32_t in_stride,
+  const unsigned int filters)
+{
+#if 0
+  printf("scale: %f\n",roi_out->scale);
+  struct timeval tm1,tm2;
+  gettimeofday(&tm1,NULL);
+  for (int k = 0 ; k < 100 ; k++)
+  {
+#endif
+    // adjust to pixel region and don't sample more than scale/2 nbs!
+    // pixel footprint on input buffer, radius:
+    const float px_footprint = 1.f/roi_out->scale;
+    // how many 2x2 blocks can be sampled inside that area
+    const int samples = round(px_footprint/2);
+
+    // move p to point to an rggb block:
+    int trggbx = 0, trggby = 0;
+    if(FC(trggby, trggbx+1, filters) != 1) trggbx ++;
+    if(FC(trggby, trggbx,   filters) != 0)
+    {
+      trggbx = (trggbx + 1)&1;
+      trggby ++;
+    }
+    const int rggbx = trggbx, rggby = trggby;
+
+    // the horizontal footprint of the output pixels is the same for all rows:
+    int *cols = (int *)malloc(sizeof(int)*2*roi_out->width);
+    if(!cols) return;
+    float fx = roi_out->x*px_footprint;
+    for(int x=0; x<roi_out->width; x++)
+    {
+      fx += px_footprint;
+      int px = (int)fx & ~1;
+      px = MIN(((roi_in->width -4) & ~1u), px) + rggbx;
+      cols[2*x]   = px;
+      cols[2*x+1] = MIN(((roi_in->width -3)&~1u)+rggbx, px+2*samples);
+    }
+
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(out, cols) schedule(static)
+#endif
+    for(int y=0; y<roi_out->height; y++)
+    {
+      float *outc = out + 4*(out_stride*y);
+
+      float fy = (y + roi_out->y)*px_footprint;
+      int py = (int)fy & ~1;
+      py = MIN(((roi_in->height-4) & ~1u), py) + rggby;
+
+      int maxj = MIN(((roi_in->height-3)&~1u)+rggby, py+2*samples);
+
+      for(int x=0; x<roi_out->width; x++)
+      {
+        __m128 col = _mm_setzero_ps();
+
+        const int px = cols[2*x], maxi = cols[2*x+1];
+
+        int num = 0;
+
+        const int idx = px + in_stride*py;
+        const uint16_t pc = MAX(MAX(in[idx], in[idx+1]), MAX(in[idx + in_stride], in[idx+1 + in_stride]));
+
+        // 2x2 blocks in the middle of sampling region, the ones on the other side of the
+        // clipping threshold than the first are left out (without branching):
+        const int clipped = pc >= 60000;
+        int s1 = 0, s23 = 0, s4 = 0;
+
+        for(int j=py; j<=maxj; j+=2)
+        {
+          const uint16_t *row0 = in + in_stride*j, *row1 = row0 + in_stride;
+          for(int i=px; i<=maxi; i+=2)
+          {
+            const int p1 = row0[i];
+            const int p2 = row0[i+1];
+            const int p3 = row1[i];
+            const int p4 = row1[i+1];
+
+            const int take = -(clipped == (MAX(MAX(p1,p2),MAX(p3,p4)) >= 60000));
+            s1  += p1 & take;
+            s23 += (p2 + p3) & take;
+            s4  += p4 & take;
+            num -= take;
+          }
+        }
+        const __m128i sum = _mm_set_epi32(0,s4,s23,s1);
+
+        col = _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_div_ps(_mm_set_ps(0.0f,1.0f/65535.0f,0.5f/65535.0f,1.0f/65535.0f),_mm_set1_ps(num)));
+        _mm_stream_ps(outc, col);
+        outc += 4;
+      }
+    }
+    _mm_sfence();
+    free(cols);
+#if 0
+  }
+  gettimeofday(&tm2,NULL);
+  float perf = (tm2.tv_sec-tm1.tv_sec)*1000.0f + (tm2.tv_usec-tm1.tv_usec)/1000.0f;
+  printf("time spent: %.4f\n",perf/100.0f);
+#endif
+}
+
+#if 0 // gets rid of pink artifacts, but doesn't do sub-pixel sampling, so shows some staircasing artifacts.
+void
+dt_iop_clip_and_zoom_demosaic_half_size_f(
+  float *out,
+  const float *const in,
+  const dt_iop_roi_t *const roi_out,
+  const dt_iop_roi_t *const roi_in,
+  const int32_t out_stride,
+  const int32_t in_stride,
+  const unsigned int filters,
+  const float clip)
+{
+  // adjust to pixel region and don't sample more than scale/2 nbs!
+  // pixel footprint on input buffer, radius:
+  const float px_footprint = 1.f/roi_out->scale;
+  // how many 2x2 blocks can be sampled inside that area
+  const int samples = round(px_footprint/2);
+
+  // move p to point to an rggb block:
+  int trggbx = 0, trggby = 0;
+  if(FC(trggby, trggbx+1, filters) != 1) trggbx ++;
+  if(FC(trggby, trggbx,   filters) != 0)
+  {
+    trggbx = (trggbx + 1)&1;
+    trggby ++;
+  }
+  const int rggbx = trggbx, rggby = trggby;
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(out) schedule(static)
+#endif
+  for(int y=0; y<roi_out->height; y++)
+  {
+    float *outc = out + 4*(out_stride*y);
+
+    float fy = (y + roi_out->y)*px_footprint;
+    int py = (int)fy & ~1;
+    py = MIN(((roi_in->height-4) & ~1u), py) + rggby;
+
+    int maxj = MIN(((roi_in->height-3)&~1u)+rggby, py+2*samples);
+
+    float fx = roi_out->x*px_footprint;
+
+    for(int x=0; x<roi_out->width; x++)
+    {
+      __m128 col = _mm_setzero_ps();
+
+      fx += px_footprint;
+      int px = (int)fx & ~1;
+      px = MIN(((roi_in->width -4) & ~1u), px) + rggbx;
+
+      int maxi = MIN(((roi_in->width -3)&~1u)+rggbx, px+2*samples);
+
+      int num = 0;
+
+      const int idx = px + in_stride*py;
+      const float pc = MAX(MAX(in[idx], in[idx+1]), MAX(in[idx + in_stride], in[idx+1 + in_stride]));
+
+      // 2x2 blocks in the middle of sampling region
+      __m128 sum = _mm_setzero_ps();
+
+      for(int j=py; j<=maxj; j+=2)
+        for(int i=px; i<=maxi; i+=2)
+        {
+          const float p1 = in[i   + in_stride*j];
+          const float p2 = in[i+1 + in_stride*j];
+          const float p3 = in[i   + in_stride*(j + 1)];
+          const float p4 = in[i+1 + in_stride*(j + 1)];
+
+          if (!((pc >= clip) ^ (MAX(MAX(p1,p2),MAX(p3,p4)) >= clip)))
+          {
+            sum = _mm_add_ps(sum, _mm_set_ps(0,p4,p3+p2,p1));
+            num++;
+          }
+        }
+
+      col = _mm_mul_ps(sum, _mm_div_ps(_mm_set_ps(0.0f,1.0f,0.5f,1.0f),_mm_set1_ps(num)));
+      _mm_stream_ps(outc, col);
+      outc += 4;
+    }
+  }
+  _mm_sfence();
+}
+
+#else // very fast and smooth, but doesn't handle highlights:
+void
+dt_iop_clip_and_zoom_demosaic_half_size_f(
+  float *out,
+  const float *const in,
+  const dt_iop_roi_t *const roi_out,
+  const dt_iop_roi_t *const roi_in,
+  const int32_t out_stride,
+  const int32_t in_stride,
+  const unsigned int filters,
+  const float clip)
+{
+  // adjust to pixel region and don't sample more than scale/2 nbs!
+  // pixel footprint on input buffer, radius:
+  const float px_footprint = 1.f/roi_out->scale;
+  // how many 2x2 blocks can be sampled inside that area
+  const int samples = round(px_footprint/2);
+
+  // move p to point to an rggb block:
+  int trggbx = 0, trggby = 0;
+  if(FC(trggby, trggbx+1, filters) != 1) trggbx ++;
+  if(FC(trggby, trggbx,   filters) != 0)
+  {
+    trggbx = (trggbx + 1)&1;
+    trggby ++;
+  }
+  const int rggbx = trggbx, rggby = trggby;
+
+  // the horizontal footprint of the output pixels is the same for all rows:
+  int *cols = (int *)malloc(sizeof(int)*2*roi_out->width);
+  float *dxs = (float *)malloc(sizeof(float)*roi_out->width);
+  if(!cols || !dxs)
+  {
+    free(cols);
+    free(dxs);
+    return;
+  }
+  for(int x=0; x<roi_out->width; x++)
+  {
+    float fx = (x + roi_out->x)*px_footprint;
+    int px = (int)fx & ~1;
+    dxs[x] = (fx - px)/2;
+    px = MIN(((roi_in->width -6) & ~1u), px) + rggbx;
+    cols[2*x]   = px;
+    cols[2*x+1] = MIN(((roi_in->width -5)&~1u)+rggbx, px+2*samples);
+  }
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(out, cols, dxs) schedule(static)
+#endif
+  for(int y=0; y<roi_out->height; y++)
+  {
+    float *outc = out + 4*(out_stride*y);
+
+    float fy = (y + roi_out->y)*px_footprint;
+    int py = (int)fy & ~1;
+    const float dy = (fy - py)/2;
+    py = MIN(((roi_in->height-6) & ~1u), py) + rggby;
+
+    int maxj = MIN(((roi_in->height-5)&~1u)+rggby, py+2*samples);
+
+    for(int x=0; x<roi_out->width; x++)
+    {
+      __m128 col = _mm_setzero_ps();
+
+      const int px = cols[2*x], maxi = cols[2*x+1];
+      const float dx = dxs[x];
+
+      float p1, p2, p4;
+      int i,j;
+      float num = 0;
+
+      // upper left 2x2 block of sampling region
+      p1 = in[px   + in_stride*py];
+      p2 = in[px+1 + in_stride*py] + in[px   + in_stride*(py + 1)];
+      p4 = in[px+1 + in_stride*(py + 1)];
+      col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps((1-dx)*(1-dy)),_mm_set_ps(0.0f, p4, p2, p1)));
+
+      // left 2x2 block border of sampling region
+      for (j = py+2 ; j <= maxj ; j+=2)
+      {
+        p1 = in[px   + in_stride*j];
+        p2 = in[px+1 + in_stride*j] + in[px   + in_stride*(j + 1)];
+        p4 = in[px+1 + in_stride*(j + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(1-dx),_mm_set_ps(0.0f, p4, p2, p1)));
+      }
+
+      // upper 2x2 block border of sampling region
+      for (i = px+2 ; i <= maxi ; i+=2)
+      {
+        p1 = in[i   + in_stride*py];
+        p2 = in[i+1 + in_stride*py] + in[i   + in_stride*(py + 1)];
+        p4 = in[i+1 + in_stride*(py + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(1-dy),_mm_set_ps(0.0f, p4, p2, p1)));
+      }
+
+      // 2x2 blocks in the middle of sampling region
+      for(int j=py+2; j<=maxj; j+=2)
+        for(int i=px+2; i<=maxi; i+=2)
+        {
+          p1 = in[i   + in_stride*j];
+          p2 = in[i+1 + in_stride*j] + in[i   + in_stride*(j + 1)];
+          p4 = in[i+1 + in_stride*(j + 1)];
+          col = _mm_add_ps(col, _mm_set_ps(0.0f, p4, p2, p1));
+        }
+
+      if (maxi == px + 2*samples && maxj == py + 2*samples)
+      {
+        // right border
+        for (j = py+2 ; j <= maxj ; j+=2)
+        {
+          p1 = in[maxi+2   + in_stride*j];
+          p2 = in[maxi+3 + in_stride*j] + in[maxi+2   + in_stride*(j + 1)];
+          p4 = in[maxi+3 + in_stride*(j + 1)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // upper right
+        p1 = in[maxi+2   + in_stride*py];
+        p2 = in[maxi+3 + in_stride*py] + in[maxi+2   + in_stride*(py + 1)];
+        p4 = in[maxi+3 + in_stride*(py + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx*(1-dy)),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        // lower border
+        for (i = px+2 ; i <= maxi ; i+=2)
+        {
+          p1 = in[i   + in_stride*(maxj+2)];
+          p2 = in[i+1 + in_stride*(maxj+2)] + in[i   + in_stride*(maxj+3)];
+          p4 = in[i+1 + in_stride*(maxj+3)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dy),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // lower left 2x2 block
+        p1 = in[px   + in_stride*(maxj+2)];
+        p2 = in[px+1 + in_stride*(maxj+2)] + in[px   + in_stride*(maxj+3)];
+        p4 = in[px+1 + in_stride*(maxj+3)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps((1-dx)*dy),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        // lower right 2x2 block
+        p1 = in[maxi+2   + in_stride*(maxj+2)];
+        p2 = in[maxi+3 + in_stride*(maxj+2)] + in[maxi   + in_stride*(maxj+3)];
+        p4 = in[maxi+3 + in_stride*(maxj+3)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx*dy),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        num = (samples+1)*(samples+1);
+      }
+      else if (maxi == px + 2*samples)
+      {
+        // right border
+        for (j = py+2 ; j <= maxj ; j+=2)
+        {
+          p1 = in[maxi+2   + in_stride*j];
+          p2 = in[maxi+3 + in_stride*j] + in[maxi+2   + in_stride*(j + 1)];
+          p4 = in[maxi+3 + in_stride*(j + 1)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // upper right
+        p1 = in[maxi+2   + in_stride*py];
+        p2 = in[maxi+3 + in_stride*py] + in[maxi+2   + in_stride*(py + 1)];
+        p4 = in[maxi+3 + in_stride*(py + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx*(1-dy)),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        num = ((maxj-py)/2+1-dy)*(samples+1);
+      }
+      else if (maxj == py + 2*samples)
+      {
+        // lower border
+        for (i = px+2 ; i <= maxi ; i+=2)
+        {
+          p1 = in[i   + in_stride*(maxj+2)];
+          p2 = in[i+1 + in_stride*(maxj+2)] + in[i   + in_stride*(maxj+3)];
+          p4 = in[i+1 + in_stride*(maxj+3)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dy),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // lower left 2x2 block
+        p1 = in[px   + in_stride*(maxj+2)];
+        p2 = in[px+1 + in_stride*(maxj+2)] + in[px   + in_stride*(maxj+3)];
+        p4 = in[px+1 + in_stride*(maxj+3)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps((1-dx)*dy),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        num = ((maxi-px)/2+1-dx)*(samples+1);
+      }
+      else
+      {
+        num = ((maxi-px)/2+1-dx)*((maxj-py)/2+1-dy);
+      }
+
+      num = 1.0f/num;
+      col = _mm_mul_ps(col, _mm_set_ps(0.0f,num,0.5f*num,num));
+      _mm_stream_ps(outc, col);
+      outc += 4;
+    }
+  }
+  _mm_sfence();
+  free(cols);
+  free(dxs);
+}
+#endif
+
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -16,6 +16,7 @@
     along with darktable.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include "common/memory.h"
 #include "develop/pixelpipe_cache.h"
 #include "develop/pixelpipe_hb.h"
 #include "libs/lib.h"
@@ -31,6 +32,13 @@
 //   ping, pong, and priority buffer (focused plugin)
 // - drop read by the time another is requested (with priority, drop that, or alternating ping and pong?)
 
+static void _cache_reclaim(void *data, const size_t bytes)
+{
+  // can't free anything here, some other thread might be processing this pipe.
+  dt_dev_pixelpipe_cache_t *cache = (dt_dev_pixelpipe_cache_t *)data;
+  cache->reclaim = 1;
+}
+
 int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, int size)
 {
   cache->entries = entries;
@@ -52,6 +60,9 @@ int dt_dev_pixelpipe_cache_init(dt_dev_pixelpipe_cache_t *cache, int entries, in
     cache->used[k] = 0;
   }
   cache->queries = cache->misses = 0;
+  cache->reclaim = 0;
+  cache->memory = dt_memory_register(darktable.memory, "pixelpipe", DT_MEMORY_RANK_PIXELPIPE, 1, _cache_reclaim, cache);
+  dt_memory_alloc(cache->memory, (size_t)entries*size);
   return 1;
 
 alloc_memory_fail:
@@ -73,6 +84,7 @@ alloc_memory_fail:
 void dt_dev_pixelpipe_cache_cleanup(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k=0; k<cache->entries; k++) free(cache->data[k]);
+  dt_memory_unregister(darktable.memory, cache->memory);
   free(cache->data);
   free(cache->hash);
   free(cache->used);
@@ -161,8 +173,10 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
     if(cache->size[max] < size)
     {
       free(cache->data[max]);
+      dt_memory_free(cache->memory, cache->size[max]);
       cache->data[max] = (void *)dt_alloc_align(16, size);
       cache->size[max] = size;
+      dt_memory_alloc(cache->memory, size);
     }
     *data = cache->data[max];
     cache->hash[max] = hash;
@@ -173,6 +187,26 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
   else return 0;
 }
 
+void dt_dev_pixelpipe_cache_reclaim(dt_dev_pixelpipe_cache_t *cache, const void *keep)
+{
+  if(!cache->reclaim) return;
+  cache->reclaim = 0;
+  size_t freed = 0;
+  for(int k=0; k<cache->entries; k++)
+  {
+    // important lines (focused module, backbuf) have negative weight, leave them alone.
+    if(cache->used[k] < 0 || !cache->data[k] || cache->data[k] == keep) continue;
+    free(cache->data[k]);
+    dt_memory_free(cache->memory, cache->size[k]);
+    freed += cache->size[k];
+    // next get will see a line too small for anything, and allocate:
+    cache->data[k] = NULL;
+    cache->size[k] = 0;
+    cache->hash[k] = -1;
+  }
+  dt_print(DT_DEBUG_MEMORY, "[pixelpipe_cache] reclaimed %.2f MB\n", freed/(1024.0*1024.0));
+}
+
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache)
 {
   for(int k=0; k<cache->entries; k++)
@@ -38,6 +38,11 @@ typedef struct dt_dev_pixelpipe_cache_t
   // profiling:
   uint64_t queries;
   uint64_t misses;
+  // cache lines as seen by the memory governor, which sets reclaim when it
+  // wants memory back. the lines are in use during processing, so that is only
+  // acted upon before the next run.
+  struct dt_memory_client_t *memory;
+  int reclaim;
 }
 dt_dev_pixelpipe_cache_t;
 
@@ -61,6 +66,10 @@ int dt_dev_pixelpipe_cache_get_weighted(dt_dev_pixelpipe_cache_t *cache, const u
 /** test availability of a cache line without destroying another, if it is not found. */
 int dt_dev_pixelpipe_cache_available(dt_dev_pixelpipe_cache_t *cache, const uint64_t hash);
 
+/** frees the memory of the unimportant cache lines if the memory governor asked for it.
+  * only safe while the pipe isn't processing. keep is spared (the current backbuf). */
+void dt_dev_pixelpipe_cache_reclaim(dt_dev_pixelpipe_cache_t *cache, const void *keep);
+
 /** invalidates all cachelines. */
 void dt_dev_pixelpipe_cache_flush(dt_dev_pixelpipe_cache_t *cache);
 
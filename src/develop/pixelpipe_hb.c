@@ -23,7 +23,9 @@
 #include "control/control.h"
 #include "control/signal.h"
 #include "common/opencl.h"
+#include "common/histogram.h"
 #include "common/imageio.h"
+#include "common/memory.h"
 #include "libs/lib.h"
 #include "libs/colorpicker.h"
 #include "iop/colorout.h"
@@ -292,162 +294,65 @@ get_output_bpp(dt_iop_module_t *module, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpi
 }
 
 
+// number of bins in the per module histograms, as drawn by the gui
+#define DT_PIXELPIPE_MODULE_HISTOGRAM_BINS 64
+
+static void
+histogram_to_module(const uint32_t *hist, const dt_iop_colorspace_type_t cst, float *histogram, float *histogram_max)
+{
+  uint32_t hist_max[4];
+  dt_histogram_max(hist, DT_PIXELPIPE_MODULE_HISTOGRAM_BINS, cst, hist_max);
+  for(int k=0; k<4*DT_PIXELPIPE_MODULE_HISTOGRAM_BINS; k++) histogram[k] = hist[k];
+  for(int c=0; c<4; c++) histogram_max[c] = hist_max[c];
+}
+
 // helper to get per module histogram
 static void
 histogram_collect(dt_iop_module_t *module, const float *pixel, const dt_iop_roi_t *roi,
                   float **histogram, float *histogram_max)
 {
-  if(*histogram == NULL) *histogram = malloc(64*4*sizeof(float));
+  if(*histogram == NULL) *histogram = malloc(DT_PIXELPIPE_MODULE_HISTOGRAM_BINS*4*sizeof(float));
 
   if(*histogram == NULL) return;
 
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(module);
 
-  float *hist = *histogram;
-
-  histogram_max[0] = histogram_max[1] = histogram_max[2] = histogram_max[3] = 0;
-  memset (hist, 0, 64*4*sizeof(float));
-
-  switch(cst)
-  {
-    case iop_cs_RAW:
-      for(int j=0; j<roi->height; j+=3) for(int i=0; i<roi->width; i+=3)  // sample one out of 9 pixels, un-locked with bayer pattern
-        {
-          uint8_t V = CLAMP(64.0f*pixel[4*(j*roi->width+i)], 0, 63);
-          hist[4*V] ++;
-        }
-      for(int k=0; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      break;
-
-    case iop_cs_rgb:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)  // sample one out of 16 pixels
-        {
-          float Rv = pixel[4*(j*roi->width+i)];
-          float Gv = pixel[4*(j*roi->width+i)+1];
-          float Bv = pixel[4*(j*roi->width+i)+2];
-          float gv = fmaxf(Rv, fmaxf(Gv, Bv));
-          uint8_t R = CLAMP(64.0f*Rv, 0, 63);
-          uint8_t G = CLAMP(64.0f*Gv, 0, 63);
-          uint8_t B = CLAMP(64.0f*Bv, 0, 63);
-          uint8_t g = CLAMP(64.0f*gv, 0, 63);
-          hist[4*R] ++;
-          hist[4*G + 1] ++;
-          hist[4*B + 2] ++;
-          hist[4*g + 3] ++;
-        }
-      // don't count <= 0 pixels
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      for(int k=5; k<4*64; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*64; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      for(int k=7; k<4*64; k+=4) histogram_max[3] = histogram_max[3] > hist[k] ? histogram_max[3] : hist[k];
-      break;
-
-    case iop_cs_Lab:
-    default:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)   // sample one out of 16 pixels
-        {
-          uint8_t L = CLAMP(64.0f/100.0f*(pixel[4*(j*roi->width+i)]), 0, 63);
-          uint8_t a = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+1]+128.0f), 0, 63);
-          uint8_t b = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+2]+128.0f), 0, 63);
-          hist[4*L] ++;
-          hist[4*a + 1] ++;
-          hist[4*b + 2] ++;
-        }
-      // don't count <= 0 pixels in L
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-
-      // don't count <= -128 and >= +128 pixels in a and b
-      for(int k=5; k<4*63; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*63; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      break;
-  }
+  // every pixel counts, the work is spread over all threads.
+  uint32_t hist[DT_PIXELPIPE_MODULE_HISTOGRAM_BINS*4];
+  dt_histogram_collect(pixel, roi->width, roi->height, cst, DT_PIXELPIPE_MODULE_HISTOGRAM_BINS, 1, hist);
+  histogram_to_module(hist, cst, *histogram, histogram_max);
 }
 
 #ifdef HAVE_OPENCL
 // helper to get per module histogram for OpenCL
 //
-// this algorithm is inefficient as hell when it comes to larger images. it's only acceptable
-// as long as we work on small image sizes like in image preview
+// the histogram is collected on the device and only the bins are copied back.
+// devices without reliable atomics fall back to reading back the whole image.
 static void
 histogram_collect_cl(int devid, dt_iop_module_t *module, cl_mem img, const dt_iop_roi_t *roi,
                      float **histogram, float *histogram_max)
 {
-  if(*histogram == NULL) *histogram = malloc(64*4*sizeof(float));
+  if(*histogram == NULL) *histogram = malloc(DT_PIXELPIPE_MODULE_HISTOGRAM_BINS*4*sizeof(float));
   if(*histogram == NULL) return;
 
-  float *pixel = dt_alloc_align(64, roi->width*roi->height*4*sizeof(float));
-  if(pixel == NULL) return;
-
-  cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, 4*sizeof(float));
-  if(err != CL_SUCCESS)
-  {
-    free(pixel);
-    return;
-  }
-
   const dt_iop_colorspace_type_t cst = dt_iop_module_colorspace(module);
 
-  float *hist = *histogram;
-
-  histogram_max[0] = histogram_max[1] = histogram_max[2] = histogram_max[3] = 0;
-  memset (hist, 0, 64*4*sizeof(float));
-
-
-  switch(cst)
+  uint32_t hist[DT_PIXELPIPE_MODULE_HISTOGRAM_BINS*4];
+  if(dt_histogram_collect_cl(devid, img, roi->width, roi->height, cst, DT_PIXELPIPE_MODULE_HISTOGRAM_BINS, hist) != CL_SUCCESS)
   {
-    case iop_cs_RAW:
-      for(int j=0; j<roi->height; j+=3) for(int i=0; i<roi->width; i+=3)  // sample one out of 9 pixels, un-locked with bayer pattern
-        {
-          uint8_t V = CLAMP(64.0f*pixel[4*(j*roi->width+i)], 0, 63);
-          hist[4*V] ++;
-        }
-      for(int k=0; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      break;
-
-    case iop_cs_rgb:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)  // sample one out of 16 pixels
-        {
-          float Rv = pixel[4*(j*roi->width+i)];
-          float Gv = pixel[4*(j*roi->width+i)+1];
-          float Bv = pixel[4*(j*roi->width+i)+2];
-          float gv = fmaxf(Rv, fmaxf(Gv, Bv));
-          uint8_t R = CLAMP(64.0f*Rv, 0, 63);
-          uint8_t G = CLAMP(64.0f*Gv, 0, 63);
-          uint8_t B = CLAMP(64.0f*Bv, 0, 63);
-          uint8_t g = CLAMP(64.0f*gv, 0, 63);
-          hist[4*R] ++;
-          hist[4*G + 1] ++;
-          hist[4*B + 2] ++;
-          hist[4*g + 3] ++;
-        }
-      // don't count <= 0 pixels
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-      for(int k=5; k<4*64; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*64; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      for(int k=7; k<4*64; k+=4) histogram_max[3] = histogram_max[3] > hist[k] ? histogram_max[3] : hist[k];
-      break;
+    float *pixel = dt_alloc_align(64, roi->width*roi->height*4*sizeof(float));
+    if(pixel == NULL) return;
 
-    case iop_cs_Lab:
-    default:
-      for(int j=0; j<roi->height; j+=4) for(int i=0; i<roi->width; i+=4)   // sample one out of 16 pixels
-        {
-          uint8_t L = CLAMP(64.0f/100.0f*(pixel[4*(j*roi->width+i)]), 0, 63);
-          uint8_t a = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+1]+128.0f), 0, 63);
-          uint8_t b = CLAMP(64.0f/256.0f*(pixel[4*(j*roi->width+i)+2]+128.0f), 0, 63);
-          hist[4*L] ++;
-          hist[4*a + 1] ++;
-          hist[4*b + 2] ++;
-        }
-      // don't count <= 0 pixels in L
-      for(int k=4; k<4*64; k+=4) histogram_max[0] = histogram_max[0] > hist[k] ? histogram_max[0] : hist[k];
-
-      // don't count <= -128 and >= +128 pixels in a and b
-      for(int k=5; k<4*63; k+=4) histogram_max[1] = histogram_max[1] > hist[k] ? histogram_max[1] : hist[k];
-      for(int k=6; k<4*63; k+=4) histogram_max[2] = histogram_max[2] > hist[k] ? histogram_max[2] : hist[k];
-      break;
+    cl_int err = dt_opencl_copy_device_to_host(devid, pixel, img, roi->width, roi->height, 4*sizeof(float));
+    if(err != CL_SUCCESS)
+    {
+      free(pixel);
+      return;
+    }
+    dt_histogram_collect(pixel, roi->width, roi->height, cst, DT_PIXELPIPE_MODULE_HISTOGRAM_BINS, 1, hist);
+    free(pixel);
   }
-
-  free(pixel);
+  histogram_to_module(hist, cst, *histogram, histogram_max);
 }
 #endif
 
@@ -2092,10 +1997,16 @@ int dt_dev_pixelpipe_process(dt_dev_pixelpipe_t *pipe, dt_develop_t *dev, int x,
 
   dt_print(DT_DEBUG_OPENCL, "[pixelpipe_process] [%s] using device %d\n", _pipe_type_to_str(pipe->type), pipe->devid);
 
+  // nothing of the cache is in use right now, give back memory if the governor asked for it:
+  dt_pthread_mutex_lock(&pipe->backbuf_mutex);
+  dt_dev_pixelpipe_cache_reclaim(&pipe->cache, pipe->backbuf);
+  dt_pthread_mutex_unlock(&pipe->backbuf_mutex);
+
   if(darktable.unmuted & DT_DEBUG_MEMORY)
   {
     fprintf(stderr, "[memory] before pixelpipe process\n");
     dt_print_mem_usage();
+    dt_memory_print(darktable.memory);
   }
 
   if(pipe->devid >= 0) dt_opencl_events_reset(pipe->devid);
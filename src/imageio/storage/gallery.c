@@ -321,35 +321,40 @@ store (dt_imageio_module_storage_t *self, dt_imageio_module_data_t *sdata, const
   } // end of critical block
   dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
 
-  /* export image to file */
-  if(dt_imageio_export(imgid, filename, format, fdata, high_quality) != 0)
+  /* the thumbnail goes into the same file name with -thumb, at reduced resolution: */
+  char thumbfilename[DT_MAX_PATH_LEN];
+  g_strlcpy(thumbfilename, filename, sizeof(thumbfilename));
+  char *c = thumbfilename + strlen(thumbfilename);
+  for(; c>thumbfilename && *c != '.' && *c != '/' ; c--);
+  if(c <= thumbfilename || *c=='/') c = thumbfilename + strlen(thumbfilename);
+  const char *ext = format->extension(fdata);
+  snprintf(c, sizeof(thumbfilename) - (c - thumbfilename), "-thumb.%s", ext);
+
+  // fresh parameters for it, so the writer has all its state, with the settings of the image:
+  dt_imageio_module_data_t *tdata = (dt_imageio_module_data_t *)format->get_params(format);
+  if(!tdata)
   {
-    fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
-    dt_control_log(_("could not export to file `%s'!"), filename);
+    fprintf(stderr, "[imageio_storage_gallery] could not get format parameters for `%s'!\n", thumbfilename);
     return 1;
   }
+  memcpy(tdata, fdata, format->params_size(format));
+  tdata->max_width  = 200;
+  tdata->max_height = 200;
 
-  /* also export thumbnail: */
-  // write with reduced resolution:
-  const int max_width  = fdata->max_width;
-  const int max_height = fdata->max_height;
-  fdata->max_width  = 200;
-  fdata->max_height = 200;
-  // alter filename with -thumb:
-  char *c = filename + strlen(filename);
-  for(; c>filename && *c != '.' && *c != '/' ; c--);
-  if(c <= filename || *c=='/') c = filename + strlen(filename);
-  const char *ext = format->extension(fdata);
-  sprintf(c,"-thumb.%s",ext);
-  if(dt_imageio_export(imgid, filename, format, fdata, FALSE) != 0)
+  /* export image and thumbnail to file, with one run of the pixelpipe */
+  const dt_imageio_rendition_t renditions[2] =
+  {
+    { filename, format, fdata },
+    { thumbfilename, format, tdata }
+  };
+  const int res = dt_imageio_export_renditions(imgid, renditions, 2, high_quality);
+  format->free_params(format, tdata);
+  if(res != 0)
   {
     fprintf(stderr, "[imageio_storage_gallery] could not export to file: `%s'!\n", filename);
     dt_control_log(_("could not export to file `%s'!"), filename);
     return 1;
   }
-  // restore for next image:
-  fdata->max_width = max_width;
-  fdata->max_height = max_height;
 
   printf("[export_job] exported to `%s'\n", filename);
   char *trunc = filename + strlen(filename) - 32;
@@ -64,6 +64,30 @@ public:
     delete[] values;
   }
 
+  /* Makes room for n vectors up front, so the table doesn't have to grow
+   * (and copy everything) while splatting. */
+  void reserve(size_t n)
+  {
+    size_t newCapacity = capacity;
+    while (newCapacity/2-1 <= n) newCapacity *= 2;
+    if (newCapacity > capacity) grow(newCapacity);
+  }
+
+  /* Frees all storage, the table is empty and small afterwards. */
+  void clear()
+  {
+    delete[] entries;
+    delete[] keys;
+    delete[] values;
+    capacity = 2;
+    capacity_bits = 1;
+    filled = 0;
+    entries = new Entry[capacity];
+    keys = new short[KD*capacity/2];
+    values = new float[VD*capacity/2];
+    memset(values, 0, sizeof(float)*VD*capacity/2);
+  }
+
   // Returns the number of vectors stored.
   int size()
   {
@@ -91,10 +115,11 @@ public:
   int lookupOffset(const short *key, size_t h, bool create = true)
   {
 
-    // Double hash table size if necessary
-    if (filled >= (capacity/2)-1)
+    // Double hash table size if necessary. only when creating: blur and
+    // slice look up from several threads at once.
+    if (create && filled >= (capacity/2)-1)
     {
-      grow();
+      grow(2*capacity);
     }
 
     // Find the entry with the given key
@@ -153,12 +178,12 @@ public:
   }
 
 private:
-  /* Grows the size of the hash table */
-  void grow()
+  /* Grows the size of the hash table to newCapacity, a power of two */
+  void grow(size_t newCapacity)
   {
     size_t oldCapacity = capacity;
-    capacity *= 2;
-    capacity_bits = (capacity_bits << 1) | 1;
+    capacity = newCapacity;
+    capacity_bits = newCapacity - 1;
 
     // Migrate the value vectors.
     float *newValues = new float[VD*capacity/2];
@@ -219,9 +244,13 @@ public:
   /* Constructor
    *     d_ : dimensionality of key vectors
    *    vd_ : dimensionality of value vectors
-   * nData_ : number of points in the input
+   * nData_ : number of points in the input. the simplex of every point is recorded
+   *          to speed up slicing, at 12*(d+1) bytes per point. pass 0 to record
+   *          nothing and slice by position instead, for large images.
+   * nVertices_ : expected number of lattice points, 0 if unknown. the hash tables
+   *          are sized for that up front.
    */
-  PermutohedralLattice(int nData_, int nThreads_=1) :
+  PermutohedralLattice(int nData_, int nThreads_=1, size_t nVertices_=0) :
     nData(nData_), nThreads(nThreads_)
   {
 
@@ -229,7 +258,7 @@ public:
     float *scaleFactorTmp = new float[D];
     int *canonicalTmp = new int[(D+1)*(D+1)];
 
-    replay = new ReplayEntry[nData*(D+1)];
+    replay = nData > 0 ? new ReplayEntry[(size_t)nData*(D+1)] : NULL;
 
     // compute the coordinates of the canonical simplex, in which
     // the difference between a contained point and the zero
@@ -266,6 +295,12 @@ public:
     scaleFactor = scaleFactorTmp;
 
     hashTables = new HashTablePermutohedral<D,VD>[nThreads];
+    if (nVertices_)
+    {
+      // all points end up in the first table when merging:
+      hashTables[0].reserve(nVertices_);
+      for (int i = 1; i < nThreads; i++) hashTables[i].reserve(nVertices_/nThreads);
+    }
   }
 
 
@@ -278,15 +313,45 @@ public:
   }
 
 
-  /* Performs splatting with given position and value vectors */
+  /* Performs splatting with given position and value vectors.
+   * replay_index is ignored if the lattice doesn't record the simplices. */
   void splat(float *position, float *value, int replay_index, int thread_index=0)
   {
-    float elevated[D+1];
     int greedy[D+1];
     int rank[D+1];
     float barycentric[D+2];
     short key[D];
 
+    embed(position, greedy, rank, barycentric);
+
+    // Splat the value into each vertex of the simplex, with barycentric weights.
+    for (int remainder = 0; remainder <= D; remainder++)
+    {
+      // Compute the location of the lattice point explicitly (all but the last coordinate - it's redundant because they sum to zero)
+      for (int i = 0; i < D; i++)
+        key[i] = greedy[i] + canonical[remainder*(D+1) + rank[i]];
+
+      // Retrieve pointer to the value at this vertex.
+      float * val = hashTables[thread_index].lookup(key, true);
+
+      // Accumulate values with barycentric weight.
+      for (int i = 0; i < VD; i++)
+        val[i] += barycentric[remainder]*value[i];
+
+      if (!replay) continue;
+
+      // Record this interaction to use later when slicing
+      replay[(size_t)replay_index*(D+1)+remainder].table = thread_index;
+      replay[(size_t)replay_index*(D+1)+remainder].offset = val - hashTables[thread_index].getValues();
+      replay[(size_t)replay_index*(D+1)+remainder].weight = barycentric[remainder];
+    }
+  }
+
+  /* Finds the simplex enclosing a position, and the barycentric coordinates in it. */
+  void embed(const float *position, int *greedy, int *rank, float *barycentric)
+  {
+    float elevated[D+1];
+
     // first rotate position into the (d+1)-dimensional hyperplane
     elevated[D] = -D*position[D-1]*scaleFactor[D-1];
     for (int i = D-1; i > 0; i--)
@@ -315,7 +380,7 @@ public:
 
     // rank differential to find the permutation between this simplex and the canonical one.
     // (See pg. 3-4 in paper.)
-    memset(rank, 0, sizeof rank);
+    memset(rank, 0, sizeof(int)*(D+1));
     for (int i = 0; i < D; i++)
       for (int j = i+1; j <= D; j++)
         if (elevated[i] - greedy[i] < elevated[j] - greedy[j]) rank[i]++;
@@ -353,35 +418,16 @@ public:
     }
 
     // Compute barycentric coordinates (See pg.10 of paper.)
-    memset(barycentric, 0, sizeof barycentric);
+    memset(barycentric, 0, sizeof(float)*(D+2));
     for (int i = 0; i <= D; i++)
     {
       barycentric[D-rank[i]] += (elevated[i] - greedy[i]) * scale;
       barycentric[D+1-rank[i]] -= (elevated[i] - greedy[i]) * scale;
     }
     barycentric[0] += 1.0f + barycentric[D+1];
-
-    // Splat the value into each vertex of the simplex, with barycentric weights.
-    for (int remainder = 0; remainder <= D; remainder++)
-    {
-      // Compute the location of the lattice point explicitly (all but the last coordinate - it's redundant because they sum to zero)
-      for (int i = 0; i < D; i++)
-        key[i] = greedy[i] + canonical[remainder*(D+1) + rank[i]];
-
-      // Retrieve pointer to the value at this vertex.
-      float * val = hashTables[thread_index].lookup(key, true);
-
-      // Accumulate values with barycentric weight.
-      for (int i = 0; i < VD; i++)
-        val[i] += barycentric[remainder]*value[i];
-
-      // Record this interaction to use later when slicing
-      replay[replay_index*(D+1)+remainder].table = thread_index;
-      replay[replay_index*(D+1)+remainder].offset = val - hashTables[thread_index].getValues();
-      replay[replay_index*(D+1)+remainder].weight = barycentric[remainder];
-    }
   }
 
+
   /* Merge the multiple threads' hash tables into the totals. */
   void merge_splat_threads(void)
   {
@@ -407,12 +453,16 @@ public:
     }
 
     /* Rewrite the offsets in the replay structure from the above generated table. */
-    for (int i = 0; i < nData*(D+1); i++)
+    if (replay) for (size_t i = 0; i < (size_t)nData*(D+1); i++)
       if (replay[i].table > 0)
         replay[i].offset = offset_remap[replay[i].table][replay[i].offset/VD];
 
     for (int i = 1; i < nThreads; i++)
+    {
       delete[] offset_remap[i];
+      // everything is in the first table now:
+      hashTables[i].clear();
+    }
   }
 
   /* Performs slicing out of position vectors. Note that the barycentric weights and the simplex
@@ -433,6 +483,29 @@ public:
     }
   }
 
+  /* Slices the value at a position, for lattices which don't record the simplices.
+   * The same position has to be splatted before, so all the vertices exist. */
+  void slice(float *col, const float *position)
+  {
+    int greedy[D+1];
+    int rank[D+1];
+    float barycentric[D+2];
+    short key[D];
+
+    embed(position, greedy, rank, barycentric);
+
+    for (int j = 0; j < VD; j++) col[j] = 0;
+    for (int remainder = 0; remainder <= D; remainder++)
+    {
+      for (int i = 0; i < D; i++)
+        key[i] = greedy[i] + canonical[remainder*(D+1) + rank[i]];
+      const float *val = hashTables[0].lookup(key, false);
+      if (!val) continue;
+      for (int j = 0; j < VD; j++)
+        col[j] += barycentric[remainder]*val[j];
+    }
+  }
+
   /* Performs a Gaussian blur along each projected axis in the hyperplane. */
   void blur()
   {
@@ -219,28 +219,49 @@ weight_sse(const __m128 *c1, const __m128 *c2, const float sharpen)
   __m128 sum = _mm_setzero_ps(); \
   __m128 wgt = _mm_setzero_ps();
 
+// the detail coefficient is shrunk, boosted and folded into the accumulated detail
+// right away, so no scale needs to keep its coefficients around.
 #define SUM_PIXEL_EPILOGUE \
   sum = _mm_mul_ps(sum, _mm_rcp_ps(wgt)); \
   \
-  _mm_stream_ps(pdetail, _mm_sub_ps(*px, sum)); \
+  { \
+    const __m128 d = _mm_sub_ps(*px, sum); \
+    const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, d), threshold)); \
+    const __m128 amount = _mm_mul_ps(boost, _mm_or_ps(_mm_and_ps(d, *mask), absamt)); \
+    _mm_store_ps(pdetail, first ? amount : _mm_add_ps(_mm_load_ps(pdetail), amount)); \
+  } \
   _mm_stream_ps(pcoarse, sum); \
   px++; \
   pdetail+=4; \
   pcoarse+=4;
 
+/* decompose in into the next coarser scale (out) and the detail coefficients. these
+ * are not stored, but are thresholded and boosted right away and added to detail,
+ * which collects the processed coefficients of all scales. the first scale
+ * initializes detail. */
 static void
 eaw_decompose (float *const out, const float *const in, float *const detail, const int scale,
-               const float sharpen, const int32_t width, const int32_t height)
+               const float sharpen, const float *thrsf, const float *boostf, const int first,
+               const int32_t width, const int32_t height)
 {
   const int mult = 1<<scale;
   static const float filter[5] = {1.0f/16.0f, 4.0f/16.0f, 6.0f/16.0f, 4.0f/16.0f, 1.0f/16.0f};
+  const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
+  const __m128 boost     = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
+  const __m128i maski = _mm_set1_epi32(0x80000000u);
+  const __m128 *const mask = (__m128*)&maski;
+
+  /* the detail is accumulated in place, so no pixel may be visited twice: the
+   * border loops below are clamped to stay disjoint on images smaller than 4*mult */
+  const int bh0 = MIN(2*mult, height), bh1 = MAX(2*mult, height-2*mult);
+  const int bw0 = MIN(2*mult, width),  bw1 = MAX(2*mult, width-2*mult);
 
   /* The first "2*mult" lines use the macro with tests because the 5x5 kernel
    * requires nearest pixel interpolation for at least a pixel in the sum */
 #ifdef _OPENMP
   #pragma omp parallel for default(none) schedule(static)
 #endif
-  for (int j=0; j<2*mult; j++)
+  for (int j=0; j<bh0; j++)
   {
     ROW_PROLOGUE
 
@@ -261,13 +282,13 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
 #ifdef _OPENMP
   #pragma omp parallel for default(none) schedule(static)
 #endif
-  for(int j=2*mult; j<height-2*mult; j++)
+  for(int j=2*mult; j<bh1; j++)
   {
     ROW_PROLOGUE
 
     /* The first "2*mult" pixels use the macro with tests because the 5x5 kernel
      * requires nearest pixel interpolation for at least a pixel in the sum */
-    for (int i=0; i<2*mult; i++)
+    for (int i=0; i<bw0; i++)
     {
       SUM_PIXEL_PROLOGUE
       for (int jj=0; jj<5; jj++)
@@ -282,7 +303,7 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
 
     /* For pixels [2*mult, width-2*mult], we can safely use macro w/o tests
      * to avoid unneeded branching in the inner loops */
-    for(int i=2*mult; i<width-2*mult; i++)
+    for(int i=2*mult; i<bw1; i++)
     {
       SUM_PIXEL_PROLOGUE
       px2 = ((__m128*)in) + i-2*mult + (j-2*mult)*width;
@@ -299,7 +320,7 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
     }
 
     /* Last two pixels in the row require a slow variant... blablabla */
-    for (int i=width-2*mult; i<width; i++)
+    for (int i=bw1; i<width; i++)
     {
       SUM_PIXEL_PROLOGUE
       for (int jj=0; jj<5; jj++)
@@ -318,7 +339,7 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
 #ifdef _OPENMP
   #pragma omp parallel for default(none) schedule(static)
 #endif
-  for (int j=height-2*mult; j<height; j++)
+  for (int j=bh1; j<height; j++)
   {
     ROW_PROLOGUE
 
@@ -345,30 +366,20 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
 #undef SUM_PIXEL_PROLOGUE
 #undef SUM_PIXEL_EPILOGUE
 
+/* adds the coarsest scale to the detail collected by eaw_decompose(), which is in out already. */
 static void
-eaw_synthesize (float *const out, const float *const in, const float *const detail,
-                const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+eaw_synthesize (float *const out, const float *const in, const int32_t width, const int32_t height)
 {
-  const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
-  const __m128 boost     = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
-
 #ifdef _OPENMP
   #pragma omp parallel for default(none) schedule(static)
 #endif
   for(int j=0; j<height; j++)
   {
-    // TODO: prefetch? _mm_prefetch()
     const __m128 *pin = (__m128 *)in + j*width;
-    __m128 *pdetail = (__m128 *)detail + j*width;
     float *pout = out + 4*j*width;
     for(int i=0; i<width; i++)
     {
-      const __m128i maski = _mm_set1_epi32(0x80000000u);
-      const __m128 *mask = (__m128*)&maski;
-      const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-      pdetail ++;
+      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_load_ps(pout)));
       pin ++;
       pout += 4;
     }
@@ -453,63 +464,56 @@ process (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, voi
     // dt_control_queue_draw(GTK_WIDGET(g->area));
   }
 
-  float *detail[MAX_NUM_SCALES] = { NULL };
-  float *tmp = NULL;
+  float *tmp[2] = { NULL };
   float *buf2 = NULL;
   float *buf1 = NULL;
 
   const int width = roi_out->width;
   const int height = roi_out->height;
 
-  tmp = (float *)dt_alloc_align(64, sizeof(float)*4*width*height);
-  if(tmp == NULL)
+  if(max_scale == 0)
   {
-    fprintf(stderr, "[atrous] failed to allocate coarse buffer!\n");
-    goto error;
+    memcpy(o, i, sizeof(float)*4*width*height);
+    goto done;
   }
 
-  for(int k=0; k<max_scale; k++)
+  // two coarse buffers, whatever the number of scales: (float *)o collects the detail.
+  for(int k=0; k<MIN(max_scale, 2); k++)
   {
-    detail[k] = (float *)dt_alloc_align(64, sizeof(float)*4*width*height);
-    if(detail[k] == NULL)
+    tmp[k] = (float *)dt_alloc_align(64, sizeof(float)*4*width*height);
+    if(tmp[k] == NULL)
     {
-      fprintf(stderr, "[atrous] failed to allocate one of the detail buffers!\n");
+      fprintf(stderr, "[atrous] failed to allocate coarse buffer!\n");
       goto error;
     }
   }
 
   buf1 = (float *)i;
-  buf2 = tmp;
+  buf2 = tmp[0];
 
   for(int scale=0; scale<max_scale; scale++)
   {
-    eaw_decompose (buf2, buf1, detail[scale], scale, sharp[scale], width, height);
-    if(scale == 0) buf1 = (float *)o;  // now switch to (float *)o for buffer ping-pong between buf1 and buf2
+    eaw_decompose (buf2, buf1, (float *)o, scale, sharp[scale], thrs[scale], boost[scale], scale == 0, width, height);
+    if(scale == 0) buf1 = tmp[1];  // now switch to tmp[1] for buffer ping-pong between buf1 and buf2
     float *buf3 = buf2;
     buf2 = buf1;
     buf1 = buf3;
   }
 
-  for(int scale=max_scale-1; scale>=0; scale--)
-  {
-    eaw_synthesize (buf2, buf1, detail[scale], thrs[scale], boost[scale], width, height);
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
-  }
-  /* due to symmetric processing, output will be left in (float *)o */
+  eaw_synthesize ((float *)o, buf1, width, height);
 
-  for(int k=0; k<max_scale; k++) free(detail[k]);
-  free(tmp);
+  free(tmp[0]);
+  free(tmp[1]);
 
+done:
   if(piece->pipe->mask_display)
     dt_iop_alpha_copy(i, o, width, height);
 
   return;
 
 error:
-  for(int k=0; k<max_scale; k++) if(detail[k] != NULL) free(detail[k]);
-  if(tmp != NULL) free(tmp);
+  free(tmp[0]);
+  free(tmp[1]);
   return;
 }
 
@@ -661,7 +665,11 @@ void tiling_callback (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_
   const int max_scale = get_scales(thrs, boost, sharp, d, roi_in, piece);
   const int max_filter_radius = (1<<max_scale); // 2 * 2^max_scale
 
-  tiling->factor = 3.0f + max_scale;  // in + out + tmp + scale buffers
+  // the cpu path only needs two coarse buffers, opencl keeps the detail of all scales.
+  if(piece->pipe->devid >= 0)
+    tiling->factor = 3.0f + max_scale;  // in + out + tmp + scale buffers
+  else
+    tiling->factor = 4.0f;  // in + out + 2 coarse buffers
   tiling->maxbuf = 1.0f;
   tiling->overhead = 0;
   tiling->overlap = max_filter_radius;
@@ -22,6 +22,7 @@
 #include "iop/colorin.h"
 #include "develop/develop.h"
 #include "control/control.h"
+#include "control/conf.h"
 #include "gui/gtk.h"
 #include "bauhaus/bauhaus.h"
 #include "common/colorspaces.h"
@@ -296,6 +297,35 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
     }
     _mm_sfence();
   }
+  else if(d->clut)
+  {
+    // lut baked from the lcms2 transform. same gamut mapping as the fallback below,
+    // but this one is thread safe.
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(roi_in,roi_out, out, in) schedule(static)
+#endif
+    for(int j=0; j<roi_out->height; j++)
+    {
+      const float *buf_in = in + (size_t)ch*roi_in->width*j;
+      float *buf_out = out + (size_t)ch*roi_out->width*j;
+      for(int i=0; i<roi_out->width; i++, buf_in+=ch, buf_out+=ch)
+      {
+        float cam[4] __attribute__((aligned(16))) = { buf_in[0], buf_in[1], buf_in[2], 0.0f };
+        const float YY = cam[0]+cam[1]+cam[2];
+        const float zz = cam[2]/YY;
+        const float bound_z = 0.5f, bound_Y = 0.5f;
+        const float amount = 0.11f;
+        if (zz > bound_z)
+        {
+          const float t = (zz - bound_z)/(1.0f-bound_z) * fminf(1.0, YY/bound_Y);
+          cam[1] += t*amount;
+          cam[2] -= t*amount;
+        }
+        _mm_stream_ps(buf_out, dt_colorlut_lookup_sse(d->clut, _mm_load_ps(cam)));
+      }
+    }
+    _mm_sfence();
+  }
   else
   {
     // use general lcms2 fallback
@@ -502,6 +532,24 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
     }
     else d->unbounded_coeffs[k][0] = -1.0f;
   }
+
+  // no matrix, bake the lcms2 transform into a lut, if we don't have it already.
+  // lut size 0 in the preferences means always use lcms2.
+  const int lut_size = dt_conf_get_int("colorlut_size");
+  gchar *key = NULL;
+  if(d->cmatrix[0] == -666.0f && d->xform[0] && lut_size > 0)
+    key = dt_colorlut_key(d->input, p->intent, lut_size);
+  if(!key || !d->clut_key || strcmp(key, d->clut_key))
+  {
+    dt_colorlut_free(d->clut);
+    g_free(d->clut_key);
+    const float min[3] = { 0.0f, 0.0f, 0.0f }, max[3] = { 1.0f, 1.0f, 1.0f };
+    // tolerance is in Lab units:
+    d->clut = key ? dt_colorlut_bake(d->xform[0], lut_size, DT_COLORLUT_SHAPER_SQRT, min, max, 0.5f) : NULL;
+    d->clut_key = d->clut ? key : NULL;
+    if(!d->clut) g_free(key);
+  }
+  else g_free(key);
 }
 
 void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_pixelpipe_iop_t *piece)
@@ -511,6 +559,8 @@ void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   d->input = NULL;
   d->xform = (cmsHTRANSFORM *)malloc(sizeof(cmsHTRANSFORM)*dt_get_num_threads());
   for(int t=0; t<dt_get_num_threads(); t++) d->xform[t] = NULL;
+  d->clut = NULL;
+  d->clut_key = NULL;
   d->Lab = dt_colorspaces_create_lab_profile();
   self->commit_params(self, self->default_params, pipe, piece);
 }
@@ -522,6 +572,8 @@ void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_de
   dt_colorspaces_cleanup_profile(d->Lab);
   for(int t=0; t<dt_get_num_threads(); t++) if(d->xform[t]) cmsDeleteTransform(d->xform[t]);
   free(d->xform);
+  dt_colorlut_free(d->clut);
+  g_free(d->clut_key);
   free(piece->data);
 }
 
@@ -18,6 +18,7 @@
 #ifndef DARKTABLE_IOP_COLORIN_H
 #define DARKTABLE_IOP_COLORIN_H
 
+#include "common/colorlut.h"
 #include "common/colorspaces.h"
 #include "develop/imageop.h"
 #include <gtk/gtk.h>
@@ -70,6 +71,8 @@ typedef struct dt_iop_colorin_data_t
   float lut[3][LUT_SAMPLES];
   float cmatrix[9];
   float unbounded_coeffs[3][3];       // approximation for extrapolation of shaper curves
+  dt_colorlut_t *clut;                // baked xform, for profiles without a matrix
+  gchar *clut_key;                    // profile and intent clut was baked for
 }
 dt_iop_colorin_data_t;
 
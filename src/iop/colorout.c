@@ -428,6 +428,19 @@ process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoi
       }
     }
   }
+  else if(d->clut)
+  {
+    // lut baked from the lcms2 transform, never used for softproofing.
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) default(none) shared(roi_in,roi_out, ivoid, ovoid)
+#endif
+    for(int j=0; j<roi_out->height; j++)
+    {
+      const float *in = (float*)ivoid + (size_t)ch*roi_in->width*j;
+      float *out = (float*)ovoid + (size_t)ch*roi_out->width*j;
+      dt_colorlut_apply(d->clut, in, out, roi_out->width);
+    }
+  }
   else
   {
     float *in  = (float*)ivoid;
@@ -651,6 +664,24 @@ void commit_params (struct dt_iop_module_t *self, dt_iop_params_t *p1, dt_dev_pi
     else d->unbounded_coeffs[k][0] = -1.0f;
   }
 
+  // no matrix, bake the lcms2 transform into a lut, if we don't have it already.
+  // softproofing and the high quality export option always go through lcms2.
+  const int lut_size = dt_conf_get_int("colorlut_size");
+  gchar *key = NULL;
+  if(isnan(d->cmatrix[0]) && d->xform && !d->softproof_enabled && !high_quality_processing && lut_size > 0)
+    key = dt_colorlut_key(d->output, outintent, lut_size);
+  if(!key || !d->clut_key || strcmp(key, d->clut_key))
+  {
+    dt_colorlut_free(d->clut);
+    g_free(d->clut_key);
+    const float min[3] = { 0.0f, -128.0f, -128.0f }, max[3] = { 100.0f, 128.0f, 128.0f };
+    // tolerance is about half a step in 8 bits:
+    d->clut = key ? dt_colorlut_bake(d->xform, lut_size, DT_COLORLUT_SHAPER_LINEAR, min, max, 0.002f) : NULL;
+    d->clut_key = d->clut ? key : NULL;
+    if(!d->clut) g_free(key);
+  }
+  else g_free(key);
+
   //fprintf(stderr, " Output profile %s, softproof %s%s%s\n", outprofile, d->softproof_enabled?"enabled ":"disabled",d->softproof_enabled?"using profile ":"",d->softproof_enabled?p->softproofprofile:"");
 
   g_free(overprofile);
@@ -663,6 +694,8 @@ void init_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_dev_p
   d->softproof_enabled = 0;
   d->softproof = d->output = NULL;
   d->xform = 0;
+  d->clut = NULL;
+  d->clut_key = NULL;
   d->Lab = dt_colorspaces_create_lab_profile();
   self->commit_params(self, self->default_params, pipe, piece);
 }
@@ -677,6 +710,8 @@ void cleanup_pipe (struct dt_iop_module_t *self, dt_dev_pixelpipe_t *pipe, dt_de
     cmsDeleteTransform(d->xform);
     d->xform = 0;
   }
+  dt_colorlut_free(d->clut);
+  g_free(d->clut_key);
 
   free(piece->data);
 }
@@ -71,6 +71,8 @@ typedef struct dt_iop_colorout_data_t
   cmsHPROFILE Lab;
   cmsHTRANSFORM *xform;
   float unbounded_coeffs[3][3];       // for extrapolation of shaper curves
+  dt_colorlut_t *clut;                // baked xform, for profiles without a matrix
+  gchar *clut_key;                    // profile and intent clut was baked for
 }
 dt_iop_colorout_data_t;
 
@@ -198,7 +198,11 @@ void tiling_callback  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop
 
     const int max_filter_radius = (1<<max_scale); // 2 * 2^max_scale
 
-    tiling->factor = 3.5f + max_scale;  // in + out + tmp + reducebuffer + scale buffers
+    // the cpu path only needs two coarse buffers, opencl keeps the detail of all scales.
+    if(piece->pipe->devid >= 0)
+      tiling->factor = 3.5f + max_scale;  // in + out + tmp + reducebuffer + scale buffers
+    else
+      tiling->factor = 4.0f;  // in + out + 2 coarse buffers
     tiling->maxbuf = 1.0f;
     tiling->overhead = 0;
     tiling->overlap = max_filter_radius;
@@ -335,7 +339,6 @@ weight_sse(const __m128 *c1, const __m128 *c2, const float inv_sigma2)
 #define ROW_PROLOGUE \
   const __m128 *px = ((__m128 *)in) + j*width; \
   const __m128 *px2; \
-  float *pdetail = detail + 4*j*width; \
   float *pcoarse = out + 4*j*width;
 
 #define SUM_PIXEL_PROLOGUE \
@@ -345,14 +348,14 @@ weight_sse(const __m128 *c1, const __m128 *c2, const float inv_sigma2)
 #define SUM_PIXEL_EPILOGUE \
   sum = _mm_div_ps(sum, wgt); \
   \
-  _mm_stream_ps(pdetail, _mm_sub_ps(*px, sum)); \
   _mm_stream_ps(pcoarse, sum); \
   px++; \
-  pdetail+=4; \
   pcoarse+=4;
 
+/* only writes the coarse scale: the detail coefficients are in - out, and are
+ * computed again where needed, so no scale keeps a buffer of them. */
 static void
-eaw_decompose (float *const out, const float *const in, float *const detail, const int scale,
+eaw_decompose (float *const out, const float *const in, const int scale,
                const float inv_sigma2, const int32_t width, const int32_t height)
 {
   const int mult = 1<<scale;
@@ -468,9 +471,13 @@ eaw_decompose (float *const out, const float *const in, float *const detail, con
 #undef SUM_PIXEL_PROLOGUE
 #undef SUM_PIXEL_EPILOGUE
 
+/* shrinks the detail coefficients between two neighbouring scales and adds them to
+ * out, which collects the processed detail of all scales. the first scale initializes
+ * out, which may be the same buffer as fine. */
 static void
-eaw_synthesize (float *const out, const float *const in, const float *const detail,
-                const float *thrsf, const float *boostf, const int32_t width, const int32_t height)
+eaw_synthesize (float *const out, const float *const fine, const float *const coarse,
+                const float *thrsf, const float *boostf, const int first,
+                const int32_t width, const int32_t height)
 {
   const __m128 threshold = _mm_set_ps(thrsf[3], thrsf[2], thrsf[1], thrsf[0]);
   const __m128 boost     = _mm_set_ps(boostf[3], boostf[2], boostf[1], boostf[0]);
@@ -481,25 +488,22 @@ eaw_synthesize (float *const out, const float *const in, const float *const deta
   for(int j=0; j<height; j++)
   {
     // TODO: prefetch? _mm_prefetch()
-    const __m128 *pin = (__m128 *)in + j*width;
-    __m128 *pdetail = (__m128 *)detail + j*width;
+    const __m128 *pfine = (__m128 *)fine + j*width;
+    const __m128 *pcoarse = (__m128 *)coarse + j*width;
     float *pout = out + 4*j*width;
     for(int i=0; i<width; i++)
     {
-#if 1
+      const __m128 detail = _mm_sub_ps(*pfine, *pcoarse);
       const __m128i maski = _mm_set1_epi32(0x80000000u);
       const __m128 *mask = (__m128*)&maski;
-      const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, *pdetail), threshold));
-      const __m128 amount = _mm_or_ps(_mm_and_ps(*pdetail, *mask), absamt);
-      _mm_stream_ps(pout, _mm_add_ps(*pin, _mm_mul_ps(boost, amount)));
-#endif
-      // _mm_stream_ps(pout, _mm_add_ps(*pin, *pdetail));
-      pdetail ++;
-      pin ++;
+      const __m128 absamt = _mm_max_ps(_mm_setzero_ps(), _mm_sub_ps(_mm_andnot_ps(*mask, detail), threshold));
+      const __m128 amount = _mm_mul_ps(boost, _mm_or_ps(_mm_and_ps(detail, *mask), absamt));
+      _mm_store_ps(pout, first ? amount : _mm_add_ps(_mm_load_ps(pout), amount));
+      pfine ++;
+      pcoarse ++;
       pout += 4;
     }
   }
-  _mm_sfence();
 }
 // =====================================================================================
 
@@ -533,12 +537,12 @@ void process_wavelets(
     if(t < 0.0f) break;
   }
 
-  float *buf[max_max_scale];
-  float *tmp = NULL;
+  // the coarse scales ping-pong between these two, *ovoid collects the detail.
+  // that way memory doesn't grow with the number of scales.
+  float *tmp[2] = { NULL };
   float *buf1 = NULL, *buf2 = NULL;
-  for(int k=0; k<max_scale; k++)
-    buf[k] = dt_alloc_align(64, 4*sizeof(float)*roi_in->width*roi_in->height);
-  tmp = dt_alloc_align(64, 4*sizeof(float)*roi_in->width*roi_in->height);
+  for(int k=0; k<2; k++)
+    tmp[k] = dt_alloc_align(64, 4*sizeof(float)*roi_in->width*roi_in->height);
 
   const float wb[3] =
   {
@@ -575,16 +579,16 @@ void process_wavelets(
   }
 #endif
   buf1 = (float *)ovoid;
-  buf2 = tmp;
+  buf2 = tmp[0];
 
   for(int scale=0; scale<max_scale; scale++)
   {
+    // variance stabilizing transform maps sigma to unity.
     const float sigma = 1.0f;
+    // it is then transformed by wavelet scales via the 5 tap a-trous filter:
     const float varf = sqrtf(2.0f + 2.0f * 4.0f*4.0f + 6.0f*6.0f)/16.0f; // about 0.5
     const float sigma_band = powf(varf, scale) *sigma;
-    eaw_decompose (buf2, buf1, buf[scale], scale, 1.0f/(sigma_band*sigma_band), width, height);
-    // DEBUG: clean out temporary memory:
-    // memset(buf1, 0, sizeof(float)*4*width*height);
+    eaw_decompose (buf2, buf1, scale, 1.0f/(sigma_band*sigma_band), width, height);
 # if 0 // DEBUG: print wavelet scales:
     if(piece->pipe->type != DT_DEV_PIXELPIPE_PREVIEW)
     {
@@ -596,35 +600,18 @@ void process_wavelets(
       for(int k=0; k<n; k++)
         fwrite(buf2+4*k, sizeof(float), 3, f);
       fclose(f);
-      snprintf(filename, 512, "/tmp/detail_%d.pfm", scale);
-      f = fopen(filename, "wb");
-      fprintf(f, "PF\n%d %d\n-1.0\n", width, height);
-      for(int k=0; k<n; k++)
-        fwrite(buf[scale]+4*k, sizeof(float), 3, f);
-      fclose(f);
     }
 #endif
-    float *buf3 = buf2;
-    buf2 = buf1;
-    buf1 = buf3;
-  }
-
-  // now do everything backwards, so the result will end up in *ovoid
-  for(int scale=max_scale-1; scale>=0; scale--)
-  {
-#if 1
-    // variance stabilizing transform maps sigma to unity.
-    const float sigma = 1.0f;
-    // it is then transformed by wavelet scales via the 5 tap a-trous filter:
-    const float varf = sqrtf(2.0f + 2.0f * 4.0f*4.0f + 6.0f*6.0f)/16.0f; // about 0.5
-    const float sigma_band = powf(varf, scale) *sigma;
     // determine thrs as bayesshrink
     // TODO: parallelize!
     float sum_y2[3] = {0.0f};
     const int n = width*height;
     for(int k=0; k<n; k++)
       for(int c=0; c<3; c++)
-        sum_y2[c] += buf[scale][4*k+c]*buf[scale][4*k+c];
+      {
+        const float detail = buf1[4*k+c] - buf2[4*k+c];
+        sum_y2[c] += detail*detail;
+      }
 
     const float sb2 = sigma_band*sigma_band;
     const float var_y[3] =
@@ -642,26 +629,32 @@ void process_wavelets(
     // add 8.0 here because it seemed a little weak
     const float adjt = 8.0f;
     const float thrs[4] = { adjt * sb2/std_x[0], adjt * sb2/std_x[1], adjt * sb2/std_x[2], 0.0f};
-    // const float std = (std_x[0] + std_x[1] + std_x[2])/3.0f;
-    // const float thrs[4] = { adjt*sigma*sigma/std, adjt*sigma*sigma/std, adjt*sigma*sigma/std, 0.0f};
     // fprintf(stderr, "scale %d thrs %f %f %f = %f / %f %f %f \n", scale, thrs[0], thrs[1], thrs[2], sb2, std_x[0], std_x[1], std_x[2]);
-#endif
     const float boost[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    // const float thrs[4] = { 0.0, 0.0, 0.0, 0.0 };
-    eaw_synthesize (buf2, buf1, buf[scale], thrs, boost, width, height);
-    // DEBUG: clean out temporary memory:
-    // memset(buf1, 0, sizeof(float)*4*width*height);
+    // the finest scale lives in *ovoid, which starts collecting the detail right here:
+    eaw_synthesize ((float *)ovoid, buf1, buf2, thrs, boost, scale == 0, width, height);
 
+    if(scale == 0) buf1 = tmp[1];  // now switch to tmp[1] for buffer ping-pong between buf1 and buf2
     float *buf3 = buf2;
     buf2 = buf1;
     buf1 = buf3;
   }
 
+  // add the coarsest scale, so the result will end up in *ovoid
+  if(max_scale > 0)
+  {
+    const int n = 4*width*height;
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(buf1, ovoid) schedule(static)
+#endif
+    for(int k=0; k<n; k++)
+      ((float *)ovoid)[k] += buf1[k];
+  }
+
   backtransform((float *)ovoid, width, height, aa, bb);
 
-  for(int k=0; k<max_scale; k++)
-    free(buf[k]);
-  free(tmp);
+  free(tmp[0]);
+  free(tmp[1]);
 
   if(piece->pipe->mask_display)
     dt_iop_alpha_copy(ivoid, ovoid, width, height);
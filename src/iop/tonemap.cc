@@ -43,6 +43,7 @@ extern "C"
 #include "bauhaus/bauhaus.h"
 #include "develop/develop.h"
 #include "develop/imageop.h"
+#include "develop/tiling.h"
 #include "control/control.h"
 #include "gui/accelerators.h"
 #include "gui/gtk.h"
@@ -89,7 +90,7 @@ extern "C"
   int
   flags ()
   {
-    return IOP_FLAGS_SUPPORTS_BLENDING;
+    return IOP_FLAGS_SUPPORTS_BLENDING | IOP_FLAGS_ALLOW_TILING;
   }
 
   void init_key_accels(dt_iop_module_so_t *self)
@@ -110,6 +111,30 @@ extern "C"
                                 GTK_WIDGET(g->Fsize));
   }
 
+  // above this many pixels, the lattice doesn't record the simplex of each pixel (48 bytes
+  // per pixel), but finds it again when slicing. a bit slower, but it only needs memory for
+  // the lattice points.
+#define DT_TONEMAP_REPLAY_MAX_PIXELS (4<<20)
+
+  static float
+  _inv_sigma_s(const dt_iop_tonemapping_data_t *data, dt_dev_pixelpipe_iop_t *piece, const float scale)
+  {
+    const float iw=piece->buf_in.width*scale;
+    const float ih=piece->buf_in.height*scale;
+    float sigma_s=(data->Fsize/100.0) * fminf(iw,ih);
+    if(sigma_s<3.0) sigma_s=3.0;
+    return 1.0/sigma_s;
+  }
+
+  // lattice points to expect: about one per unit volume, touching a few range levels per
+  // spatial cell for natural images. only used to size the hash tables up front.
+  static size_t
+  _lattice_points(const int width, const int height, const float inv_sigma_s)
+  {
+    const size_t cells = (size_t)(width*inv_sigma_s + 2) * (size_t)(height*inv_sigma_s + 2);
+    return MIN(4*cells, (size_t)width*height);
+  }
+
   void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
   {
     dt_iop_tonemapping_data_t *data = (dt_iop_tonemapping_data_t *)piece->data;
@@ -122,14 +147,11 @@ extern "C"
     width=roi_in->width;
     height=roi_in->height;
     size=width*height;
-    const float iw=piece->buf_in.width*roi_out->scale;
-    const float ih=piece->buf_in.height*roi_out->scale;
+    inv_sigma_s = _inv_sigma_s(data, piece, roi_out->scale);
 
-    inv_sigma_s=(data->Fsize/100.0) * fminf(iw,ih);
-    if(inv_sigma_s<3.0) inv_sigma_s=3.0;
-    inv_sigma_s = 1.0/inv_sigma_s;
-
-    PermutohedralLattice<3,2> lattice(size, omp_get_max_threads());
+    const int replay = size <= DT_TONEMAP_REPLAY_MAX_PIXELS;
+    PermutohedralLattice<3,2> lattice(replay ? size : 0, omp_get_max_threads(),
+                                      _lattice_points(width, height, inv_sigma_s));
 
     // Build I=log(L)
     // and splat into the lattice
@@ -188,11 +210,17 @@ extern "C"
       float *out = (float*)ovoid + j*width*ch;
       for(int i=0; i<width; i++, index++, in+=ch, out+=ch)
       {
-        float val[2];
-        lattice.slice(val, index);
         float L = 0.2126*in[0]+ 0.7152*in[1] + 0.0722*in[2];
         if(L<=0.0) L=1e-6;
         L = logf(L);
+        float val[2];
+        if(replay) lattice.slice(val, index);
+        else
+        {
+          // same position as splatted above
+          const float pos[3] = {i*inv_sigma_s, j*inv_sigma_s, L*inv_sigma_r};
+          lattice.slice(val, pos);
+        }
         const float B = val[0]/val[1];
         const float detail = L - B;
         const float Ln = expf(B*(contr - 1.0f) + detail - 1.0f);
@@ -274,6 +302,27 @@ extern "C"
     memcpy(module->default_params, &tmp, sizeof(dt_iop_tonemapping_params_t));
   }
 
+  void tiling_callback  (struct dt_iop_module_t *self, struct dt_dev_pixelpipe_iop_t *piece, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out, struct dt_develop_tiling_t *tiling)
+  {
+    dt_iop_tonemapping_data_t *data = (dt_iop_tonemapping_data_t *)piece->data;
+    const float inv_sigma_s = _inv_sigma_s(data, piece, roi_out->scale);
+    const int width = roi_in->width, height = roi_in->height;
+    const size_t size = (size_t)width*height;
+    // a lattice point costs up to 64 bytes in the hash tables, and the per thread
+    // tables hold them once more before merging. the lattice grows with the area,
+    // so express it relative to the 16 bytes per pixel of the input buffer.
+    const float lattice = 2.0f*64.0f*_lattice_points(width, height, inv_sigma_s)/(16.0f*size);
+    // recorded simplices, 48 bytes per pixel:
+    const float replay = size <= DT_TONEMAP_REPLAY_MAX_PIXELS ? 3.0f : 0.0f;
+    tiling->factor = 2.0f + lattice + replay;
+    tiling->maxbuf = 1.0f;
+    tiling->overhead = 0;
+    tiling->overlap = ceilf(3.0f/inv_sigma_s);
+    tiling->xalign = 1;
+    tiling->yalign = 1;
+    return;
+  }
+
   void init(dt_iop_module_t *module)
   {
     // module->data = malloc(sizeof(dt_iop_tonemapping_data_t));
@@ -42,13 +42,22 @@
 #endif
 
 #include "common/metadata.h"
+#include "common/memory.h"
 #include "common/utility.h"
 #include "common/file_location.h"
 
+#include <glib/gstdio.h>
+#include <sys/stat.h>
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
 #define CLIP(x) ((x<0)?0.0:(x>1.0)?1.0:x)
 DT_MODULE(2)
 
-// gchar *checksum = g_compute_checksum_for_data(G_CHECKSUM_MD5,data,length);
+// number of entries kept in each of the caches below
+#define DT_WATERMARK_MAX_FILES    8
+#define DT_WATERMARK_MAX_SVGS     8
+#define DT_WATERMARK_MAX_OVERLAYS 8
 
 typedef enum dt_iop_watermark_base_scale_t
 {
@@ -87,6 +96,56 @@ typedef struct dt_iop_watermark_data_t
 }
 dt_iop_watermark_data_t;
 
+/** contents of a watermark file, only read again when it changes on disk. */
+typedef struct dt_iop_watermark_file_t
+{
+  gchar *path;
+  time_t mtime;
+  gchar *data;
+  gsize length;
+  /** checksum of data. */
+  gchar *checksum;
+  /** no $(..) variables, the document is the same for every image. */
+  int is_static;
+}
+dt_iop_watermark_file_t;
+
+/** a parsed document, by checksum of the svg after variable substitution. */
+typedef struct dt_iop_watermark_svg_t
+{
+  gchar *checksum;
+  RsvgHandle *handle;
+  RsvgDimensionData dimension;
+}
+dt_iop_watermark_svg_t;
+
+/** a rendered watermark. it only covers the bounding box of the svg, clipped to the roi. */
+typedef struct dt_iop_watermark_overlay_t
+{
+  // key: document, scale and position of the svg in output pixels, roi size
+  gchar *checksum;
+  float scale, tx, ty;
+  int roi_width, roi_height;
+  // bounding box in the roi and premultiplied ARGB32 pixels
+  int x, y, width, height, stride;
+  guint8 *image;
+  // pipes blending it right now, it's only freed when that drops to zero.
+  int users;
+}
+dt_iop_watermark_overlay_t;
+
+/** shared by all pipes, so batch exports with the same logo only parse and render it once. */
+typedef struct dt_iop_watermark_global_data_t
+{
+  dt_pthread_mutex_t lock;
+  // most recently used first:
+  GList *files;
+  GList *svgs;
+  GList *overlays;
+  dt_memory_client_t *memory;
+}
+dt_iop_watermark_global_data_t;
+
 typedef struct dt_iop_watermark_gui_data_t
 {
   GtkComboBox *combobox1;		                                             // watermark
@@ -210,10 +269,14 @@ static gboolean _combo_box_set_active_text(GtkComboBox *cb,gchar *text)
 // replace < and > with &lt; and &gt;. any more? Yes! & -> &amp;
 static gchar *_string_escape(const gchar *string)
 {
-  gchar *result;
+  gchar *result, *tmp;
   result = dt_util_str_replace(string, "&", "&amp;");
-  result = dt_util_str_replace(result, "<", "&lt;");
-  result = dt_util_str_replace(result, ">", "&gt;");
+  tmp = result;
+  result = dt_util_str_replace(tmp, "<", "&lt;");
+  g_free(tmp);
+  tmp = result;
+  result = dt_util_str_replace(tmp, ">", "&gt;");
+  g_free(tmp);
   return result;
 }
 
@@ -226,28 +289,10 @@ static gchar *_string_substitute(gchar *string,const gchar *search,const gchar *
   return result;
 }
 
-static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_data_t *data, const dt_image_t *image)
+// substitutes the variables in a copy of the file contents, takes ownership of svgdata.
+static gchar * _watermark_get_svgdoc( gchar *svgdata, const dt_image_t *image)
 {
-  gsize length;
-
   gchar *svgdoc=NULL;
-  gchar configdir[DT_MAX_PATH_LEN];
-  gchar datadir[DT_MAX_PATH_LEN];
-  gchar *filename;
-  dt_loc_get_datadir(datadir, DT_MAX_PATH_LEN);
-  dt_loc_get_user_config_dir(configdir, DT_MAX_PATH_LEN);
-  g_strlcat(datadir,"/watermarks/", DT_MAX_PATH_LEN);
-  g_strlcat(configdir,"/watermarks/", DT_MAX_PATH_LEN);
-  g_strlcat(datadir,data->filename, DT_MAX_PATH_LEN);
-  g_strlcat(configdir,data->filename, DT_MAX_PATH_LEN);
-
-  if (g_file_test(configdir,G_FILE_TEST_EXISTS))
-    filename=configdir;
-  else if (g_file_test(datadir,G_FILE_TEST_EXISTS))
-    filename=datadir;
-  else return NULL;
-
-  gchar *svgdata=NULL;
   char datetime[200];
 
   // EXIF datetime
@@ -271,7 +316,7 @@ static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_da
   time_t t = time(NULL);
   (void)localtime_r(&t, &tt_cur);
 
-  if( g_file_get_contents( filename, &svgdata, &length, NULL) )
+  if( svgdata )
   {
     // File is loaded lets substitute strings if found...
 
@@ -585,52 +630,317 @@ static gchar * _watermark_get_svgdoc( dt_iop_module_t *self, dt_iop_watermark_da
 }
 
 
-void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+
+static void
+_watermark_file_free(dt_iop_watermark_file_t *file)
 {
-  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
-  float *in  = (float *)ivoid;
-  float *out = (float *)ovoid;
-  const int ch = piece->colors;
+  g_free(file->path);
+  g_free(file->data);
+  g_free(file->checksum);
+  free(file);
+}
 
-  /* Load svg if not loaded */
-  gchar *svgdoc = _watermark_get_svgdoc (self, data, &piece->pipe->image);
-  if (!svgdoc)
+static void
+_watermark_svg_free(dt_iop_watermark_svg_t *svg)
+{
+  g_free(svg->checksum);
+  g_object_unref(svg->handle);
+  free(svg);
+}
+
+static void
+_watermark_overlay_free(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_overlay_t *overlay)
+{
+  dt_memory_free(gd->memory, (size_t)overlay->stride*overlay->height);
+  g_free(overlay->checksum);
+  g_free(overlay->image);
+  free(overlay);
+}
+
+// drop unused overlays from the tail until at most keep are left. called with gd->lock held.
+static void
+_watermark_overlays_trim(dt_iop_watermark_global_data_t *gd, const int keep)
+{
+  int cnt = 0;
+  GList *l = gd->overlays;
+  while(l)
   {
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    GList *next = g_list_next(l);
+    dt_iop_watermark_overlay_t *overlay = (dt_iop_watermark_overlay_t *)l->data;
+    if(!overlay->users && ++cnt > keep)
+    {
+      gd->overlays = g_list_delete_link(gd->overlays, l);
+      _watermark_overlay_free(gd, overlay);
+    }
+    l = next;
+  }
+}
+
+static void
+_watermark_reclaim(void *data, const size_t bytes)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)data;
+  dt_pthread_mutex_lock(&gd->lock);
+  _watermark_overlays_trim(gd, 0);
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+// returns the contents of the watermark file, reading it only if it changed on disk.
+// called with gd->lock held.
+static dt_iop_watermark_file_t *
+_watermark_get_file(dt_iop_watermark_global_data_t *gd, const char *name)
+{
+  gchar configdir[DT_MAX_PATH_LEN];
+  gchar datadir[DT_MAX_PATH_LEN];
+  gchar *filename;
+  dt_loc_get_datadir(datadir, DT_MAX_PATH_LEN);
+  dt_loc_get_user_config_dir(configdir, DT_MAX_PATH_LEN);
+  g_strlcat(datadir,"/watermarks/", DT_MAX_PATH_LEN);
+  g_strlcat(configdir,"/watermarks/", DT_MAX_PATH_LEN);
+  g_strlcat(datadir,name, DT_MAX_PATH_LEN);
+  g_strlcat(configdir,name, DT_MAX_PATH_LEN);
+
+  if (g_file_test(configdir,G_FILE_TEST_EXISTS))
+    filename=configdir;
+  else if (g_file_test(datadir,G_FILE_TEST_EXISTS))
+    filename=datadir;
+  else return NULL;
+
+  struct stat st;
+  if(g_stat(filename, &st)) return NULL;
+
+  for(GList *l = gd->files; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_file_t *file = (dt_iop_watermark_file_t *)l->data;
+    if(strcmp(file->path, filename)) continue;
+    gd->files = g_list_delete_link(gd->files, l);
+    if(file->mtime == st.st_mtime)
+    {
+      gd->files = g_list_prepend(gd->files, file);
+      return file;
+    }
+    // changed on disk, read it again
+    _watermark_file_free(file);
+    break;
+  }
+
+  dt_iop_watermark_file_t *file = (dt_iop_watermark_file_t *)malloc(sizeof(dt_iop_watermark_file_t));
+  if(!file) return NULL;
+  if(!g_file_get_contents(filename, &file->data, &file->length, NULL))
+  {
+    free(file);
+    return NULL;
+  }
+  file->path = g_strdup(filename);
+  file->mtime = st.st_mtime;
+  file->checksum = g_compute_checksum_for_data(G_CHECKSUM_MD5, (const guchar *)file->data, file->length);
+  file->is_static = strstr(file->data, "$(") == NULL;
+  gd->files = g_list_prepend(gd->files, file);
+
+  GList *last = g_list_nth(gd->files, DT_WATERMARK_MAX_FILES);
+  if(last)
+  {
+    _watermark_file_free((dt_iop_watermark_file_t *)last->data);
+    gd->files = g_list_delete_link(gd->files, last);
+  }
+  return file;
+}
+
+// returns a new reference to the parsed watermark for this image, and the checksum of
+// its document (to be freed by the caller), or NULL.
+static RsvgHandle *
+_watermark_get_svg(dt_iop_watermark_global_data_t *gd, const dt_iop_watermark_data_t *data,
+                   const dt_image_t *image, RsvgDimensionData *dimension, gchar **checksum)
+{
+  gchar *svgdoc = NULL;
+  *checksum = NULL;
+
+  dt_pthread_mutex_lock(&gd->lock);
+  dt_iop_watermark_file_t *file = _watermark_get_file(gd, data->filename);
+  if(!file)
+  {
+    dt_pthread_mutex_unlock(&gd->lock);
+    return NULL;
+  }
+  const int is_static = file->is_static;
+  if(is_static)
+  {
+    *checksum = g_strdup(file->checksum);
+  }
+  else
+  {
+    // the variables need the database, don't keep the others waiting.
+    gchar *svgdata = g_strndup(file->data, file->length);
+    dt_pthread_mutex_unlock(&gd->lock);
+    svgdoc = _watermark_get_svgdoc(svgdata, image);
+    if(!svgdoc) return NULL;
+    *checksum = g_compute_checksum_for_string(G_CHECKSUM_MD5, svgdoc, -1);
+    dt_pthread_mutex_lock(&gd->lock);
+  }
+
+  for(GList *l = gd->svgs; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_svg_t *svg = (dt_iop_watermark_svg_t *)l->data;
+    if(strcmp(svg->checksum, *checksum)) continue;
+    gd->svgs = g_list_delete_link(gd->svgs, l);
+    gd->svgs = g_list_prepend(gd->svgs, svg);
+    *dimension = svg->dimension;
+    RsvgHandle *handle = g_object_ref(svg->handle);
+    dt_pthread_mutex_unlock(&gd->lock);
+    g_free(svgdoc);
+    return handle;
   }
 
   /* create the rsvghandle from parsed svg data */
   GError *error = NULL;
-  RsvgHandle *svg = rsvg_handle_new_from_data ((const guint8 *)svgdoc,strlen (svgdoc),&error);
-  g_free (svgdoc);
-  if (!svg || error)
+  RsvgHandle *handle = NULL;
+  if(is_static)
   {
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    // still holding the lock, so file is valid.
+    handle = rsvg_handle_new_from_data((const guint8 *)file->data, file->length, &error);
+  }
+  else
+  {
+    handle = rsvg_handle_new_from_data((const guint8 *)svgdoc, strlen(svgdoc), &error);
+  }
+  g_free(svgdoc);
+  if(!handle || error)
+  {
+    dt_pthread_mutex_unlock(&gd->lock);
+    if(handle) g_object_unref(handle);
+    if(error) g_error_free(error);
+    g_free(*checksum);
+    *checksum = NULL;
+    return NULL;
   }
 
-  /* setup stride for performance */
-  int stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,roi_out->width);
+  dt_iop_watermark_svg_t *svg = (dt_iop_watermark_svg_t *)malloc(sizeof(dt_iop_watermark_svg_t));
+  svg->checksum = g_strdup(*checksum);
+  svg->handle = handle;
+  rsvg_handle_get_dimensions(handle, &svg->dimension);
+  *dimension = svg->dimension;
+  gd->svgs = g_list_prepend(gd->svgs, svg);
 
-  /* create cairo memory surface */
-  guint8 *image= (guint8 *)g_malloc (stride*roi_out->height);
-  memset (image,0,stride*roi_out->height);
-  cairo_surface_t *surface = cairo_image_surface_create_for_data (image,CAIRO_FORMAT_ARGB32,roi_out->width,roi_out->height,stride);
-  if (cairo_surface_status(surface)!=	CAIRO_STATUS_SUCCESS)
+  GList *last = g_list_nth(gd->svgs, DT_WATERMARK_MAX_SVGS);
+  if(last)
   {
-//   fprintf(stderr,"Cairo surface error: %s\n",cairo_status_to_string(cairo_surface_status(surface)));
-    g_free (image);
-    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
-    return;
+    _watermark_svg_free((dt_iop_watermark_svg_t *)last->data);
+    gd->svgs = g_list_delete_link(gd->svgs, last);
   }
 
-  /* create cairo context and setup transformation/scale */
-  cairo_t *cr = cairo_create (surface);
+  handle = g_object_ref(handle);
+  dt_pthread_mutex_unlock(&gd->lock);
+  return handle;
+}
 
-  /* get the dimension of svg */
+// returns the watermark rendered at the given scale, with the svg origin at (tx,ty) in output
+// pixels, clipped to the roi. renders it on a cache miss. release with _watermark_release_overlay().
+static dt_iop_watermark_overlay_t *
+_watermark_get_overlay(dt_iop_watermark_global_data_t *gd, RsvgHandle *handle, const gchar *checksum,
+                       const RsvgDimensionData *dimension, const float scale, const float tx, const float ty,
+                       const int roi_width, const int roi_height)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  for(GList *l = gd->overlays; l; l = g_list_next(l))
+  {
+    dt_iop_watermark_overlay_t *overlay = (dt_iop_watermark_overlay_t *)l->data;
+    if(overlay->scale != scale || overlay->tx != tx || overlay->ty != ty ||
+       overlay->roi_width != roi_width || overlay->roi_height != roi_height ||
+       strcmp(overlay->checksum, checksum)) continue;
+    gd->overlays = g_list_delete_link(gd->overlays, l);
+    gd->overlays = g_list_prepend(gd->overlays, overlay);
+    overlay->users++;
+    dt_pthread_mutex_unlock(&gd->lock);
+    return overlay;
+  }
+  dt_pthread_mutex_unlock(&gd->lock);
+
+  // bounding box of the svg, clipped to the roi:
+  const int x0 = MAX(0, (int)floorf(tx)), y0 = MAX(0, (int)floorf(ty));
+  const int x1 = MIN(roi_width,  (int)ceilf(tx + dimension->width*scale));
+  const int y1 = MIN(roi_height, (int)ceilf(ty + dimension->height*scale));
+
+  dt_iop_watermark_overlay_t *overlay = (dt_iop_watermark_overlay_t *)malloc(sizeof(dt_iop_watermark_overlay_t));
+  overlay->checksum = g_strdup(checksum);
+  overlay->scale = scale;
+  overlay->tx = tx;
+  overlay->ty = ty;
+  overlay->roi_width = roi_width;
+  overlay->roi_height = roi_height;
+  overlay->x = x0;
+  overlay->y = y0;
+  overlay->width = MAX(0, x1 - x0);
+  overlay->height = MAX(0, y1 - y0);
+  overlay->stride = cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, overlay->width);
+  overlay->image = NULL;
+  overlay->users = 1;
+
+  if(overlay->width > 0 && overlay->height > 0)
+  {
+    overlay->image = (guint8 *)g_malloc0((size_t)overlay->stride*overlay->height);
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(overlay->image, CAIRO_FORMAT_ARGB32,
+                                                                   overlay->width, overlay->height, overlay->stride);
+    if(cairo_surface_status(surface) != CAIRO_STATUS_SUCCESS)
+    {
+      cairo_surface_destroy(surface);
+      g_free(overlay->image);
+      overlay->image = NULL;
+      overlay->width = overlay->height = 0;
+    }
+    else
+    {
+      /* create cairo context and setup transformation/scale */
+      cairo_t *cr = cairo_create(surface);
+      cairo_translate(cr, tx - x0, ty - y0);
+      cairo_scale(cr, scale, scale);
+
+      /* render svg into surface*/
+      dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
+      rsvg_handle_render_cairo(handle, cr);
+      dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+
+      /* ensure that all operations on surface finishing up */
+      cairo_surface_flush(surface);
+      cairo_destroy(cr);
+      cairo_surface_destroy(surface);
+    }
+  }
+  dt_memory_alloc(gd->memory, (size_t)overlay->stride*overlay->height);
+
+  dt_pthread_mutex_lock(&gd->lock);
+  gd->overlays = g_list_prepend(gd->overlays, overlay);
+  _watermark_overlays_trim(gd, DT_WATERMARK_MAX_OVERLAYS);
+  dt_pthread_mutex_unlock(&gd->lock);
+  return overlay;
+}
+
+static void
+_watermark_release_overlay(dt_iop_watermark_global_data_t *gd, dt_iop_watermark_overlay_t *overlay)
+{
+  dt_pthread_mutex_lock(&gd->lock);
+  overlay->users--;
+  _watermark_overlays_trim(gd, DT_WATERMARK_MAX_OVERLAYS);
+  dt_pthread_mutex_unlock(&gd->lock);
+}
+
+void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void *ivoid, void *ovoid, const dt_iop_roi_t *roi_in, const dt_iop_roi_t *roi_out)
+{
+  dt_iop_watermark_data_t *data = (dt_iop_watermark_data_t *)piece->data;
+  float *in  = (float *)ivoid;
+  float *out = (float *)ovoid;
+  const int ch = piece->colors;
+
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)self->data;
+
+  /* get the parsed svg, from the cache if the document didn't change */
   RsvgDimensionData dimension;
-  rsvg_handle_get_dimensions (svg,&dimension);
+  gchar *checksum = NULL;
+  RsvgHandle *svg = _watermark_get_svg (gd, data, &piece->pipe->image, &dimension, &checksum);
+  if (!svg)
+  {
+    memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
+    return;
+  }
 
   //  width/height of current (possibly cropped) image
   const float iw = piece->buf_in.width;
@@ -729,54 +1039,54 @@ void process (struct dt_iop_module_t *self, dt_dev_pixelpipe_iop_t *piece, void
   else if( data->alignment == 2 ||  data->alignment == 5 || data->alignment==8 )
     tx=iw-svg_width;
 
-  // translate to position
-  cairo_translate (cr,-roi_in->x,-roi_in->y);
-
   // add translation for the given value in GUI (xoffset,yoffset)
   tx += data->xoffset*wbase;
   ty += data->yoffset*hbase;
 
-  cairo_translate (cr,tx*roi_out->scale,ty*roi_out->scale);
-
-  // now set proper scale for the watermark itself
-  cairo_scale(cr, scale, scale);
-
-  /* render svg into surface*/
-  dt_pthread_mutex_lock(&darktable.plugin_threadsafe);
-  rsvg_handle_render_cairo (svg,cr);
-  dt_pthread_mutex_unlock(&darktable.plugin_threadsafe);
+  // position of the svg in the output buffer
+  tx = tx*roi_out->scale - roi_in->x;
+  ty = ty*roi_out->scale - roi_in->y;
 
-  /* ensure that all operations on surface finishing up */
-  cairo_surface_flush (surface);
-
-  /* render surface on output */
-  guint8 *sd = image;
-  float opacity = data->opacity/100.0;
-  /*
-  #ifdef _OPENMP
-  	#pragma omp parallel for default(none) shared(roi_out, in, out,sd,opacity) schedule(static)
-  #endif
-  */
-  for(int j=0; j<roi_out->height; j++) for(int i=0; i<roi_out->width; i++)
+  /* get the watermark rendered at this size and position */
+  dt_iop_watermark_overlay_t *overlay = _watermark_get_overlay (gd, svg, checksum, &dimension, scale, tx, ty,
+                                                               roi_out->width, roi_out->height);
+  g_object_unref (svg);
+  g_free (checksum);
+
+  memcpy(ovoid, ivoid, sizeof(float)*ch*roi_out->width*roi_out->height);
+
+  /* blend it over the output, only where it is */
+  const float opacity = data->opacity/100.0;
+  const __m128 op = _mm_set1_ps(opacity/255.0f);
+  const __m128 one = _mm_set1_ps(1.0f);
+  // keeps the alpha channel of the input
+  const __m128 rgb = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(overlay, in, out, roi_out) schedule(static)
+#endif
+  for(int j=0; j<overlay->height; j++)
+  {
+    const guint8 *sd = overlay->image + (size_t)j*overlay->stride;
+    const float *pin = in + ch*((size_t)(j + overlay->y)*roi_out->width + overlay->x);
+    float *pout = out + ch*((size_t)(j + overlay->y)*roi_out->width + overlay->x);
+    for(int i=0; i<overlay->width; i++)
     {
-      float alpha = (sd[3]/255.0)*opacity;
-      /* svg uses a premultiplied alpha, so only use opacity for the blending */
-      out[0] = ((1.0-alpha)*in[0]) + (opacity*(sd[2]/255.0));
-      out[1] = ((1.0-alpha)*in[1]) + (opacity*(sd[1]/255.0));
-      out[2] = ((1.0-alpha)*in[2]) + (opacity*(sd[0]/255.0));
-      out[3] = in[3];
-
-      out+=ch;
-      in+=ch;
+      // bgra bytes to floats, svg uses a premultiplied alpha, so only use opacity for the blending
+      const __m128i px = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(*(const int *)sd), _mm_setzero_si128()),
+                                            _mm_setzero_si128());
+      const __m128 bgra = _mm_mul_ps(_mm_cvtepi32_ps(px), op);
+      const __m128 color = _mm_shuffle_ps(bgra, bgra, _MM_SHUFFLE(3, 0, 1, 2));
+      const __m128 alpha = _mm_shuffle_ps(bgra, bgra, _MM_SHUFFLE(3, 3, 3, 3));
+      const __m128 vin = _mm_load_ps(pin);
+      const __m128 blended = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(one, alpha), vin), color);
+      _mm_store_ps(pout, _mm_or_ps(_mm_and_ps(rgb, blended), _mm_andnot_ps(rgb, vin)));
+      pout+=ch;
+      pin+=ch;
       sd+=4;
     }
+  }
 
-
-  /* clean up */
-  cairo_surface_destroy (surface);
-  g_object_unref (svg);
-  g_free (image);
-
+  _watermark_release_overlay (gd, overlay);
 }
 
 static void
@@ -1021,6 +1331,31 @@ void cleanup(dt_iop_module_t *module)
   module->params = NULL;
 }
 
+void init_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)malloc(sizeof(dt_iop_watermark_global_data_t));
+  module->data = gd;
+  dt_pthread_mutex_init(&gd->lock, NULL);
+  gd->files = NULL;
+  gd->svgs = NULL;
+  gd->overlays = NULL;
+  gd->memory = dt_memory_register(darktable.memory, "watermarks", DT_MEMORY_RANK_PIXELPIPE, 1, _watermark_reclaim, gd);
+}
+
+void cleanup_global(dt_iop_module_so_t *module)
+{
+  dt_iop_watermark_global_data_t *gd = (dt_iop_watermark_global_data_t *)module->data;
+  g_list_free_full(gd->files, (GDestroyNotify)_watermark_file_free);
+  g_list_free_full(gd->svgs, (GDestroyNotify)_watermark_svg_free);
+  for(GList *l = gd->overlays; l; l = g_list_next(l))
+    _watermark_overlay_free(gd, (dt_iop_watermark_overlay_t *)l->data);
+  g_list_free(gd->overlays);
+  dt_memory_unregister(darktable.memory, gd->memory);
+  dt_pthread_mutex_destroy(&gd->lock);
+  free(module->data);
+  module->data = NULL;
+}
+
 void gui_init(struct dt_iop_module_t *self)
 {
   self->gui_data = malloc(sizeof(dt_iop_watermark_gui_data_t));
@@ -40,7 +40,7 @@ typedef struct dt_lib_image_t
   *rotate_cw_button, *rotate_ccw_button, *remove_button,
   *delete_button, *create_hdr_button, *duplicate_button, *reset_button,
   *move_button, *copy_button, *group_button, *ungroup_button, *cache_button,
-  *uncache_button;
+  *uncache_button, *thumbnails_button;
 }
 dt_lib_image_t;
 
@@ -119,6 +119,7 @@ button_clicked(GtkWidget *widget, gpointer user_data)
   else if(i == 11) _ungroup_helper_function();
   else if(i == 12) dt_control_set_local_copy_images();
   else if(i == 13) dt_control_reset_local_copy_images();
+  else if(i == 14) dt_control_generate_thumbnails();
 }
 
 int
@@ -233,6 +234,15 @@ gui_init (dt_lib_module_t *self)
   gtk_box_pack_start(hbox, button, TRUE, TRUE, 0);
   g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(button_clicked), (gpointer)11);
 
+  gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(hbox), TRUE, TRUE, 0);
+  hbox = GTK_BOX(gtk_hbox_new(TRUE, 5));
+
+  button = gtk_button_new_with_label(_("generate thumbnails"));
+  d->thumbnails_button = button;
+  g_object_set(G_OBJECT(button), "tooltip-text", _("generate the thumbnails of the whole collection in the background"), (char *)NULL);
+  gtk_box_pack_start(hbox, button, TRUE, TRUE, 0);
+  g_signal_connect(G_OBJECT(button), "clicked", G_CALLBACK(button_clicked), (gpointer)14);
+
   gtk_box_pack_start(GTK_BOX(self->widget), GTK_WIDGET(hbox), TRUE, TRUE, 0);
 }
 
@@ -260,6 +270,7 @@ void init_key_accels(dt_lib_module_t *self)
   // Grouping keys
   dt_accel_register_lib(self, NC_("accel", "group"), GDK_g, GDK_CONTROL_MASK);
   dt_accel_register_lib(self, NC_("accel", "ungroup"), GDK_g, GDK_CONTROL_MASK | GDK_SHIFT_MASK);
+  dt_accel_register_lib(self, NC_("accel", "generate thumbnails"), 0, 0);
 }
 
 void connect_key_accels(dt_lib_module_t *self)
@@ -278,6 +289,7 @@ void connect_key_accels(dt_lib_module_t *self)
   // Grouping keys
   dt_accel_connect_button_lib(self, "group", d->group_button);
   dt_accel_connect_button_lib(self, "ungroup", d->ungroup_button);
+  dt_accel_connect_button_lib(self, "generate thumbnails", d->thumbnails_button);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
 // vim: shiftwidth=2 expandtab tabstop=2 cindent
@@ -135,13 +135,12 @@ static void update(dt_lib_module_t *user_data, gboolean early_bark_out)
   // using dt_metadata_get() is not possible here. we want to do all this in a single pass, everything else takes ages.
   if(imgsel < 0)  // selected images
   {
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select key, value from meta_data where id in (select imgid from selected_images) group by key, value order by value", -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db, "select key, value from meta_data where id in (select imgid from selected_images) group by key, value order by value");
   }
   else     // single image under mouse cursor
   {
-    char query[1024];
-    snprintf(query, 1024, "select key, value from meta_data where id = %d group by key, value order by value", imgsel);
-    DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+    stmt = dt_database_get_statement(darktable.db, "select key, value from meta_data where id = ?1 group by key, value order by value");
+    DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, imgsel);
   }
   while(sqlite3_step(stmt) == SQLITE_ROW)
   {
@@ -173,7 +172,7 @@ static void update(dt_lib_module_t *user_data, gboolean early_bark_out)
       }
     }
   }
-  sqlite3_finalize(stmt);
+  dt_database_release_statement(darktable.db, stmt);
 
   fill_combo_box_entry(&(d->title), title_count, &title, &(d->multi_title));
   fill_combo_box_entry(&(d->description), description_count, &description, &(d->multi_description));
@@ -182,11 +182,10 @@ static void _metadata_view_update_values(dt_lib_module_t *self)
     }
     else
     {
-      sqlite3_stmt *stmt;
-      DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select imgid from selected_images limit 1", -1, &stmt, NULL);
+      sqlite3_stmt *stmt = dt_database_get_statement(darktable.db, "select imgid from selected_images limit 1");
       if(sqlite3_step(stmt) == SQLITE_ROW)
         mouse_over_id = sqlite3_column_int(stmt, 0);
-      sqlite3_finalize(stmt);
+      dt_database_release_statement(darktable.db, stmt);
     }
   }
 
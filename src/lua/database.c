@@ -22,6 +22,7 @@
 #include "common/debug.h"
 #include "common/darktable.h"
 #include "common/image.h"
+#include "common/image_cache.h"
 #include "common/film.h"
 
 /***********************************************************************
@@ -117,6 +118,104 @@ static int database_index(lua_State*L)
   return 1;
 }
 
+/***********************************************************************
+  Batches
+ **********************************************************************/
+
+// running totals, a batch reports the difference.
+static int batch_commits = 0;
+static int batch_statements = 0;
+
+void dt_lua_database_count(const int commits, const int statements)
+{
+  batch_commits += commits;
+  batch_statements += statements;
+}
+
+gint *dt_lua_image_list(lua_State *L, int index, int *num)
+{
+  luaL_checktype(L,index,LUA_TTABLE);
+  *num = luaL_len(L,index);
+  // check them all before allocating, luaL_error doesn't return.
+  for(int k = 1; k <= *num; k++) {
+    lua_rawgeti(L,index,k);
+    if(!luaL_testudata(L,-1,"dt_lua_image_t"))
+      luaL_error(L,"entry %d of the list is not an image",k);
+    lua_pop(L,1);
+  }
+  gint *imgs = g_new(gint,MAX(*num,1));
+  for(int k = 1; k <= *num; k++) {
+    lua_rawgeti(L,index,k);
+    luaA_to(L,dt_lua_image_t,&imgs[k-1],-1);
+    lua_pop(L,1);
+  }
+  return imgs;
+}
+
+// calls the function at the bottom of the stack with the rest as arguments, with all image
+// writes in one transaction and the sidecars written once it is committed. an error inside
+// still commits what has been done so far, the image structs have been changed already.
+static int batch_call(lua_State *L)
+{
+  dt_image_cache_stats_t before, after;
+  const int commits = batch_commits;
+  const int statements = batch_statements;
+  dt_image_cache_get_stats(darktable.image_cache,&before);
+  dt_image_cache_write_batch_begin(darktable.image_cache);
+  const int error = lua_pcall(L,lua_gettop(L)-1,0,0);
+  dt_image_cache_write_batch_end(darktable.image_cache);
+  if(error) return lua_error(L);
+  dt_image_cache_get_stats(darktable.image_cache,&after);
+
+  const int writes = after.writes - before.writes;
+  const int alone = writes + batch_commits - commits;
+  lua_newtable(L);
+  lua_pushnumber(L,writes);
+  lua_setfield(L,-2,"images_written");
+  lua_pushnumber(L,MAX(alone - 1,0));
+  lua_setfield(L,-2,"commits_avoided");
+  lua_pushnumber(L,batch_statements - statements);
+  lua_setfield(L,-2,"statements_avoided");
+  lua_pushnumber(L,(after.sidecars_requested - before.sidecars_requested)
+                 - (after.sidecars_queued - before.sidecars_queued));
+  lua_setfield(L,-2,"sidecars_avoided");
+  dt_print(DT_DEBUG_LUA,"[lua] batch wrote %d images, avoided %d commits and %d statements\n",
+           writes,MAX(alone - 1,0),batch_statements - statements);
+  return 1;
+}
+
+static int database_batch(lua_State *L)
+{
+  luaL_checktype(L,1,LUA_TFUNCTION);
+  lua_settop(L,1);
+  return batch_call(L);
+}
+
+static int set_images(lua_State *L)
+{
+  const int num = luaL_len(L,1);
+  for(int k = 1; k <= num; k++) {
+    lua_rawgeti(L,1,k);
+    lua_pushvalue(L,2);
+    lua_pushvalue(L,3);
+    lua_settable(L,-3);
+    lua_pop(L,1);
+  }
+  return 0;
+}
+
+// database.set(images,field,value): image[field] = value for a whole list of images.
+static int database_set(lua_State *L)
+{
+  luaL_checktype(L,1,LUA_TTABLE);
+  luaL_checkstring(L,2);
+  luaL_checkany(L,3);
+  lua_settop(L,3);
+  lua_pushcfunction(L,set_images);
+  lua_insert(L,1);
+  return batch_call(L);
+}
+
 int dt_lua_init_database(lua_State * L)
 {
 
@@ -131,6 +230,10 @@ int dt_lua_init_database(lua_State * L)
   dt_lua_register_type_callback_stack_typeid(L,type_id,"duplicate");
   lua_pushcfunction(L,import_images);
   dt_lua_register_type_callback_stack_typeid(L,type_id,"import");
+  lua_pushcfunction(L,database_batch);
+  dt_lua_register_type_callback_stack_typeid(L,type_id,"batch");
+  lua_pushcfunction(L,database_set);
+  dt_lua_register_type_callback_stack_typeid(L,type_id,"set");
 
   return 0;
 }
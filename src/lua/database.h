@@ -23,6 +23,13 @@
 int dt_lua_duplicate_image(lua_State *L);
 int dt_lua_init_database(lua_State * L);
 
+/** the ids of a lua table of images, to be freed with g_free(). raises a lua error if an entry isn't an image. */
+gint *dt_lua_image_list(lua_State *L, int index, int *num);
+/** accounting for darktable.database.batch(): an operation which would have committed this many times
+    on its own, and saved this many sql statements by working on a whole list, compared to the single
+    image calls. negative if the list cost more. */
+void dt_lua_database_count(const int commits, const int statements);
+
 #endif
 
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
@@ -17,6 +17,7 @@
  */
 #include "lua/tags.h"
 #include "lua/image.h"
+#include "lua/database.h"
 #include "lua/types.h"
 #include "common/darktable.h"
 #include "common/tags.h"
@@ -150,6 +151,19 @@ int dt_lua_tag_attach(lua_State *L)
 {
   dt_lua_image_t imgid = -1;
   dt_lua_tag_t tagid = 0;
+  if(lua_istable(L,1) || lua_istable(L,2)) {
+    // a list of images: the same few statements for all of them, instead of a few per image.
+    const int list = lua_istable(L,1) ? 1 : 2;
+    luaA_to(L,dt_lua_tag_t,&tagid,3-list);
+    int num;
+    gint *imgs = dt_lua_image_list(L,list,&num);
+    const int run = dt_database_get_statements_run(darktable.db);
+    dt_tag_attach_images(tagid,imgs,num);
+    g_free(imgs);
+    // against what dt_tag_attach() would have run for each of them:
+    dt_lua_database_count(num,num*DT_TAG_SINGLE_STATEMENTS - (dt_database_get_statements_run(darktable.db) - run));
+    return 0;
+  }
   if(luaL_testudata(L,1,"dt_lua_image_t")) {
     luaA_to(L,dt_lua_image_t,&imgid,1);
     luaA_to(L,dt_lua_tag_t,&tagid,2);
@@ -158,6 +172,7 @@ int dt_lua_tag_attach(lua_State *L)
     luaA_to(L,dt_lua_image_t,&imgid,2);
   }
   dt_tag_attach(tagid,imgid);
+  dt_lua_database_count(1,0);
   return 0;
 }
 
@@ -165,6 +180,18 @@ int dt_lua_tag_detach(lua_State *L)
 {
   dt_lua_image_t imgid;
   dt_lua_tag_t tagid;
+  if(lua_istable(L,1) || lua_istable(L,2)) {
+    const int list = lua_istable(L,1) ? 1 : 2;
+    luaA_to(L,dt_lua_tag_t,&tagid,3-list);
+    int num;
+    gint *imgs = dt_lua_image_list(L,list,&num);
+    const int run = dt_database_get_statements_run(darktable.db);
+    dt_tag_detach_images(tagid,imgs,num);
+    g_free(imgs);
+    // against what dt_tag_detach() would have run for each of them:
+    dt_lua_database_count(num,num*DT_TAG_SINGLE_STATEMENTS - (dt_database_get_statements_run(darktable.db) - run));
+    return 0;
+  }
   if(luaL_testudata(L,1,"dt_lua_image_t")) {
     luaA_to(L,dt_lua_image_t,&imgid,1);
     luaA_to(L,dt_lua_tag_t,&tagid,2);
@@ -173,6 +200,7 @@ int dt_lua_tag_detach(lua_State *L)
     luaA_to(L,dt_lua_image_t,&imgid,2);
   }
   dt_tag_detach(tagid,imgid);
+  dt_lua_database_count(1,0);
   return 0;
 }
 
@@ -29,6 +29,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <assert.h>
+#include <sys/time.h>
 #ifdef _OPENMP
 #  include <omp.h>
 #endif
@@ -42,6 +43,48 @@ alloc_dummy(void *data, const uint32_t key, int32_t *cost, void **buf)
   return 0;
 }
 
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + 1e-6*time.tv_usec;
+}
+
+// contention benchmark: all threads read the same working set over and over,
+// as export threads and the lighttable do with the image and mipmap caches.
+// with working_set < quota these are all hits, else a mix of hits and evictions.
+static void
+benchmark(const int working_set, const int quota)
+{
+  dt_cache_t cache;
+  dt_cache_init(&cache, 2*working_set, 16, 64, quota);
+  dt_cache_set_allocate_callback(&cache, alloc_dummy, NULL);
+  const int ops = 1<<20;
+  for(int threads=1; threads<=64; threads*=2)
+  {
+    const double start = get_time();
+#ifdef _OPENMP
+    #  pragma omp parallel for default(none) schedule(static) shared(cache, working_set, ops) num_threads(threads)
+#endif
+    for(int k=0; k<ops; k++)
+    {
+      // scatter the keys a bit, so threads don't walk in lock step:
+      const uint32_t key = 1 + ((uint32_t)k * 2654435761u) % working_set;
+      const int val = (int)(long int)dt_cache_read_get(&cache, key);
+      assert(val == key);
+      dt_cache_read_release(&cache, key);
+    }
+    const double end = get_time();
+    fprintf(stderr, "[bench] working set %d, quota %d, %2d threads: %.2f Mops/s\n",
+            working_set, quota, threads, ops/(end-start)*1e-6);
+  }
+  const int size = dt_cache_size(&cache);
+  assert(size == lru_check_consistency(&cache));
+  assert(size == lru_check_consistency_reverse(&cache));
+  dt_cache_cleanup(&cache);
+}
+
 int main(int argc, char *arg[])
 {
   dt_cache_t cache;
@@ -124,6 +167,12 @@ int main(int argc, char *arg[])
     dt_cache_cleanup(&cache2);
   }
 
+  // all hits, nothing is ever evicted:
+  benchmark(4096, 8192);
+  // working set twice the quota, the garbage collector has to step in all the time:
+  benchmark(4096, 2048);
+  fprintf(stderr, "[passed] contention benchmark\n");
+
   exit(0);
 }
 // modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
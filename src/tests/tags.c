@@ -0,0 +1,220 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+// the bits of dt the tags use, on a plain sqlite3 handle:
+#include <sqlite3.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static struct
+{
+  sqlite3 *db;
+  void *signals;
+}
+darktable;
+
+#define dt_database_get(db) (db)
+#define dt_print(flags, ...)
+#define dt_control_signal_raise(signals, signal)
+#define DT_SIGNAL_TAG_CHANGED 0
+
+static sqlite3_stmt *
+dt_database_get_statement(sqlite3 *db, const char *sql)
+{
+  sqlite3_stmt *stmt = NULL;
+  sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  return stmt;
+}
+
+static void
+dt_database_release_statement(sqlite3 *db, sqlite3_stmt *stmt)
+{
+  sqlite3_finalize(stmt);
+}
+
+// single threaded, so nobody to wait for:
+static void
+dt_database_start_savepoint(sqlite3 *db, const char *name)
+{
+  gchar *sql = g_strdup_printf("savepoint %s", name);
+  sqlite3_exec(db, sql, NULL, NULL, NULL);
+  g_free(sql);
+}
+
+static void
+dt_database_release_savepoint(sqlite3 *db, const char *name)
+{
+  gchar *sql = g_strdup_printf("release %s", name);
+  sqlite3_exec(db, sql, NULL, NULL, NULL);
+  g_free(sql);
+}
+
+static gchar *
+dt_util_glist_to_str(const gchar *separator, GList *items, const unsigned int count)
+{
+  return g_strdup("");
+}
+
+// unit test for the tag pairs in tagxtag and the suggestions built on top of them.
+#include "common/tags.c"
+
+static void
+exec(const char *sql)
+{
+  char *err = NULL;
+  if(sqlite3_exec(darktable.db, sql, NULL, NULL, &err) != SQLITE_OK)
+  {
+    fprintf(stderr, "sqlite3 error: %s\n  %s\n", err, sql);
+    exit(1);
+  }
+}
+
+// the tables of the library and the in-memory ones the tags use, as control.c creates them.
+static void
+create_tables()
+{
+  assert(sqlite3_open(":memory:", &darktable.db) == SQLITE_OK);
+  exec("ATTACH DATABASE ':memory:' AS memory");
+  exec("create table tags (id integer primary key, name varchar, icon blob, description varchar, flags integer)");
+  exec("create table tagxtag (id1 integer, id2 integer, count integer, primary key(id1, id2))");
+  exec("create table tagged_images (imgid integer, tagid integer, primary key(imgid, tagid))");
+  exec("create table selected_images (imgid integer primary key)");
+  exec("CREATE TABLE memory.tagq (tmpid INTEGER PRIMARY KEY, id INTEGER)");
+  exec("CREATE TABLE memory.taglist (tmpid INTEGER PRIMARY KEY, id INTEGER UNIQUE ON CONFLICT REPLACE, count INTEGER)");
+  exec("CREATE TABLE memory.tag_trigrams (trigram INTEGER, id INTEGER, PRIMARY KEY (trigram, id))");
+  exec("CREATE TABLE memory.tag_images (imgid INTEGER PRIMARY KEY)");
+}
+
+static int
+pair_count(const guint a, const guint b)
+{
+  sqlite3_stmt *stmt;
+  sqlite3_prepare_v2(darktable.db, "SELECT count FROM tagxtag WHERE id1 = ?1 AND id2 = ?2", -1, &stmt, NULL);
+  sqlite3_bind_int(stmt, 1, MIN(a, b));
+  sqlite3_bind_int(stmt, 2, MAX(a, b));
+  const int count = sqlite3_step(stmt) == SQLITE_ROW ? sqlite3_column_int(stmt, 0) : 0;
+  sqlite3_finalize(stmt);
+  return count;
+}
+
+static int
+suggested(const char *keyword, const guint tagid)
+{
+  GList *result = NULL;
+  dt_tag_get_suggestions(keyword, &result);
+  int found = 0;
+  for(GList *l = result; l; l = g_list_next(l))
+    if(((dt_tag_t *)l->data)->id == tagid) found = 1;
+  dt_tag_free_result(&result);
+  return found;
+}
+
+// what dt_database_get_statements_run() counts, the same way:
+static int statements_run = 0;
+
+static void
+count_statements(void *data, const char *sql, sqlite3_uint64 ns)
+{
+  statements_run++;
+}
+
+int main(int argc, char *arg[])
+{
+  create_tables();
+
+  guint sky, sea, tree;
+  assert(dt_tag_new("landscape|sky", &sky));
+  assert(dt_tag_new("landscape|sea", &sea));
+  // a tag which isn't on any image comes back for its own name, with and without trigrams:
+  assert(suggested("sky", sky));
+  assert(suggested("sk", sky));
+  assert(suggested("landscape|s", sea));
+  assert(!suggested("sky", sea));
+  fprintf(stderr, "[passed] fresh tags are suggested by name\n");
+
+  dt_tag_attach(sky, 1);
+  dt_tag_attach(sea, 1);
+  dt_tag_attach(sea, 2);
+  // attaching twice doesn't count twice:
+  dt_tag_attach(sea, 1);
+  assert(pair_count(sky, sea) == 1);
+  assert(suggested("sky", sea));
+  assert(suggested("sea", sky));
+  fprintf(stderr, "[passed] tags on the same image are paired and suggested\n");
+
+  // created after the trigram table was built:
+  assert(dt_tag_new("tree", &tree));
+  assert(suggested("tree", tree));
+  assert(!suggested("tree", sky));
+  fprintf(stderr, "[passed] tags created later are suggested by name\n");
+
+  dt_tag_detach(sea, 1);
+  assert(pair_count(sky, sea) == 0);
+  assert(!suggested("sky", sea));
+  assert(suggested("sky", sky));
+  fprintf(stderr, "[passed] pairs are dropped when no image has both tags\n");
+
+  // reading an xmp sidecar again, as dt_exif_xmp_read does it: strip the tags of the
+  // image, then attach the ones of its dc:subject, which brings a new tag along.
+  dt_tag_attach(sky, 3);
+  dt_tag_attach(tree, 3);
+  assert(pair_count(sky, tree) == 1);
+  for(int k=0; k<2; k++)
+  {
+    dt_tag_detach_all(3);
+    dt_tag_attach_string_list("landscape|sky, holiday", 3);
+  }
+  guint holiday;
+  assert(dt_tag_exists("holiday", &holiday));
+  assert(pair_count(sky, tree) == 0);
+  assert(pair_count(sky, holiday) == 1);
+  assert(pair_count(holiday, holiday) == 0);
+  assert(suggested("holiday", holiday));
+  assert(suggested("sky", holiday));
+  assert(!suggested("tree", holiday));
+  fprintf(stderr, "[passed] tags read from an xmp are paired and suggested\n");
+
+  // the numbers lua reports for the list variants:
+  const gint imgs[] = { 10, 11, 12, 13 };
+  sqlite3_profile(darktable.db, count_statements, NULL);
+  statements_run = 0;
+  dt_tag_attach(sky, 9);
+  assert(statements_run == DT_TAG_SINGLE_STATEMENTS);
+  statements_run = 0;
+  dt_tag_detach(sky, 9);
+  assert(statements_run == DT_TAG_SINGLE_STATEMENTS);
+  statements_run = 0;
+  dt_tag_attach_images(sky, imgs, 4);
+  assert(statements_run == 4 + 6);
+  statements_run = 0;
+  dt_tag_detach_images(sky, imgs, 4);
+  assert(statements_run == 4 + 6);
+  sqlite3_profile(darktable.db, NULL, NULL);
+  fprintf(stderr, "[passed] statements run by single and list variants\n");
+
+  sqlite3_close(darktable.db);
+  exit(0);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -0,0 +1,555 @@
+/*
+    This file is part of darktable,
+    copyright (c) 2013 darktable developers.
+
+    darktable is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    darktable is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with darktable.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#define DT_UNIT_TEST
+// the bits of dt the pixel kernels use:
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define CLAMP(x, low, high) (((x) > (high)) ? (high) : (((x) < (low)) ? (low) : (x)))
+typedef struct dt_iop_roi_t
+{
+  int x, y, width, height;
+  float scale;
+}
+dt_iop_roi_t;
+
+// unit test and benchmark for the zoom and half size demosaic of thumbnails and previews.
+#include "develop/imageop_math.c"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+
+// the plain scalar versions, as the reference the results have to match:
+
+static void
+old_dt_iop_flip_and_zoom_8(
+  const uint8_t *in,
+  int32_t iw,
+  int32_t ih,
+  uint8_t *out,
+  int32_t ow,
+  int32_t oh,
+  const int32_t orientation,
+  uint32_t *width,
+  uint32_t *height)
+{
+  // init strides:
+  const uint32_t iwd = (orientation & 4) ? ih : iw;
+  const uint32_t iht = (orientation & 4) ? iw : ih;
+  const float scale = fmaxf(iwd/(float)ow, iht/(float)oh);
+  const uint32_t wd = *width  = MIN(ow, iwd/scale);
+  const uint32_t ht = *height = MIN(oh, iht/scale);
+  const int bpp = 4; // bytes per pixel
+  int32_t ii = 0, jj = 0;
+  int32_t si = 1, sj = iw;
+  if(orientation & 2)
+  {
+    jj = ih - jj - 1;
+    sj = -sj;
+  }
+  if(orientation & 1)
+  {
+    ii = iw - ii - 1;
+    si = -si;
+  }
+  if(orientation & 4)
+  {
+    int t = sj;
+    sj = si;
+    si = t;
+  }
+  const int32_t half_pixel = .5f*scale;
+  const int32_t offm = half_pixel*bpp*MIN(MIN(0, si), MIN(sj, si+sj));
+  const int32_t offM = half_pixel*bpp*MAX(MAX(0, si), MAX(sj, si+sj));
+#ifdef _OPENMP
+  #pragma omp parallel for schedule(static) default(none) shared(in, out, jj, ii, sj, si, iw, ih)
+#endif
+  for(uint32_t j=0; j<ht; j++)
+  {
+    uint8_t *out2 = out + bpp*wd*j;
+    const uint8_t *in2 = in + bpp*(iw*jj + ii + sj*(int32_t)(scale*j));
+    float stepi = 0.0f;
+    for(uint32_t i=0; i<wd; i++)
+    {
+      const uint8_t *in3 = in2 + ((int32_t)stepi)*si*bpp;
+      // this should always be within the bounds of in[], due to the way
+      // wd/ht are constructed by always just rounding down. half_pixel should never
+      // add up to one pixel difference.
+      // we have this check with the hope the branch predictor will get rid of it:
+      if(in3 + offm >= in &&
+          in3 + offM < in + bpp*iw*ih)
+      {
+        for(int k=0; k<3; k++) out2[k] = // in3[2-k];
+            CLAMP(((int32_t)in3[bpp*half_pixel*sj      + 2-k] +
+                   (int32_t)in3[bpp*half_pixel*(si+sj) + 2-k] +
+                   (int32_t)in3[bpp*half_pixel*si      + 2-k] +
+                   (int32_t)in3[2-k])/4, 0, 255);
+      }
+      out2  += bpp;
+      stepi += scale;
+    }
+  }
+}
+
+static void old_dt_iop_clip_and_zoom_8(const uint8_t *i, int32_t ix, int32_t iy, int32_t iw, int32_t ih, int32_t ibw, int32_t ibh,
+                            uint8_t *o, int32_t ox, int32_t oy, int32_t ow, int32_t oh, int32_t obw, int32_t obh)
+{
+  const float scalex = iw/(float)ow;
+  const float scaley = ih/(float)oh;
+  int32_t ix2 = MAX(ix, 0);
+  int32_t iy2 = MAX(iy, 0);
+  int32_t ox2 = MAX(ox, 0);
+  int32_t oy2 = MAX(oy, 0);
+  int32_t oh2 = MIN(MIN(oh, (ibh - iy2)/scaley), obh - oy2);
+  int32_t ow2 = MIN(MIN(ow, (ibw - ix2)/scalex), obw - ox2);
+  assert((int)(ix2 + ow2*scalex) <= ibw);
+  assert((int)(iy2 + oh2*scaley) <= ibh);
+  assert(ox2 + ow2 <= obw);
+  assert(oy2 + oh2 <= obh);
+  assert(ix2 >= 0 && iy2 >= 0 && ox2 >= 0 && oy2 >= 0);
+  float x = ix2, y = iy2;
+  for(int s=0; s<oh2; s++)
+  {
+    int idx = ox2 + obw*(oy2+s);
+    for(int t=0; t<ow2; t++)
+    {
+      for(int k=0; k<3; k++) o[4*idx + k] = //i[3*(ibw* (int)y +             (int)x             ) + k)];
+          CLAMP(((int32_t)i[(4*(ibw*(int32_t) y +            (int32_t) (x + .5f*scalex)) + k)] +
+                 (int32_t)i[(4*(ibw*(int32_t)(y+.5f*scaley) +(int32_t) (x + .5f*scalex)) + k)] +
+                 (int32_t)i[(4*(ibw*(int32_t)(y+.5f*scaley) +(int32_t) (x             )) + k)] +
+                 (int32_t)i[(4*(ibw*(int32_t) y +            (int32_t) (x             )) + k)])/4, 0, 255);
+      x += scalex;
+      idx++;
+    }
+    y += scaley;
+    x = ix2;
+  }
+}
+
+
+static int
+old_FC(const int row, const int col, const unsigned int filters)
+{
+  return filters >> ((((row) << 1 & 14) + ((col) & 1)) << 1) & 3;
+}
+
+/**
+ * downscales and clips a mosaiced buffer (in) to the given region of interest (r_*)
+ * and writes it to out in float4 format.
+ * filters is the dcraw supplied int encoding of the bayer pattern, flipped with the buffer.
+ * resamping is done via bilateral filtering and respecting the input mosaic pattern.
+ */
+static void
+old_dt_iop_clip_and_zoom_demosaic_half_size(
+  float *out,
+  const uint16_t *const in,
+  const dt_iop_roi_t *const roi_out,
+  const dt_iop_roi_t *const roi_in,
+  const int32_t out_stride,
+  const int32_t in_stride,
+  const unsigned int filters)
+{
+    // adjust to pixel region and don't sample more than scale/2 nbs!
+    // pixel footprint on input buffer, radius:
+    const float px_footprint = 1.f/roi_out->scale;
+    // how many 2x2 blocks can be sampled inside that area
+    const int samples = round(px_footprint/2);
+
+    // move p to point to an rggb block:
+    int trggbx = 0, trggby = 0;
+    if(old_FC(trggby, trggbx+1, filters) != 1) trggbx ++;
+    if(old_FC(trggby, trggbx,   filters) != 0)
+    {
+      trggbx = (trggbx + 1)&1;
+      trggby ++;
+    }
+    const int rggbx = trggbx, rggby = trggby;
+
+#ifdef _OPENMP
+    #pragma omp parallel for default(none) shared(out) schedule(static)
+#endif
+    for(int y=0; y<roi_out->height; y++)
+    {
+      float *outc = out + 4*(out_stride*y);
+
+      float fy = (y + roi_out->y)*px_footprint;
+      int py = (int)fy & ~1;
+      py = MIN(((roi_in->height-4) & ~1u), py) + rggby;
+
+      int maxj = MIN(((roi_in->height-3)&~1u)+rggby, py+2*samples);
+
+      float fx = roi_out->x*px_footprint;
+
+      for(int x=0; x<roi_out->width; x++)
+      {
+        __m128 col = _mm_setzero_ps();
+
+        fx += px_footprint;
+        int px = (int)fx & ~1;
+        px = MIN(((roi_in->width -4) & ~1u), px) + rggbx;
+
+        int maxi = MIN(((roi_in->width -3)&~1u)+rggbx, px+2*samples);
+
+        int num = 0;
+
+        const int idx = px + in_stride*py;
+        const uint16_t pc = MAX(MAX(in[idx], in[idx+1]), MAX(in[idx + in_stride], in[idx+1 + in_stride]));
+
+        // 2x2 blocks in the middle of sampling region
+        __m128i sum = _mm_set_epi32(0,0,0,0);
+
+        for(int j=py; j<=maxj; j+=2)
+          for(int i=px; i<=maxi; i+=2)
+          {
+            const uint16_t p1 = in[i   + in_stride*j];
+            const uint16_t p2 = in[i+1 + in_stride*j];
+            const uint16_t p3 = in[i   + in_stride*(j + 1)];
+            const uint16_t p4 = in[i+1 + in_stride*(j + 1)];
+
+            if (!((pc >= 60000) ^ (MAX(MAX(p1,p2),MAX(p3,p4)) >= 60000)))
+            {
+              sum = _mm_add_epi32(sum, _mm_set_epi32(0,p4,p3+p2,p1));
+              num++;
+            }
+          }
+
+        col = _mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_div_ps(_mm_set_ps(0.0f,1.0f/65535.0f,0.5f/65535.0f,1.0f/65535.0f),_mm_set1_ps(num)));
+        _mm_stream_ps(outc, col);
+        outc += 4;
+      }
+    }
+    _mm_sfence();
+}
+
+static void
+old_dt_iop_clip_and_zoom_demosaic_half_size_f(
+  float *out,
+  const float *const in,
+  const dt_iop_roi_t *const roi_out,
+  const dt_iop_roi_t *const roi_in,
+  const int32_t out_stride,
+  const int32_t in_stride,
+  const unsigned int filters,
+  const float clip)
+{
+  // adjust to pixel region and don't sample more than scale/2 nbs!
+  // pixel footprint on input buffer, radius:
+  const float px_footprint = 1.f/roi_out->scale;
+  // how many 2x2 blocks can be sampled inside that area
+  const int samples = round(px_footprint/2);
+
+  // move p to point to an rggb block:
+  int trggbx = 0, trggby = 0;
+  if(old_FC(trggby, trggbx+1, filters) != 1) trggbx ++;
+  if(old_FC(trggby, trggbx,   filters) != 0)
+  {
+    trggbx = (trggbx + 1)&1;
+    trggby ++;
+  }
+  const int rggbx = trggbx, rggby = trggby;
+
+#ifdef _OPENMP
+  #pragma omp parallel for default(none) shared(out) schedule(static)
+#endif
+  for(int y=0; y<roi_out->height; y++)
+  {
+    float *outc = out + 4*(out_stride*y);
+
+    float fy = (y + roi_out->y)*px_footprint;
+    int py = (int)fy & ~1;
+    const float dy = (fy - py)/2;
+    py = MIN(((roi_in->height-6) & ~1u), py) + rggby;
+
+    int maxj = MIN(((roi_in->height-5)&~1u)+rggby, py+2*samples);
+
+    for(int x=0; x<roi_out->width; x++)
+    {
+      __m128 col = _mm_setzero_ps();
+
+      float fx = (x + roi_out->x)*px_footprint;
+      int px = (int)fx & ~1;
+      const float dx = (fx - px)/2;
+      px = MIN(((roi_in->width -6) & ~1u), px) + rggbx;
+
+      int maxi = MIN(((roi_in->width -5)&~1u)+rggbx, px+2*samples);
+
+      float p1, p2, p4;
+      int i,j;
+      float num = 0;
+
+      // upper left 2x2 block of sampling region
+      p1 = in[px   + in_stride*py];
+      p2 = in[px+1 + in_stride*py] + in[px   + in_stride*(py + 1)];
+      p4 = in[px+1 + in_stride*(py + 1)];
+      col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps((1-dx)*(1-dy)),_mm_set_ps(0.0f, p4, p2, p1)));
+
+      // left 2x2 block border of sampling region
+      for (j = py+2 ; j <= maxj ; j+=2)
+      {
+        p1 = in[px   + in_stride*j];
+        p2 = in[px+1 + in_stride*j] + in[px   + in_stride*(j + 1)];
+        p4 = in[px+1 + in_stride*(j + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(1-dx),_mm_set_ps(0.0f, p4, p2, p1)));
+      }
+
+      // upper 2x2 block border of sampling region
+      for (i = px+2 ; i <= maxi ; i+=2)
+      {
+        p1 = in[i   + in_stride*py];
+        p2 = in[i+1 + in_stride*py] + in[i   + in_stride*(py + 1)];
+        p4 = in[i+1 + in_stride*(py + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(1-dy),_mm_set_ps(0.0f, p4, p2, p1)));
+      }
+
+      // 2x2 blocks in the middle of sampling region
+      for(int j=py+2; j<=maxj; j+=2)
+        for(int i=px+2; i<=maxi; i+=2)
+        {
+          p1 = in[i   + in_stride*j];
+          p2 = in[i+1 + in_stride*j] + in[i   + in_stride*(j + 1)];
+          p4 = in[i+1 + in_stride*(j + 1)];
+          col = _mm_add_ps(col, _mm_set_ps(0.0f, p4, p2, p1));
+        }
+
+      if (maxi == px + 2*samples && maxj == py + 2*samples)
+      {
+        // right border
+        for (j = py+2 ; j <= maxj ; j+=2)
+        {
+          p1 = in[maxi+2   + in_stride*j];
+          p2 = in[maxi+3 + in_stride*j] + in[maxi+2   + in_stride*(j + 1)];
+          p4 = in[maxi+3 + in_stride*(j + 1)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // upper right
+        p1 = in[maxi+2   + in_stride*py];
+        p2 = in[maxi+3 + in_stride*py] + in[maxi+2   + in_stride*(py + 1)];
+        p4 = in[maxi+3 + in_stride*(py + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx*(1-dy)),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        // lower border
+        for (i = px+2 ; i <= maxi ; i+=2)
+        {
+          p1 = in[i   + in_stride*(maxj+2)];
+          p2 = in[i+1 + in_stride*(maxj+2)] + in[i   + in_stride*(maxj+3)];
+          p4 = in[i+1 + in_stride*(maxj+3)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dy),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // lower left 2x2 block
+        p1 = in[px   + in_stride*(maxj+2)];
+        p2 = in[px+1 + in_stride*(maxj+2)] + in[px   + in_stride*(maxj+3)];
+        p4 = in[px+1 + in_stride*(maxj+3)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps((1-dx)*dy),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        // lower right 2x2 block
+        p1 = in[maxi+2   + in_stride*(maxj+2)];
+        p2 = in[maxi+3 + in_stride*(maxj+2)] + in[maxi   + in_stride*(maxj+3)];
+        p4 = in[maxi+3 + in_stride*(maxj+3)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx*dy),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        num = (samples+1)*(samples+1);
+      }
+      else if (maxi == px + 2*samples)
+      {
+        // right border
+        for (j = py+2 ; j <= maxj ; j+=2)
+        {
+          p1 = in[maxi+2   + in_stride*j];
+          p2 = in[maxi+3 + in_stride*j] + in[maxi+2   + in_stride*(j + 1)];
+          p4 = in[maxi+3 + in_stride*(j + 1)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // upper right
+        p1 = in[maxi+2   + in_stride*py];
+        p2 = in[maxi+3 + in_stride*py] + in[maxi+2   + in_stride*(py + 1)];
+        p4 = in[maxi+3 + in_stride*(py + 1)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dx*(1-dy)),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        num = ((maxj-py)/2+1-dy)*(samples+1);
+      }
+      else if (maxj == py + 2*samples)
+      {
+        // lower border
+        for (i = px+2 ; i <= maxi ; i+=2)
+        {
+          p1 = in[i   + in_stride*(maxj+2)];
+          p2 = in[i+1 + in_stride*(maxj+2)] + in[i   + in_stride*(maxj+3)];
+          p4 = in[i+1 + in_stride*(maxj+3)];
+          col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps(dy),_mm_set_ps(0.0f, p4, p2, p1)));
+        }
+
+        // lower left 2x2 block
+        p1 = in[px   + in_stride*(maxj+2)];
+        p2 = in[px+1 + in_stride*(maxj+2)] + in[px   + in_stride*(maxj+3)];
+        p4 = in[px+1 + in_stride*(maxj+3)];
+        col = _mm_add_ps(col, _mm_mul_ps(_mm_set1_ps((1-dx)*dy),_mm_set_ps(0.0f, p4, p2, p1)));
+
+        num = ((maxi-px)/2+1-dx)*(samples+1);
+      }
+      else
+      {
+        num = ((maxi-px)/2+1-dx)*((maxj-py)/2+1-dy);
+      }
+
+      num = 1.0f/num;
+      col = _mm_mul_ps(col, _mm_set_ps(0.0f,num,0.5f*num,num));
+      _mm_stream_ps(outc, col);
+      outc += 4;
+    }
+  }
+  _mm_sfence();
+}
+
+static double
+get_time()
+{
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return time.tv_sec + 1e-6*time.tv_usec;
+}
+
+// number of differing color channels of two rgba buffers. the alpha channel is left alone.
+static int
+diff_8(const uint8_t *a, const uint8_t *b, const int num)
+{
+  int bad = 0;
+  for(int k=0; k<4*num; k++) if((k&3) != 3 && a[k] != b[k]) bad++;
+  return bad;
+}
+
+// an 8-bit image, as the thumbnails are made from, down to the lighttable sizes:
+static void
+test_8(const int iw, const int ih, const int ow, const int oh)
+{
+  uint8_t *in = malloc(4*iw*ih);
+  for(int k=0; k<4*iw*ih; k++) in[k] = rand();
+  uint8_t *ref = calloc(4*ow*oh, 1), *out = calloc(4*ow*oh, 1);
+
+  for(int orientation=0; orientation<8; orientation++)
+  {
+    uint32_t rw, rh, w, h;
+    old_dt_iop_flip_and_zoom_8(in, iw, ih, ref, ow, oh, orientation, &rw, &rh);
+    dt_iop_flip_and_zoom_8(in, iw, ih, out, ow, oh, orientation, &w, &h);
+    assert(rw == w && rh == h);
+    assert(diff_8(ref, out, w*h) == 0);
+  }
+  old_dt_iop_clip_and_zoom_8(in, 0, 0, iw, ih, iw, ih, ref, 0, 0, ow, oh, ow, oh);
+  dt_iop_clip_and_zoom_8(in, 0, 0, iw, ih, iw, ih, out, 0, 0, ow, oh, ow, oh);
+  assert(diff_8(ref, out, ow*oh) == 0);
+
+  const int runs = 50;
+  uint32_t w, h;
+  double start = get_time();
+  for(int r=0; r<runs; r++) old_dt_iop_flip_and_zoom_8(in, iw, ih, ref, ow, oh, 0, &w, &h);
+  double mid = get_time();
+  for(int r=0; r<runs; r++) dt_iop_flip_and_zoom_8(in, iw, ih, out, ow, oh, 0, &w, &h);
+  double end = get_time();
+  fprintf(stderr, "[bench] flip_and_zoom_8 %dx%d -> %4dx%-4d old %7.3f ms new %7.3f ms\n",
+          iw, ih, ow, oh, (mid-start)*1e3/runs, (end-mid)*1e3/runs);
+
+  start = get_time();
+  for(int r=0; r<runs; r++) old_dt_iop_clip_and_zoom_8(in, 0, 0, iw, ih, iw, ih, ref, 0, 0, ow, oh, ow, oh);
+  mid = get_time();
+  for(int r=0; r<runs; r++) dt_iop_clip_and_zoom_8(in, 0, 0, iw, ih, iw, ih, out, 0, 0, ow, oh, ow, oh);
+  end = get_time();
+  fprintf(stderr, "[bench] clip_and_zoom_8 %dx%d -> %4dx%-4d old %7.3f ms new %7.3f ms\n",
+          iw, ih, ow, oh, (mid-start)*1e3/runs, (end-mid)*1e3/runs);
+
+  free(in);
+  free(ref);
+  free(out);
+}
+
+// a raw, as the preview pipe gets it, down to the preview sizes:
+static void
+test_half_size(const uint16_t *const in, const float *const inf, const int iw, const int ih,
+               const int ow, const int oh, const unsigned int filters)
+{
+  const dt_iop_roi_t roi_in = { 0, 0, iw, ih, 1.0f };
+  const dt_iop_roi_t roi_out = { 0, 0, ow, oh, ow/(float)iw };
+  float *ref = _mm_malloc(4*sizeof(float)*ow*oh, 16), *out = _mm_malloc(4*sizeof(float)*ow*oh, 16);
+
+  const int runs = 5;
+  double start = get_time();
+  for(int r=0; r<runs; r++) old_dt_iop_clip_and_zoom_demosaic_half_size(ref, in, &roi_out, &roi_in, ow, iw, filters);
+  double mid = get_time();
+  for(int r=0; r<runs; r++) dt_iop_clip_and_zoom_demosaic_half_size(out, in, &roi_out, &roi_in, ow, iw, filters);
+  double end = get_time();
+  assert(memcmp(ref, out, 4*sizeof(float)*ow*oh) == 0);
+  fprintf(stderr, "[bench] demosaic_half_size   %dx%d -> %4dx%-4d old %7.3f ms new %7.3f ms\n",
+          iw, ih, ow, oh, (mid-start)*1e3/runs, (end-mid)*1e3/runs);
+
+  start = get_time();
+  for(int r=0; r<runs; r++) old_dt_iop_clip_and_zoom_demosaic_half_size_f(ref, inf, &roi_out, &roi_in, ow, iw, filters, 1.0f);
+  mid = get_time();
+  for(int r=0; r<runs; r++) dt_iop_clip_and_zoom_demosaic_half_size_f(out, inf, &roi_out, &roi_in, ow, iw, filters, 1.0f);
+  end = get_time();
+  assert(memcmp(ref, out, 4*sizeof(float)*ow*oh) == 0);
+  fprintf(stderr, "[bench] demosaic_half_size_f %dx%d -> %4dx%-4d old %7.3f ms new %7.3f ms\n",
+          iw, ih, ow, oh, (mid-start)*1e3/runs, (end-mid)*1e3/runs);
+
+  _mm_free(ref);
+  _mm_free(out);
+}
+
+int main(int argc, char *arg[])
+{
+  srand(1);
+
+  // the mip sizes of the lighttable, from a 1440x960 preview:
+  test_8(1440, 960, 180, 110);
+  test_8(1440, 960, 360, 225);
+  test_8(1440, 960, 720, 450);
+  // odd sizes and upscaling:
+  test_8(1001, 667, 333, 222);
+  test_8(120, 80, 360, 225);
+  fprintf(stderr, "[passed] 8-bit zoom matches the reference\n");
+
+  const int iw = 6000, ih = 4000;
+  uint16_t *in = _mm_malloc(sizeof(uint16_t)*iw*ih, 16);
+  float *inf = _mm_malloc(sizeof(float)*iw*ih, 16);
+  for(int k=0; k<iw*ih; k++)
+  {
+    // some clipped pixels, too:
+    in[k] = (rand() % 16 == 0) ? 65535 : rand() % 65536;
+    inf[k] = in[k]/65535.0f;
+  }
+  // rggb and gbrg:
+  const unsigned int filters[] = { 0x94949494, 0x49494949 };
+  for(int f=0; f<2; f++)
+  {
+    test_half_size(in, inf, iw, ih, 720, 480, filters[f]);
+    test_half_size(in, inf, iw, ih, 1440, 960, filters[f]);
+    test_half_size(in, inf, iw, ih, 2000, 1333, filters[f]);
+  }
+  _mm_free(in);
+  _mm_free(inf);
+  fprintf(stderr, "[passed] half size demosaic matches the reference\n");
+
+  exit(0);
+}
+// modelines: These editor modelines have been set for all relevant files by tools/update_modelines.sh
+// vim: shiftwidth=2 expandtab tabstop=2 cindent
+// kate: tab-indents: off; indent-width 2; replace-tabs on; indent-mode cstyle; remove-trailing-space on;
@@ -497,6 +497,25 @@ select_this_image(const int imgid)
   }
 }
 
+// the preview pipe already holds the processed image, downscaled. if it is up to
+// date, use that for the lighttable thumbnails instead of running the whole pipe
+// once more when they are requested:
+static void
+_darkroom_update_thumbnail(dt_develop_t *dev)
+{
+  const uint32_t imgid = dev->image_storage.id;
+  if(dev->image_loading || dev->preview_dirty ||
+     dev->preview_pipe->input_timestamp < dev->pipe->input_timestamp)
+  {
+    dt_mipmap_cache_remove(darktable.mipmap_cache, imgid);
+    return;
+  }
+  dt_pthread_mutex_lock(&dev->preview_pipe->backbuf_mutex);
+  dt_mipmap_cache_write_from_buffer(darktable.mipmap_cache, imgid, dev->preview_pipe->backbuf,
+                                    dev->preview_pipe->backbuf_width, dev->preview_pipe->backbuf_height);
+  dt_pthread_mutex_unlock(&dev->preview_pipe->backbuf_mutex);
+}
+
 static void dt_dev_cleanup_module_accels(dt_iop_module_t *module)
 {
   dt_accel_disconnect_list(module->accel_closures);
@@ -544,7 +563,7 @@ dt_dev_change_image(dt_develop_t *dev, const uint32_t imgid)
   // TODO: only if image changed!
   // if()
   {
-    dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
+    _darkroom_update_thumbnail(dev);
     dt_image_synch_xmp(dev->image_storage.id);
   }
 
@@ -859,6 +878,14 @@ static void _darkroom_ui_pipe_finish_signal_callback(gpointer instance, gpointer
   dt_control_queue_redraw();
 }
 
+static void _darkroom_mipmaps_updated_signal_callback(gpointer instance, gpointer data)
+{
+  // the full buffer of the current image might have arrived, the image job waits for it.
+  dt_develop_t *dev = (dt_develop_t *)((dt_view_t *)data)->data;
+  if(dev->image_loading || dev->preview_dirty)
+    dt_control_queue_redraw_center();
+}
+
 static void _darkroom_ui_favorite_presets_popupmenu(GtkWidget *w, gpointer user_data)
 {
   /* create favorites menu and popup */
@@ -1050,6 +1077,11 @@ void enter(dt_view_t *self)
                             DT_SIGNAL_DEVELOP_UI_PIPE_FINISHED,G_CALLBACK(_darkroom_ui_pipe_finish_signal_callback),
                             (gpointer)self);
 
+  /* the raw is loaded in the background, redraw when it's there */
+  dt_control_signal_connect(darktable.signals,
+                            DT_SIGNAL_DEVELOP_MIPMAP_UPDATED,G_CALLBACK(_darkroom_mipmaps_updated_signal_callback),
+                            (gpointer)self);
+
   dt_print(DT_DEBUG_CONTROL, "[run_job+] 11 %f in darkroom mode\n", dt_get_wtime());
   dt_develop_t *dev = (dt_develop_t *)self->data;
   if (!dev->form_gui)
@@ -1275,6 +1307,14 @@ void leave(dt_view_t *self)
                                G_CALLBACK(_darkroom_ui_pipe_finish_signal_callback),
                                (gpointer)self);
 
+  // nobody is going to look at the neighbours now:
+  dt_view_filmstrip_prefetch_cancel();
+
+  /* disconnect from mipmap updated signal */
+  dt_control_signal_disconnect(darktable.signals,
+                               G_CALLBACK(_darkroom_mipmaps_updated_signal_callback),
+                               (gpointer)self);
+
   // store groups for next time:
   dt_conf_set_int("plugins/darkroom/groups", dt_dev_modulegroups_get(darktable.develop));
 
@@ -1297,7 +1337,7 @@ void leave(dt_view_t *self)
   // TODO: only if changed!
   // if()
   {
-    dt_mipmap_cache_remove(darktable.mipmap_cache, dev->image_storage.id);
+    _darkroom_update_thumbnail(dev);
     // dump new xmp data
     dt_image_synch_xmp(dev->image_storage.id);
   }
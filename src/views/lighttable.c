@@ -515,6 +515,9 @@ expose_filemanager (dt_view_t *self, cairo_t *cr, int32_t width, int32_t height,
   }
 
 end_query_cache:
+  /* fetch selection, labels, grouping and history state of all visible thumbs at once */
+  dt_view_image_info_prefetch(darktable.view_manager, query_ids, max_rows*max_cols);
+
   mouse_over_id = -1;
   cairo_save(cr);
   int current_image =0;
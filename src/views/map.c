@@ -31,35 +31,77 @@
 #include "gui/draw.h"
 #include "gui/accelerators.h"
 #include <gdk/gdkkeysyms.h>
+#include <math.h>
+#include <stdlib.h>
 
 #include "osm-gps-map.h"
 
 DT_MODULE(1)
 
 
+// the spatial index is a uniform grid of DT_MAP_INDEX_SIZE^2 buckets over the world
+#define DT_MAP_INDEX_SIZE 256
+// rendered markers kept around, the cache simply starts over when full
+#define DT_MAP_THUMB_CACHE_SIZE 1024
+
+/* a geotagged image in the spatial index */
+typedef struct dt_map_point_t
+{
+  gint imgid;
+  float latitude, longitude;
+  // web mercator, the world is [0,1)x[0,1) with north up
+  double x, y;
+} dt_map_point_t;
+
 typedef struct dt_map_t
 {
   GtkWidget *center;
   OsmGpsMap *map;
   OsmGpsMapLayer *osd;
-  GSList *images;
-  GdkPixbuf *pin;
-  gint selected_image;
-  gboolean start_drag;
+  // markers on the map, by cell of the cluster grid
+  GHashTable *images;
+  // zoom level the markers were clustered for
+  int images_zoom;
+  // rendered markers, by imgid and number of images in the cluster
+  GHashTable *thumbs;
+  int max_images_drawn;
+  // all geotagged images, sorted by bucket
   struct
   {
-    sqlite3_stmt *main_query;
-  } statements;
+    dt_map_point_t *points;
+    int num_points;
+    // first point of each bucket, plus one past the last point
+    int *bucket;
+    gboolean dirty;
+  } index;
+  gint selected_image;
+  gboolean start_drag;
   gboolean drop_filmstrip_activated;
 } dt_map_t;
 
+/* a marker on the map: one image, or a cluster of images shown with the first of them */
 typedef struct dt_map_image_t
 {
+  gint64 cell;
   gint imgid;
+  gint count;
   OsmGpsMapImage *image;
   gint width, height;
+  float latitude, longitude;
+  // drawn from a smaller mipmap, replaced once the right one is there
+  gboolean complete;
 } dt_map_image_t;
 
+/* images falling into one cell of the cluster grid */
+typedef struct dt_map_cluster_t
+{
+  gint64 cell;
+  gint imgid;
+  gint count;
+  double latitude, longitude;
+  double distance;
+} dt_map_cluster_t;
+
 static const int thumb_size = 64, thumb_border = 1, pin_size = 13;
 static const uint32_t thumb_frame_color = 0x000000aa;
 
@@ -100,22 +142,190 @@ uint32_t view(dt_view_t *self)
   return DT_VIEW_MAP;
 }
 
-static GdkPixbuf *init_pin()
+static void _view_map_set_frame_color(cairo_t *cr)
+{
+  cairo_set_source_rgba(cr, ((thumb_frame_color & 0xff000000) >> 24) / 255.0,
+                        ((thumb_frame_color & 0x00ff0000) >> 16) / 255.0,
+                        ((thumb_frame_color & 0x0000ff00) >>  8) / 255.0,
+                        ((thumb_frame_color & 0x000000ff) >>  0) / 255.0);
+}
+
+/* renders the thumbnail of an image in its frame, with the number of images for clusters
+   and optionally the pin below. complete tells if the mipmap had the right size. */
+static GdkPixbuf *_view_map_draw_marker(const int imgid, const int count, const gboolean pin,
+                                        const dt_mipmap_get_flags_t flags, gboolean *complete)
 {
-  int w = thumb_size + 2*thumb_border, h = pin_size;
-  float r, g, b, a;
-  r = ((thumb_frame_color & 0xff000000) >> 24) / 255.0;
-  g = ((thumb_frame_color & 0x00ff0000) >> 16) / 255.0;
-  b = ((thumb_frame_color & 0x0000ff00) >>  8) / 255.0;
-  a = ((thumb_frame_color & 0x000000ff) >>  0) / 255.0;
+  dt_mipmap_buffer_t buf;
+  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, thumb_size, thumb_size);
+  dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, flags);
+  if(!buf.buf)
+  {
+    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+    return NULL;
+  }
+  if(complete) *complete = (buf.size == mip);
+  uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
+  uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
+
+  int w=thumb_size, h=thumb_size;
+  if(buf.width < buf.height) w = (buf.width*thumb_size)/buf.height; // portrait
+  else                       h = (buf.height*thumb_size)/buf.width; // landscape
+  const int width = w + 2*thumb_border, height = h + 2*thumb_border + (pin ? pin_size : 0);
 
-  cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, h);
+  cairo_surface_t *cst = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
   cairo_t *cr = cairo_create(cst);
-  cairo_set_source_rgba(cr, r, g, b, a);
-  dtgtk_cairo_paint_map_pin(cr, 0, 0, w, h, 0);
-  uint8_t* data = cairo_image_surface_get_data(cst);
-  dt_draw_cairo_to_gdk_pixbuf(data, w, h);
-  return gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, TRUE, 8, w, h, w*4, (GdkPixbufDestroyNotify) free, NULL);
+  _view_map_set_frame_color(cr);
+  cairo_rectangle(cr, 0, 0, width, h + 2*thumb_border);
+  cairo_fill(cr);
+
+  // the mipmap is bgr(x) already, which is what cairo wants: no conversion
+  cairo_surface_t *source = cairo_image_surface_create_for_data(buf_decompressed, CAIRO_FORMAT_RGB24,
+                            buf.width, buf.height, cairo_format_stride_for_width(CAIRO_FORMAT_RGB24, buf.width));
+  cairo_save(cr);
+  cairo_translate(cr, thumb_border, thumb_border);
+  cairo_scale(cr, w/(double)buf.width, h/(double)buf.height);
+  cairo_set_source_surface(cr, source, 0, 0);
+  cairo_pattern_set_filter(cairo_get_source(cr), CAIRO_FILTER_GOOD);
+  cairo_paint(cr);
+  cairo_restore(cr);
+  cairo_surface_destroy(source);
+  free(scratchmem);
+  dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+
+  if(count > 1)
+  {
+    // number of images in the top right corner
+    char text[16];
+    snprintf(text, sizeof(text), "%d", count);
+    cairo_select_font_face(cr, "sans-serif", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_BOLD);
+    cairo_set_font_size(cr, 10);
+    cairo_text_extents_t ext;
+    cairo_text_extents(cr, text, &ext);
+    const double bw = ext.width + 6, bh = 14;
+    cairo_rectangle(cr, width - thumb_border - bw, thumb_border, bw, bh);
+    _view_map_set_frame_color(cr);
+    cairo_fill(cr);
+    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
+    cairo_move_to(cr, width - thumb_border - bw + 3 - ext.x_bearing, thumb_border + (bh - ext.height)/2 - ext.y_bearing);
+    cairo_show_text(cr, text);
+  }
+  if(pin)
+  {
+    // the pin is drawn for the widest thumbnail, narrower ones get its left part
+    cairo_rectangle(cr, 0, h + 2*thumb_border, width, pin_size);
+    cairo_clip(cr);
+    cairo_translate(cr, 0, h + 2*thumb_border);
+    _view_map_set_frame_color(cr);
+    dtgtk_cairo_paint_map_pin(cr, 0, 0, thumb_size + 2*thumb_border, pin_size, 0);
+  }
+  cairo_destroy(cr);
+  cairo_surface_flush(cst);
+
+  uint8_t *data = cairo_image_surface_get_data(cst);
+  dt_draw_cairo_to_gdk_pixbuf(data, width, height);
+  GdkPixbuf *tmp = gdk_pixbuf_new_from_data(data, GDK_COLORSPACE_RGB, TRUE, 8, width, height,
+                   cairo_image_surface_get_stride(cst), NULL, NULL);
+  GdkPixbuf *thumb = gdk_pixbuf_copy(tmp);
+  g_object_unref(tmp);
+  cairo_surface_destroy(cst);
+  return thumb;
+}
+
+/* marker for a single image (count 1) or a cluster, from the cache if possible */
+static GdkPixbuf *_view_map_get_marker(dt_map_t *lib, const int imgid, const int count, gboolean *complete)
+{
+  gint64 key = (gint64)imgid | ((gint64)count << 32);
+  GdkPixbuf *thumb = (GdkPixbuf *)g_hash_table_lookup(lib->thumbs, &key);
+  if(thumb)
+  {
+    *complete = TRUE;
+    return g_object_ref(thumb);
+  }
+  thumb = _view_map_draw_marker(imgid, count, TRUE, DT_MIPMAP_BEST_EFFORT, complete);
+  if(thumb && *complete)
+  {
+    if(g_hash_table_size(lib->thumbs) >= DT_MAP_THUMB_CACHE_SIZE)
+      g_hash_table_remove_all(lib->thumbs);
+    gint64 *k = (gint64 *)malloc(sizeof(gint64));
+    *k = key;
+    g_hash_table_insert(lib->thumbs, k, g_object_ref(thumb));
+  }
+  return thumb;
+}
+
+static inline void _view_map_project(const float latitude, const float longitude, double *x, double *y)
+{
+  const double lat = CLAMPS(latitude, -85.0511, 85.0511) * M_PI/180.0;
+  *x = (longitude + 180.0)/360.0;
+  *y = 0.5 - log(tan(lat) + 1.0/cos(lat))/(2.0*M_PI);
+}
+
+static inline int _view_map_bucket(const double v)
+{
+  return CLAMPS((int)(v*DT_MAP_INDEX_SIZE), 0, DT_MAP_INDEX_SIZE-1);
+}
+
+static inline int _view_map_point_bucket(const dt_map_point_t *p)
+{
+  return _view_map_bucket(p->y)*DT_MAP_INDEX_SIZE + _view_map_bucket(p->x);
+}
+
+static int _view_map_point_cmp(const void *a, const void *b)
+{
+  return _view_map_point_bucket((const dt_map_point_t *)a) - _view_map_point_bucket((const dt_map_point_t *)b);
+}
+
+/* reads the positions of all geotagged images and sorts them into the grid */
+static void _view_map_build_index(dt_map_t *lib)
+{
+  const double start = dt_get_wtime();
+  lib->index.dirty = FALSE;
+  lib->index.num_points = 0;
+  memset(lib->index.bucket, 0, sizeof(int)*(DT_MAP_INDEX_SIZE*DT_MAP_INDEX_SIZE+1));
+
+  int num = 0;
+  sqlite3_stmt *stmt;
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select count(id) from images where longitude not null and latitude not null",
+                              -1, &stmt, NULL);
+  if(sqlite3_step(stmt) == SQLITE_ROW)
+    num = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  free(lib->index.points);
+  lib->index.points = num > 0 ? (dt_map_point_t *)malloc(sizeof(dt_map_point_t)*num) : NULL;
+  if(!lib->index.points) return;
+
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db),
+                              "select id, latitude, longitude from images where longitude not null and latitude not null",
+                              -1, &stmt, NULL);
+  int k = 0;
+  while(sqlite3_step(stmt) == SQLITE_ROW && k < num)
+  {
+    dt_map_point_t *p = lib->index.points + k;
+    p->imgid = sqlite3_column_int(stmt, 0);
+    p->latitude = sqlite3_column_double(stmt, 1);
+    p->longitude = sqlite3_column_double(stmt, 2);
+    if(isnan(p->latitude) || isnan(p->longitude)) continue;
+    _view_map_project(p->latitude, p->longitude, &p->x, &p->y);
+    k++;
+  }
+  sqlite3_finalize(stmt);
+  lib->index.num_points = k;
+
+  qsort(lib->index.points, k, sizeof(dt_map_point_t), _view_map_point_cmp);
+  for(int i=0; i<k; i++)
+    lib->index.bucket[_view_map_point_bucket(lib->index.points + i) + 1]++;
+  for(int i=0; i<DT_MAP_INDEX_SIZE*DT_MAP_INDEX_SIZE; i++)
+    lib->index.bucket[i+1] += lib->index.bucket[i];
+
+  dt_print(DT_DEBUG_PERF, "[map] indexed %d geotagged images in %.3f secs\n", k, dt_get_wtime() - start);
+}
+
+static void _view_map_remove_all_images(dt_map_t *lib)
+{
+  osm_gps_map_image_remove_all(lib->map);
+  g_hash_table_remove_all(lib->images);
 }
 
 void init(dt_view_t *self)
@@ -125,9 +335,14 @@ void init(dt_view_t *self)
 
   dt_map_t *lib = (dt_map_t *)self->data;
 
+  lib->images = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
+  lib->thumbs = g_hash_table_new_full(g_int64_hash, g_int64_equal, free, g_object_unref);
+  lib->images_zoom = -1;
+  lib->index.bucket = (int *)malloc(sizeof(int)*(DT_MAP_INDEX_SIZE*DT_MAP_INDEX_SIZE+1));
+  lib->index.dirty = TRUE;
+
   if(darktable.gui)
   {
-    lib->pin = init_pin();
     lib->drop_filmstrip_activated = FALSE;
 
     OsmGpsMapSource_t map_source = OSM_GPS_MAP_SOURCE_OPENSTREETMAP;
@@ -177,19 +392,9 @@ void init(dt_view_t *self)
     g_signal_connect(GTK_WIDGET(lib->map), "drag-failed", G_CALLBACK(_view_map_dnd_failed_callback), self);
   }
 
-  /* build the query string */
-  int max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
-  if(max_images_drawn == 0)
-    max_images_drawn = 100;
-  char *geo_query = g_strdup_printf("select * from (select id, latitude from images where \
-                              longitude >= ?1 and longitude <= ?2 and latitude <= ?3 and latitude >= ?4 \
-                              and longitude not NULL and latitude not NULL order by abs(latitude - ?5), abs(longitude - ?6) \
-                              limit 0, %d) order by (180 - latitude), id", max_images_drawn);
-
-  /* prepare the main query statement */
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), geo_query, -1, &lib->statements.main_query, NULL);
-
-  g_free(geo_query);
+  lib->max_images_drawn = dt_conf_get_int("plugins/map/max_images_drawn");
+  if(lib->max_images_drawn == 0)
+    lib->max_images_drawn = 100;
 }
 
 void cleanup(dt_view_t *self)
@@ -197,9 +402,12 @@ void cleanup(dt_view_t *self)
   dt_map_t *lib = (dt_map_t *)self->data;
   if(darktable.gui)
   {
-    g_object_unref(G_OBJECT(lib->pin));
     g_object_unref(G_OBJECT(lib->osd));
   }
+  g_hash_table_destroy(lib->images);
+  g_hash_table_destroy(lib->thumbs);
+  free(lib->index.points);
+  free(lib->index.bucket);
   free(self->data);
 }
 
@@ -221,10 +429,26 @@ static gboolean _view_map_redraw(gpointer user_data)
   return FALSE; // remove the function again
 }
 
+static gint _view_map_cluster_distance_cmp(gconstpointer a, gconstpointer b)
+{
+  const double da = ((const dt_map_cluster_t *)a)->distance, db = ((const dt_map_cluster_t *)b)->distance;
+  return da < db ? -1 : da > db;
+}
+
+static gint _view_map_cluster_latitude_cmp(gconstpointer a, gconstpointer b)
+{
+  // north first, so that markers further south are drawn on top
+  const double la = ((const dt_map_cluster_t *)a)->latitude, lb = ((const dt_map_cluster_t *)b)->latitude;
+  return la > lb ? -1 : la < lb;
+}
+
 static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
 {
   dt_map_t *lib = (dt_map_t *)self->data;
 
+  if(lib->index.dirty)
+    _view_map_build_index(lib);
+
   OsmGpsMapPoint bb[2];
 
   /* get bounding box coords */
@@ -233,17 +457,6 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   osm_gps_map_point_get_degrees(&bb[0], &bb_0_lat, &bb_0_lon);
   osm_gps_map_point_get_degrees(&bb[1], &bb_1_lat, &bb_1_lon);
 
-  /* make the bounding box a little bigger to the west and south */
-  float lat0 = 0.0, lon0 = 0.0, lat1 = 0.0, lon1 = 0.0;
-  OsmGpsMapPoint *pt0 = osm_gps_map_point_new_degrees(0.0, 0.0), *pt1 = osm_gps_map_point_new_degrees(0.0, 0.0);
-  osm_gps_map_convert_screen_to_geographic(map, 0, 0, pt0);
-  osm_gps_map_convert_screen_to_geographic(map, 1.5*thumb_size, 1.5*thumb_size, pt1);
-  osm_gps_map_point_get_degrees(pt0, &lat0, &lon0);
-  osm_gps_map_point_get_degrees(pt1, &lat1, &lon1);
-  osm_gps_map_point_free(pt0);
-  osm_gps_map_point_free(pt1);
-  double south_border = lat0 - lat1, west_border = lon1 - lon0;
-
   /* get map view state and store  */
   int zoom;
   float center_lat, center_lon;
@@ -252,97 +465,117 @@ static void _view_map_changed_callback(OsmGpsMap *map, dt_view_t *self)
   dt_conf_set_float("plugins/map/latitude", center_lat);
   dt_conf_set_int("plugins/map/zoom", zoom);
 
-  /* let's reset and reuse the main_query statement */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(lib->statements.main_query);
-  DT_DEBUG_SQLITE3_RESET(lib->statements.main_query);
-
-  /* bind bounding box coords for the main query */
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 1, bb_0_lon - west_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 2, bb_1_lon);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 3, bb_0_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 4, bb_1_lat - south_border);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 5, center_lat);
-  DT_DEBUG_SQLITE3_BIND_DOUBLE(lib->statements.main_query, 6, center_lon);
-
-  /* remove the old images */
-  osm_gps_map_image_remove_all(map);
-  if(lib->images)
+  /* bounding box in mercator, a little bigger to the west and south as the markers hang to the top right */
+  const double world = ldexp(256.0, zoom);
+  double x0, y0, x1, y1, cx, cy;
+  _view_map_project(bb_0_lat, bb_0_lon, &x0, &y0);
+  _view_map_project(bb_1_lat, bb_1_lon, &x1, &y1);
+  _view_map_project(center_lat, center_lon, &cx, &cy);
+  x0 -= (thumb_size + 2*thumb_border)/world;
+  y1 += (thumb_size + 2*thumb_border + pin_size)/world;
+
+  /* the markers are clustered on a grid anchored to the world, so panning doesn't move them
+     around. the cells are about as large as a thumbnail, images closer than that would overlap. */
+  const double cell = (thumb_size + 2*thumb_border)/world;
+  if(zoom != lib->images_zoom)
   {
-    g_slist_foreach(lib->images, (GFunc) g_free, NULL);
-    g_slist_free(lib->images);
-    lib->images = NULL;
+    _view_map_remove_all_images(lib);
+    lib->images_zoom = zoom;
   }
 
-  /* add  all images to the map */
-  gboolean needs_redraw = FALSE;
-  dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, thumb_size, thumb_size);
-  while(sqlite3_step(lib->statements.main_query) == SQLITE_ROW)
-  {
-    int imgid = sqlite3_column_int(lib->statements.main_query, 0);
-    dt_mipmap_buffer_t buf;
-    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, imgid, mip, DT_MIPMAP_BEST_EFFORT);
-
-    if(buf.buf)
+  GHashTable *clusters = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free);
+  const int bx0 = _view_map_bucket(x0), bx1 = _view_map_bucket(x1);
+  const int by0 = _view_map_bucket(y0), by1 = _view_map_bucket(y1);
+  for(int by=by0; by<=by1 && lib->index.num_points; by++)
+    for(int bx=bx0; bx<=bx1; bx++)
     {
-      GdkPixbuf *source = NULL, *thumb = NULL;
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-      uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-      // convert image to pixbuf compatible rgb format
-      uint8_t *rgbbuf = (uint8_t*)malloc(buf.width*buf.height*3);
-      if(!rgbbuf) goto map_changed_failure;
-      for(int i=0; i<buf.height; i++)
-        for(int j=0; j<buf.width; j++)
-          for(int k=0; k<3; k++)
-            rgbbuf[(i*buf.width+j)*3+k] = buf_decompressed[(i*buf.width+j)*4+2-k];
-
-      int w=thumb_size, h=thumb_size;
-      if(buf.width < buf.height) w = (buf.width*thumb_size)/buf.height; // portrait
-      else                       h = (buf.height*thumb_size)/buf.width; // landscape
-
-      // next we get a pixbuf for the image
-      source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, buf.width, buf.height, buf.width*3, NULL, NULL);
-      if(!source) goto map_changed_failure;
-
-      // now we want a slightly larger pixbuf that we can put the image on
-      thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w+2*thumb_border, h+2*thumb_border+pin_size);
-      if(!thumb) goto map_changed_failure;
-      gdk_pixbuf_fill(thumb, thumb_frame_color);
-
-      // put the image onto the frame
-      gdk_pixbuf_scale(source, thumb, thumb_border, thumb_border, w, h, thumb_border, thumb_border,
-                       (1.0*w) / buf.width, (1.0*h) / buf.height, GDK_INTERP_HYPER);
-
-      // and finally add the pin
-      gdk_pixbuf_copy_area(lib->pin, 0, 0, w+2*thumb_border, pin_size, thumb, 0, h+2*thumb_border);
-
-      const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
-      if(!cimg) goto map_changed_failure;
-      dt_map_image_t *entry = (dt_map_image_t*)malloc(sizeof(dt_map_image_t));
-      if(!entry)
+      const int b = by*DT_MAP_INDEX_SIZE + bx;
+      for(int k=lib->index.bucket[b]; k<lib->index.bucket[b+1]; k++)
       {
-        dt_image_cache_read_release(darktable.image_cache, cimg);
-        goto map_changed_failure;
+        const dt_map_point_t *p = lib->index.points + k;
+        if(p->x < x0 || p->x > x1 || p->y < y0 || p->y > y1) continue;
+        gint64 key = ((gint64)(p->x/cell) << 32) | (gint64)(p->y/cell);
+        dt_map_cluster_t *c = (dt_map_cluster_t *)g_hash_table_lookup(clusters, &key);
+        if(!c)
+        {
+          c = (dt_map_cluster_t *)malloc(sizeof(dt_map_cluster_t));
+          c->cell = key;
+          c->imgid = p->imgid;
+          c->count = 0;
+          c->latitude = c->longitude = c->distance = 0.0;
+          g_hash_table_insert(clusters, &c->cell, c);
+        }
+        c->imgid = MIN(c->imgid, p->imgid);
+        c->count++;
+        c->latitude += p->latitude;
+        c->longitude += p->longitude;
       }
-      entry->imgid = imgid;
-      entry->image = osm_gps_map_image_add_with_alignment(map, cimg->latitude, cimg->longitude, thumb, 0, 1);
-      entry->width = w;
-      entry->height = h;
-      lib->images = g_slist_prepend(lib->images, entry);
-      dt_image_cache_read_release(darktable.image_cache, cimg);
-
-map_changed_failure:
-      if(source)
-        g_object_unref(source);
-      if(thumb)
-        g_object_unref(thumb);
-      free(scratchmem);
-      free(rgbbuf);
     }
-    else
+
+  /* keep the clusters closest to the center */
+  GList *visible = g_hash_table_get_values(clusters);
+  for(GList *l = visible; l; l = g_list_next(l))
+  {
+    dt_map_cluster_t *c = (dt_map_cluster_t *)l->data;
+    c->latitude /= c->count;
+    c->longitude /= c->count;
+    double x, y;
+    _view_map_project(c->latitude, c->longitude, &x, &y);
+    c->distance = (x - cx)*(x - cx) + (y - cy)*(y - cy);
+  }
+  visible = g_list_sort(visible, _view_map_cluster_distance_cmp);
+  GList *cut = g_list_nth(visible, lib->max_images_drawn);
+  if(cut)
+  {
+    for(GList *l = cut; l; l = g_list_next(l))
+      g_hash_table_remove(clusters, &((dt_map_cluster_t *)l->data)->cell);
+    cut->prev->next = NULL;
+    g_list_free(cut);
+  }
+
+  /* markers which left the view or whose cluster changed go away, the others just stay */
+  GHashTableIter iter;
+  gpointer key, value;
+  g_hash_table_iter_init(&iter, lib->images);
+  while(g_hash_table_iter_next(&iter, &key, &value))
+  {
+    dt_map_image_t *entry = (dt_map_image_t *)value;
+    const dt_map_cluster_t *c = (const dt_map_cluster_t *)g_hash_table_lookup(clusters, key);
+    if(c && c->imgid == entry->imgid && c->count == entry->count && entry->complete) continue;
+    osm_gps_map_image_remove(map, entry->image);
+    g_hash_table_iter_remove(&iter);
+  }
+
+  /* add the new ones */
+  gboolean needs_redraw = FALSE;
+  visible = g_list_sort(visible, _view_map_cluster_latitude_cmp);
+  for(GList *l = visible; l; l = g_list_next(l))
+  {
+    const dt_map_cluster_t *c = (const dt_map_cluster_t *)l->data;
+    if(g_hash_table_lookup(lib->images, &c->cell)) continue;
+    gboolean complete = FALSE;
+    GdkPixbuf *thumb = _view_map_get_marker(lib, c->imgid, c->count, &complete);
+    if(!thumb)
+    {
       needs_redraw = TRUE;
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
+      continue;
+    }
+    if(!complete) needs_redraw = TRUE;
+    dt_map_image_t *entry = (dt_map_image_t*)malloc(sizeof(dt_map_image_t));
+    entry->cell = c->cell;
+    entry->imgid = c->imgid;
+    entry->count = c->count;
+    entry->latitude = c->latitude;
+    entry->longitude = c->longitude;
+    entry->complete = complete;
+    entry->width = gdk_pixbuf_get_width(thumb) - 2*thumb_border;
+    entry->height = gdk_pixbuf_get_height(thumb) - 2*thumb_border - pin_size;
+    entry->image = osm_gps_map_image_add_with_alignment(map, entry->latitude, entry->longitude, thumb, 0, 1);
+    g_hash_table_insert(lib->images, &entry->cell, entry);
+    g_object_unref(thumb);
   }
+  g_list_free(visible);
+  g_hash_table_destroy(clusters);
 
   // not exactly thread safe, but should be good enough for updating the display
   static int timeout_event_source = 0;
@@ -359,24 +592,26 @@ map_changed_failure:
   }
 }
 
-static int _view_map_get_img_at_pos(dt_view_t *self, double x, double y)
+static dt_map_image_t *_view_map_get_entry_at_pos(dt_view_t *self, double x, double y)
 {
   dt_map_t *lib = (dt_map_t*)self->data;
-  GSList *iter;
+  GHashTableIter iter;
+  gpointer key, value;
 
-  for(iter = lib->images; iter != NULL; iter = iter->next)
+  g_hash_table_iter_init(&iter, lib->images);
+  while(g_hash_table_iter_next(&iter, &key, &value))
   {
-    dt_map_image_t *entry = (dt_map_image_t*)iter->data;
+    dt_map_image_t *entry = (dt_map_image_t*)value;
     OsmGpsMapImage *image = entry->image;
     OsmGpsMapPoint *pt = (OsmGpsMapPoint*)osm_gps_map_image_get_point(image);
     gint img_x=0, img_y=0;
     osm_gps_map_convert_geographic_to_screen(lib->map, pt, &img_x, &img_y);
     img_y -= pin_size;
     if(x >= img_x && x <= img_x + entry->width && y <= img_y && y >= img_y - entry->height)
-      return entry->imgid;
+      return entry;
   }
 
-  return 0;
+  return NULL;
 }
 
 static gboolean _view_map_motion_notify_callback(GtkWidget *w, GdkEventMotion *e, dt_view_t *self)
@@ -385,13 +620,16 @@ static gboolean _view_map_motion_notify_callback(GtkWidget *w, GdkEventMotion *e
 
   if(lib->start_drag && lib->selected_image > 0)
   {
-    for(GSList *iter = lib->images; iter != NULL; iter = iter->next)
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, lib->images);
+    while(g_hash_table_iter_next(&iter, &key, &value))
     {
-      dt_map_image_t *entry = (dt_map_image_t*)iter->data;
-      OsmGpsMapImage *image = entry->image;
-      if(entry->imgid == lib->selected_image)
+      dt_map_image_t *entry = (dt_map_image_t*)value;
+      if(entry->imgid == lib->selected_image && entry->count == 1)
       {
-        osm_gps_map_image_remove(lib->map, image);
+        osm_gps_map_image_remove(lib->map, entry->image);
+        g_hash_table_iter_remove(&iter);
         break;
       }
     }
@@ -399,53 +637,14 @@ static gboolean _view_map_motion_notify_callback(GtkWidget *w, GdkEventMotion *e
     lib->start_drag = FALSE;
     GtkTargetList *targets = gtk_target_list_new(target_list_all, n_targets_all);
 
-    dt_mipmap_buffer_t buf;
-    dt_mipmap_size_t mip = dt_mipmap_cache_get_matching_size(darktable.mipmap_cache, thumb_size, thumb_size);
-    dt_mipmap_cache_read_get(darktable.mipmap_cache, &buf, lib->selected_image, mip, DT_MIPMAP_BLOCKING);
-
-    if(buf.buf)
+    GdkPixbuf *thumb = _view_map_draw_marker(lib->selected_image, 1, FALSE, DT_MIPMAP_BLOCKING, NULL);
+    if(thumb)
     {
-      GdkPixbuf *source = NULL, *thumb = NULL;
-      uint8_t *scratchmem = dt_mipmap_cache_alloc_scratchmem(darktable.mipmap_cache);
-      uint8_t *buf_decompressed = dt_mipmap_cache_decompress(&buf, scratchmem);
-
-      // convert image to pixbuf compatible rgb format
-      uint8_t *rgbbuf = (uint8_t*)malloc(buf.width*buf.height*3);
-      if(!rgbbuf) goto map_motion_failure;
-      for(int i=0; i<buf.height; i++)
-        for(int j=0; j<buf.width; j++)
-          for(int k=0; k<3; k++)
-            rgbbuf[(i*buf.width+j)*3+k] = buf_decompressed[(i*buf.width+j)*4+2-k];
-
-      int w=thumb_size, h=thumb_size;
-      if(buf.width < buf.height) w = (buf.width*thumb_size)/buf.height; // portrait
-      else                       h = (buf.height*thumb_size)/buf.width; // landscape
-
-      // next we get a pixbuf for the image
-      source = gdk_pixbuf_new_from_data(rgbbuf, GDK_COLORSPACE_RGB, FALSE, 8, buf.width, buf.height, buf.width*3, NULL, NULL);
-
-      // now we want a slightly larger pixbuf that we can put the image on
-      thumb = gdk_pixbuf_new(GDK_COLORSPACE_RGB, TRUE, 8, w+2*thumb_border, h+2*thumb_border);
-      gdk_pixbuf_fill(thumb, thumb_frame_color);
-
-      // put the image onto the frame
-      gdk_pixbuf_scale(source, thumb, thumb_border, thumb_border, w, h, thumb_border, thumb_border,
-                       (1.0*w) / buf.width, (1.0*h) / buf.height, GDK_INTERP_HYPER);
-
       GdkDragContext * context = gtk_drag_begin(GTK_WIDGET(lib->map), targets, GDK_ACTION_COPY, 1, (GdkEvent*)e);
       gtk_drag_set_icon_pixbuf(context, thumb, 0, 0);
-
-map_motion_failure:
-      if(source)
-        g_object_unref(source);
-      if(thumb)
-        g_object_unref(thumb);
-      free(scratchmem);
-      free(rgbbuf);
+      g_object_unref(thumb);
     }
 
-    dt_mipmap_cache_read_release(darktable.mipmap_cache, &buf);
-
     gtk_target_list_unref(targets);
     return TRUE;
   }
@@ -458,7 +657,10 @@ static gboolean _view_map_button_press_callback(GtkWidget *w, GdkEventButton *e,
   if(e->button == 1)
   {
     // check if the click was on an image or just some random position
-    lib->selected_image = _view_map_get_img_at_pos(self, e->x, e->y);
+    const dt_map_image_t *entry = _view_map_get_entry_at_pos(self, e->x, e->y);
+    lib->selected_image = entry ? entry->imgid : 0;
+    // clusters can't be dragged, double clicking them zooms in
+    if(entry && entry->count > 1) lib->selected_image = 0;
     if(e->type == GDK_BUTTON_PRESS && lib->selected_image > 0)
     {
       lib->start_drag = TRUE;
@@ -477,10 +679,18 @@ static gboolean _view_map_button_press_callback(GtkWidget *w, GdkEventButton *e,
       {
         // zoom into that position
         float longitude, latitude;
-        OsmGpsMapPoint *pt = osm_gps_map_point_new_degrees(0.0, 0.0);
-        osm_gps_map_convert_screen_to_geographic(lib->map, e->x, e->y, pt);
-        osm_gps_map_point_get_degrees(pt, &latitude, &longitude);
-        osm_gps_map_point_free(pt);
+        if(entry)
+        {
+          longitude = entry->longitude;
+          latitude = entry->latitude;
+        }
+        else
+        {
+          OsmGpsMapPoint *pt = osm_gps_map_point_new_degrees(0.0, 0.0);
+          osm_gps_map_convert_screen_to_geographic(lib->map, e->x, e->y, pt);
+          osm_gps_map_point_get_degrees(pt, &latitude, &longitude);
+          osm_gps_map_point_free(pt);
+        }
         int zoom, max_zoom;
         g_object_get(G_OBJECT(lib->map), "zoom", &zoom, "max-zoom", &max_zoom, NULL);
         zoom = MIN(zoom+1, max_zoom);
@@ -507,6 +717,10 @@ void enter(dt_view_t *self)
 
   gtk_widget_show_all(GTK_WIDGET(lib->map));
 
+  /* locations and thumbnails might have changed in other views */
+  lib->index.dirty = TRUE;
+  g_hash_table_remove_all(lib->thumbs);
+
   /* setup proxy functions */
   darktable.view_manager->proxy.map.view = self;
   darktable.view_manager->proxy.map.center_on_location = _view_map_center_on_location;
@@ -539,6 +753,11 @@ void leave(dt_view_t *self)
   gtk_widget_hide(GTK_WIDGET(lib->map));
   gtk_widget_show_all(dt_ui_center(darktable.gui->ui));
 
+  /* the markers are rebuilt when we come back */
+  _view_map_remove_all_images(lib);
+  lib->images_zoom = -1;
+  g_hash_table_remove_all(lib->thumbs);
+
   /* reset proxy */
   darktable.view_manager->proxy.map.view = NULL;
 
@@ -678,6 +897,9 @@ static void _get_image_location(dt_view_t *self, int imgid, float *longitude, fl
 
 static void _set_image_location(dt_view_t *self, int imgid, float longitude, float latitude, gboolean record_undo)
 {
+  dt_map_t *lib = (dt_map_t*)self->data;
+  lib->index.dirty = TRUE;
+
   const dt_image_t *cimg = dt_image_cache_read_get(darktable.image_cache, imgid);
   dt_image_t *img = dt_image_cache_write_get(darktable.image_cache, cimg);
 
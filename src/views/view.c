@@ -27,6 +27,8 @@
 #include "libs/lib.h"
 #include "control/conf.h"
 #include "control/control.h"
+#include "control/jobs/image_jobs.h"
+#include "control/signal.h"
 #include "develop/develop.h"
 #include "views/view.h"
 #include "views/undo.h"
@@ -42,15 +44,31 @@
 
 #define DECORATION_SIZE_LIMIT 40
 
+// upper bound of cached thumbnail decorations, way more than fit on screen.
+#define DT_VIEW_IMAGE_INFO_MAX 2048
+
+static void _view_image_info_changed_callback(gpointer instance, gpointer user_data)
+{
+  dt_view_image_info_invalidate((dt_view_manager_t *)user_data);
+}
+
 void dt_view_manager_init(dt_view_manager_t *vm)
 {
   /* prepare statements */
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select * from selected_images where imgid = ?1", -1, &vm->statements.is_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "delete from selected_images where imgid = ?1", -1, &vm->statements.delete_from_selected, NULL);
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "insert or ignore into selected_images values (?1)", -1, &vm->statements.make_selected, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select num from history where imgid = ?1", -1, &vm->statements.have_history, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select color from color_labels where imgid=?1", -1, &vm->statements.get_color, NULL);
-  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), "select id from images where group_id = (select group_id from images where id=?1) and id != ?2", -1, &vm->statements.get_grouped, NULL);
+
+  /* thumbnail decorations, refetched whenever something might have changed them */
+  vm->image_info.images = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+  vm->image_info.db_changes = -1;
+  vm->prefetch_generation = 0;
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_COLLECTION_CHANGED,
+                            G_CALLBACK(_view_image_info_changed_callback), vm);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_FILMROLLS_REMOVED,
+                            G_CALLBACK(_view_image_info_changed_callback), vm);
+  dt_control_signal_connect(darktable.signals, DT_SIGNAL_DEVELOP_HISTORY_CHANGE,
+                            G_CALLBACK(_view_image_info_changed_callback), vm);
 
   int res=0, midx=0;
   char *modules[] =
@@ -84,6 +102,78 @@ void dt_view_manager_init(dt_view_manager_t *vm)
 void dt_view_manager_cleanup(dt_view_manager_t *vm)
 {
   for(int k=0; k<vm->num_views; k++) dt_view_unload_module(vm->view + k);
+  dt_control_signal_disconnect(darktable.signals, G_CALLBACK(_view_image_info_changed_callback), vm);
+  g_hash_table_destroy(vm->image_info.images);
+}
+
+void dt_view_image_info_invalidate(dt_view_manager_t *vm)
+{
+  g_hash_table_remove_all(vm->image_info.images);
+}
+
+static void _view_image_info_check(dt_view_manager_t *vm)
+{
+  // selection, color labels, ratings and history are written from all over the
+  // place, so besides the signals also watch the change counter of the connection.
+  // this is a plain counter, no statement is run.
+  const int changes = sqlite3_total_changes(dt_database_get(darktable.db));
+  if(changes != vm->image_info.db_changes || g_hash_table_size(vm->image_info.images) > DT_VIEW_IMAGE_INFO_MAX)
+  {
+    dt_view_image_info_invalidate(vm);
+    vm->image_info.db_changes = changes;
+  }
+}
+
+void dt_view_image_info_prefetch(dt_view_manager_t *vm, const int32_t *imgids, const int num)
+{
+  _view_image_info_check(vm);
+
+  GString *ids = NULL;
+  for(int k=0; k<num; k++)
+  {
+    if(imgids[k] <= 0 || g_hash_table_lookup(vm->image_info.images, GINT_TO_POINTER(imgids[k])))
+      continue;
+    // also remember images that vanished from the db, so we don't ask again.
+    g_hash_table_insert(vm->image_info.images, GINT_TO_POINTER(imgids[k]), g_malloc0(sizeof(dt_view_image_info_t)));
+    if(!ids) ids = g_string_new(NULL);
+    else g_string_append_c(ids, ',');
+    g_string_append_printf(ids, "%d", imgids[k]);
+  }
+  if(!ids) return;
+
+  sqlite3_stmt *stmt;
+  gchar *query = g_strdup_printf(
+                   "select id, flags, group_id, "
+                   "exists(select imgid from selected_images where imgid = a.id), "
+                   "exists(select num from history where imgid = a.id), "
+                   "exists(select id from images as b where b.group_id = a.group_id and b.id != a.id), "
+                   "(select sum(distinct 1 << color) from color_labels where imgid = a.id) "
+                   "from images as a where id in (%s)", ids->str);
+  DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), query, -1, &stmt, NULL);
+  while(sqlite3_step(stmt) == SQLITE_ROW)
+  {
+    dt_view_image_info_t *info = g_hash_table_lookup(vm->image_info.images, GINT_TO_POINTER(sqlite3_column_int(stmt, 0)));
+    if(!info) continue;
+    info->stars       = sqlite3_column_int(stmt, 1) & 0x7;
+    info->group_id    = sqlite3_column_int(stmt, 2);
+    info->selected    = sqlite3_column_int(stmt, 3);
+    info->altered     = sqlite3_column_int(stmt, 4);
+    info->is_grouped  = sqlite3_column_int(stmt, 5);
+    info->colorlabels = sqlite3_column_int(stmt, 6);
+  }
+  sqlite3_finalize(stmt);
+  g_free(query);
+  g_string_free(ids, TRUE);
+}
+
+static const dt_view_image_info_t *_view_image_info_get(dt_view_manager_t *vm, const int32_t imgid)
+{
+  _view_image_info_check(vm);
+  const dt_view_image_info_t *info = g_hash_table_lookup(vm->image_info.images, GINT_TO_POINTER(imgid));
+  if(info) return info;
+  // the caller didn't prefetch this one, go get it alone.
+  dt_view_image_info_prefetch(vm, &imgid, 1);
+  return g_hash_table_lookup(vm->image_info.images, GINT_TO_POINTER(imgid));
 }
 
 const dt_view_t *dt_view_manager_get_current_view(dt_view_manager_t *vm)
@@ -717,14 +807,11 @@ dt_view_image_expose(
   // this is a gui thread only thing. no mutex required:
   imgsel = darktable.control->global_settings.lib_image_mouse_over_id;
 
+  // selection, labels, grouping and history all come from the snapshot, no db access here.
+  const dt_view_image_info_t *info = _view_image_info_get(darktable.view_manager, imgid);
+
 #if DRAW_SELECTED == 1
-  /* clear and reset statements */
-  DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.is_selected);
-  DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.is_selected);
-  /* bind imgid to prepared statments */
-  DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.is_selected, 1, imgid);
-  /* lets check if imgid is selected */
-  if(sqlite3_step(darktable.view_manager->statements.is_selected) == SQLITE_ROW)
+  if(info && info->selected)
     selected = 1;
 #endif
 
@@ -916,9 +1003,10 @@ dt_view_image_expose(
       float x, y;
       if(zoom != 1) y = 0.90*height;
       else y = .12*fscale;
-      gboolean image_is_rejected = (img && ((img->flags & 0x7) == 6));
+      const int stars = info ? info->stars : (img ? img->flags & 0x7 : 0);
+      gboolean image_is_rejected = ((img || info) && stars == 6);
 
-      if(img) for(int k=0; k<5; k++)
+      if(img || info) for(int k=0; k<5; k++)
         {
           if(zoom != 1) x = (0.41+k*0.12)*width;
           else x = (.08+k*0.04)*fscale;
@@ -932,7 +1020,7 @@ dt_view_image_expose(
               *image_over = DT_VIEW_STAR_1 + k;
               cairo_fill(cr);
             }
-            else if((img->flags & 0x7) > k)
+            else if(stars > k)
             {
               cairo_fill_preserve(cr);
               cairo_set_source_rgb(cr, 1.0-bordercol, 1.0-bordercol, 1.0-bordercol);
@@ -973,13 +1061,8 @@ dt_view_image_expose(
       cairo_set_line_width(cr, 1.5);
 
 #if DRAW_GROUPING == 1
-      DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.get_grouped);
-      DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.get_grouped);
-      DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_grouped, 1, imgid);
-      DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_grouped, 2, imgid);
-
       /* lets check if imgid is in a group */
-      if(sqlite3_step(darktable.view_manager->statements.get_grouped) == SQLITE_ROW)
+      if(info && info->is_grouped)
         is_grouped = 1;
       else if(img && darktable.gui->expanded_group_id == img->group_id)
         darktable.gui->expanded_group_id = -1;
@@ -1013,12 +1096,8 @@ dt_view_image_expose(
       }
 
 #if DRAW_HISTORY == 1
-      DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.have_history);
-      DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.have_history);
-      DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.have_history, 1, imgid);
-
       /* lets check if imgid has history */
-      if(sqlite3_step(darktable.view_manager->statements.have_history) == SQLITE_ROW)
+      if(info && info->altered)
         altered = 1;
 #endif
 
@@ -1048,7 +1127,6 @@ dt_view_image_expose(
 
 #if DRAW_COLORLABELS == 1
   // TODO: make mouse sensitive, just as stars!
-  // TODO: cache in image struct!
 
   // TODO: there is a branch that sets the bg == colorlabel
   //       this might help if zoom > 15
@@ -1059,16 +1137,10 @@ dt_view_image_expose(
     const float y = zoom == 1 ? 0.17*fscale: 0.1*height;
     const float r = zoom == 1 ? 0.01*fscale : 0.03*width;
 
-    /* clear and reset prepared statement */
-    DT_DEBUG_SQLITE3_CLEAR_BINDINGS(darktable.view_manager->statements.get_color);
-    DT_DEBUG_SQLITE3_RESET(darktable.view_manager->statements.get_color);
-
-    /* setup statement and iterate rows */
-    DT_DEBUG_SQLITE3_BIND_INT(darktable.view_manager->statements.get_color, 1, imgid);
-    while(sqlite3_step(darktable.view_manager->statements.get_color) == SQLITE_ROW)
+    for(int col = 0; info && col < 8; col++)
     {
+      if(!(info->colorlabels & (1<<col))) continue;
       cairo_save(cr);
-      int col = sqlite3_column_int(darktable.view_manager->statements.get_color, 0);
       // see src/dtgtk/paint.c
       dtgtk_cairo_paint_label(cr, x+(3*r*col)-5*r, y-r, r*2, r*2, col);
       cairo_restore(cr);
@@ -1272,11 +1344,21 @@ void dt_view_filmstrip_set_active_image(dt_view_manager_t *vm,int iid)
 
 void dt_view_filmstrip_prefetch()
 {
+  // whatever is still queued for the last image isn't needed any more:
+  const int32_t generation = __sync_add_and_fetch(&darktable.view_manager->prefetch_generation, 1);
+
+  // number of images to prefetch: the next one first, then the previous one, then the
+  // one after the next, and so on. each needs a slot of the full and the f mip cache,
+  // which are tiny (two slots by default), and one of them has to stay for the image
+  // in the darkroom, or the look-ahead would evict the buffers it is being edited from.
+  const int slots = darktable.mipmap_cache->mip[DT_MIPMAP_FULL].cache.cost_quota - 1;
+  const int cnt = MIN(MIN(dt_conf_get_int("plugins/darkroom/prefetch"), 8), slots);
+  // and the furthest neighbour needed on the side of the next images:
+  const int num = (cnt + 1) / 2;
   const gchar *qin = dt_collection_get_query (darktable.collection);
-  if(!qin) return;
+  if(!qin || num <= 0) return;
 
   int offset = 0;
-  if(qin)
   {
     int imgid = -1;
     sqlite3_stmt *stmt;
@@ -1288,18 +1370,34 @@ void dt_view_filmstrip_prefetch()
     offset = dt_collection_image_offset(imgid);
   }
 
+  // the neighbours on both sides, at positions first .. offset+num
+  const int first = MAX(0, offset - num);
+  uint32_t ids[17] = {0};
   sqlite3_stmt *stmt;
   DT_DEBUG_SQLITE3_PREPARE_V2(dt_database_get(darktable.db), qin, -1, &stmt, NULL);
-  // only get one more image:
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, offset+1);
-  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offset+2);
-  if(sqlite3_step(stmt) == SQLITE_ROW)
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 1, first);
+  DT_DEBUG_SQLITE3_BIND_INT(stmt, 2, offset + num - first + 1);
+  for(int k = first; k <= offset + num && sqlite3_step(stmt) == SQLITE_ROW; k++)
+    ids[k - offset + num] = sqlite3_column_int(stmt, 0);
+  sqlite3_finalize(stmt);
+
+  // closest first, the next image before the previous one. the mip f needs the
+  // full buffer, so both end up in the cache. these go to the end of the queue,
+  // so they don't hold up anything the user is waiting for.
+  for(int k = 0; k < cnt; k++)
   {
-    const uint32_t prefetchid = sqlite3_column_int(stmt, 0);
-    // dt_control_log("prefetching image %u", prefetchid);
-    dt_mipmap_cache_read_get(darktable.mipmap_cache, NULL, prefetchid, DT_MIPMAP_FULL, DT_MIPMAP_PREFETCH);
+    const int d = k/2 + 1, s = (k & 1) ? -1 : 1;
+    const uint32_t prefetchid = ids[num + s*d];
+    if(!prefetchid) continue;
+    dt_job_t j;
+    dt_image_prefetch_job_init(&j, prefetchid, DT_MIPMAP_F, &darktable.view_manager->prefetch_generation, generation);
+    dt_control_add_job(darktable.control, &j);
   }
-  sqlite3_finalize(stmt);
+}
+
+void dt_view_filmstrip_prefetch_cancel()
+{
+  __sync_add_and_fetch(&darktable.view_manager->prefetch_generation, 1);
 }
 
 void dt_view_manager_view_toolbox_add(dt_view_manager_t *vm,GtkWidget *tool)
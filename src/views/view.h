@@ -120,6 +120,21 @@ dt_view_image_expose(
   int32_t py,
   gboolean full_preview);
 
+/** the per image state needed to decorate a thumbnail. it is fetched in one go
+    for all visible images, so exposing a thumbnail doesn't have to query the db. */
+typedef struct dt_view_image_info_t
+{
+  int32_t group_id;
+  /* flags & 0x7, 6 means rejected */
+  uint8_t stars;
+  /* one bit per attached color label (1<<color) */
+  uint8_t colorlabels;
+  uint8_t selected;
+  uint8_t altered;
+  uint8_t is_grouped;
+}
+dt_view_image_info_t;
+
 /** Set the selection bit to a given value for the specified image */
 void dt_view_set_selection(int imgid, int value);
 /** toggle selection of given image. */
@@ -141,20 +156,26 @@ typedef struct dt_view_manager_t
    */
   struct
   {
-    /* select num from history where imgid = ?1*/
-    sqlite3_stmt *have_history;
     /* select * from selected_images where imgid = ?1 */
     sqlite3_stmt *is_selected;
     /* delete from selected_images where imgid = ?1 */
     sqlite3_stmt *delete_from_selected;
     /* insert into selected_images values (?1) */
     sqlite3_stmt *make_selected;
-    /* select color from color_labels where imgid=?1 */
-    sqlite3_stmt *get_color;
-    /* select images in group from images where imgid=?1 (also bind to ?2) */
-    sqlite3_stmt *get_grouped;
   } statements;
 
+  /* bumped to cancel the queued jobs of dt_view_filmstrip_prefetch() */
+  int32_t prefetch_generation;
+
+  /* snapshot of the thumbnail decorations, see dt_view_image_info_prefetch() */
+  struct
+  {
+    /* imgid -> dt_view_image_info_t */
+    GHashTable *images;
+    /* sqlite3_total_changes() at the time the snapshot was taken */
+    int db_changes;
+  } image_info;
+
 
   /*
    * Proxy
@@ -253,6 +274,12 @@ dt_view_manager_t;
 void dt_view_manager_init(dt_view_manager_t *vm);
 void dt_view_manager_cleanup(dt_view_manager_t *vm);
 
+/** load the thumbnail decorations of the given images with a single query.
+    images already in the snapshot are skipped, call this before exposing a range of thumbs. */
+void dt_view_image_info_prefetch(dt_view_manager_t *vm, const int32_t *imgids, const int num);
+/** drop the snapshot of thumbnail decorations, it is refetched on the next expose. */
+void dt_view_image_info_invalidate(dt_view_manager_t *vm);
+
 /** return translated name. */
 const char *dt_view_manager_name (dt_view_manager_t *vm);
 /** switch to this module. returns non-null if the module fails to change. */
@@ -343,6 +370,8 @@ void dt_view_filmstrip_set_active_image(dt_view_manager_t *vm,int iid);
     TODO: move to control ?
 */
 void dt_view_filmstrip_prefetch();
+/** drop the queued prefetches, if they haven't started yet. */
+void dt_view_filmstrip_prefetch_cancel();
 
 /*
  * Map View Proxy